@@ -0,0 +1,924 @@
+#include "saaddb.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+/* ========== saaddb-check ==========
+  saaddb-check DIR: the tests `make check` runs. Each one runs in a child
+  process of its own against a fresh database in DIR/<test> (the engine
+  keeps process-wide state, and the crash test kills its writer), and a
+  failing expectation prints "FAIL <test>: ..." and fails it:
+    - crash: a process killed by SIGKILL in the middle of a transaction;
+      the next open keeps what committed and undoes the rest.
+    - durability: a commit whose log record can't be written is rolled
+      back: neither other sessions nor the next open see its changes.
+    - snapshots: readers in transactions see one committed state, the
+      same on every read, while writers commit and roll back.
+    - versions: a transaction's snapshot reads the same rows through
+      every path (scans, primary key, index, columnar, aggregate, join)
+      while another session inserts, updates and deletes; it sees their
+      commit once it ends, and never a rolled back change.
+    - conflict: an update of a row another session changed after the
+      transaction began is refused, and the other change kept.
+    - locks: a column with a table's name doesn't lock that table, so a
+      write to it doesn't wait for a transaction holding the table.
+    - queue: a statement that gives up on a lock at once (lock wait 0,
+      as the server's sessions do) keeps its turn: readers don't get
+      past a writer that gave up, and writers go in the order they asked.
+    - migration: a table in the old text .sdb format is moved to the
+      binary one the first time it is opened, rejecting bad rows.
+    - indexes: hash and btree secondary indexes are picked for = and
+      range terms and stay right through updates and deletes.
+    - columnar: a columnar table answers filters on each column type
+      the same as a row table holding the same rows.
+    - aggregates: count, sum, avg, min and max, grouped or not, match
+      the sums taken here, in memory and with groups spilled to disk.
+    - ordering: order by, with and without limit, in memory and as an
+      external merge sort of spilled runs, matches a sort done here.
+    - joins: index nested-loop and hash joins, in memory and partitioned
+      on disk, return the pairs a nested loop here finds.
+    - cache: statements that differ only in their values share a cached
+      plan yet each runs with its own, through schema changes and
+      evictions; prepare; and execute; bind values, never keywords.
+    - compaction: vacuum T; rewrites a table while readers keep taking
+      overlapping snapshots and a writer keeps changing it; no write
+      times out and no change is lost.
+    - statements: prepare refuses what it can't plan, a bind outside
+      1..parameters() fails the next execute, and bound values run.
+*/
+
+static string DIR;
+static string TEST;         // the test running in this process
+static bool FAILED = false;
+
+static void expect(bool ok, const string& what, const string& detail = "") {
+    if (ok) return;
+    cout << "FAIL " << TEST << ": " << what << "\n";
+    if (!detail.empty()) cout << detail << (detail.back() == '\n' ? "" : "\n");
+    FAILED = true;
+}
+
+static bool contains(const string& s, const string& part) { return s.find(part) != string::npos; }
+
+// Runs sql and expects it to succeed.
+static saaddb::ResultSet run(saaddb::Session& s, const string& sql) {
+    saaddb::ResultSet rs = s.query(sql);
+    expect(rs.ok(), sql, rs.message());
+    return rs;
+}
+
+static saaddb::ResultSet run(saaddb::Database& db, const string& sql) {
+    saaddb::ResultSet rs = db.query(sql);
+    expect(rs.ok(), sql, rs.message());
+    return rs;
+}
+
+// The first column of every row, as text ("1,2,3").
+static string column_text(const saaddb::ResultSet& rs) {
+    string out;
+    for (const saaddb::Row& row : rs) {
+        if (!out.empty()) out += ",";
+        if (!row.empty()) out += row[0].text();
+    }
+    return out;
+}
+
+// Every row, fields separated by spaces and rows by ";".
+static string rows_text(const saaddb::ResultSet& rs) {
+    string out;
+    for (const saaddb::Row& row : rs) {
+        for (size_t i = 0; i < row.size(); ++i) out += (i ? " " : "") + row[i].text();
+        out += ";";
+    }
+    return out;
+}
+
+// Runs fn in a child process; true if it exited 0 (fn returned true and
+// nothing failed).
+static bool in_child(const function<bool()>& fn) {
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        bool ok = fn() && !FAILED;
+        cout.flush();
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool open_db(saaddb::Database& db, string& msg) {
+    bool ok = db.open(DIR + "/" + TEST, msg);
+    expect(ok, "open", msg);
+    return ok;
+}
+
+/* ---------- crash ---------- */
+
+static bool crash_test() {
+    int ready[2];
+    if (pipe(ready) != 0) return false;
+    pid_t writer = fork();
+    if (writer < 0) return false;
+    if (writer == 0) {
+        saaddb::Database db;
+        string msg;
+        if (!open_db(db, msg)) _exit(1);
+        run(db, "create table Acct(id int, bal int, primary key(id));");
+        run(db, "insert into Acct values (1, 100);");
+        run(db, "insert into Acct values (2, 100);");
+        run(db, "begin;");
+        run(db, "insert into Acct values (3, 100);");
+        run(db, "update Acct set bal = 50 where id = 1;");
+        run(db, "commit;");
+        run(db, "begin;");
+        run(db, "insert into Acct values (4, 100);");
+        run(db, "update Acct set bal = 0 where id = 2;");
+        run(db, "delete from Acct where id = 3;");
+        char c = FAILED ? 'x' : 'k';
+        cout.flush();
+        if (write(ready[1], &c, 1) != 1) _exit(1);
+        pause();    // killed here, the transaction still open
+        _exit(1);
+    }
+    close(ready[1]);
+    char c = 0;
+    bool wrote = read(ready[0], &c, 1) == 1 && c == 'k';
+    close(ready[0]);
+    kill(writer, SIGKILL);
+    int status = 0;
+    waitpid(writer, &status, 0);
+    expect(wrote, "the writer didn't reach the open transaction");
+    if (!wrote) return false;
+
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    expect(contains(msg, "undid") && contains(msg, "1 unfinished transaction"), "recovery didn't undo the open transaction", msg);
+    expect(column_text(run(db, "select id from Acct;")) == "1,2,3", "committed rows after recovery");
+    expect(column_text(run(db, "select bal from Acct;")) == "50,100,100", "committed values after recovery");
+    run(db, "insert into Acct values (4, 1);");
+    expect(column_text(run(db, "select bal from Acct where id = 4;")) == "1", "insert after recovery");
+    db.close();
+    return true;
+}
+
+/* ---------- durability ---------- */
+
+static bool durability_test() {
+    string wal = DIR + "/" + TEST + "/SaadDB.wal";
+    bool ran = in_child([&] {
+        saaddb::Database db;
+        string msg;
+        if (!open_db(db, msg)) return false;
+        run(db, "create table Acct(id int, bal int, primary key(id));");
+        run(db, "insert into Acct values (1, 100), (2, 100);");
+        saaddb::Session a, b;
+        run(a, "begin;");
+        run(a, "update Acct set bal = 0 where id = 1;");
+        // the log can't grow past what it holds now: the commit record fails
+        struct stat st;
+        if (stat(wal.c_str(), &st) != 0) return false;
+        signal(SIGXFSZ, SIG_IGN);
+        rlimit lim{ (rlim_t)st.st_size, RLIM_INFINITY };
+        if (setrlimit(RLIMIT_FSIZE, &lim) != 0) return false;
+        saaddb::ResultSet commit = a.query("commit;");
+        expect(commit.error() == saaddb::Error::IoError, "a commit that couldn't be logged succeeded", commit.message());
+        expect(!a.in_transaction(), "the failed commit left its transaction open");
+        expect(column_text(run(b, "select bal from Acct;")) == "100,100", "another session saw a failed commit");
+        expect(column_text(run(a, "select bal from Acct;")) == "100,100", "the failed commit's own session sees it");
+        saaddb::ResultSet own = a.query("update Acct set bal = 7 where id = 2;");
+        expect(own.error() == saaddb::Error::IoError, "a statement that couldn't be logged succeeded", own.message());
+        expect(column_text(run(b, "select bal from Acct;")) == "100,100", "another session saw a failed statement");
+        return true;
+    });
+    if (!ran) return false;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    expect(column_text(run(db, "select bal from Acct;")) == "100,100", "the next open kept a failed commit");
+    db.close();
+    return true;
+}
+
+/* ---------- snapshots ---------- */
+
+static bool snapshot_test() {
+    const int ROWS = 8, WRITERS = 2, READERS = 3, ROUNDS = 150;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table Acct(id int, bal int, primary key(id));");
+    for (int i = 1; i <= ROWS; ++i) run(db, "insert into Acct values (" + to_string(i) + ", 0);");
+
+    // A writer sets every balance to one value, in two statements of one
+    // transaction, and commits, or sets them to -1 and rolls back. Every
+    // committed state has all balances equal and none -1.
+    atomic<bool> stop{ false };
+    atomic<long> commits{ 0 }, rollbacks{ 0 }, reads{ 0 };
+    vector<thread> threads;
+    for (int w = 0; w < WRITERS; ++w) {
+        threads.emplace_back([&, w] {
+            saaddb::Session s;
+            for (int r = 1; r <= ROUNDS; ++r) {
+                bool undo = r % 3 == 0;
+                string v = undo ? "-1" : to_string(w * ROUNDS + r);
+                if (!s.query("begin;").ok()) { expect(false, "writer begin"); break; }
+                saaddb::ResultSet a = s.query("update Acct set bal = " + v + " where id <= " + to_string(ROWS / 2) + ";");
+                saaddb::ResultSet b = a.ok() ? s.query("update Acct set bal = " + v + " where id > " + to_string(ROWS / 2) + ";") : a;
+                // a transaction that began before the other writer's commit
+                // may not change its rows (see conflict); it rolls back
+                const saaddb::ResultSet& bad = a.ok() ? b : a;
+                expect(bad.ok() || bad.error() == saaddb::Error::Conflict || bad.error() == saaddb::Error::LockTimeout,
+                    "writer update", bad.message());
+                bool commit = !undo && a.ok() && b.ok();
+                saaddb::ResultSet end = s.query(commit ? "commit;" : "rollback;");
+                expect(end.ok(), commit ? "commit" : "rollback", end.message());
+                ++(commit ? commits : rollbacks);
+            }
+        });
+    }
+    for (int r = 0; r < READERS; ++r) {
+        threads.emplace_back([&] {
+            saaddb::Session s;
+            while (!stop.load()) {
+                run(s, "begin;");
+                string first = column_text(run(s, "select bal from Acct;"));
+                this_thread::yield();
+                string again = column_text(run(s, "select bal from Acct;"));
+                run(s, "commit;");
+                expect(first == again, "a transaction's reads differ", first + "\n" + again);
+                size_t cut = first.find(',');
+                string one = first.substr(0, cut), all;
+                for (int i = 0; i < ROWS; ++i) all += (i ? "," : "") + one;
+                expect(first == all && one != "-1", "a read saw a partial or rolled back state", first);
+                ++reads;
+                if (FAILED) break;
+            }
+        });
+    }
+    for (int w = 0; w < WRITERS; ++w) threads[w].join();
+    stop = true;
+    for (size_t i = WRITERS; i < threads.size(); ++i) threads[i].join();
+    expect(commits > 0 && rollbacks > 0 && reads > 0, "nothing ran concurrently");
+    string last = column_text(run(db, "select bal from Acct;"));
+    expect(last.find("-1") == string::npos, "a rolled back value is left", last);
+    db.close();
+    return true;
+}
+
+/* ---------- versions ---------- */
+
+static bool versions_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table R(id int, grp varchar(8), v int, primary key(id));");
+    run(db, "create table C(id int, v int, primary key(id)) storage columnar;");
+    string r, c;
+    for (int i = 1; i <= 300; ++i) {
+        r += string(i > 1 ? ", " : "") + "(" + to_string(i) + ", \"g" + to_string(i % 5) + "\", " + to_string(i * 7 % 1000) + ")";
+        c += string(i > 1 ? ", " : "") + "(" + to_string(i) + ", " + to_string(i * 13 % 1000) + ")";
+    }
+    run(db, "insert into R values " + r + ";");
+    run(db, "insert into C values " + c + ";");
+    run(db, "create index R_grp on R(grp) using hash;");
+    const vector<string> reads = {
+        "select id, grp, v from R order by id;",
+        "select grp, v from R where id = 10;",
+        "select id, v from R where grp = \"g3\" order by id;",
+        "select count(*), sum(v), min(v), max(v) from R;",
+        "select grp, count(*) from R group by grp order by grp;",
+        "select id, v from C where v < 200 order by id;",
+        "select count(*), sum(v) from C;",
+        "select R.id, R.v, C.v from R join C on R.id = C.id where C.v < 300 order by R.id;",
+    };
+    auto read_all = [&](saaddb::Session& s) {
+        vector<string> out;
+        for (const string& q : reads) out.push_back(rows_text(run(s, q)));
+        return out;
+    };
+    const string changes[] = {
+        "insert into R values (301, \"g3\", 5), (302, \"g1\", 6);",
+        "update R set grp = \"g3\", v = 999 where id = 10;",
+        "update R set v = 0 where grp = \"g3\";",
+        "delete from R where id <= 40;",
+        "insert into C values (301, 1), (302, 2);",
+        "update C set v = 150 where id >= 200;",
+        "delete from C where v < 50;",
+    };
+
+    expect(contains(run(db, "explain " + reads[2]).message(), "hash index R_grp"), "= on grp didn't use the index");
+
+    saaddb::Session reader, writer;
+    run(reader, "begin;");
+    vector<string> before = read_all(reader);
+    for (const string& sql : changes) run(writer, sql);
+    expect(read_all(reader) == before, "a snapshot saw changes committed after it began");
+    vector<string> after = read_all(writer);
+    for (size_t i = 0; i < reads.size(); ++i) expect(after[i] != before[i], "a change didn't show: " + reads[i], after[i]);
+    run(reader, "commit;");
+    expect(read_all(reader) == after, "the committed changes after the transaction");
+
+    // a rolled back transaction's changes are never seen, in it or after
+    run(reader, "begin;");
+    run(writer, "begin;");
+    run(writer, "delete from R where id > 100;");
+    run(writer, "update C set v = 7;");
+    expect(read_all(reader) == after, "a snapshot saw uncommitted changes");
+    run(writer, "rollback;");
+    expect(read_all(reader) == after, "a snapshot saw rolled back changes");
+    run(reader, "commit;");
+    expect(read_all(reader) == after, "rolled back changes after the rollback");
+    db.close();
+    return true;
+}
+
+/* ---------- conflict ---------- */
+
+static bool conflict_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table Acct(id int, bal int, primary key(id));");
+    run(db, "insert into Acct values (1, 100);");
+    run(db, "insert into Acct values (2, 100);");
+    {
+        saaddb::Session a, b;
+        a.set_lock_wait(1000);
+        b.set_lock_wait(1000);
+        run(a, "begin;");
+        expect(column_text(run(a, "select bal from Acct where id = 1;")) == "100", "snapshot before the other write");
+        run(b, "update Acct set bal = 5 where id = 1;");
+        saaddb::ResultSet lost = a.query("update Acct set bal = 6 where id = 1;");
+        expect(lost.error() == saaddb::Error::Conflict && lost.affected() == 0, "a write-write conflict wasn't refused", lost.message());
+        expect(column_text(run(a, "select bal from Acct where id = 1;")) == "100", "the refused transaction's snapshot changed");
+        run(a, "update Acct set bal = 7 where id = 2;");   // rows nobody else changed still can be
+        run(a, "rollback;");
+    }
+    expect(column_text(run(db, "select bal from Acct;")) == "5,100", "values after the conflict");
+    db.close();
+    return true;
+}
+
+/* ---------- locks ---------- */
+
+static bool locks_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table Acct(id int, bal int, primary key(id));");
+    run(db, "create table Log(id int, Acct int, primary key(id));");
+    run(db, "insert into Log values (1, 0);");
+    {
+        saaddb::Session a, b;
+        b.set_lock_wait(200);
+        run(a, "begin;");
+        run(a, "insert into Acct values (1, 100);");   // holds Acct's row lock until commit
+        run(b, "update Log set Acct = 1 where id = 1;");
+        expect(column_text(run(b, "select Acct from Log;")) == "1", "the update of Log");
+        saaddb::ResultSet waits = b.query("update Acct set bal = 5 where id = 1;");
+        expect(waits.error() == saaddb::Error::LockTimeout, "a write to the locked table didn't wait", waits.message());
+        run(a, "commit;");
+    }
+    db.close();
+    return true;
+}
+
+/* ---------- queue ---------- */
+
+static bool queue_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table Acct(id int, bal int, primary key(id));");
+    run(db, "insert into Acct values (1, 100);");
+    saaddb::Session holder, w1, w2, reader;
+    for (saaddb::Session* s : { &w1, &w2, &reader }) s->set_lock_wait(0);
+    auto refused = [](saaddb::Session& s, const string& sql) { return s.query(sql).error() == saaddb::Error::LockTimeout; };
+
+    // a schema change that gave up holds back statements asked for after it
+    run(holder, "begin;");
+    expect(refused(w1, "create table Log(id int, primary key(id));"), "create ran next to an open transaction");
+    expect(refused(reader, "select bal from Acct;"), "a select got past a queued create");
+    uint64_t released = saaddb::lock_releases();
+    run(holder, "commit;");
+    expect(saaddb::lock_releases() != released, "a release with parked statements wasn't counted");
+    expect(refused(reader, "select bal from Acct;"), "a select went before the create asked for first");
+    run(w1, "create table Log(id int, primary key(id));");
+    expect(column_text(run(reader, "select bal from Acct;")) == "100", "the select after the create");
+
+    // writers of one table, in the order they asked
+    run(holder, "begin;");
+    run(holder, "update Acct set bal = 1 where id = 1;");
+    expect(refused(w1, "update Acct set bal = 2 where id = 1;"), "a write got past a transaction's row lock");
+    expect(refused(w2, "update Acct set bal = 3 where id = 1;"), "a second write got past a transaction's row lock");
+    run(holder, "commit;");
+    expect(refused(w2, "update Acct set bal = 3 where id = 1;"), "the second writer went first");
+    run(w1, "update Acct set bal = 2 where id = 1;");
+    run(w2, "update Acct set bal = 3 where id = 1;");
+    expect(column_text(run(reader, "select bal from Acct;")) == "3", "writes in turn");
+
+    // a turn given up doesn't hold anyone back
+    run(holder, "begin;");
+    expect(refused(w1, "drop table Log;"), "drop ran next to an open transaction");
+    w1.stop_waiting();
+    expect(column_text(run(reader, "select bal from Acct;")) == "3", "a select waited for a turn given up");
+    run(holder, "commit;");
+    db.close();
+    return true;
+}
+
+/* ---------- migration ---------- */
+
+static bool migration_test() {
+    string dir = DIR + "/" + TEST;
+    mkdir(dir.c_str(), 0755);
+    ofstream(dir + "/SaadSchema.txt")
+        << "*People*\n<<\npk: id\nid int\nname varchar 20\nborn date\npay decimal 7 2\n>>\n\n";
+    ofstream(dir + "/People.sdb")
+        << "<1,Ann,01-02-1990,1200.50>\n"
+        << "<2,Bob,15-07-1985,990.00>\n"
+        << "\n"
+        << "<2,Dup,01-01-2000,1.00>\n"        // repeats a primary key
+        << "<3,Cy,not-a-date,5.00>\n";        // doesn't fit its column
+    bool opened = in_child([] {
+        saaddb::Database db;
+        string msg;
+        if (!open_db(db, msg)) return false;
+        saaddb::ResultSet rs = run(db, "select name, born, pay from People;");
+        expect(contains(rs.message(), "migrated <People> to binary format: 2 rows, 2 rejected"), "migration message", rs.message());
+        expect(column_text(rs) == "Ann,Bob", "migrated rows");
+        expect(rs.size() == 2 && rs.rows()[1][1].text() == "15-07-1985" && rs.rows()[1][2].text() == "990.00", "migrated values");
+        run(db, "insert into People values (3, \"Cy\", 01-01-2001, 5.00);");
+        db.close();
+        return true;
+    });
+    ifstream text(dir + "/People.sdb.txt");
+    expect(text.good(), "the text copy wasn't kept");
+    if (!opened) return false;
+    // migrated once: the next open reads the binary file
+    return in_child([] {
+        saaddb::Database db;
+        string msg;
+        if (!open_db(db, msg)) return false;
+        saaddb::ResultSet rs = run(db, "select id from People;");
+        expect(!contains(rs.message(), "migrated"), "migrated twice", rs.message());
+        expect(column_text(rs) == "1,2,3", "rows after reopening");
+        db.close();
+        return true;
+    });
+}
+
+/* ---------- indexes ---------- */
+
+static bool indexes_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table P(id int, grp varchar(8), born date, primary key(id));");
+    string rows;
+    for (int i = 1; i <= 200; ++i)
+        rows += string(i > 1 ? ", " : "") + "(" + to_string(i) + ", \"g" + to_string(i % 7) + "\", " + (i % 28 < 9 ? "0" : "") + to_string(i % 28 + 1) + "-03-2020)";
+    run(db, "insert into P values " + rows + ";");
+    const string eq = "select id from P where grp = \"g3\" order by id;";
+    const string range = "select id from P where born >= 10-03-2020 and born < 12-03-2020 order by id;";
+    string eqRows = column_text(run(db, eq)), rangeRows = column_text(run(db, range));
+    expect(eqRows.size() > 0 && rangeRows.size() > 0, "rows before the indexes");
+
+    run(db, "create index P_grp on P(grp) using hash;");
+    run(db, "create index P_born on P(born);");
+    expect(contains(run(db, "explain " + eq).message(), "hash index P_grp"), "= didn't use the hash index");
+    expect(contains(run(db, "explain " + range).message(), "btree index P_born"), "a range didn't use the btree index");
+    expect(column_text(run(db, eq)) == eqRows, "rows by the hash index", column_text(run(db, eq)));
+    expect(column_text(run(db, range)) == rangeRows, "rows by the btree index", column_text(run(db, range)));
+
+    // the indexes follow the rows they point at
+    run(db, "update P set grp = \"g3\", born = 10-03-2020 where id = 1;");
+    run(db, "delete from P where id = 3;");
+    run(db, "insert into P values (301, \"g3\", 11-03-2020);");
+    string eqAfter = column_text(run(db, eq)), rangeAfter = column_text(run(db, range));
+    run(db, "drop index P_grp;");
+    run(db, "drop index P_born;");
+    expect(!contains(run(db, "explain " + eq).message(), "index P_grp"), "a dropped index is still used");
+    expect(column_text(run(db, eq)) == eqAfter, "hash index after changes", eqAfter);
+    expect(column_text(run(db, range)) == rangeAfter, "btree index after changes", rangeAfter);
+    expect(contains(eqAfter, "301") && eqAfter.find("1,") == 0 && !contains("," + eqAfter + ",", ",3,"), "changed rows by the index", eqAfter);
+    db.close();
+    return true;
+}
+
+/* ---------- columnar ---------- */
+
+static bool columnar_test() {
+    const int ROWS = 40000;     // a few scan segments
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    string csv = DIR + "/" + TEST + "/rows.csv";
+    {
+        ofstream out(csv);
+        for (int i = 1; i <= ROWS; ++i) {
+            int day = i % 28 + 1, cents = (i * 7919) % 100000;
+            out << i << ",n" << i % 97 << "," << (day < 10 ? "0" : "") << day << "-0" << i % 9 + 1 << "-2021,"
+                << cents / 100 << "." << (cents % 100 < 10 ? "0" : "") << cents % 100 << "," << (i * 31) % 1000 - 500 << "\n";
+        }
+    }
+    run(db, "set threads 4;");
+    for (const string& t : { "R", "C" }) {
+        run(db, "create table " + t + "(id int, name varchar(6), d date, pay decimal(7,2), n int, primary key(id))"
+            + (t == "C" ? " storage columnar;" : ";"));
+        expect(run(db, "load " + t + " from '" + csv + "';").affected() == ROWS, "rows loaded into " + t);
+    }
+    expect(contains(run(db, "explain select id from C where n > 0;").message(), "columnar full scan"), "C isn't scanned as columnar");
+    const vector<string> filters = {
+        "n > 400", "n <= -499", "n = 0 and pay < 500.00", "n != 3 and n >= 498",
+        "pay >= 999.50", "pay < 0.20 or pay > 999.90", "d = 05-03-2021 and n < -450",
+        "d >= 27-09-2021", "name = \"n5\" and n > 300", "name != \"n5\" and pay < 0.10",
+    };
+    for (const string& f : filters) {
+        string row = rows_text(run(db, "select id, name, d, pay from R where " + f + " order by id;"));
+        string col = rows_text(run(db, "select id, name, d, pay from C where " + f + " order by id;"));
+        expect(!row.empty() && row == col, "columnar rows where " + f, row + "\n" + col);
+    }
+    // changes go through to the columns
+    run(db, "update C set pay = 1000.00 where id = 7;");
+    run(db, "delete from C where n < -480;");
+    run(db, "update R set pay = 1000.00 where id = 7;");
+    run(db, "delete from R where n < -480;");
+    for (const string& f : { string("pay >= 999.90"), string("n < -470") }) {
+        string row = column_text(run(db, "select id from R where " + f + " order by id;"));
+        string col = column_text(run(db, "select id from C where " + f + " order by id;"));
+        expect(!row.empty() && row == col, "columnar rows after changes where " + f, row + "\n" + col);
+    }
+    db.close();
+    return true;
+}
+
+/* ---------- aggregates ---------- */
+
+static bool aggregates_test() {
+    const int ROWS = 60000, GROUPS = 20011;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    struct Sums { int64_t count = 0, sum = 0, min = 0, max = 0; };
+    map<string, Sums> want;
+    string csv = DIR + "/" + TEST + "/rows.csv";
+    {
+        ofstream out(csv);
+        for (int i = 1; i <= ROWS; ++i) {
+            string k = "k" + to_string((i * 13) % GROUPS);
+            int64_t v = (int64_t)(i * 7919) % 100003 - 50000;
+            out << i << "," << k << "," << v << "\n";
+            Sums& g = want[k];
+            if (!g.count++) g.min = g.max = v;
+            g.sum += v; g.min = min(g.min, v); g.max = max(g.max, v);
+        }
+    }
+    run(db, "create table A(id int, k varchar(8), v int, primary key(id));");
+    run(db, "load A from '" + csv + "';");
+    const string grouped = "select k, count(*), sum(v), avg(v), min(v), max(v) from A group by k;";
+    auto check = [&](const string& when) {
+        saaddb::ResultSet rs = run(db, grouped);
+        expect(rs.size() == want.size(), "groups " + when, to_string(rs.size()));
+        size_t wrong = 0;
+        for (const saaddb::Row& row : rs) {
+            auto it = want.find(row[0].text());
+            const Sums* g = it == want.end() ? nullptr : &it->second;
+            double avg = (double)row[3].num / pow(10.0, row[3].scale);
+            if (!g || row[1].num != g->count || row[2].num != g->sum || row[4].num != g->min || row[5].num != g->max ||
+                fabs(avg - (double)g->sum / g->count) > 0.01) ++wrong;
+        }
+        expect(wrong == 0, "groups " + when + " with wrong values", to_string(wrong));
+    };
+    check("in memory");
+    run(db, "set memory 1;");
+    expect(contains(run(db, "explain analyze " + grouped).message(), "spilled to disk"), "the groups didn't spill with 1 MB");
+    check("spilled");
+
+    int64_t total = 0;
+    for (const auto& g : want) total += g.second.sum;
+    expect(rows_text(run(db, "select count(*), sum(v) from A;")) == to_string(ROWS) + " " + to_string(total) + ";", "count and sum of the table");
+    expect(rows_text(run(db, "select count(*), sum(v), min(v) from A where id > " + to_string(ROWS) + ";")) == "0 NULL NULL;", "aggregates of no rows");
+    expect(run(db, "select k, count(*) from A where id < 0 group by k;").size() == 0, "groups of no rows");
+    db.close();
+    return true;
+}
+
+/* ---------- ordering ---------- */
+
+static bool ordering_test() {
+    const int ROWS = 60000;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    struct R { int id; int v; string name; };
+    vector<R> rows;
+    string csv = DIR + "/" + TEST + "/rows.csv";
+    {
+        ofstream out(csv);
+        for (int i = 1; i <= ROWS; ++i) {
+            R r{ i, (i * 7919) % 1000, "n" + to_string((i * 31) % 5003) };     // many equal keys
+            out << r.id << "," << r.v << "," << r.name << "\n";
+            rows.push_back(r);
+        }
+    }
+    run(db, "create table S(id int, v int, name varchar(8), primary key(id));");
+    run(db, "load S from '" + csv + "';");
+    // v desc, then id
+    sort(rows.begin(), rows.end(), [](const R& a, const R& b) { return a.v != b.v ? a.v > b.v : a.id < b.id; });
+    auto ids = [](const vector<R>& rs, size_t n) {
+        string out;
+        for (size_t i = 0; i < n && i < rs.size(); ++i) out += (i ? "," : "") + to_string(rs[i].id);
+        return out;
+    };
+    const string all = ids(rows, rows.size());
+    const string byV = "select id from S order by v desc, id";
+    auto check = [&](const string& when) {
+        expect(column_text(run(db, byV + ";")) == all, "order by " + when);
+        expect(column_text(run(db, byV + " limit 25;")) == ids(rows, 25), "order by with limit " + when);
+        expect(column_text(run(db, byV + " limit 0;")).empty(), "limit 0 " + when);
+    };
+    check("in memory");
+    run(db, "set memory 1;");
+    expect(contains(run(db, "explain analyze " + byV + ";").message(), "spilled to disk"), "the sort didn't spill with 1 MB");
+    check("spilled");
+
+    // a varchar key, ascending, then id descending
+    sort(rows.begin(), rows.end(), [](const R& a, const R& b) { return a.name != b.name ? a.name < b.name : a.id > b.id; });
+    expect(column_text(run(db, "select id from S order by name, id desc;")) == ids(rows, rows.size()), "order by a varchar");
+    // groups ordered by an aggregate
+    saaddb::ResultSet top = run(db, "select v, count(*) from S where v < 3 group by v order by count(*) desc, v limit 2;");
+    int64_t n0 = 0, n1 = 0, n2 = 0;
+    for (const R& r : rows) { n0 += r.v == 0; n1 += r.v == 1; n2 += r.v == 2; }
+    expect(top.size() == 2 && top.rows()[0][1].num >= top.rows()[1][1].num &&
+           top.rows()[0][1].num == max(n0, max(n1, n2)), "groups ordered by count(*)", rows_text(top));
+    db.close();
+    return true;
+}
+
+/* ---------- joins ---------- */
+
+// The rows of rs as text, sorted: joins don't promise an order.
+static vector<string> sorted_rows(const saaddb::ResultSet& rs) {
+    vector<string> out;
+    for (const saaddb::Row& row : rs) {
+        string line;
+        for (size_t i = 0; i < row.size(); ++i) line += (i ? " " : "") + row[i].text();
+        out.push_back(line);
+    }
+    sort(out.begin(), out.end());
+    return out;
+}
+
+static bool joins_test() {
+    const int CUSTS = 2000, ORDERS = 40000;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    vector<int> region(CUSTS + 1), cust(ORDERS + 1), ref(ORDERS + 1);
+    string dir = DIR + "/" + TEST + "/";
+    {
+        ofstream c(dir + "cust.csv"), o(dir + "orders.csv"), sh(dir + "ship.csv");
+        for (int i = 1; i <= CUSTS; ++i) { region[i] = i % 17; c << i << "," << region[i] << "\n"; }
+        for (int i = 1; i <= ORDERS; ++i) {
+            cust[i] = (i * 7) % (CUSTS + 50) + 1;      // some name no customer
+            ref[i] = (int64_t)i * 7919 % ORDERS;
+            o << i << "," << cust[i] << "," << ref[i] << "\n";
+            sh << i << "," << (int64_t)i * 104729 % ORDERS << ",shipped by road in a box " << i << "\n";  // ref: another permutation
+        }
+    }
+    run(db, "create table Cust(id int, region int, primary key(id));");
+    run(db, "create table Orders(id int, cust int, ref int, primary key(id));");
+    run(db, "create table Ship(id int, ref int, note varchar(40), primary key(id));");
+    run(db, "load Cust from '" + dir + "cust.csv';");
+    run(db, "load Orders from '" + dir + "orders.csv';");
+    run(db, "load Ship from '" + dir + "ship.csv';");
+
+    // a few orders, their customers looked up by Cust's PK
+    const string byPk = "select Orders.id, Cust.id from Orders join Cust on Orders.cust = Cust.id where Orders.id <= 200 and Cust.region < 9;";
+    expect(contains(run(db, "explain " + byPk).message(), "index nested loop"), "no index nested-loop join on a PK");
+    vector<string> want;
+    for (int i = 1; i <= 200; ++i)
+        if (cust[i] <= CUSTS && region[cust[i]] < 9) want.push_back(to_string(i) + " " + to_string(cust[i]));
+    sort(want.begin(), want.end());
+    expect(sorted_rows(run(db, byPk)) == want, "rows of the join on a PK", to_string(run(db, byPk).size()));
+
+    // many to many on columns no index covers: a hash join
+    const string byRegion = "select Cust.id, Orders.id from Cust join Orders on Cust.region = Orders.ref where Orders.id < 3000;";
+    expect(contains(run(db, "explain " + byRegion).message(), "hash join"), "no hash join on unindexed columns");
+    want.clear();
+    for (int o = 1; o < 3000; ++o)
+        for (int c = 1; c <= CUSTS; ++c)
+            if (region[c] == ref[o]) want.push_back(to_string(c) + " " + to_string(o));
+    sort(want.begin(), want.end());
+    expect(!want.empty() && sorted_rows(run(db, byRegion)) == want, "rows of a many-to-many hash join");
+
+    // one to one on large sides, then with the build side over the memory budget
+    const string byRef = "select Orders.id, Ship.id from Orders join Ship on Orders.ref = Ship.ref;";
+    vector<int> shipOf(ORDERS);
+    for (int i = 1; i <= ORDERS; ++i) shipOf[(int64_t)i * 104729 % ORDERS] = i;
+    want.clear();
+    for (int i = 1; i <= ORDERS; ++i) want.push_back(to_string(i) + " " + to_string(shipOf[ref[i]]));
+    sort(want.begin(), want.end());
+    expect(sorted_rows(run(db, byRef)) == want, "rows of a hash join in memory");
+    run(db, "set memory 1;");
+    expect(contains(run(db, "explain analyze " + byRef).message(), "partition pairs on disk"), "the join didn't partition with 1 MB");
+    expect(sorted_rows(run(db, byRef)) == want, "rows of a partitioned hash join");
+    db.close();
+    return true;
+}
+
+/* ---------- cache ---------- */
+
+static bool cache_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table T(id int, name varchar(12), primary key(id));");
+    // one insert shape, values that look like keywords and separators
+    const vector<string> names = { "Ann", "where", "a b", "x;y", "(1)", "and id = 2", "3", "" };
+    for (size_t i = 0; i < names.size(); ++i)
+        run(db, "insert into T values (" + to_string(i + 1) + ", \"" + names[i] + "\");");
+    for (size_t i = 0; i < names.size(); ++i) {
+        string got = rows_text(run(db, "select name from T where id = " + to_string(i + 1) + ";"));
+        expect(got == names[i] + ";", "a cached select's value " + to_string(i + 1), got);
+        got = rows_text(run(db, "select id from T where name = \"" + names[i] + "\";"));
+        expect(got == to_string(i + 1) + ";", "a cached select by name " + names[i], got);
+    }
+    run(db, "update T set name = \"Bo\" where id = 1;");
+    run(db, "update T set name = \"Cy\" where id = 2;");
+    expect(column_text(run(db, "select name from T where id < 3;")) == "Bo,Cy", "cached updates");
+
+    // evicted plans come back; a schema change replans
+    for (int i = 0; i < 100; ++i) run(db, "select id from T where id = " + to_string(i) + " and name != \"q" + to_string(i) + "\" limit " + to_string(i + 1) + ";");
+    for (int i = 0; i < 100; ++i) run(db, "select id" + string(i % 2 ? ", name" : "") + " from T where id > " + to_string(i) + (i % 3 ? ";" : " ;"));
+    expect(column_text(run(db, "select name from T where id = 2;")) == "Cy", "a select after evictions");
+    run(db, "drop table T;");
+    expect(db.query("select name from T where id = 2;").error() == saaddb::Error::Invalid, "a cached select of a dropped table");
+    run(db, "create table T(id int, born date, name varchar(12), primary key(id));");
+    run(db, "insert into T values (2, 01-02-2003, \"Di\");");
+    expect(rows_text(run(db, "select name from T where id = 2;")) == "Di;", "a cached select after the table changed");
+    run(db, "create index T_name on T(name) using hash;");
+    expect(column_text(run(db, "select id from T where name = \"Di\";")) == "2", "a cached select after create index");
+
+    // prepare; and execute;
+    run(db, "prepare byName as select id, born from T where name = ?;");
+    run(db, "prepare add as insert into T values (?, ?, ?);");
+    run(db, "execute add(3, 04-05-2006, where);");
+    run(db, "execute add(4, 07-08-2009, Ed);");
+    expect(rows_text(run(db, "execute byName(where);")) == "3 04-05-2006;", "execute with a keyword as its value");
+    expect(rows_text(run(db, "execute byName(Ed);")) == "4 07-08-2009;", "execute rebound");
+    expect(db.query("execute byName(a, b);").error() == saaddb::Error::Invalid, "execute with too many values");
+    run(db, "deallocate byName;");
+    expect(db.query("execute byName(Ed);").error() == saaddb::Error::Invalid, "execute after deallocate");
+    db.close();
+    return true;
+}
+
+/* ---------- compaction ---------- */
+
+static bool compaction_test() {
+    const int ROWS = 20000, READERS = 3;
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table P(id int, v int, pad varchar(100), primary key(id));");
+    string pad(90, 'x');
+    for (int b = 0; b < ROWS; b += 1000) {
+        string sql = "insert into P values ";
+        for (int i = b; i < b + 1000; ++i) sql += (i > b ? ",(" : "(") + to_string(i) + ", 0, \"" + pad + "\")";
+        run(db, sql + ";");
+    }
+    run(db, "delete from P where id >= 5000;");
+
+    // every select's snapshot begins before the one ahead of it ends, and
+    // every update leaves a version those snapshots read
+    atomic<bool> stop{ false };
+    atomic<long> updates{ 0 }, reads{ 0 };
+    vector<thread> threads;
+    for (int r = 0; r < READERS; ++r) {
+        threads.emplace_back([&] {
+            saaddb::Session s;
+            while (!stop.load() && !FAILED) {
+                expect(column_text(run(s, "select count(*) from P;")) == "5000", "count during compaction");
+                ++reads;
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        saaddb::Session s;
+        for (long n = 0; !stop.load() && !FAILED; ++n) {     // row n % 5000 gets n + 1
+            saaddb::ResultSet rs = s.query("update P set v = " + to_string(n + 1) + " where id = " + to_string(n % 5000) + ";");
+            expect(rs.ok() && rs.affected() == 1, "update during compaction", rs.message());
+            updates += rs.ok();
+        }
+    });
+    this_thread::sleep_for(chrono::milliseconds(100));
+    for (int i = 0; i < 3; ++i) {
+        saaddb::ResultSet rs = run(db, "vacuum P;");
+        expect(contains(rs.message(), "Compacted <P>: 5000 rows"), "vacuum P", rs.message());
+    }
+    stop = true;
+    for (thread& t : threads) t.join();
+    expect(reads > 0 && updates > 0, "nothing ran during compaction");
+    string n = to_string(updates.load()), changed = to_string(min(updates.load(), 5000L));
+    expect(rows_text(run(db, "select count(*), max(v) from P where v > 0;")) == changed + " " + n + ";", "updates lost by compaction");
+    expect(column_text(run(db, "select count(*) from P where id < 5000;")) == "5000", "rows after compaction");
+    db.close();
+    return true;
+}
+
+/* ---------- statements ---------- */
+
+static bool statements_test() {
+    saaddb::Database db;
+    string msg;
+    if (!open_db(db, msg)) return false;
+    run(db, "create table Acct(id int, bal int, primary key(id));");
+    for (const char* bad : { "create table Log(id int, primary key(id));", "vacuum;", "selec id from Acct;",
+                             "select id from Nope where id = ?;", "update Acct set nope = ? where id = 1;", "" }) {
+        saaddb::Statement st = db.prepare(bad);
+        expect(!st && st.message().find("[SaadDB]") == 0, string("prepared: ") + bad, st.message());
+        expect(st.execute().error() == saaddb::Error::Invalid, string("executed: ") + bad);
+    }
+    saaddb::ResultSet tables = db.query("select * from Log;");
+    expect(tables.error() == saaddb::Error::Invalid, "a refused prepare ran its statement", tables.message());
+
+    saaddb::Statement ins = db.prepare("insert into Acct values (?, ?);");
+    expect(bool(ins) && ins.parameters() == 2, "insert with 2 parameters", ins.message());
+    ins.bind(1, int64_t(1)).bind(2, int64_t(100)).bind(3, int64_t(7));
+    saaddb::ResultSet bad = ins.execute();
+    expect(bad.error() == saaddb::Error::Invalid && contains(bad.message(), "parameter 3"), "bind(3) of 2 wasn't refused", bad.message());
+    ins.bind(0, "5");
+    expect(ins.execute().error() == saaddb::Error::Invalid, "bind(0) wasn't refused");
+    expect(column_text(run(db, "select id from Acct;")).empty(), "a refused execute inserted");
+    saaddb::ResultSet good = ins.execute();     // the bad binds were reported; 1 and 2 still hold
+    expect(good.ok() && good.affected() == 1, "execute after the refused ones", good.message());
+    ins.bind(1, int64_t(2)).bind(2, "where");
+    expect(ins.execute().error() == saaddb::Error::Constraint, "a bound varchar for an int column");
+    ins.bind(2, int64_t(200));
+    expect(ins.execute().affected() == 1, "second insert");
+
+    saaddb::Statement sel = db.prepare("select bal from Acct where id >= ? limit ?;");
+    expect(bool(sel) && sel.parameters() == 2, "select with 2 parameters", sel.message());
+    sel.bind(1, int64_t(2)).bind(2, int64_t(5));
+    expect(column_text(sel.execute()) == "200", "prepared select");
+    sel.bind(1, int64_t(0));
+    expect(column_text(sel.execute()) == "100,200", "prepared select rebound");
+    db.close();
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) { cout << "usage: saaddb-check DIR\n"; return 2; }
+    DIR = argv[1];
+    mkdir(DIR.c_str(), 0755);
+    struct Test { const char* name; bool (*fn)(); };
+    const Test tests[] = {
+        { "crash", crash_test },
+        { "durability", durability_test },
+        { "snapshots", snapshot_test },
+        { "versions", versions_test },
+        { "conflict", conflict_test },
+        { "locks", locks_test },
+        { "queue", queue_test },
+        { "migration", migration_test },
+        { "indexes", indexes_test },
+        { "columnar", columnar_test },
+        { "aggregates", aggregates_test },
+        { "ordering", ordering_test },
+        { "joins", joins_test },
+        { "cache", cache_test },
+        { "compaction", compaction_test },
+        { "statements", statements_test },
+    };
+    int failed = 0;
+    for (const Test& t : tests) {
+        TEST = t.name;
+        bool ok = in_child(t.fn);
+        cout << (ok ? "ok   " : "FAIL ") << t.name << "\n";
+        if (!ok) ++failed;
+    }
+    cout << (failed ? to_string(failed) + " of " : "all ") << size(tests) << " tests " << (failed ? "failed" : "passed") << "\n";
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#include "protocol.h"
+#include "statement_line.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+/* ========== saaddb-client ==========
+  saaddb-client PATH: the REPL, talking to `saaddb --serve PATH` instead of
+  opening the database itself. Output is the same as the REPL's.
+*/
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+    if (argc != 2) { cout << "usage: saaddb-client PATH\n"; return 2; }
+
+    sockaddr_un addr{};
+    string path = argv[1];
+    if (path.size() >= sizeof addr.sun_path) { cout << "[SaadDB] Socket path too long\n"; return 1; }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof addr) != 0) {
+        cout << "[SaadDB] Cannot connect to " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    cout << "=== Saad DB (C++ mini-SQL) ===\n";
+    cout << "Connected to " << path << ". Type help; or quit;\n";
+    string q, req, payload, line;
+    vector<saaddb::Column> cols;
+    saaddb::Row row;
+    saaddb::QueryStatus status;
+    while (true) {
+        cout << "\n>> ";
+        if (!std::getline(cin, q)) break;
+        if (!saaddb::has_semicolon(q)) { cout << "[SaadDB] ; missing at the end\n"; continue; }
+        if (saaddb::is_quit(q)) { cout << "[SaadDB] Bye.\n"; break; }
+        req.clear();
+        saaddb::wire::put_frame(req, saaddb::wire::QUERY, q);
+        if (!saaddb::wire::write_all(fd, req.data(), req.size())) { cout << "[SaadDB] Connection lost\n"; return 1; }
+        uint8_t kind;
+        while (true) {
+            if (!saaddb::wire::read_frame(fd, kind, payload)) { cout << "[SaadDB] Connection lost\n"; return 1; }
+            if (kind == saaddb::wire::COLUMNS) saaddb::wire::get_columns(payload, cols);
+            else if (kind == saaddb::wire::ROW) {
+                saaddb::wire::get_row(payload, cols, row);
+                line.clear();
+                for (const saaddb::Value& v : row) {
+                    size_t at = line.size();
+                    v.append_text(line);
+                    if (line.size() - at < 20) line.append(20 - (line.size() - at), ' ');
+                }
+                line.push_back('\n');
+                cout << line;
+            }
+            else if (kind == saaddb::wire::DONE) {
+                if (!saaddb::wire::get_done(payload, status)) { cout << "[SaadDB] Connection lost\n"; return 1; }
+                cout << status.message;
+                break;
+            }
+        }
+    }
+    ::close(fd);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include "protocol.h"
+#include "statement_line.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+/* ========== saaddb-load ==========
+  saaddb-load PATH [-c clients] [-n rounds] [-r range] "statement;" ...
+  Opens clients connections to `saaddb --serve PATH` and has each run the
+  statements in order n times back to back (e.g. "begin;" "insert ...;"
+  "commit;" for a transaction per round), every ? replaced by a random
+  integer in [0, range). Reports throughput and the latency percentiles
+  of the rounds that ran, the rows they returned and changed, how many
+  were rejected (a statement's DONE frame reports an error: a duplicate
+  key, a lock timeout, a parse error, ...) and how many failed (the
+  connection broke).
+*/
+
+static int connect_to(const string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof addr.sun_path) return -1;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof addr) != 0) { ::close(fd); return -1; }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    string path;
+    vector<string> stmts;
+    long clients = 4, count = 1000, range = 1000;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if ((a == "-c" || a == "-n" || a == "-r") && i + 1 < argc) {
+            long v = atol(argv[++i]);
+            (a == "-c" ? clients : a == "-n" ? count : range) = v;
+        }
+        else if (path.empty()) path = a;
+        else stmts.push_back(a);
+    }
+    if (path.empty() || stmts.empty() || clients < 1 || count < 1 || range < 1) {
+        cout << "usage: saaddb-load PATH [-c clients] [-n rounds] [-r range] \"statement;\" ...\n";
+        return 2;
+    }
+    for (const string& stmt : stmts) {
+        if (!saaddb::has_semicolon(stmt)) { cout << "[SaadDB] ; missing at the end of " << stmt << "\n"; return 2; }
+        if (saaddb::is_quit(stmt)) { cout << "[SaadDB] saaddb-load doesn't send quit\n"; return 2; }
+    }
+
+    vector<vector<double>> latency((size_t)clients);    // ms, per client
+    atomic<uint64_t> rows{0}, changed{0};
+    atomic<long> failed{0}, rejected{0};
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (long c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            int fd = connect_to(path);
+            if (fd < 0) { failed += count; return; }
+            mt19937_64 rng((uint64_t)c * 7919 + 1);
+            vector<double>& lat = latency[(size_t)c];
+            lat.reserve((size_t)count);
+            string req, payload, sql;
+            saaddb::QueryStatus status;
+            uint64_t n = 0, m = 0;
+            bool ok = true;
+            for (long k = 0; ok && k < count; ++k) {
+                auto s = chrono::steady_clock::now();
+                bool error = false;
+                uint64_t affected = 0;
+                for (const string& stmt : stmts) {
+                    sql.clear();
+                    for (char ch : stmt) {
+                        if (ch == '?') sql += to_string((long)(rng() % (uint64_t)range));
+                        else sql.push_back(ch);
+                    }
+                    req.clear();
+                    saaddb::wire::put_frame(req, saaddb::wire::QUERY, sql);
+                    ok = saaddb::wire::write_all(fd, req.data(), req.size());
+                    uint8_t kind = 0;
+                    while (ok && kind != saaddb::wire::DONE) {
+                        ok = saaddb::wire::read_frame(fd, kind, payload);
+                        n += ok && kind == saaddb::wire::ROW;
+                    }
+                    if (ok) ok = saaddb::wire::get_done(payload, status);
+                    if (!ok) { failed += count - k; break; }
+                    error = error || !status.ok();
+                    affected += status.affected;
+                }
+                if (ok && error) ++rejected;
+                else if (ok) {
+                    lat.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - s).count());
+                    m += affected;
+                }
+            }
+            rows += n;
+            changed += m;
+            ::close(fd);
+        });
+    }
+    for (auto& t : threads) t.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    vector<double> all;
+    for (auto& l : latency) all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    auto pct = [&](double p) { return all.empty() ? 0.0 : all[min(all.size() - 1, (size_t)(p * all.size()))]; };
+    char line[256];
+    snprintf(line, sizeof line, "[SaadDB] %ld clients: %zu rounds in %.3f s (%.0f/s), %llu rows, %llu changed, %ld rejected, %ld failed\n",
+        clients, all.size(), secs, secs > 0 ? all.size() / secs : 0.0, (unsigned long long)rows.load(),
+        (unsigned long long)changed.load(), rejected.load(), failed.load());
+    cout << line;
+    snprintf(line, sizeof line, "[SaadDB] latency ms: p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+        pct(0.50), pct(0.95), pct(0.99), all.empty() ? 0.0 : all.back());
+    cout << line;
+    return failed || rejected ? 1 : 0;
+}
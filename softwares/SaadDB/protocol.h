@@ -0,0 +1,191 @@
+#ifndef SAADDB_PROTOCOL_H
+#define SAADDB_PROTOCOL_H
+
+/* ========== SaadDB wire protocol ==========
+  Spoken over the Unix domain socket of `saaddb --serve` (server.cpp) by
+  saaddb-client and saaddb-load. Every message is a frame: a uint32 length
+  of what follows, a kind byte, then the payload. Integers are little endian.
+    client -> server  'Q'  a statement, as text
+    server -> client  'C'  columns, before the first row:
+                           u16 count, then per column: u8 type, u8 scale,
+                           u16 name length + name
+                      'R'  a row: per value u8 type, then an int64 for
+                           int / date / decimal, u32 length + bytes for varchar
+                      'D'  done: u8 status (saaddb::Error, 0 = ran), u64 rows
+                           affected, then the statement's messages, as text
+  A client may send its next statement before the last one is done; the
+  statements of one connection run in the order they arrive.
+*/
+
+#include "saaddb.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+
+namespace saaddb {
+namespace wire {
+
+enum Kind : uint8_t { QUERY = 'Q', COLUMNS = 'C', ROW = 'R', DONE = 'D' };
+
+static const uint32_t MAX_FRAME = 64u << 20;
+static const size_t FRAME_HEADER = 5;
+
+inline void put_u8(std::string& b, uint8_t v) { b.push_back((char)v); }
+inline void put_u16(std::string& b, uint16_t v) { for (int i = 0; i < 2; ++i) b.push_back((char)(v >> (8 * i))); }
+inline void put_u32(std::string& b, uint32_t v) { for (int i = 0; i < 4; ++i) b.push_back((char)(v >> (8 * i))); }
+inline void put_u64(std::string& b, uint64_t v) { for (int i = 0; i < 8; ++i) b.push_back((char)(v >> (8 * i))); }
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)(uint8_t)p[i] << (8 * i);
+    return v;
+}
+
+// Starts a frame of kind k at the end of b; end_frame(b, at) fills in its length.
+inline size_t begin_frame(std::string& b, Kind k) {
+    size_t at = b.size();
+    put_u32(b, 0);
+    put_u8(b, k);
+    return at;
+}
+
+inline void end_frame(std::string& b, size_t at) {
+    uint32_t n = (uint32_t)(b.size() - at - 4);
+    for (int i = 0; i < 4; ++i) b[at + i] = (char)(n >> (8 * i));
+}
+
+inline void put_frame(std::string& b, Kind k, const std::string& payload) {
+    size_t at = begin_frame(b, k);
+    b += payload;
+    end_frame(b, at);
+}
+
+inline void put_columns(std::string& b, const std::vector<Column>& cols) {
+    size_t at = begin_frame(b, COLUMNS);
+    put_u16(b, (uint16_t)cols.size());
+    for (const Column& c : cols) {
+        put_u8(b, (uint8_t)c.type);
+        put_u8(b, (uint8_t)c.scale);
+        put_u16(b, (uint16_t)c.name.size());
+        b += c.name;
+    }
+    end_frame(b, at);
+}
+
+inline void put_row(std::string& b, const Row& row) {
+    size_t at = begin_frame(b, ROW);
+    for (const Value& v : row) {
+        put_u8(b, (uint8_t)v.type);
+        if (v.type == Type::Null) continue;
+        if (v.type == Type::Varchar) { put_u32(b, (uint32_t)v.str.size()); b += v.str; }
+        else put_u64(b, (uint64_t)v.num);
+    }
+    end_frame(b, at);
+}
+
+inline void put_done(std::string& b, const QueryStatus& st) {
+    size_t at = begin_frame(b, DONE);
+    put_u8(b, (uint8_t)st.error);
+    put_u64(b, st.affected);
+    b += st.message;
+    end_frame(b, at);
+}
+
+// Reads a payload front to back; ok turns false on a short or malformed one.
+struct Reader {
+    const char* p;
+    const char* end;
+    bool ok = true;
+
+    Reader(const std::string& s) : p(s.data()), end(s.data() + s.size()) {}
+    bool has(size_t n) { if ((size_t)(end - p) < n) ok = false; return ok; }
+    uint64_t num(int bytes) {
+        if (!has((size_t)bytes)) return 0;
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) v |= (uint64_t)(uint8_t)p[i] << (8 * i);
+        p += bytes;
+        return v;
+    }
+    void text(size_t n, std::string& out) {
+        if (!has(n)) return;
+        out.assign(p, n);
+        p += n;
+    }
+};
+
+inline bool get_columns(const std::string& payload, std::vector<Column>& cols) {
+    Reader r(payload);
+    cols.resize((size_t)r.num(2));
+    for (Column& c : cols) {
+        c.type = (Type)r.num(1);
+        c.scale = (int)r.num(1);
+        r.text((size_t)r.num(2), c.name);
+    }
+    return r.ok;
+}
+
+inline bool get_done(const std::string& payload, QueryStatus& st) {
+    Reader r(payload);
+    st.error = (Error)r.num(1);
+    st.affected = r.num(8);
+    st.message.assign(r.ok ? r.p : r.end, r.end);
+    return r.ok;
+}
+
+// Decodes a row of cols, reusing row's values (and their strings) from the last one.
+inline bool get_row(const std::string& payload, const std::vector<Column>& cols, Row& row) {
+    Reader r(payload);
+    size_t n = 0;
+    while (r.p < r.end && r.ok) {
+        if (row.size() <= n) row.emplace_back();
+        Value& v = row[n++];
+        v.type = (Type)r.num(1);
+        v.scale = v.type == Type::Decimal && n <= cols.size() ? cols[n - 1].scale : 0;
+        v.num = 0;
+        v.str.clear();
+        if (v.type == Type::Null) continue;
+        if (v.type == Type::Varchar) r.text((size_t)r.num(4), v.str);
+        else v.num = (int64_t)r.num(8);
+    }
+    row.resize(n);
+    return r.ok;
+}
+
+// Blocking helpers for clients.
+inline bool write_all(int fd, const char* p, size_t n) {
+    while (n) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w; n -= (size_t)w;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* p, size_t n) {
+    while (n) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; n -= (size_t)r;
+    }
+    return true;
+}
+
+inline bool read_frame(int fd, uint8_t& kind, std::string& payload) {
+    char h[FRAME_HEADER];
+    if (!read_all(fd, h, sizeof h)) return false;
+    uint32_t n = get_u32(h);
+    if (n < 1 || n > MAX_FRAME) return false;
+    kind = (uint8_t)h[4];
+    payload.resize(n - 1);
+    return read_all(fd, &payload[0], payload.size());
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,8499 @@
+#include "saaddb.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <unordered_map>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <signal.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/* ========== Saad DB ==========
+  The engine behind libsaaddb (see saaddb.h); main.cpp is the REPL.
+
+  Storage (every file below lives in the directory given to Database::open):
+    - Schema file: SaadSchema.txt
+      Blocks:
+        *TableName*
+        <<
+        pk: primaryKeyName
+        col1 <type...>
+        col2 <type...>
+        ...
+        >>
+    - Table data: <TableName>.sdb
+      Binary paged file, fixed-width typed rows (see "paged table storage").
+      The old text format (lines like <v1,v2,...,vn>) is still read by
+      import/export and is migrated automatically the first time a table is opened.
+      A table created with "storage columnar" instead keeps one file per
+      column, <TableName>.<column>.col (+ .blob for varchar); see "columnar storage".
+    - Primary key index: <TableName>.pk
+      On-disk B+tree (see "B+tree index"); rebuilt from the table if missing.
+    - Secondary indexes: <TableName>.<index>.idx, listed in the schema block as
+        index: name column hash|btree
+    - Zone maps: <TableName>.zone, per-segment min/max and Bloom filters
+      used to skip parts of a full scan (see "zone maps"); rebuilt if missing.
+    - Write-ahead log: SaadDB.wal (see "write-ahead log"); rows are updated
+      and deleted in place, and the log is replayed at startup after a crash.
+      The space of deleted rows comes back when a table is compacted
+      (see "compaction").
+
+  Notes:
+    - Case-insensitive keywords; identifiers & values keep case.
+    - Strings in INSERT must be quoted "like this".
+    - WHERE supports = != < > <= >= on every type (strings compare bytewise),
+      joined with AND / OR; AND binds tighter than OR.
+    - Types: int, varchar N, date (dd-mm-yyyy), decimal P S
+*/
+
+// "" or "dir/": prefixed to every file of the database (see data_path).
+static string DATA_DIR;
+static string data_path(const string& name) { return DATA_DIR + name; }
+
+static string SCHEMA_FILE = "SaadSchema.txt";
+
+// Engine messages ("[SaadDB] ..."). Each thread has its own stream, writing
+// into cout's buffer unless the library points it at a CaptureBuf.
+static thread_local ostream OUT(cout.rdbuf());
+
+/* ---------- statement outcome ----------
+  A message saying the statement didn't do its work goes out through
+  fail(), which records why (the first reason wins) for ResultSet::error()
+  and QueryStatus. Statements that change rows leave the count in
+  STMT_AFFECTED. run_captured clears both before each statement.
+*/
+using saaddb::Error;
+static thread_local Error STMT_ERROR = Error::None;
+static thread_local uint64_t STMT_AFFECTED = 0;
+
+static ostream& fail(Error why = Error::Invalid) {
+    if (STMT_ERROR == Error::None) STMT_ERROR = why;
+    return OUT;
+}
+
+/* ---------- counters ----------
+  ALLOCATIONS counts heap allocations when the program's operator new
+  bumps saaddb::allocations (the REPL's does, see main.cpp; the library
+  leaves operator new alone and the count stays 0 otherwise). Every live
+  row a scan hands out bumps ROWS_VISITED, every row inserted, updated or
+  deleted bumps ROWS_WRITTEN and every full-scan segment counts as
+  scanned or skipped (see "zone maps"); `benchmark` reports them per query.
+*/
+std::atomic<uint64_t> saaddb::allocations{ 0 };
+static atomic<uint64_t>& ALLOCATIONS = saaddb::allocations;
+static atomic<uint64_t> ROWS_VISITED{ 0 };
+static atomic<uint64_t> ROWS_WRITTEN{ 0 };
+static atomic<uint64_t> SEGMENTS_SCANNED{ 0 };  // full-scan segments read / ruled out by zone maps
+static atomic<uint64_t> SEGMENTS_SKIPPED{ 0 };
+
+/* ---------- statement arena ----------
+  Scratch memory a statement takes and gives back row after row (index
+  keys, B-tree and bucket pages, the keys of an insert batch) comes from
+  stmt_arena(): a pool over a monotonic buffer, living as long as the
+  statement (run_locked opens it). A block given back is handed out again
+  to the next row, so a statement settles into a fixed working set, and
+  its end frees everything at once. The thread keeps the first
+  ARENA_BYTES between statements; a statement that fits in them doesn't
+  call operator new for its scratch at all. Threads outside a statement
+  (pool workers, recovery) get the heap. Nothing allocated here may
+  outlive the statement or cross to another thread: row versions and undo
+  images stay on the heap.
+*/
+static const size_t ARENA_BYTES = 1u << 20;
+
+static thread_local pmr::memory_resource* STMT_ARENA = nullptr;
+
+static pmr::memory_resource* stmt_arena() { return STMT_ARENA ? STMT_ARENA : pmr::new_delete_resource(); }
+
+struct StatementArena {
+    optional<pmr::monotonic_buffer_resource> mono;
+    optional<pmr::unsynchronized_pool_resource> pool;
+
+    // Inside another statement's arena: share it.
+    StatementArena() {
+        if (STMT_ARENA) return;
+        static thread_local unique_ptr<char[]> first(new char[ARENA_BYTES]);
+        mono.emplace(first.get(), ARENA_BYTES);
+        pool.emplace(pmr::pool_options{ 0, 16u << 10 }, &*mono);
+        STMT_ARENA = &*pool;
+    }
+    ~StatementArena() { if (pool) STMT_ARENA = nullptr; }
+    StatementArena(const StatementArena&) = delete;
+    StatementArena& operator=(const StatementArena&) = delete;
+};
+
+/* ---------- profiling ----------
+  explain / explain analyze and `set timing on;`. An operator opens a
+  ProfileSpan and, only when PROFILE is set, begin()s it with what it is
+  about to do, so with profiling off a span costs a branch and a row
+  counter. Spans opened while another is open nest under it, which makes
+  the list of spans the plan tree. Under explain analyze each span also
+  records the wall time and counter deltas of its lifetime; operators are
+  pipelined, so that time includes the per-row work of the operators its
+  rows flow into. Schema lookups happen while planning, before any span,
+  so explain analyze reports them for the whole statement. Plain explain runs the statement with dryRun set:
+  operators begin their span and return before reading any rows.
+*/
+static atomic<uint64_t> BYTES_READ{ 0 };         // table data read by scans and row fetches
+static atomic<uint64_t> SCHEMA_LOOKUPS{ 0 };     // catalog lookups by table name
+
+struct OpProfile {
+    string name, detail;
+    int depth = 0;
+    double secs = 0;
+    uint64_t rowsRead = 0, rowsOut = 0, bytesRead = 0, allocs = 0;
+};
+
+struct QueryProfile {
+    bool dryRun = false;
+    int depth = 0;
+    vector<OpProfile> ops;
+};
+
+// Per thread: each is about the statement running on it (see "statement locks").
+static thread_local QueryProfile* PROFILE = nullptr;
+static thread_local bool TIMING = false;                            // set timing on|off; (the session's)
+static thread_local chrono::steady_clock::time_point STMT_PLANNED;  // when the running statement finished planning
+
+static bool dry_run() { return PROFILE && PROFILE->dryRun; }
+
+// Statements call this where planning ends and rows start to flow.
+static void mark_planned() { if (TIMING) STMT_PLANNED = chrono::steady_clock::now(); }
+
+struct ProfileSpan {
+    uint64_t out = 0;       // rows the operator passed on
+    int at = -1;
+    chrono::steady_clock::time_point t0;
+    uint64_t rows0 = 0, bytes0 = 0, allocs0 = 0;
+
+    ProfileSpan() = default;
+    ProfileSpan(const ProfileSpan&) = delete;
+    ProfileSpan& operator=(const ProfileSpan&) = delete;
+    ~ProfileSpan() { if (at >= 0) end(); }
+
+    void begin(string name, string detail) {
+        OpProfile op;
+        op.name = move(name);
+        op.detail = move(detail);
+        op.depth = PROFILE->depth++;
+        at = (int)PROFILE->ops.size();
+        PROFILE->ops.push_back(move(op));
+        rows0 = ROWS_VISITED.load();
+        bytes0 = BYTES_READ.load();
+        allocs0 = ALLOCATIONS.load();
+        t0 = chrono::steady_clock::now();
+    }
+
+    // Adds to the span's description (e.g. a spill decided while running).
+    void note(const string& s) { if (at >= 0) PROFILE->ops[at].detail += s; }
+
+    void end() {
+        OpProfile& op = PROFILE->ops[at];
+        op.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        op.allocs = ALLOCATIONS.load() - allocs0;
+        op.rowsRead = ROWS_VISITED.load() - rows0;
+        op.bytesRead = BYTES_READ.load() - bytes0;
+        op.rowsOut = out;
+        --PROFILE->depth;
+        at = -1;
+    }
+};
+
+static void print_profile(const QueryProfile& qp, bool analyze) {
+    for (const OpProfile& op : qp.ops) {
+        OUT << string(2 + 2 * op.depth, ' ') << op.name;
+        if (!op.detail.empty()) OUT << ": " << op.detail;
+        if (analyze) {
+            char line[160];
+            snprintf(line, sizeof line, "  (%.3f ms, %llu rows read, %llu out, %.1f KB read, %llu allocations)",
+                op.secs * 1e3, (unsigned long long)op.rowsRead, (unsigned long long)op.rowsOut, op.bytesRead / 1024.0,
+                (unsigned long long)op.allocs);
+            OUT << line;
+        }
+        OUT << "\n";
+    }
+}
+
+// One token of a statement: its text, and how it was written. The flags
+// travel with the text, so a slice or copy of the tokens (explain,
+// benchmark, a prepared statement, a join's WHERE) keeps them.
+struct Token : string {
+    bool quoted = false;    // written "in quotes": a value, never a keyword or ?
+    int group = -1;         // which (...) group it sits in, -1 outside parentheses
+
+    Token() = default;
+    Token(string text, bool q = false, int g = -1) : string(move(text)), quoted(q), group(g) {}
+    Token(const char* text) : string(text) {}
+};
+typedef vector<Token> Tokens;
+
+static thread_local Tokens TOKENS;
+
+// Whether token t spells keyword word (lowercase) in any case. Tokens keep
+// the case they were written in, so identifiers that spell a keyword do too.
+static bool is_kw(const string& t, const char* word) {
+    size_t i = 0;
+    for (; i < t.size() && word[i]; ++i) if (tolower((unsigned char)t[i]) != word[i]) return false;
+    return i == t.size() && !word[i];
+}
+
+static string lowered(string t) {
+    for (char& c : t) c = (char)tolower((unsigned char)c);
+    return t;
+}
+
+// First position >= from of keyword word in T, skipping values that spell it; T.size() if none.
+static int keyword_pos(const Tokens& T, const char* word, int from = 0) {
+    for (int i = from; i < (int)T.size(); ++i) if (is_kw(T[i], word) && !T[i].quoted) return i;
+    return (int)T.size();
+}
+
+
+static inline string trim(const string& s) {
+    size_t i = 0, j = s.size();
+    while (i < j && isspace((unsigned char)s[i])) ++i;
+    while (j > i && isspace((unsigned char)s[j - 1])) --j;
+    return s.substr(i, j - i);
+}
+static inline void trim_in_place(string& s) {
+    size_t j = s.size();
+    while (j && isspace((unsigned char)s[j - 1])) --j;
+    s.erase(j);
+    size_t i = 0;
+    while (i < s.size() && isspace((unsigned char)s[i])) ++i;
+    s.erase(0, i);
+}
+static inline bool starts_with(const string& s, char c) { return !s.empty() && s.front() == c; }
+static inline bool ends_with(const string& s, char c) { return !s.empty() && s.back() == c; }
+
+static bool safe_getline(ifstream& f, string& out) {
+    out.clear();
+    return static_cast<bool>(std::getline(f, out));
+}
+
+static bool is_integer(const string& s) {
+    if (s.empty()) return false;
+    size_t i = 0; if (s[0] == '+' || s[0] == '-') i = 1;
+    if (i >= s.size()) return false;
+    for (; i < s.size(); ++i) if (!isdigit((unsigned char)s[i])) return false;
+    return true;
+}
+static bool is_number(const string& s) {
+
+    if (s.empty()) return false;
+    bool dot = false; size_t i = 0;
+    if (s[0] == '+' || s[0] == '-') i = 1;
+    if (i >= s.size()) return false;
+    for (; i < s.size(); ++i) {
+        if (s[i] == '.') { if (dot) return false; dot = true; }
+        else if (!isdigit((unsigned char)s[i])) return false;
+    }
+    return true;
+}
+
+static bool is_date_token(const string& s) {
+
+
+
+    if (s.size() != 10) return false;
+    return isdigit(s[0]) && isdigit(s[1]) && s[2] == '-' &&
+        isdigit(s[3]) && isdigit(s[4]) && s[5] == '-' &&
+        isdigit(s[6]) && isdigit(s[7]) && isdigit(s[8]) && isdigit(s[9]);
+}
+
+// Splits <v1,...,vn> into res, reusing the strings already in it.
+static void split_csv_inside_tuple(const string& tupleLine, vector<string>& res) {
+    size_t n = 0;
+    auto field = [&](size_t from, size_t to) {
+        if (n == res.size()) res.emplace_back();
+        res[n++].assign(tupleLine, from, to - from);
+    };
+    if (tupleLine.size() >= 2 && tupleLine.front() == '<' && tupleLine.back() == '>') {
+        size_t from = 1, end = tupleLine.size() - 1;
+        for (size_t i = from; i < end; ++i)
+            if (tupleLine[i] == ',') { field(from, i); from = i + 1; }
+        if (from < end) field(from, end);
+    }
+    res.resize(n);
+}
+
+// Writes <v1,...,vn> into s, reusing its buffer.
+static void join_csv_tuple(const vector<string>& vals, string& s) {
+    s.assign(1, '<');
+    for (size_t i = 0; i < vals.size(); ++i) {
+        s += vals[i];
+        if (i + 1 < vals.size()) s += ',';
+    }
+    s += '>';
+}
+
+static bool file_exists(const string& path) {
+    ifstream f(path);
+    return f.good();
+}
+
+
+/* ---------- catalog ----------
+  SaadSchema.txt is parsed once at startup into CATALOG; lookups never touch
+  the file again. Only DDL (create/drop) writes the schema file back.
+  A table whose primary key names none of its columns, or that declares a
+  column twice, is refused at load: it stays out of CATALOG, so every
+  TableDef there has a valid pkIndex, and its block is written back as is.
+*/
+enum ColKind : uint8_t { COL_INT, COL_VARCHAR, COL_DATE, COL_DECIMAL };
+
+struct ColumnDef {
+    string name;
+    string type;            // int | varchar | date | decimal
+    ColKind kind = COL_INT;
+    int length = 0;         // varchar N
+    int precision = 0;      // decimal P
+    int scale = 0;          // decimal S
+    string check;           // raw CHECK clause (without the keyword), if any
+};
+
+struct IndexDef {
+    string name;
+    string column;
+    string kind;            // hash | btree
+    int col = -1;
+};
+
+struct TableDef {
+    string name;
+    string pk;
+    int pkIndex = -1;
+    vector<ColumnDef> cols;
+    vector<IndexDef> indexes;
+    vector<string> attrs;   // column names, in declaration order
+    vector<string> types;   // column types, parallel to attrs
+    // binary row layout, derived from cols (see "paged table storage")
+    vector<uint32_t> offsets;
+    uint32_t rowSize = 0;
+    uint32_t rowsPerPage = 0;
+    bool columnar = false;  // "storage: columnar" (see "columnar storage")
+    vector<string> bloom;   // "bloom: a b": columns with zone Bloom filters (see "zone maps")
+    vector<int> bloomCols;  // their indexes in cols
+};
+
+static unordered_map<string, TableDef> CATALOG;
+static vector<string> CATALOG_ORDER;   // tables in schema-file order
+static uint64_t CATALOG_VERSION = 0;   // bumped on every schema change; cached plans check it
+static vector<TableDef> REFUSED_TABLES; // schema-file tables load_catalog refused
+
+static string column_line(const ColumnDef& c) {
+    ostringstream ln; ln << c.name << " " << c.type;
+    if (c.type == "varchar") ln << " " << c.length;
+    else if (c.type == "decimal") ln << " " << c.precision << " " << c.scale;
+    if (!c.check.empty()) ln << " check " << c.check;
+    return ln.str();
+}
+
+static bool parse_column_line(const string& line, ColumnDef& c) {
+    istringstream ss(line);
+    if (!(ss >> c.name >> c.type)) return false;
+    if (c.type == "varchar") c.kind = COL_VARCHAR;
+    else if (c.type == "date") c.kind = COL_DATE;
+    else if (c.type == "decimal") c.kind = COL_DECIMAL;
+    else c.kind = COL_INT;
+    if (c.type == "varchar") ss >> c.length;
+    else if (c.type == "decimal") ss >> c.precision >> c.scale;
+    string kw;
+    if (ss >> kw && kw == "check") {
+        getline(ss, c.check);
+        c.check = trim(c.check);
+    }
+    return true;
+}
+
+static const uint32_t PAGE_SIZE = 4096;
+static const uint32_t PAGE_HEADER = 8;
+static const uint32_t MAX_ROW_SIZE = PAGE_SIZE - PAGE_HEADER;   // a row table's row, status byte included
+
+static uint32_t column_width(const ColumnDef& c) {
+    switch (c.kind) {
+    case COL_INT:     return 8;
+    case COL_DATE:    return 4;
+    case COL_DECIMAL: return 8;
+    case COL_VARCHAR: return 2 + (uint32_t)max(c.length, 0);
+    }
+    return 0;
+}
+
+static void finish_table_def(TableDef& def) {
+    def.attrs.clear(); def.types.clear(); def.offsets.clear();
+    uint32_t off = 1; // status byte
+    for (const auto& c : def.cols) {
+        def.attrs.push_back(c.name); def.types.push_back(c.type);
+        def.offsets.push_back(off);
+        off += column_width(c);
+    }
+    def.rowSize = off;
+    def.rowsPerPage = MAX_ROW_SIZE / def.rowSize;
+    for (auto& ix : def.indexes) {
+        auto it = find(def.attrs.begin(), def.attrs.end(), ix.column);
+        ix.col = it == def.attrs.end() ? -1 : (int)(it - def.attrs.begin());
+    }
+    def.bloomCols.clear();
+    for (const auto& b : def.bloom) {
+        auto it = find(def.attrs.begin(), def.attrs.end(), b);
+        if (it != def.attrs.end()) def.bloomCols.push_back((int)(it - def.attrs.begin()));
+    }
+    auto it = find(def.attrs.begin(), def.attrs.end(), def.pk);
+    def.pkIndex = it == def.attrs.end() ? -1 : (int)(it - def.attrs.begin());
+}
+
+static vector<string> table_block_lines(const TableDef& def) {
+    vector<string> blk;
+    blk.push_back("*" + def.name + "*");
+    blk.push_back("<<");
+    blk.push_back("pk: " + def.pk);
+    if (def.columnar) blk.push_back("storage: columnar");
+    if (!def.bloom.empty()) {
+        string ln = "bloom:";
+        for (const auto& b : def.bloom) ln += " " + b;
+        blk.push_back(ln);
+    }
+    for (const auto& c : def.cols) blk.push_back(column_line(c));
+    for (const auto& ix : def.indexes) blk.push_back("index: " + ix.name + " " + ix.column + " " + ix.kind);
+    blk.push_back(">>");
+    return blk;
+}
+
+static void catalog_put(TableDef def) {
+    ++CATALOG_VERSION;
+    finish_table_def(def);
+    if (!CATALOG.count(def.name)) CATALOG_ORDER.push_back(def.name);
+    CATALOG[def.name] = move(def);
+}
+
+static void catalog_erase(const string& table) {
+    ++CATALOG_VERSION;
+    CATALOG.erase(table);
+    CATALOG_ORDER.erase(remove(CATALOG_ORDER.begin(), CATALOG_ORDER.end(), table), CATALOG_ORDER.end());
+}
+
+// Why def can't be used as a table, or "" if it can.
+static string table_def_error(const TableDef& def) {
+    if (def.cols.empty()) return "no columns";
+    for (size_t i = 0; i < def.cols.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (def.cols[i].name == def.cols[j].name) return "column " + def.cols[i].name + " declared twice";
+        }
+    }
+    if (def.pkIndex < 0) return "primary key " + def.pk + " is not one of its columns";
+    return "";
+}
+
+static void load_catalog() {
+    ++CATALOG_VERSION;
+    CATALOG.clear(); CATALOG_ORDER.clear(); REFUSED_TABLES.clear();
+    ifstream in(SCHEMA_FILE);
+    if (!in) return;
+    string line;
+    TableDef cur;
+    bool inTable = false, inBlock = false;
+    while (safe_getline(in, line)) {
+        string t = trim(line);
+        if (!inTable) {
+            if (starts_with(t, '*') && ends_with(t, '*') && t.size() >= 2) {
+                cur = TableDef();
+                cur.name = t.substr(1, t.size() - 2);
+                inTable = true; inBlock = false;
+            }
+            continue;
+        }
+        if (t == "<<") { inBlock = true; continue; }
+        if (t == ">>") {
+            finish_table_def(cur);
+            string why = table_def_error(cur);
+            if (why.empty()) catalog_put(cur);
+            else {
+                OUT << "[SaadDB] Table <" << cur.name << "> refused: " << why << ". Fix it in " << SCHEMA_FILE << ".\n";
+                REFUSED_TABLES.push_back(cur);
+            }
+            inTable = false; continue;
+        }
+        if (!inBlock || t.empty()) continue;
+        if (t.rfind("pk:", 0) == 0) { cur.pk = trim(t.substr(3)); continue; }
+        if (t.rfind("storage:", 0) == 0) { cur.columnar = trim(t.substr(8)) == "columnar"; continue; }
+        if (t.rfind("bloom:", 0) == 0) {
+            istringstream ss(t.substr(6));
+            string b;
+            while (ss >> b) cur.bloom.push_back(b);
+            continue;
+        }
+        if (t.rfind("index:", 0) == 0) {
+            IndexDef ix;
+            istringstream ss(t.substr(6));
+            if (ss >> ix.name >> ix.column >> ix.kind) cur.indexes.push_back(ix);
+            continue;
+        }
+        ColumnDef c;
+        if (parse_column_line(t, c)) cur.cols.push_back(c);
+    }
+}
+
+static bool save_catalog() {
+    ++CATALOG_VERSION;
+    ofstream out(SCHEMA_FILE, ios::trunc);
+    if (!out) return false;
+    for (const auto& name : CATALOG_ORDER) {
+        for (const auto& ln : table_block_lines(CATALOG.at(name))) out << ln << "\n";
+        out << "\n";
+    }
+    for (const auto& def : REFUSED_TABLES) {
+        for (const auto& ln : table_block_lines(def)) out << ln << "\n";
+        out << "\n";
+    }
+    return true;
+}
+
+static const TableDef* lookup_table(const string& table) {
+    SCHEMA_LOOKUPS.fetch_add(1, memory_order_relaxed);
+    auto it = CATALOG.find(table);
+    return it == CATALOG.end() ? nullptr : &it->second;
+}
+
+static bool table_exists(const string& table) {
+    SCHEMA_LOOKUPS.fetch_add(1, memory_order_relaxed);
+    return CATALOG.count(table) != 0;
+}
+
+static bool append_table_schema(const TableDef& def) {
+    ofstream out(SCHEMA_FILE, ios::app);
+    if (!out) return false;
+    for (const auto& ln : table_block_lines(def)) out << ln << "\n";
+    out << "\n";
+    return true;
+}
+
+
+static int column_index(const TableDef& def, const string& col) {
+    auto it = find(def.attrs.begin(), def.attrs.end(), col);
+    if (it != def.attrs.end()) return (int)(it - def.attrs.begin());
+    // the columns of a joined row are named table.col; a bare name does when only one table has it
+    int found = -1;
+    for (size_t k = 0; k < def.attrs.size(); ++k) {
+        const string& a = def.attrs[k];
+        if (a.size() <= col.size() || a[a.size() - col.size() - 1] != '.' || a.compare(a.size() - col.size(), col.size(), col)) continue;
+        if (found >= 0) return -1;
+        found = (int)k;
+    }
+    return found;
+}
+
+// Why column_index found no col in def.
+static string column_error(const TableDef& def, const string& col) {
+    int n = 0;
+    for (const auto& a : def.attrs)
+        n += a.size() > col.size() && a[a.size() - col.size() - 1] == '.' && !a.compare(a.size() - col.size(), col.size(), col);
+    return n > 1 ? "Column " + col + " is ambiguous; write table." + col : "Unknown column " + col;
+}
+
+/* ---------- typed values ----------
+  Text <-> binary field encoding. Values are parsed once on the way in
+  (insert/update/import) and formatted once on the way out (select/export).
+*/
+static bool parse_int64(const string& s, int64_t& out) {
+    if (!is_integer(s)) return false;
+    errno = 0;
+    long long v = strtoll(s.c_str(), nullptr, 10);
+    if (errno == ERANGE) return false;
+    out = v;
+    return true;
+}
+
+// days since 01-01-1970 for a proleptic Gregorian date (H. Hinnant's algorithm)
+static int32_t days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int32_t z, int& y, int& m, int& d) {
+    z += 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp + (mp < 10 ? 3 : -9);
+    y = yoe + era * 400 + (m <= 2);
+}
+
+static bool parse_date(const string& s, int32_t& out) {
+    if (!is_date_token(s)) return false;
+    int d = (s[0] - '0') * 10 + (s[1] - '0');
+    int m = (s[3] - '0') * 10 + (s[4] - '0');
+    int y = stoi(s.substr(6, 4));
+    static const int mdays[] = { 31,28,31,30,31,30,31,31,30,31,30,31 };
+    if (m < 1 || m > 12 || d < 1) return false;
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > mdays[m - 1] + (m == 2 && leap)) return false;
+    out = days_from_civil(y, m, d);
+    return true;
+}
+
+static const int64_t POW10[] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL
+};
+
+// "123.456" with scale 2 -> 12346 (rounded half away from zero); at most P-S integer digits
+static bool parse_decimal(const string& s, int precision, int scale, int64_t& out) {
+    if (!is_number(s)) return false;
+    size_t i = 0; bool neg = false;
+    if (s[0] == '+' || s[0] == '-') { neg = s[0] == '-'; i = 1; }
+    int64_t whole = 0; int intDigits = 0;
+    for (; i < s.size() && s[i] != '.'; ++i) {
+        if (intDigits == 0 && s[i] == '0') continue;
+        if (++intDigits > precision - scale) return false;
+        whole = whole * 10 + (s[i] - '0');
+    }
+    int64_t frac = 0; int fracDigits = 0; bool roundUp = false;
+    if (i < s.size()) {
+        for (++i; i < s.size(); ++i) {
+            if (fracDigits < scale) { frac = frac * 10 + (s[i] - '0'); ++fracDigits; }
+            else { roundUp = s[i] >= '5'; break; }
+        }
+    }
+    frac *= POW10[scale - fracDigits];
+    int64_t v = whole * POW10[scale] + frac + (roundUp ? 1 : 0);
+    if (v >= POW10[precision]) return false;
+    out = neg ? -v : v;
+    return true;
+}
+
+// Encodes one text value into its fixed-width field; false if it doesn't fit the column type.
+static bool encode_field(const ColumnDef& c, const string& v, uint8_t* dst) {
+    switch (c.kind) {
+    case COL_INT: {
+        int64_t x; if (!parse_int64(v, x)) return false;
+        memcpy(dst, &x, 8); return true;
+    }
+    case COL_DATE: {
+        int32_t x; if (!parse_date(v, x)) return false;
+        memcpy(dst, &x, 4); return true;
+    }
+    case COL_DECIMAL: {
+        int64_t x; if (!parse_decimal(v, c.precision, c.scale, x)) return false;
+        memcpy(dst, &x, 8); return true;
+    }
+    case COL_VARCHAR: {
+        if ((int)v.size() > c.length) return false;
+        uint16_t n = (uint16_t)v.size();
+        memcpy(dst, &n, 2);
+        memcpy(dst + 2, v.data(), n);
+        memset(dst + 2 + n, 0, c.length - n);
+        return true;
+    }
+    }
+    return false;
+}
+
+// int, decimal (scaled) and date (days) fields as one signed integer
+static int64_t decode_num(const ColumnDef& c, const uint8_t* p) {
+    if (c.kind == COL_DATE) { int32_t x; memcpy(&x, p, 4); return x; }
+    int64_t x; memcpy(&x, p, 8); return x;
+}
+
+static int64_t field_num(const TableDef& def, const uint8_t* rec, int col) {
+    return decode_num(def.cols[col], rec + def.offsets[col]);
+}
+
+static string_view field_str(const TableDef& def, const uint8_t* rec, int col) {
+    const uint8_t* p = rec + def.offsets[col];
+    uint16_t n; memcpy(&n, p, 2);
+    return string_view((const char*)p + 2, n);
+}
+
+// Text of field col without touching the heap: numbers are formatted into buf
+// (FIELD_BUF bytes), a varchar is viewed in place inside rec.
+static const size_t FIELD_BUF = 48;
+
+// v / 10^scale in plain decimal notation, formatted into buf (FIELD_BUF bytes).
+static string_view format_scaled(__int128 v, int scale, char* buf) {
+    // digits of |v| right to left, the decimal point after scale of them
+    unsigned __int128 a = v < 0 ? 0 - (unsigned __int128)v : (unsigned __int128)v;
+    char* end = buf + FIELD_BUF;
+    char* p = end;
+    for (int i = 0; i < scale; ++i) { *--p = char('0' + (int)(a % 10)); a /= 10; }
+    if (scale > 0) *--p = '.';
+    do { *--p = char('0' + (int)(a % 10)); a /= 10; } while (a);
+    if (v < 0) *--p = '-';
+    return string_view(p, (size_t)(end - p));
+}
+
+static string_view field_view(const TableDef& def, const uint8_t* rec, int col, char* buf) {
+    const ColumnDef& c = def.cols[col];
+    if (c.kind == COL_VARCHAR) return field_str(def, rec, col);
+    int64_t v = field_num(def, rec, col);
+    if (c.kind == COL_DATE) {
+        int y, m, d; civil_from_days((int32_t)v, y, m, d);
+        int n = snprintf(buf, FIELD_BUF, "%02d-%02d-%04d", d, m, y);
+        return string_view(buf, (size_t)n);
+    }
+    return format_scaled(v, c.kind == COL_DECIMAL ? c.scale : 0, buf);
+}
+
+/* ---------- result rows ----------
+  A select hands its rows to ROW_SINK as typed values (saaddb::Row), one
+  reused Row per select so a row costs no allocations once the strings have
+  grown. With no sink (benchmark, explain analyze) rows are never built.
+*/
+struct RowSink {
+    virtual ~RowSink() = default;
+    virtual void columns(const vector<saaddb::Column>& cols) = 0;  // before the first row
+    virtual bool row(const saaddb::Row& r) = 0;                      // false ends the select
+};
+static thread_local RowSink* ROW_SINK = nullptr;
+
+static saaddb::Type column_type(const ColumnDef& c) {
+    switch (c.kind) {
+    case COL_INT: return saaddb::Type::Int;
+    case COL_DATE: return saaddb::Type::Date;
+    case COL_DECIMAL: return saaddb::Type::Decimal;
+    case COL_VARCHAR: return saaddb::Type::Varchar;
+    }
+    return saaddb::Type::Null;
+}
+
+static saaddb::Column column_info(const ColumnDef& c) {
+    saaddb::Column out;
+    out.name = c.name;
+    out.type = column_type(c);
+    out.scale = c.kind == COL_DECIMAL ? c.scale : 0;
+    return out;
+}
+
+static void field_value(const TableDef& def, const uint8_t* rec, int col, saaddb::Value& v) {
+    const ColumnDef& c = def.cols[col];
+    v.type = column_type(c);
+    v.scale = c.kind == COL_DECIMAL ? c.scale : 0;
+    if (c.kind == COL_VARCHAR) { string_view s = field_str(def, rec, col); v.str.assign(s.data(), s.size()); v.num = 0; }
+    else { v.num = field_num(def, rec, col); v.str.clear(); }
+}
+
+/* ---------- paged table storage ----------
+  <Table>.sdb is a sequence of PAGE_SIZE pages:
+    page 0  : file header (magic "SDBP", version, page size, row size, column count)
+    page 1..: data pages: PageHeader, then rowsPerPage fixed-width row slots
+  A slot is one status byte (ROW_FREE / ROW_LIVE) followed by the columns in
+  schema order:
+    int        int64
+    date       int32, days since 01-01-1970
+    decimal    int64, value scaled by 10^S
+    varchar N  uint16 length + N bytes (zero padded)
+  Slots keep their position for the life of the file, so a row id (rid) is
+  simply the slot ordinal: page 1 + rid / rowsPerPage, slot rid % rowsPerPage.
+*/
+static const char SDB_MAGIC[4] = { 'S','D','B','P' };
+static const uint32_t SDB_VERSION = 1;
+enum : uint8_t { ROW_FREE = 0, ROW_LIVE = 1 };
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version, pageSize, rowSize, ncols;
+};
+
+struct PageHeader {
+    uint32_t used;  // slots handed out on this page
+    uint32_t live;  // slots currently ROW_LIVE
+};
+
+static string table_path(const string& table) { return data_path(table + ".sdb"); }
+
+static inline uint8_t* slot_ptr(const TableDef& def, uint8_t* page, uint32_t slot) {
+    return page + PAGE_HEADER + (size_t)slot * def.rowSize;
+}
+static inline const uint8_t* slot_ptr(const TableDef& def, const uint8_t* page, uint32_t slot) {
+    return page + PAGE_HEADER + (size_t)slot * def.rowSize;
+}
+
+/* ---------- write-ahead log ----------
+  SaadDB.wal is an append-only log shared by all tables. Every row change
+  is logged here before its data page is overwritten in place:
+    WalRecord, table name, images
+  with the row's new image for an insert, its old image for a delete and
+  both (old, then new) for an update, so a change can be redone and undone.
+  Each record carries the transaction that made it; WAL_COMMIT ends a
+  transaction and WAL_ABORT one whose changes were rolled back (they are
+  undone by later records of the same transaction).
+  The first record for a table after a checkpoint is WAL_TOUCH, written at
+  once, so every table whose files changed since the last checkpoint is in
+  the log before any of its index pages are written.
+  Checkpoint: fsync the touched tables' data and index files, then truncate
+  the log. Recovery (startup): replay every intact record into the data
+  files, undo the changes of transactions that neither committed nor
+  aborted (newest first), drop the touched tables' indexes (rebuilt on next
+  open), checkpoint.
+  A bulk load writes its pages without row records; a WAL_LOAD with no
+  matching WAL_LOAD_DONE makes recovery cut the table back to where it began.
+  Compaction moves rows to new rids: recovery finishes a WAL_COMPACT's file
+  swap and drops the table's records before it.
+  Syncs are shared (group commit): a session that needs the log on disk
+  waits while another one is in fdatasync, then syncs everything appended
+  since in one go for itself and everyone who queued meanwhile. How long a
+  commit waits is `set synchronous` (see SyncLevel).
+*/
+static string WAL_FILE = "SaadDB.wal";
+static const uint64_t WAL_CHECKPOINT_BYTES = 16u << 20;
+enum WalType : uint8_t {
+    WAL_TOUCH = 1, WAL_INSERT = 2, WAL_UPDATE = 3, WAL_DELETE = 4,
+    WAL_LOAD = 5,       // bulk load starts appending unlogged rows at rid
+    WAL_LOAD_DONE = 6,  // ... and its pages are durable
+    WAL_COMMIT = 7, WAL_ABORT = 8,  // no table, no image
+    WAL_COMPACT = 9     // the table was rewritten (see "compaction"): its earlier records are void
+};
+
+struct WalRecord {
+    uint32_t size;      // whole record, this header included
+    uint32_t sum;       // FNV-1a over everything after this field
+    uint8_t type;
+    uint8_t pad;
+    uint16_t nameLen;
+    uint32_t imageLen;
+    uint64_t rid;
+    uint64_t txn;       // 0: not part of a transaction (touch, recovery)
+};
+
+// set synchronous full|normal|off, per session:
+//   full    commit returns once its records are on stable storage, and the
+//           log is synced before any data page it describes is written
+//   normal  commit returns once its records are written to the log file:
+//           safe if saaddb crashes, a power failure loses recent commits
+//           (or, rarely, leaves part of one on disk)
+//   off     records wait in memory until pages or a later commit need
+//           them: a crash of saaddb can lose the last commits too, but
+//           never leaves a change without its log record
+enum SyncLevel { SYNC_OFF = 0, SYNC_NORMAL = 1, SYNC_FULL = 2 };
+static thread_local int SYNCHRONOUS = SYNC_FULL;
+
+// set commit_window N: microseconds a session about to sync the log waits
+// first, so commits of other writing transactions can join the same sync.
+static atomic<unsigned> COMMIT_WINDOW_US{ 0 };
+static atomic<int> WRITING_TXNS{ 0 };   // transactions with logged changes, not yet ended
+
+// A row image as it was before a change of an open transaction.
+struct UndoRecord {
+    uint8_t type;               // the change: WAL_INSERT / WAL_UPDATE / WAL_DELETE
+    uint64_t rid;
+    vector<uint8_t> before;     // empty for an insert
+};
+
+class RwLock;
+struct TxnState;
+
+// One transaction: a statement on its own, or begin ... commit (see
+// "transactions"). TXN is the one the running statement belongs to.
+struct Transaction {
+    uint64_t id = 0;
+    bool open = false;          // begin ... commit: spans statements and keeps undo records
+    bool wrote = false;         // has logged row changes
+    bool undoing = false;       // rolling back: its changes aren't recorded again
+    uint64_t endPos = 0;        // log position after its commit / abort record, 0 before
+    RwLock* engine = nullptr;   // held shared until the end (open transactions)
+    set<RwLock*> locks;         // row locks held exclusive until the end
+    map<string, vector<UndoRecord>> undo;   // per table, oldest first
+    shared_ptr<TxnState> state; // how it ended, for the row versions it left
+    uint64_t snapshot = 0;      // END_SEQ its reads see (see "row versions")
+    bool reading = false;       // has a snapshot registered in SNAPSHOTS
+};
+static thread_local Transaction* TXN = nullptr;
+static atomic<uint64_t> NEXT_TXN{ 1 };
+
+struct WalState {
+    int fd = -1;
+    uint64_t size = 0;          // bytes in the file
+    string pending;             // records not yet written
+    set<string> touched;        // tables changed since the last checkpoint
+    // positions count every byte ever appended, across checkpoints
+    uint64_t appended = 0;      // end of pending
+    uint64_t written = 0;       // end of what the file has
+    uint64_t synced = 0;        // end of what is on stable storage
+    bool syncing = false;       // a session is in fdatasync for everyone
+};
+static WalState WAL;
+static mutex WAL_MUTEX;         // sessions log concurrently; held per call, never across a sync
+static condition_variable WAL_SYNCED;
+
+static uint32_t fnv1a32(const uint8_t* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
+// Writes the pending records to the file (WAL_MUTEX held). What a failed
+// call did write leaves pending, so the next call goes on after it.
+static bool wal_write_locked() {
+    size_t done = 0;
+    bool ok = true;
+    while (done < WAL.pending.size()) {
+        ssize_t n = write(WAL.fd, WAL.pending.data() + done, WAL.pending.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { ok = false; break; }
+        done += (size_t)n;
+    }
+    WAL.size += done;
+    WAL.pending.erase(0, done);
+    WAL.written = WAL.appended - WAL.pending.size();
+    return ok;
+}
+
+// Makes the log up to position end written and, with sync, on stable
+// storage. The first session to need a sync leads: it waits the commit
+// window if other transactions are writing, writes everything pending and
+// syncs with WAL_MUTEX released; sessions arriving meanwhile wait and are
+// done if that sync covered them, else the next leader covers them.
+static bool wal_sync_to(uint64_t end, bool sync) {
+    unique_lock<mutex> lk(WAL_MUTEX);
+    if (WAL.fd < 0) return true;
+    if (!sync) return WAL.written >= end || wal_write_locked();
+    while (WAL.synced < end) {
+        if (WAL.syncing) { WAL_SYNCED.wait(lk); continue; }
+        WAL.syncing = true;
+        unsigned window = COMMIT_WINDOW_US.load(memory_order_relaxed);
+        if (window && WRITING_TXNS.load(memory_order_relaxed) > 1) {
+            lk.unlock();
+            this_thread::sleep_for(chrono::microseconds(window));
+            lk.lock();
+        }
+        bool ok = wal_write_locked();
+        uint64_t upto = WAL.written;
+        int fd = WAL.fd;
+        lk.unlock();
+        ok = ok && fdatasync(fd) == 0;
+        lk.lock();
+        WAL.syncing = false;
+        if (ok) WAL.synced = max(WAL.synced, upto);
+        WAL_SYNCED.notify_all();
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Writes the pending records; with sync they are also on stable storage on return.
+static bool wal_flush(bool sync) {
+    uint64_t end;
+    { lock_guard<mutex> lk(WAL_MUTEX); end = WAL.appended; }
+    return wal_sync_to(end, sync);
+}
+
+// Before data pages go out: the log records they depend on must be in the
+// file first, and on stable storage under synchronous full.
+static bool wal_flush_for_pages() { return wal_flush(SYNCHRONOUS == SYNC_FULL); }
+
+// Appends a record whose images are a (alen bytes) then b (blen bytes); WAL_MUTEX held.
+static void wal_append(WalType type, const string& table, uint64_t rid, uint64_t txn,
+                       const uint8_t* a, uint32_t alen, const uint8_t* b = nullptr, uint32_t blen = 0) {
+    WalRecord r{};
+    r.size = (uint32_t)(sizeof r + table.size() + alen + blen);
+    r.type = type; r.nameLen = (uint16_t)table.size(); r.imageLen = alen + blen; r.rid = rid; r.txn = txn;
+    size_t at = WAL.pending.size();
+    WAL.pending.append((const char*)&r, sizeof r);
+    WAL.pending.append(table);
+    if (alen) WAL.pending.append((const char*)a, alen);
+    if (blen) WAL.pending.append((const char*)b, blen);
+    uint8_t* rec = (uint8_t*)&WAL.pending[at];
+    uint32_t sum = fnv1a32(rec + 8, r.size - 8);
+    memcpy(rec + 4, &sum, 4);
+    WAL.appended += r.size;
+}
+
+// Records that table is about to change; written (synced under full) before returning.
+static bool wal_touch(const string& table) {
+    uint64_t end;
+    {
+        lock_guard<mutex> lk(WAL_MUTEX);
+        if (WAL.fd < 0 || WAL.touched.count(table)) return true;
+        WAL.touched.insert(table);
+        wal_append(WAL_TOUCH, table, 0, 0, nullptr, 0);
+        end = WAL.appended;
+    }
+    return wal_sync_to(end, SYNCHRONOUS == SYNC_FULL);
+}
+
+// Records that table's files are about to be replaced by the ones
+// compaction built under the name built; on stable storage on return.
+static bool wal_compact(const string& table, const string& built) {
+    uint64_t end;
+    {
+        lock_guard<mutex> lk(WAL_MUTEX);
+        if (WAL.fd < 0) return true;
+        if (WAL.touched.insert(table).second) wal_append(WAL_TOUCH, table, 0, 0, nullptr, 0);
+        wal_append(WAL_COMPACT, table, 0, 0, (const uint8_t*)built.data(), (uint32_t)built.size());
+        end = WAL.appended;
+    }
+    return wal_sync_to(end, true);
+}
+
+static void version_publish(const string& table, uint64_t rid, const uint8_t* before, uint32_t rowSize);
+
+// Logs a change of row rid in table for the running transaction. before /
+// after are the row's images (rowSize bytes) where the record keeps them;
+// the transaction also keeps before, to roll back (rollback;, or a commit
+// that can't be made durable, see txn_commit). Every change also
+// leaves the row's old image for snapshots (see "row versions"), before
+// the caller touches the row.
+static void wal_log(WalType type, const string& table, uint64_t rid,
+                    const uint8_t* before, const uint8_t* after, uint32_t rowSize) {
+    Transaction* tx = TXN;
+    bool change = type == WAL_INSERT || type == WAL_UPDATE || type == WAL_DELETE;
+    if (tx && change && !tx->undoing) {
+        UndoRecord u;
+        u.type = type; u.rid = rid;
+        if (type != WAL_INSERT) u.before.assign(before, before + rowSize);
+        tx->undo[table].push_back(move(u));
+    }
+    if (tx && change) version_publish(table, rid, type == WAL_INSERT ? nullptr : before, rowSize);
+    lock_guard<mutex> lk(WAL_MUTEX);
+    if (WAL.fd < 0) return;
+    if (tx && !tx->wrote) { tx->wrote = true; WRITING_TXNS.fetch_add(1); }
+    if (!WAL.touched.count(table)) {
+        WAL.touched.insert(table);
+        wal_append(WAL_TOUCH, table, 0, 0, nullptr, 0);
+    }
+    uint64_t txn = tx ? tx->id : 0;
+    if (type == WAL_INSERT) wal_append(type, table, rid, txn, after, rowSize);
+    else if (type == WAL_UPDATE) wal_append(type, table, rid, txn, before, rowSize, after, rowSize);
+    else if (type == WAL_DELETE) wal_append(type, table, rid, txn, before, rowSize);
+    else wal_append(type, table, rid, txn, nullptr, 0);
+}
+
+// Appends tx's WAL_COMMIT / WAL_ABORT; returns the log position after it.
+static uint64_t wal_end_txn(WalType type, const Transaction& tx) {
+    lock_guard<mutex> lk(WAL_MUTEX);
+    if (WAL.fd >= 0) wal_append(type, string(), 0, tx.id, nullptr, 0);
+    return WAL.appended;
+}
+
+// The log has grown enough to checkpoint after the running statements.
+static bool wal_due() {
+    lock_guard<mutex> lk(WAL_MUTEX);
+    return WAL.size + WAL.pending.size() >= WAL_CHECKPOINT_BYTES;
+}
+
+/* ---------- row versions ----------
+  Snapshot isolation: readers never wait for writers, nor writers for
+  readers. A select sees the rows as they were when its snapshot began:
+  the rows of every transaction that had committed by then, plus those its
+  own transaction changed. A statement on its own takes its snapshot when
+  it starts, begin; takes one for the whole transaction. Pages always
+  hold the newest image of a row, committed or not; every change first
+  leaves the image it replaces here, tagged with the transaction making
+  it, and a reader walks a row back past each change its snapshot doesn't
+  see. Transactions are numbered as they end (END_SEQ) and a snapshot is
+  the number it began at: it sees the changes of transactions that
+  committed at or before it. The vacuum thread drops versions once no
+  running snapshot can need them. None of this is logged: no snapshot
+  outlives the process.
+*/
+enum TxnStatus { TXN_RUNNING, TXN_COMMITTED, TXN_ABORTED };
+
+// How a transaction ended, shared by the versions it left behind.
+struct TxnState {
+    uint64_t id = 0;
+    atomic<int> status{ TXN_RUNNING };
+    atomic<uint64_t> seq{ 0 };      // END_SEQ it ended at
+};
+
+struct RowVersion {
+    shared_ptr<TxnState> by;        // the change that replaced this image
+    vector<uint8_t> before;         // empty: there was no row
+};
+
+struct TableVersions {
+    mutex m;
+    map<uint64_t, vector<RowVersion>> rows;     // per rid, oldest change first
+    atomic<uint64_t> changes{ 0 };              // versions ever added
+    uint64_t generation = 0;                    // table files swapped by compaction (m held)
+};
+static mutex VERSIONS_MUTEX;        // guards VERSIONS, END_SEQ and SNAPSHOTS
+static unordered_map<string, unique_ptr<TableVersions>> VERSIONS;  // never erased
+static uint64_t END_SEQ = 0;
+static multiset<uint64_t> SNAPSHOTS;    // of the transactions reading now
+// The transaction whose snapshot the running statement reads; null for
+// statements that change rows, which work on the newest ones.
+static thread_local const Transaction* READER = nullptr;
+
+static TableVersions& table_versions(const string& table) {
+    lock_guard<mutex> lk(VERSIONS_MUTEX);
+    unique_ptr<TableVersions>& v = VERSIONS[table];
+    if (!v) v.reset(new TableVersions());
+    return *v;
+}
+
+// Keeps the image of row rid (null: none) that a change of the running transaction replaces.
+static void version_publish(const string& table, uint64_t rid, const uint8_t* before, uint32_t rowSize) {
+    Transaction* tx = TXN;
+    if (!tx->state) { tx->state = make_shared<TxnState>(); tx->state->id = tx->id; }
+    RowVersion v;
+    v.by = tx->state;
+    if (before) v.before.assign(before, before + rowSize);
+    TableVersions& tv = table_versions(table);
+    lock_guard<mutex> lk(tv.m);
+    tv.rows[rid].push_back(move(v));
+    tv.changes.fetch_add(1);
+}
+
+static void snapshot_begin(Transaction& tx) {
+    lock_guard<mutex> lk(VERSIONS_MUTEX);
+    tx.snapshot = END_SEQ;
+    tx.reading = true;
+    SNAPSHOTS.insert(tx.snapshot);
+}
+
+static void snapshot_end(Transaction& tx) {
+    if (!tx.reading) return;
+    lock_guard<mutex> lk(VERSIONS_MUTEX);
+    SNAPSHOTS.erase(SNAPSHOTS.find(tx.snapshot));
+    tx.reading = false;
+}
+
+// Numbers tx's end: snapshots from now on see its changes (commit) or
+// never do (abort). Runs before tx releases its row locks.
+static void versions_end(Transaction& tx, bool commit) {
+    if (!tx.state) return;
+    lock_guard<mutex> lk(VERSIONS_MUTEX);
+    tx.state->seq.store(++END_SEQ);
+    tx.state->status.store(commit ? TXN_COMMITTED : TXN_ABORTED);
+    tx.state.reset();
+}
+
+static bool version_visible(const RowVersion& v, const Transaction& reader) {
+    if (v.by->id == reader.id) return true;
+    return v.by->status.load() == TXN_COMMITTED && v.by->seq.load() <= reader.snapshot;
+}
+
+// How one table looks to a reader's snapshot, next to its pages. Files
+// that compaction has since replaced no longer change: their pages are the
+// snapshot, and the versions (of the new files' rids) don't apply.
+struct SnapshotView {
+    TableVersions* versions = nullptr;
+    const Transaction* reader = nullptr;    // null: the pages as they are
+    uint64_t generation = 0;                // of the files this view reads
+
+    bool active() const { return reader != nullptr; }
+    bool current() const { return versions->generation == generation; }    // versions->m held
+
+    // Calls fn(rid, image) for the rows in [lo, hi) whose snapshot image
+    // isn't the one on the pages (empty where the snapshot has no row), in
+    // rid order. Call it after reading the pages: a change leaves its
+    // version before its row is written.
+    template <class F>
+    void each(uint64_t lo, uint64_t hi, F&& fn) const {
+        if (!reader) return;
+        lock_guard<mutex> lk(versions->m);
+        if (!current()) return;
+        for (auto it = versions->rows.lower_bound(lo); it != versions->rows.end() && it->first < hi; ++it) {
+            const vector<RowVersion>& chain = it->second;
+            size_t k = chain.size();
+            while (k && !version_visible(chain[k - 1], *reader)) --k;
+            if (k < chain.size()) fn(it->first, chain[k].before);
+        }
+    }
+
+    void rows(uint64_t lo, uint64_t hi, map<uint64_t, vector<uint8_t>>& out) const {
+        each(lo, hi, [&](uint64_t rid, const vector<uint8_t>& image) { out[rid] = image; });
+    }
+
+    // Whether any row in [lo, hi) has versions at all.
+    bool any(uint64_t lo, uint64_t hi) const {
+        if (!reader) return false;
+        lock_guard<mutex> lk(versions->m);
+        if (!current()) return false;
+        auto it = versions->rows.lower_bound(lo);
+        return it != versions->rows.end() && it->first < hi;
+    }
+};
+
+// The rows of a table that differ in a snapshot, for reads through an
+// index: the index holds the newest keys, so a lookup skips the rids in
+// changed and checks the snapshot images in rows (those keep() passed)
+// instead. refresh() after each lookup: it only looks again when versions
+// were added meanwhile.
+template <class K>
+struct SnapshotChanges {
+    const SnapshotView& view;
+    K keep;
+    uint64_t seen = UINT64_MAX;
+    unordered_set<uint64_t> changed;
+    map<uint64_t, vector<uint8_t>> rows;
+
+    SnapshotChanges(const SnapshotView& v, K k) : view(v), keep(k) {}
+
+    void refresh() {
+        if (!view.active()) return;
+        uint64_t n = view.versions->changes.load();
+        if (n == seen) return;
+        seen = n;
+        changed.clear();
+        rows.clear();
+        view.each(0, UINT64_MAX, [&](uint64_t rid, const vector<uint8_t>& image) {
+            changed.insert(rid);
+            if (!image.empty() && keep(image.data())) rows[rid] = image;
+        });
+    }
+};
+
+// Inside begin ... commit: whether a transaction that committed after the
+// running one's snapshot changed one of rids (saying so). Changing them now
+// would overwrite a change the transaction never saw, so the statement is
+// refused; the transaction stays open.
+static bool changed_since_snapshot(const string& table, const vector<uint64_t>& rids) {
+    const Transaction* tx = TXN;
+    if (!tx || !tx->open || !tx->reading) return false;
+    TableVersions& tv = table_versions(table);
+    lock_guard<mutex> lk(tv.m);
+    for (uint64_t rid : rids) {
+        auto it = tv.rows.find(rid);
+        if (it == tv.rows.end()) continue;
+        for (const RowVersion& v : it->second) {
+            if (v.by->id == tx->id || v.by->status.load() != TXN_COMMITTED || v.by->seq.load() <= tx->snapshot) continue;
+            fail(Error::Conflict) << "[SaadDB] <" << table << "> changed since this transaction began; statement not run, roll back and retry\n";
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops the versions every running snapshot sees past: those of
+// transactions that ended at or before the oldest snapshot (all of them
+// when nothing reads). Returns how many went.
+static size_t vacuum_versions() {
+    static atomic<uint64_t> lastHorizon{ UINT64_MAX };
+    uint64_t horizon;
+    vector<TableVersions*> tables;
+    {
+        lock_guard<mutex> lk(VERSIONS_MUTEX);
+        horizon = SNAPSHOTS.empty() ? END_SEQ : *SNAPSHOTS.begin();
+        if (horizon == lastHorizon.load()) return 0;
+        for (auto& kv : VERSIONS) tables.push_back(kv.second.get());
+    }
+    lastHorizon.store(horizon);
+    size_t dropped = 0;
+    for (TableVersions* tv : tables) {
+        lock_guard<mutex> lk(tv->m);
+        for (auto it = tv->rows.begin(); it != tv->rows.end(); ) {
+            vector<RowVersion>& chain = it->second;
+            size_t before = chain.size();
+            chain.erase(remove_if(chain.begin(), chain.end(), [&](const RowVersion& v) {
+                return v.by->status.load() != TXN_RUNNING && v.by->seq.load() <= horizon;
+            }), chain.end());
+            dropped += before - chain.size();
+            it = chain.empty() ? tv->rows.erase(it) : next(it);
+        }
+    }
+    return dropped;
+}
+
+static void compact_due();
+
+// Held while the engine starts a thread of its own, which then starts with
+// every signal blocked: SIGINT / SIGTERM go to the embedder's threads (the
+// server's signalfd) instead of killing the process from an engine thread.
+struct SignalsBlocked {
+    sigset_t saved;
+    SignalsBlocked() { sigset_t all; sigfillset(&all); pthread_sigmask(SIG_BLOCK, &all, &saved); }
+    ~SignalsBlocked() { pthread_sigmask(SIG_SETMASK, &saved, nullptr); }
+    SignalsBlocked(const SignalsBlocked&) = delete;
+    SignalsBlocked& operator=(const SignalsBlocked&) = delete;
+};
+
+// Runs vacuum_versions every VACUUM_INTERVAL while the database is open,
+// and compacts tables that need it every COMPACT_INTERVAL.
+static const chrono::milliseconds VACUUM_INTERVAL(100);
+static const chrono::milliseconds COMPACT_INTERVAL(2000);
+static thread VACUUM_THREAD;
+static mutex VACUUM_MUTEX;
+static condition_variable VACUUM_WAKE;
+static bool VACUUM_STOP = false;
+
+static void vacuum_start() {
+    VACUUM_STOP = false;
+    SignalsBlocked blocked;
+    VACUUM_THREAD = thread([] {
+        auto compactAt = chrono::steady_clock::now() + COMPACT_INTERVAL;
+        unique_lock<mutex> lk(VACUUM_MUTEX);
+        while (!VACUUM_WAKE.wait_for(lk, VACUUM_INTERVAL, [] { return VACUUM_STOP; })) {
+            lk.unlock();
+            vacuum_versions();
+            if (chrono::steady_clock::now() >= compactAt) {
+                compact_due();
+                compactAt = chrono::steady_clock::now() + COMPACT_INTERVAL;
+            }
+            lk.lock();
+        }
+    });
+}
+
+// Stops the thread and drops every version left (no session may be running).
+static void vacuum_stop() {
+    if (!VACUUM_THREAD.joinable()) return;
+    { lock_guard<mutex> lk(VACUUM_MUTEX); VACUUM_STOP = true; }
+    VACUUM_WAKE.notify_all();
+    VACUUM_THREAD.join();
+    lock_guard<mutex> lk(VERSIONS_MUTEX);
+    VERSIONS.clear();
+    SNAPSHOTS.clear();
+}
+
+/* ---------- columnar storage ----------
+  A table created with "storage columnar" keeps each column in its own file:
+    <Table>.sdb          header page (magic "SDBC"), then one status byte per rid
+    <Table>.<col>.col    one packed value per rid: int int64, date int32,
+                         decimal int64 (scaled), varchar uint64 blob offset << 16 | length
+    <Table>.<col>.blob   varchar bytes, append-only
+  Everything above the files (log records, indexes, row callbacks) still
+  sees rids and row images in the paged layout; rows are cut into columns
+  when written and assembled on the way back. Changes wait in pending as row
+  images and go out one pwrite per column run on flush. An updated varchar
+  value is appended to the blob; the old bytes stay behind.
+*/
+static const char SDB_COLUMNAR_MAGIC[4] = { 'S','D','B','C' };
+static const size_t COLUMN_BLOCK = 4096;   // rows per read while scanning
+
+static string column_path(const string& table, const string& col) { return data_path(table + "." + col + ".col"); }
+static string blob_path(const string& table, const string& col) { return data_path(table + "." + col + ".blob"); }
+static uint32_t packed_width(const ColumnDef& c) { return c.kind == COL_DATE ? 4 : 8; }
+
+static bool pread_full(int fd, void* buf, size_t n, off_t off) {
+    uint8_t* p = (uint8_t*)buf;
+    while (n) {
+        ssize_t r = pread(fd, p, n, off);
+        if (r <= 0) return false;
+        p += r; off += r; n -= (size_t)r;
+    }
+    return true;
+}
+
+static bool pwrite_full(int fd, const void* buf, size_t n, off_t off) {
+    const uint8_t* p = (const uint8_t*)buf;
+    while (n) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w <= 0) return false;
+        p += w; off += w; n -= (size_t)w;
+    }
+    return true;
+}
+
+struct ColumnStore {
+    const TableDef* def = nullptr;
+    int statusFd = -1;
+    vector<int> colFd, blobFd;              // blobFd is -1 for fixed-width columns
+    vector<uint64_t> blobEnd;
+    uint64_t stored = 0;                    // rids with a status byte on disk
+    uint64_t rows = 0;                      // rids handed out, pending appends included
+    map<uint64_t, vector<uint8_t>> pending; // row image, or only the status byte of a delete
+    static const size_t MAX_PENDING = 4096;
+
+    ColumnStore() = default;
+    ColumnStore(const ColumnStore&) = delete;
+    ColumnStore& operator=(const ColumnStore&) = delete;
+    ~ColumnStore() { close(); }
+
+    bool open(const TableDef& d, bool create) {
+        def = &d;
+        int flags = O_RDWR | O_CREAT | (create ? O_TRUNC : 0);
+        statusFd = ::open(table_path(d.name).c_str(), flags, 0644);
+        if (statusFd < 0) return false;
+        for (const auto& c : d.cols) {
+            colFd.push_back(::open(column_path(d.name, c.name).c_str(), flags, 0644));
+            if (colFd.back() < 0) return false;
+            blobFd.push_back(c.kind == COL_VARCHAR ? ::open(blob_path(d.name, c.name).c_str(), flags, 0644) : -1);
+            if (c.kind == COL_VARCHAR && blobFd.back() < 0) return false;
+            struct stat st;
+            blobEnd.push_back(blobFd.back() >= 0 && fstat(blobFd.back(), &st) == 0 ? (uint64_t)st.st_size : 0);
+        }
+        if (create) {
+            vector<uint8_t> page(PAGE_SIZE, 0);
+            FileHeader fh;
+            memcpy(fh.magic, SDB_COLUMNAR_MAGIC, 4);
+            fh.version = SDB_VERSION; fh.pageSize = PAGE_SIZE;
+            fh.rowSize = d.rowSize; fh.ncols = (uint32_t)d.cols.size();
+            memcpy(page.data(), &fh, sizeof fh);
+            return pwrite_full(statusFd, page.data(), PAGE_SIZE, 0);
+        }
+        FileHeader fh;
+        struct stat st;
+        if (!pread_full(statusFd, &fh, sizeof fh, 0) || memcmp(fh.magic, SDB_COLUMNAR_MAGIC, 4) != 0 ||
+            fh.version != SDB_VERSION || fh.rowSize != d.rowSize || fh.ncols != d.cols.size() ||
+            fstat(statusFd, &st) != 0 || (uint64_t)st.st_size < PAGE_SIZE) return false;
+        stored = rows = (uint64_t)st.st_size - PAGE_SIZE;
+        return true;
+    }
+
+    void close() {
+        if (statusFd >= 0) { flush(); ::close(statusFd); }
+        for (int fd : colFd) if (fd >= 0) ::close(fd);
+        for (int fd : blobFd) if (fd >= 0) ::close(fd);
+        statusFd = -1; colFd.clear(); blobFd.clear(); blobEnd.clear();
+        stored = rows = 0;
+        pending.clear();
+    }
+
+    bool sync() {
+        bool ok = fsync(statusFd) == 0;
+        for (int fd : colFd) ok = fsync(fd) == 0 && ok;
+        for (int fd : blobFd) if (fd >= 0) ok = fsync(fd) == 0 && ok;
+        return ok;
+    }
+
+    // n packed values of column c from rid base on (zeros past the end of the file).
+    void read_column(int c, uint64_t base, size_t n, vector<uint8_t>& out) const {
+        uint32_t w = packed_width(def->cols[c]);
+        out.assign(n * w, 0);
+        ssize_t got = pread(colFd[c], out.data(), out.size(), (off_t)(base * w));
+        (void)got;
+    }
+
+    // The blob bytes the varchar entries cover; blobBase is the file offset of blob[0].
+    void read_blob(int c, const uint64_t* entries, size_t n, string& blob, uint64_t& blobBase) const {
+        uint64_t lo = UINT64_MAX, hi = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t off = entries[i] >> 16, len = entries[i] & 0xFFFF;
+            if (!len) continue;
+            lo = min(lo, off); hi = max(hi, off + len);
+        }
+        blob.clear(); blobBase = 0;
+        if (lo >= hi) return;
+        blob.resize(hi - lo);
+        blobBase = lo;
+        if (!pread_full(blobFd[c], &blob[0], blob.size(), (off_t)lo)) blob.clear();
+    }
+
+    // Full row image of rid; false unless the row is live.
+    bool row(uint64_t rid, uint8_t* rec) const {
+        auto it = pending.find(rid);
+        if (it != pending.end() && it->second.size() == def->rowSize) {
+            memcpy(rec, it->second.data(), def->rowSize);
+            return rec[0] == ROW_LIVE;
+        }
+        if (rid >= stored) return false;
+        memset(rec, 0, def->rowSize);
+        if (!pread_full(statusFd, rec, 1, (off_t)(PAGE_SIZE + rid))) return false;
+        if (it != pending.end()) rec[0] = it->second[0];
+        if (rec[0] != ROW_LIVE) return false;
+        for (size_t c = 0; c < def->cols.size(); ++c) {
+            const ColumnDef& cd = def->cols[c];
+            uint8_t* f = rec + def->offsets[c];
+            uint32_t w = packed_width(cd);
+            if (cd.kind != COL_VARCHAR) { pread_full(colFd[c], f, w, (off_t)(rid * w)); continue; }
+            uint64_t e = 0;
+            pread_full(colFd[c], &e, 8, (off_t)(rid * 8));
+            uint16_t len = (uint16_t)min<uint64_t>(e & 0xFFFF, (uint64_t)cd.length);
+            memcpy(f, &len, 2);
+            if (len) pread_full(blobFd[c], f + 2, len, (off_t)(e >> 16));
+        }
+        return true;
+    }
+
+    // Calls fn(rec, rid) for every live row with rid >= from, in rid order,
+    // as view sees them.
+    template <class F>
+    void scan(F&& fn, uint64_t from, const SnapshotView& view) const {
+        const TableDef& d = *def;
+        vector<uint8_t> status, rec(d.rowSize);
+        map<uint64_t, vector<uint8_t>> changed;
+        vector<vector<uint8_t>> cols(d.cols.size());
+        vector<string> blobs(d.cols.size());
+        vector<uint64_t> blobBase(d.cols.size());
+        for (uint64_t base = from; base < rows; base += COLUMN_BLOCK) {
+            size_t n = (size_t)min<uint64_t>(COLUMN_BLOCK, rows - base);
+            status.assign(n, 0);
+            if (base < stored) pread_full(statusFd, status.data(), (size_t)min<uint64_t>(n, stored - base), (off_t)(PAGE_SIZE + base));
+            for (size_t c = 0; c < d.cols.size(); ++c) {
+                read_column((int)c, base, n, cols[c]);
+                if (d.cols[c].kind == COL_VARCHAR)
+                    read_blob((int)c, (const uint64_t*)cols[c].data(), n, blobs[c], blobBase[c]);
+            }
+            changed.clear();
+            view.rows(base, base + n, changed);
+            auto fix = changed.begin();
+            auto over = pending.lower_bound(base);
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t rid = base + i;
+                if (fix != changed.end() && fix->first == rid) {
+                    const vector<uint8_t>& image = (fix++)->second;
+                    if (!image.empty()) { ROWS_VISITED.fetch_add(1, memory_order_relaxed); fn(image.data(), rid); }
+                    continue;
+                }
+                while (over != pending.end() && over->first < rid) ++over;
+                if (over != pending.end() && over->first == rid) {
+                    if (over->second.size() == d.rowSize) {
+                        if (over->second[0] == ROW_LIVE) { ROWS_VISITED.fetch_add(1, memory_order_relaxed); fn(over->second.data(), rid); }
+                        continue;
+                    }
+                    status[i] = over->second[0];
+                }
+                if (status[i] != ROW_LIVE) continue;
+                ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+                rec[0] = ROW_LIVE;
+                for (size_t c = 0; c < d.cols.size(); ++c)
+                    unpack_field((int)c, cols[c].data(), i, blobs[c], blobBase[c], rec.data());
+                fn(rec.data(), rid);
+            }
+        }
+    }
+
+    // Copies value i of a column block into its field of rec.
+    void unpack_field(int c, const uint8_t* col, size_t i, const string& blob, uint64_t blobBase, uint8_t* rec) const {
+        const ColumnDef& cd = def->cols[c];
+        uint8_t* f = rec + def->offsets[c];
+        uint32_t w = packed_width(cd);
+        if (cd.kind != COL_VARCHAR) { memcpy(f, col + i * w, w); return; }
+        uint64_t e; memcpy(&e, col + i * 8, 8);
+        uint64_t off = e >> 16;
+        uint16_t len = (uint16_t)min<uint64_t>(e & 0xFFFF, (uint64_t)cd.length);
+        if (len && (off < blobBase || off + len > blobBase + blob.size())) len = 0;
+        memcpy(f, &len, 2);
+        memcpy(f + 2, blob.data() + (len ? off - blobBase : 0), len);
+        memset(f + 2 + len, 0, cd.length - len);
+    }
+
+    // Records the new image (or, for a delete, status byte) of rid; written by flush().
+    void put(uint64_t rid, const uint8_t* image, size_t len) {
+        auto& slot = pending[rid];
+        if (len == 1 && slot.size() == def->rowSize) slot[0] = image[0];
+        else slot.assign(image, image + len);
+        if (rid >= rows) rows = rid + 1;
+    }
+
+    bool append(const uint8_t* rec, uint64_t* rid) {
+        uint64_t r = rows;
+        put(r, rec, def->rowSize);
+        pending[r][0] = ROW_LIVE;
+        if (rid) *rid = r;
+        wal_log(WAL_INSERT, def->name, r, nullptr, pending[r].data(), def->rowSize);
+        return pending.size() < MAX_PENDING || flush();
+    }
+
+    bool update(uint64_t rid, const uint8_t* rec) {
+        vector<uint8_t> cur(def->rowSize);
+        if (!row(rid, cur.data())) return false;
+        put(rid, rec, def->rowSize);
+        pending[rid][0] = ROW_LIVE;
+        wal_log(WAL_UPDATE, def->name, rid, cur.data(), pending[rid].data(), def->rowSize);
+        return pending.size() < MAX_PENDING || flush();
+    }
+
+    bool erase(uint64_t rid) {
+        vector<uint8_t> cur(def->rowSize);
+        if (!row(rid, cur.data())) return false;
+        uint8_t st = ROW_FREE;
+        put(rid, &st, 1);
+        wal_log(WAL_DELETE, def->name, rid, cur.data(), nullptr, def->rowSize);
+        return pending.size() < MAX_PENDING || flush();
+    }
+
+    // Makes the deleted row rid live again as rec (rolling back its delete).
+    bool restore(uint64_t rid, const uint8_t* rec) {
+        put(rid, rec, def->rowSize);
+        pending[rid][0] = ROW_LIVE;
+        wal_log(WAL_INSERT, def->name, rid, nullptr, pending[rid].data(), def->rowSize);
+        return pending.size() < MAX_PENDING || flush();
+    }
+
+    // Cuts n row images into per-column buffers and writes them at rid first;
+    // varchar bytes are appended to the blobs. Status bytes go last.
+    bool write_rows(uint64_t first, const uint8_t* const* images, size_t n) {
+        const TableDef& d = *def;
+        for (size_t c = 0; c < d.cols.size(); ++c) {
+            const ColumnDef& cd = d.cols[c];
+            uint32_t w = packed_width(cd);
+            vector<uint8_t> col(n * w);
+            string blob;
+            for (size_t i = 0; i < n; ++i) {
+                const uint8_t* f = images[i] + d.offsets[c];
+                if (cd.kind != COL_VARCHAR) { memcpy(&col[i * w], f, w); continue; }
+                uint16_t len; memcpy(&len, f, 2);
+                uint64_t e = ((blobEnd[c] + blob.size()) << 16) | len;
+                memcpy(&col[i * 8], &e, 8);
+                blob.append((const char*)f + 2, len);
+            }
+            if (!blob.empty()) {
+                if (!pwrite_full(blobFd[c], blob.data(), blob.size(), (off_t)blobEnd[c])) return false;
+                blobEnd[c] += blob.size();
+            }
+            if (!pwrite_full(colFd[c], col.data(), col.size(), (off_t)(first * w))) return false;
+        }
+        vector<uint8_t> status(n);
+        for (size_t i = 0; i < n; ++i) status[i] = images[i][0];
+        if (!pwrite_full(statusFd, status.data(), n, (off_t)(PAGE_SIZE + first))) return false;
+        stored = max(stored, first + n);
+        return true;
+    }
+
+    // Logs first, then writes pending changes: runs of consecutive full images
+    // column by column, lone status bytes (deletes) in place.
+    bool flush() {
+        if (pending.empty()) return true;
+        if (!wal_flush_for_pages()) return false;
+        bool ok = true;
+        vector<const uint8_t*> run;
+        uint64_t runFirst = 0;
+        auto flush_run = [&]() {
+            if (!run.empty()) ok = write_rows(runFirst, run.data(), run.size()) && ok;
+            run.clear();
+        };
+        for (auto& kv : pending) {
+            if (kv.second.size() != def->rowSize) {
+                flush_run();
+                if (kv.first >= stored) {
+                    // a delete of a row that never reached the file: write it as a dead row
+                    vector<uint8_t> dead(def->rowSize, 0);
+                    const uint8_t* p = dead.data();
+                    ok = write_rows(kv.first, &p, 1) && ok;
+                }
+                else ok = pwrite_full(statusFd, kv.second.data(), 1, (off_t)(PAGE_SIZE + kv.first)) && ok;
+                continue;
+            }
+            if (!run.empty() && kv.first != runFirst + run.size()) flush_run();
+            if (run.empty()) runFirst = kv.first;
+            run.push_back(kv.second.data());
+        }
+        flush_run();
+        pending.clear();
+        return ok;
+    }
+
+    // Appends n live row images (bulk load) without log records.
+    bool append_rows(const uint8_t* recs, size_t n) {
+        if (!flush()) return false;
+        vector<const uint8_t*> images(n);
+        for (size_t i = 0; i < n; ++i) images[i] = recs + i * def->rowSize;
+        if (!write_rows(rows, images.data(), n)) return false;
+        rows += n;
+        return true;
+    }
+
+    // Drops every rid >= n (an unfinished bulk load).
+    bool truncate(uint64_t n) {
+        pending.erase(pending.lower_bound(n), pending.end());
+        bool ok = ftruncate(statusFd, (off_t)(PAGE_SIZE + n)) == 0;
+        for (size_t c = 0; c < def->cols.size(); ++c)
+            ok = ftruncate(colFd[c], (off_t)(n * packed_width(def->cols[c]))) == 0 && ok;
+        stored = min(stored, n); rows = min(rows, n);
+        return ok;
+    }
+};
+
+/* ---------- buffer pool ----------
+  Pages of the row tables' data files and of the index files (B+tree and
+  hash) are read and written through BUFFER_POOL: PAGE_SIZE frames shared
+  by every session, as many as `set buffer_pool N;` (MB) allows, split over
+  POOL_SHARDS shards by page, each with its own mutex. A page is known by
+  its file's device and inode, so the files compaction moves over a table
+  never meet the old ones' pages, and the pool keeps a descriptor of every
+  file it holds pages of, so no new file can take that inode meanwhile.
+  A page being read in is pinned; whoever else wants it waits for the read.
+  Replacement is LRU-2: the victim is the frame whose second-to-last use is
+  the oldest, frames used only once going first. A full scan doesn't
+  compete: its hits don't count as uses, and once a shard is full the pages
+  it misses go into a ring of RING_FRAMES frames there that scans recycle,
+  so a big scan can't push the hot lookup pages out. A lookup hitting a
+  ring frame takes it into the pool proper.
+  Writes are write-back: a statement's changed pages become dirty frames
+  (after their log records, see TableFile::flush) and reach the file when
+  evicted, before the file is mapped or synced, and at a checkpoint. Pages
+  past the end of a file go straight to it instead, so its size always
+  counts every page. Columnar tables and zone maps read whole column runs
+  and stay outside the pool.
+*/
+static const size_t POOL_SHARDS = 16;
+static const size_t RING_FRAMES = 2;            // per shard
+static size_t BUFFER_POOL_BYTES = 64u << 20;    // set buffer_pool N; (MB)
+
+// A file the pool holds pages of, shared by every handle open on it.
+struct PoolFile {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    int fd = -1;                        // the pool's own descriptor
+    atomic<uint64_t> diskPages{ 0 };    // pages the file has on disk
+    atomic<uint64_t> dirty{ 0 };        // its dirty frames
+    atomic<uint64_t> frames{ 0 };       // its frames
+    size_t users = 0;                   // handles attached (BufferPool::filesMutex)
+    mutex m;                            // held by writes and truncation
+};
+
+struct BufferPool {
+    struct PageKey {
+        PoolFile* file;
+        uint64_t pno;
+        bool operator==(const PageKey& o) const { return file == o.file && pno == o.pno; }
+    };
+    struct PageHash {
+        size_t operator()(const PageKey& k) const {
+            uint64_t h = ((uint64_t)(uintptr_t)k.file >> 4) * 0x9E3779B97F4A7C15ULL ^ k.pno * 0xFF51AFD7ED558CCDULL;
+            return (size_t)(h ^ h >> 29);
+        }
+    };
+    using Order = set<tuple<uint64_t, uint64_t, uint32_t>>;     // (prev, last, frame): victims first
+    struct Frame {
+        PoolFile* file = nullptr;       // null when free
+        uint64_t pno = 0;
+        unique_ptr<uint8_t[]> data;
+        uint32_t pins = 0;              // reads in progress
+        bool dirty = false;
+        bool ring = false;              // a scan's frame, outside order
+        uint64_t last = 0, prev = 0;    // the two latest uses (shard ticks); prev 0 after one use
+        Order::iterator pos;
+    };
+    struct Shard {
+        mutex m;
+        condition_variable loaded;      // a pinned frame was read in
+        unordered_map<PageKey, uint32_t, PageHash> map;
+        vector<Frame> frames;
+        vector<uint32_t> free;
+        Order order;
+        deque<uint32_t> ring;
+        uint64_t tick = 0;
+        size_t cap = 0;
+    };
+    static const uint32_t NO_FRAME = UINT32_MAX;
+
+    Shard shards[POOL_SHARDS];
+    mutex filesMutex;
+    map<pair<dev_t, ino_t>, unique_ptr<PoolFile>> files;
+    atomic<uint64_t> hits{ 0 }, misses{ 0 }, evictions{ 0 }, writebacks{ 0 }, ringReads{ 0 };
+
+    BufferPool() { size_frames(BUFFER_POOL_BYTES); }
+
+    void size_frames(size_t bytes) {
+        size_t per = max(bytes / PAGE_SIZE / POOL_SHARDS, RING_FRAMES + 2);
+        for (Shard& s : shards) { lock_guard<mutex> lk(s.m); s.cap = per; }
+    }
+
+    // Empties the pool and sizes it for bytes (no statement may be running).
+    bool set_budget(size_t bytes) {
+        bool ok = clear();
+        size_frames(bytes);
+        return ok;
+    }
+
+    // The pool's entry for the file open as fd; every handle attaches its file.
+    PoolFile* attach(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) return nullptr;
+        PoolFile* f;
+        {
+            lock_guard<mutex> lk(filesMutex);
+            unique_ptr<PoolFile>& e = files[{ st.st_dev, st.st_ino }];
+            if (!e) {
+                e.reset(new PoolFile());
+                e->dev = st.st_dev; e->ino = st.st_ino;
+                e->fd = dup(fd);
+                e->diskPages = (uint64_t)st.st_size / PAGE_SIZE;
+                if (e->fd < 0) { files.erase({ st.st_dev, st.st_ino }); return nullptr; }
+            }
+            f = e.get();
+            f->users++;
+        }
+        // created over with O_TRUNC since: the pages held are stale
+        lock_guard<mutex> lk(f->m);
+        if (fstat(f->fd, &st) == 0 && (uint64_t)st.st_size / PAGE_SIZE != f->diskPages) {
+            drop(f);
+            f->diskPages = (uint64_t)st.st_size / PAGE_SIZE;
+        }
+        return f;
+    }
+
+    void detach(PoolFile* f) {
+        if (!f) return;
+        lock_guard<mutex> lk(filesMutex);
+        f->users--;
+        reap();
+    }
+
+    // Copies the first len bytes of page pno of f to out; false past the end of the file.
+    bool read(PoolFile* f, uint64_t pno, void* out, size_t len = PAGE_SIZE, bool scan = false) {
+        PageKey k{ f, pno };
+        Shard& s = shard_of(k);
+        unique_lock<mutex> lk(s.m);
+        for (auto it = s.map.find(k); it != s.map.end(); it = s.map.find(k)) {
+            if (s.frames[it->second].pins) { s.loaded.wait(lk); continue; }
+            memcpy(out, s.frames[it->second].data.get(), len);
+            hits.fetch_add(1, memory_order_relaxed);
+            if (!scan) use(s, it->second);
+            return true;
+        }
+        misses.fetch_add(1, memory_order_relaxed);
+        if (pno >= f->diskPages) return false;
+        bool ring = scan && s.free.empty() && s.frames.size() >= s.cap;
+        if (ring) ringReads.fetch_add(1, memory_order_relaxed);
+        uint32_t i = take(s, ring);
+        if (i == NO_FRAME) {
+            lk.unlock();
+            return pread_full(f->fd, out, len, (off_t)(pno * PAGE_SIZE));
+        }
+        link(s, i, k, ring);
+        s.frames[i].pins = 1;
+        uint8_t* data = s.frames[i].data.get();
+        lk.unlock();
+        bool ok = pread_full(f->fd, data, PAGE_SIZE, (off_t)(pno * PAGE_SIZE));
+        lk.lock();
+        s.frames[i].pins = 0;
+        s.loaded.notify_all();
+        if (!ok) { unlink(s, i, false); s.free.push_back(i); return false; }
+        memcpy(out, data, len);
+        return true;
+    }
+
+    // Writes n pages from pno on: pages the file already has become dirty
+    // frames, pages past its end go straight to the file.
+    bool write(PoolFile* f, uint64_t pno, const uint8_t* data, uint64_t n = 1) {
+        lock_guard<mutex> lk(f->m);
+        uint64_t disk = f->diskPages;
+        uint64_t inside = pno < disk ? min(n, disk - pno) : 0;
+        bool ok = true;
+        for (uint64_t k = 0; k < inside; ++k) ok = put(f, pno + k, data + k * PAGE_SIZE) && ok;
+        if (inside == n) return ok;
+        if (!pwrite_full(f->fd, data + inside * PAGE_SIZE, (size_t)((n - inside) * PAGE_SIZE), (off_t)((pno + inside) * PAGE_SIZE)))
+            return false;
+        f->diskPages = pno + n;
+        return ok;
+    }
+
+    // Cuts f down to pages pages, dropping the frames past them.
+    bool truncate(PoolFile* f, uint64_t pages) {
+        lock_guard<mutex> lk(f->m);
+        drop(f, pages);
+        if (ftruncate(f->fd, (off_t)(pages * PAGE_SIZE)) != 0) return false;
+        f->diskPages = pages;
+        return true;
+    }
+
+    // Writes the dirty frames of f (of every file when null) to their files.
+    bool write_back(PoolFile* f = nullptr) {
+        if (f && !f->dirty) return true;
+        bool ok = true;
+        for (Shard& s : shards) {
+            lock_guard<mutex> lk(s.m);
+            for (Frame& fr : s.frames) {
+                if (!fr.file || !fr.dirty || (f && fr.file != f)) continue;
+                if (!pwrite_full(fr.file->fd, fr.data.get(), PAGE_SIZE, (off_t)(fr.pno * PAGE_SIZE))) { ok = false; continue; }
+                fr.dirty = false;
+                fr.file->dirty--;
+                writebacks.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        return ok;
+    }
+
+    // write_back() for the file at path, if the pool holds any of its pages.
+    bool write_back(const string& path) {
+        PoolFile* f = entry_of(path);
+        if (!f) return true;
+        bool ok = write_back(f);
+        detach(f);
+        return ok;
+    }
+
+    // Writes back and drops the pages of the file at path (about to be removed or replaced).
+    void forget(const string& path) {
+        PoolFile* f = entry_of(path);
+        if (!f) return;
+        write_back(f);
+        drop(f);
+        detach(f);
+    }
+
+    // Writes back and drops every page.
+    bool clear() {
+        bool ok = write_back();
+        drop(nullptr);
+        for (Shard& s : shards) {
+            lock_guard<mutex> lk(s.m);
+            if (!s.map.empty()) continue;
+            vector<Frame>().swap(s.frames);
+            s.free.clear();
+            s.ring.clear();
+        }
+        lock_guard<mutex> lk(filesMutex);
+        reap();
+        return ok;
+    }
+
+    // Pages held and how many of them are dirty.
+    void usage(uint64_t& pages, uint64_t& dirty) {
+        pages = dirty = 0;
+        for (Shard& s : shards) {
+            lock_guard<mutex> lk(s.m);
+            pages += s.map.size();
+            for (const Frame& fr : s.frames) dirty += fr.file && fr.dirty;
+        }
+    }
+
+    Shard& shard_of(const PageKey& k) { return shards[(PageHash()(k) >> 7) % POOL_SHARDS]; }
+
+    // Entry of the file at path with a user held, or null.
+    PoolFile* entry_of(const string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return nullptr;
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.find({ st.st_dev, st.st_ino });
+        if (it == files.end()) return nullptr;
+        it->second->users++;
+        return it->second.get();
+    }
+
+    // Closes the entries no handle uses and no frame refers to (filesMutex held).
+    void reap() {
+        for (auto it = files.begin(); it != files.end(); ) {
+            if (it->second->users || it->second->frames) { ++it; continue; }
+            ::close(it->second->fd);
+            it = files.erase(it);
+        }
+    }
+
+    // Counts a use of frame i: LRU-2 orders it by the use before this one.
+    void use(Shard& s, uint32_t i) {
+        Frame& fr = s.frames[i];
+        fr.prev = fr.last;
+        fr.last = ++s.tick;
+        if (fr.ring) {
+            s.ring.erase(find(s.ring.begin(), s.ring.end(), i));
+            fr.ring = false;
+            fr.pos = s.order.insert({ fr.prev, fr.last, i }).first;
+            return;
+        }
+        auto node = s.order.extract(fr.pos);
+        node.value() = { fr.prev, fr.last, i };
+        fr.pos = s.order.insert(move(node)).position;
+    }
+
+    // Puts frame i (free) in the shard as page k, in the ring when ring is set.
+    void link(Shard& s, uint32_t i, const PageKey& k, bool ring) {
+        Frame& fr = s.frames[i];
+        fr.file = k.file; fr.pno = k.pno;
+        fr.dirty = false;
+        fr.ring = ring;
+        fr.prev = 0; fr.last = ++s.tick;
+        s.map.emplace(k, i);
+        k.file->frames++;
+        if (ring) s.ring.push_back(i);
+        else fr.pos = s.order.insert({ 0, fr.last, i }).first;
+    }
+
+    // Takes frame i out of the shard, writing it back first when it is
+    // dirty and writeBack is set; false if that write failed (it stays).
+    bool unlink(Shard& s, uint32_t i, bool writeBack) {
+        Frame& fr = s.frames[i];
+        if (fr.dirty) {
+            if (writeBack) {
+                if (!pwrite_full(fr.file->fd, fr.data.get(), PAGE_SIZE, (off_t)(fr.pno * PAGE_SIZE))) return false;
+                writebacks.fetch_add(1, memory_order_relaxed);
+            }
+            fr.dirty = false;
+            fr.file->dirty--;
+        }
+        s.map.erase(PageKey{ fr.file, fr.pno });
+        if (fr.ring) s.ring.erase(find(s.ring.begin(), s.ring.end(), i));
+        else s.order.erase(fr.pos);
+        fr.ring = false;
+        fr.file->frames--;
+        fr.file = nullptr;
+        return true;
+    }
+
+    // A frame to read a page into: the ring's oldest for a ring page once
+    // the ring is full, else a free one, a new one under the cap, or the
+    // LRU-2 victim. NO_FRAME when every candidate is pinned.
+    uint32_t take(Shard& s, bool ring) {
+        if (ring && s.ring.size() >= RING_FRAMES) {
+            for (size_t n = s.ring.size(); n--; ) {
+                uint32_t i = s.ring.front();
+                if (!s.frames[i].pins) { unlink(s, i, true); return i; }
+                s.ring.pop_front();
+                s.ring.push_back(i);
+            }
+            return NO_FRAME;
+        }
+        if (!s.free.empty()) { uint32_t i = s.free.back(); s.free.pop_back(); return i; }
+        if (s.frames.size() < s.cap) {
+            s.frames.emplace_back();
+            s.frames.back().data.reset(new uint8_t[PAGE_SIZE]);
+            return (uint32_t)(s.frames.size() - 1);
+        }
+        for (const auto& o : s.order) {
+            uint32_t i = get<2>(o);
+            if (s.frames[i].pins || !unlink(s, i, true)) continue;
+            evictions.fetch_add(1, memory_order_relaxed);
+            return i;
+        }
+        return NO_FRAME;
+    }
+
+    // Installs page pno of f as a dirty frame holding data.
+    bool put(PoolFile* f, uint64_t pno, const uint8_t* data) {
+        PageKey k{ f, pno };
+        Shard& s = shard_of(k);
+        unique_lock<mutex> lk(s.m);
+        auto it = s.map.find(k);
+        while (it != s.map.end() && s.frames[it->second].pins) { s.loaded.wait(lk); it = s.map.find(k); }
+        uint32_t i;
+        if (it != s.map.end()) {
+            i = it->second;
+            if (s.frames[i].ring) use(s, i);
+        }
+        else {
+            i = take(s, false);
+            // no frame to spare: write through (under the lock, so no read can cache the old page meanwhile)
+            if (i == NO_FRAME) return pwrite_full(f->fd, data, PAGE_SIZE, (off_t)(pno * PAGE_SIZE));
+            link(s, i, k, false);
+        }
+        Frame& fr = s.frames[i];
+        memcpy(fr.data.get(), data, PAGE_SIZE);
+        if (!fr.dirty) { fr.dirty = true; f->dirty++; }
+        return true;
+    }
+
+    // Discards the frames of f (of every file when null) from page from on.
+    void drop(PoolFile* f, uint64_t from = 0) {
+        for (Shard& s : shards) {
+            unique_lock<mutex> lk(s.m);
+            auto mine = [&](uint32_t i) { const Frame& fr = s.frames[i]; return fr.file && (!f || fr.file == f) && fr.pno >= from; };
+            for (uint32_t i = 0; i < s.frames.size(); ++i) {
+                while (mine(i) && s.frames[i].pins) s.loaded.wait(lk);
+                if (!mine(i)) continue;
+                unlink(s, i, false);
+                s.free.push_back(i);
+            }
+        }
+    }
+};
+
+static BufferPool BUFFER_POOL;
+
+struct TableFile {
+    const TableDef* def = nullptr;
+    int fd = -1;
+    PoolFile* pool = nullptr;   // the file in BUFFER_POOL
+    uint64_t pages = 0;     // including the header page (and pages still only in dirty)
+    map<uint64_t, vector<uint8_t>> dirty;   // pages changed since the last flush
+    static const size_t MAX_DIRTY = 256;
+    unique_ptr<ColumnStore> cols;           // set for a columnar table; fd and pages unused then
+    SnapshotView view;                      // what scans and fetches see (a reader's snapshot)
+
+    TableFile() = default;
+    TableFile(const TableFile&) = delete;
+    TableFile& operator=(const TableFile&) = delete;
+    ~TableFile() { close(); }
+
+    // A full scan reads with scan set (see "buffer pool").
+    bool read_page(uint64_t pno, uint8_t* buf, bool scan = false) const {
+        auto it = dirty.find(pno);
+        if (it != dirty.end()) { memcpy(buf, it->second.data(), PAGE_SIZE); return true; }
+        return BUFFER_POOL.read(pool, pno, buf, PAGE_SIZE, scan);
+    }
+    bool write_page(uint64_t pno, const uint8_t* buf) { return write_pages(pno, buf, 1); }
+    bool write_pages(uint64_t pno, const uint8_t* buf, uint64_t n) {
+        if (!BUFFER_POOL.write(pool, pno, buf, n)) return false;
+        if (pno + n > pages) pages = pno + n;
+        return true;
+    }
+    void close() {
+        if (fd >= 0) { flush(); BUFFER_POOL.detach(pool); ::close(fd); }
+        fd = -1; pool = nullptr; pages = 0;
+        dirty.clear();
+        cols.reset();
+        view = SnapshotView();
+    }
+
+    bool sync() { return cols ? cols->sync() : BUFFER_POOL.write_back(pool) && fsync(fd) == 0; }
+
+    // Rid the next append_rows() starts at; 0 for a table that never held a row.
+    uint64_t end_rid() const {
+        if (cols) return cols->rows;
+        return pages <= 1 ? 0 : (pages - 1) * def->rowsPerPage;
+    }
+    bool empty() const { return end_rid() == 0; }
+
+    // Drops every row from rid n on; n must be an end_rid() of this file.
+    bool truncate_rows(uint64_t n) {
+        if (cols) return cols->truncate(n);
+        dirty.clear();
+        pages = 1 + n / def->rowsPerPage;
+        return BUFFER_POOL.truncate(pool, pages);
+    }
+
+    // Writes the log records of the changes so far, then hands the changed
+    // pages to the buffer pool. Runs of consecutive pages go in one call, so
+    // a run past the end of the file goes out in one pwrite.
+    bool flush() {
+        if (cols) return cols->flush();
+        if (dirty.empty()) return true;
+        if (!wal_flush_for_pages()) return false;
+        bool ok = true;
+        vector<uint8_t> run;
+        for (auto it = dirty.begin(); it != dirty.end(); ) {
+            uint64_t first = it->first, next = first;
+            auto end = it;
+            while (end != dirty.end() && end->first == next) { ++end; ++next; }
+            if (next - first == 1) ok = write_page(first, it->second.data()) && ok;
+            else {
+                run.clear();
+                for (; it != end; ++it) run.insert(run.end(), it->second.begin(), it->second.end());
+                ok = write_pages(first, run.data(), next - first) && ok;
+            }
+            it = end;
+        }
+        dirty.clear();
+        return ok;
+    }
+
+    // Page pno held in the dirty set for modification; a page past the end starts zeroed.
+    uint8_t* page_for_write(uint64_t pno) {
+        auto it = dirty.find(pno);
+        if (it != dirty.end()) return it->second.data();
+        if (dirty.size() >= MAX_DIRTY) flush();
+        vector<uint8_t>& page = dirty[pno];
+        page.assign(PAGE_SIZE, 0);
+        if (pno < pages && !BUFFER_POOL.read(pool, pno, page.data()))
+            fill(page.begin(), page.end(), 0);
+        if (pno >= pages) pages = pno + 1;
+        return page.data();
+    }
+
+    // Live row at rid inside a writable page, or nullptr.
+    uint8_t* row_for_write(uint64_t rid, uint8_t** pageOut = nullptr) {
+        uint64_t pno = 1 + rid / def->rowsPerPage;
+        if (pno >= pages) return nullptr;
+        uint8_t* page = page_for_write(pno);
+        PageHeader ph; memcpy(&ph, page, sizeof ph);
+        uint32_t slot = (uint32_t)(rid % def->rowsPerPage);
+        if (slot >= ph.used) return nullptr;
+        uint8_t* rec = slot_ptr(*def, page, slot);
+        if (pageOut) *pageOut = page;
+        return rec[0] == ROW_LIVE ? rec : nullptr;
+    }
+
+    // Puts a ROW_LIVE record in the first unused slot at the end of the file.
+    bool append(const uint8_t* rec, uint64_t* rid = nullptr) {
+        if (cols) return cols->append(rec, rid);
+        uint64_t pno = pages - 1;
+        PageHeader ph{ 0, 0 };
+        if (pno >= 1) memcpy(&ph, page_for_write(pno), sizeof ph);
+        if (pno < 1 || ph.used >= def->rowsPerPage) {
+            pno = pages;
+            ph = PageHeader{ 0, 0 };
+        }
+        uint8_t* page = page_for_write(pno);
+        uint8_t* slot = slot_ptr(*def, page, ph.used);
+        memcpy(slot, rec, def->rowSize);
+        slot[0] = ROW_LIVE;
+        uint64_t r = (pno - 1) * def->rowsPerPage + ph.used;
+        if (rid) *rid = r;
+        ph.used++; ph.live++;
+        memcpy(page, &ph, sizeof ph);
+        wal_log(WAL_INSERT, def->name, r, nullptr, slot, def->rowSize);
+        return true;
+    }
+
+    // Overwrites the live row at rid with rec.
+    bool update(uint64_t rid, const uint8_t* rec) {
+        if (cols) return cols->update(rid, rec);
+        uint8_t* slot = row_for_write(rid);
+        if (!slot) return false;
+        wal_log(WAL_UPDATE, def->name, rid, slot, rec, def->rowSize);  // replay marks the new image live
+        memcpy(slot, rec, def->rowSize);
+        slot[0] = ROW_LIVE;
+        return true;
+    }
+
+    // Writes n records (rowSize bytes each) from end_rid() on without log records:
+    // new pages at the end of the file, one pwrite per call, every page full
+    // except possibly the last.
+    bool append_rows(const uint8_t* recs, size_t n) {
+        if (cols) return cols->append_rows(recs, n);
+        if (!flush()) return false;
+        size_t rpp = def->rowsPerPage;
+        size_t npages = (n + rpp - 1) / rpp;
+        vector<uint8_t> buf(npages * PAGE_SIZE, 0);
+        for (size_t p = 0; p < npages; ++p) {
+            uint8_t* page = &buf[p * PAGE_SIZE];
+            uint32_t cnt = (uint32_t)min(rpp, n - p * rpp);
+            memcpy(slot_ptr(*def, page, 0), recs + p * rpp * def->rowSize, (size_t)cnt * def->rowSize);
+            PageHeader ph{ cnt, cnt };
+            memcpy(page, &ph, sizeof ph);
+        }
+        return write_pages(pages, buf.data(), npages);
+    }
+
+    // Turns the live row at rid into a tombstone (ROW_FREE slot).
+    bool erase(uint64_t rid) {
+        if (cols) return cols->erase(rid);
+        uint8_t* page;
+        uint8_t* slot = row_for_write(rid, &page);
+        if (!slot) return false;
+        wal_log(WAL_DELETE, def->name, rid, slot, nullptr, def->rowSize);
+        slot[0] = ROW_FREE;
+        PageHeader ph; memcpy(&ph, page, sizeof ph);
+        ph.live--;
+        memcpy(page, &ph, sizeof ph);
+        return true;
+    }
+
+    // Makes the freed slot rid live again as rec (rolling back its delete).
+    bool restore(uint64_t rid, const uint8_t* rec) {
+        if (cols) return cols->restore(rid, rec);
+        uint64_t pno = 1 + rid / def->rowsPerPage;
+        if (pno >= pages) return false;
+        uint8_t* page = page_for_write(pno);
+        PageHeader ph; memcpy(&ph, page, sizeof ph);
+        uint32_t slot = (uint32_t)(rid % def->rowsPerPage);
+        uint8_t* dst = slot_ptr(*def, page, slot);
+        if (slot >= ph.used || dst[0] == ROW_LIVE) return false;
+        memcpy(dst, rec, def->rowSize);
+        dst[0] = ROW_LIVE;
+        ph.live++;
+        memcpy(page, &ph, sizeof ph);
+        wal_log(WAL_INSERT, def->name, rid, nullptr, dst, def->rowSize);
+        return true;
+    }
+};
+
+static bool write_file_header(TableFile& tf) {
+    vector<uint8_t> page(PAGE_SIZE, 0);
+    FileHeader fh;
+    memcpy(fh.magic, SDB_MAGIC, 4);
+    fh.version = SDB_VERSION; fh.pageSize = PAGE_SIZE;
+    fh.rowSize = tf.def->rowSize; fh.ncols = (uint32_t)tf.def->cols.size();
+    memcpy(page.data(), &fh, sizeof fh);
+    return tf.write_page(0, page.data());
+}
+
+// Creates an empty binary table file at path (overwriting it).
+static bool create_table_file(const TableDef& def, const string& path, TableFile& tf) {
+    tf.close();
+    tf.def = &def;
+    if (def.columnar) {
+        tf.cols.reset(new ColumnStore());
+        return tf.cols->open(def, true);
+    }
+    tf.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tf.fd < 0) return false;
+    tf.pool = BUFFER_POOL.attach(tf.fd);
+    return tf.pool && write_file_header(tf);
+}
+
+static bool is_binary_table_file(const string& path) {
+    ifstream in(path, ios::binary);
+    char m[4] = { 0,0,0,0 };
+    return in.read(m, 4) && (memcmp(m, SDB_MAGIC, 4) == 0 || memcmp(m, SDB_COLUMNAR_MAGIC, 4) == 0);
+}
+
+// Opens <Table>.sdb, creating it if missing. A legacy text file is moved aside to
+// <Table>.sdb.txt and an empty binary file created; legacyPath tells the caller to import it.
+static bool open_table_file(const TableDef& def, TableFile& tf, string& legacyPath) {
+    tf.close();
+    tf.def = &def;
+    legacyPath.clear();
+    string path = table_path(def.name);
+    struct stat st;
+    bool exists = stat(path.c_str(), &st) == 0;
+    if (exists && st.st_size > 0 && !is_binary_table_file(path)) {
+        legacyPath = path + ".txt";
+        if (rename(path.c_str(), legacyPath.c_str()) != 0) return false;
+        return create_table_file(def, path, tf);
+    }
+    if (!exists || st.st_size == 0) return create_table_file(def, path, tf);
+    if (def.columnar) {
+        tf.cols.reset(new ColumnStore());
+        if (tf.cols->open(def, false)) return true;
+        fail(Error::IoError) << "[SaadDB] " << path << " doesn't match the schema of <" << def.name << ">\n";
+        tf.close();
+        return false;
+    }
+
+    tf.fd = ::open(path.c_str(), O_RDWR);
+    if (tf.fd < 0) return false;
+    tf.pool = BUFFER_POOL.attach(tf.fd);
+    if (!tf.pool) { tf.close(); return false; }
+    FileHeader fh;
+    if (pread(tf.fd, &fh, sizeof fh, 0) != (ssize_t)sizeof fh || memcmp(fh.magic, SDB_MAGIC, 4) != 0 ||
+        fh.version != SDB_VERSION || fh.pageSize != PAGE_SIZE ||
+        fh.rowSize != def.rowSize || fh.ncols != def.cols.size()) {
+        fail(Error::IoError) << "[SaadDB] " << path << " doesn't match the schema of <" << def.name << ">\n";
+        tf.close();
+        return false;
+    }
+    tf.pages = (uint64_t)st.st_size / PAGE_SIZE;
+    return true;
+}
+
+// Pages of a row table for scanning: a read-only mapping of the whole file
+// when every page is on disk (no copies, rows are handed out where they lie;
+// the pool's dirty pages of the file are written back first), else nothing
+// and readers fall back to read_page copies. A snapshot reads
+// copies too: its row versions must be looked up after a page is read, and
+// a mapped page changes under the reader.
+struct PageMap {
+    const uint8_t* base = nullptr;
+    size_t len = 0;
+
+    explicit PageMap(const TableFile& tf) {
+        if (tf.cols || tf.fd < 0 || !tf.dirty.empty() || tf.pages <= 1 || tf.view.active()) return;
+        if (!BUFFER_POOL.write_back(tf.pool)) return;
+        len = (size_t)(tf.pages * PAGE_SIZE);
+        void* m = mmap(nullptr, len, PROT_READ, MAP_SHARED, tf.fd, 0);
+        if (m == MAP_FAILED) { len = 0; return; }
+        madvise(m, len, MADV_SEQUENTIAL);
+        base = (const uint8_t*)m;
+    }
+    PageMap(const PageMap&) = delete;
+    PageMap& operator=(const PageMap&) = delete;
+    ~PageMap() { if (base) munmap((void*)base, len); }
+};
+
+// Calls fn(rec, rid); false when fn returns false to stop the scan early
+// (a fn returning void never stops it).
+template <class F>
+static bool row_visit(F& fn, const uint8_t* rec, uint64_t rid) {
+    if constexpr (is_same<decltype(fn(rec, rid)), bool>::value) return fn(rec, rid);
+    else { fn(rec, rid); return true; }
+}
+
+// Calls fn(rec, rid) for every live row on pages [pfrom, pto) with rid >= from;
+// false if fn stopped it.
+template <class F>
+static bool scan_page_range(const TableFile& tf, const PageMap& pm, uint64_t pfrom, uint64_t pto, uint64_t from, F&& fn) {
+    const TableDef& def = *tf.def;
+    vector<uint8_t> copy;
+    map<uint64_t, vector<uint8_t>> changed;
+    for (uint64_t pno = pfrom; pno < pto; ++pno) {
+        const uint8_t* page;
+        if (pm.base) page = pm.base + pno * PAGE_SIZE;
+        else {
+            copy.resize(PAGE_SIZE);
+            if (!tf.read_page(pno, copy.data(), true)) break;
+            page = copy.data();
+        }
+        PageHeader ph; memcpy(&ph, page, sizeof ph);
+        uint64_t base = (pno - 1) * def.rowsPerPage;
+        uint32_t used = min(ph.used, def.rowsPerPage);
+        changed.clear();
+        tf.view.rows(base, base + def.rowsPerPage, changed);
+        auto fix = changed.begin();
+        for (uint32_t s = 0; s < used; ++s) {
+            const uint8_t* rec = slot_ptr(def, page, s);
+            if (fix != changed.end() && fix->first == base + s) {
+                const vector<uint8_t>& image = (fix++)->second;
+                rec = image.empty() ? nullptr : image.data();
+            }
+            if (!rec || rec[0] != ROW_LIVE || base + s < from) continue;
+            ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+            if (!row_visit(fn, rec, base + s)) return false;
+        }
+    }
+    return true;
+}
+
+// Calls fn(rec, rid) for every live row with rid >= from, in rid order.
+template <class F>
+static void scan_rows(const TableFile& tf, F&& fn, uint64_t from = 0) {
+    if (tf.cols) { tf.cols->scan(fn, from, tf.view); return; }
+    PageMap pm(tf);
+    scan_page_range(tf, pm, 1 + from / tf.def->rowsPerPage, tf.pages, from, fn);
+}
+
+// Reads single rows by rid, keeping the last page read.
+struct RowFetcher {
+    const TableFile& tf;
+    uint64_t pno = 0;
+    vector<uint8_t> page;
+    vector<uint8_t> image;                      // a snapshot image get() returned
+    map<uint64_t, vector<uint8_t>> changed;
+
+    explicit RowFetcher(const TableFile& f) : tf(f), page(max<size_t>(PAGE_SIZE, f.def->rowSize)) {}
+
+    // Live row at rid as the file's view sees it, or nullptr.
+    const uint8_t* get(uint64_t rid) {
+        const uint8_t* rec = read(rid);
+        if (!tf.view.active()) return rec;
+        changed.clear();
+        tf.view.rows(rid, rid + 1, changed);
+        if (changed.empty()) return rec;
+        image.swap(changed.begin()->second);
+        return image.empty() ? nullptr : image.data();
+    }
+
+    // Live row at rid as the pages hold it, or nullptr.
+    const uint8_t* read(uint64_t rid) {
+        const TableDef& def = *tf.def;
+        if (tf.cols) {
+            BYTES_READ.fetch_add(def.rowSize, memory_order_relaxed);
+            return tf.cols->row(rid, page.data()) ? page.data() : nullptr;
+        }
+        uint64_t want = 1 + rid / def.rowsPerPage;
+        if (want >= tf.pages) return nullptr;
+        if (want != pno) {
+            if (!tf.read_page(want, page.data())) { pno = 0; return nullptr; }
+            BYTES_READ.fetch_add(PAGE_SIZE, memory_order_relaxed);
+            pno = want;
+        }
+        uint32_t slot = (uint32_t)(rid % def.rowsPerPage);
+        PageHeader ph; memcpy(&ph, page.data(), sizeof ph);
+        if (slot >= ph.used) return nullptr;
+        const uint8_t* rec = slot_ptr(def, page.data(), slot);
+        return rec[0] == ROW_LIVE ? rec : nullptr;
+    }
+};
+
+/* ---------- B+tree index ----------
+  <Table>.pk holds a B+tree over the primary key, mapping key -> rid.
+    page 0  : IndexMeta
+    page 1..: nodes. NodeHeader, then sorted entries
+      leaf    : key, rid                    (link = next leaf, 0 at the end)
+      internal: key, rid, child             (link = leftmost child)
+  Keys are fixed width: int/date/decimal as int64, varchar N as its field
+  bytes (uint16 length + N). A non-unique tree orders equal keys by rid, so
+  (key, rid) is always unique and separators carry the rid too.
+  Deletes only remove the leaf entry; nodes are never merged.
+*/
+static const char IDX_MAGIC[4] = { 'S','D','B','I' };
+static const uint32_t IDX_VERSION = 1;
+
+struct IndexMeta {
+    char magic[4];
+    uint32_t version;
+    uint32_t keyWidth;
+    uint8_t numeric, unique, pad[2];
+    uint64_t root;
+};
+
+struct NodeHeader {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t pad;
+    uint64_t link;
+};
+
+static uint32_t key_width(const ColumnDef& c) {
+    return c.kind == COL_VARCHAR ? column_width(c) : 8;
+}
+
+// Orders two index keys of the same column.
+static int key_cmp(bool numeric, const uint8_t* ka, const uint8_t* kb) {
+    if (numeric) {
+        int64_t a, b; memcpy(&a, ka, 8); memcpy(&b, kb, 8);
+        return a < b ? -1 : a > b;
+    }
+    uint16_t na, nb; memcpy(&na, ka, 2); memcpy(&nb, kb, 2);
+    int c = string_view((const char*)ka + 2, na).compare(string_view((const char*)kb + 2, nb));
+    return c < 0 ? -1 : c > 0;
+}
+
+// Index key of column col taken from a row.
+static void row_key(const TableDef& def, int col, const uint8_t* rec, uint8_t* key) {
+    const ColumnDef& c = def.cols[col];
+    if (c.kind == COL_VARCHAR) { memcpy(key, rec + def.offsets[col], column_width(c)); return; }
+    int64_t v = field_num(def, rec, col);
+    memcpy(key, &v, 8);
+}
+
+struct BTree {
+    int fd = -1;
+    PoolFile* pool = nullptr;
+    uint32_t keyWidth = 0;
+    bool numeric = true;
+    bool unique = true;
+    uint64_t root = 0;
+    uint64_t pages = 0;
+    shared_mutex* latch = nullptr;  // the table's index latch (see "table locks")
+    bool shared = false;            // other handles change the file meanwhile: reread the root per lookup
+
+    BTree() = default;
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+    BTree(BTree&& o) noexcept { *this = move(o); }
+    BTree& operator=(BTree&& o) noexcept {
+        if (this != &o) {
+            close();
+            fd = o.fd; pool = o.pool; keyWidth = o.keyWidth; numeric = o.numeric; unique = o.unique;
+            root = o.root; pages = o.pages; latch = o.latch; shared = o.shared;
+            o.fd = -1; o.pool = nullptr;
+        }
+        return *this;
+    }
+    ~BTree() { close(); }
+
+    void close() {
+        if (fd >= 0) { BUFFER_POOL.detach(pool); ::close(fd); }
+        fd = -1; pool = nullptr;
+    }
+
+    uint32_t leaf_entry() const { return keyWidth + 8; }
+    uint32_t inner_entry() const { return keyWidth + 16; }
+    uint32_t leaf_cap() const { return (PAGE_SIZE - sizeof(NodeHeader)) / leaf_entry(); }
+    uint32_t inner_cap() const { return (PAGE_SIZE - sizeof(NodeHeader)) / inner_entry(); }
+
+    bool read(uint64_t pno, uint8_t* buf) const { return BUFFER_POOL.read(pool, pno, buf); }
+    bool write(uint64_t pno, const uint8_t* buf) {
+        if (!BUFFER_POOL.write(pool, pno, buf)) return false;
+        if (pno >= pages) pages = pno + 1;
+        return true;
+    }
+    // Lookups hold the latch shared and changes hold it exclusive, so a
+    // lookup never meets a split half done.
+    shared_lock<shared_mutex> read_latch() const { return latch ? shared_lock<shared_mutex>(*latch) : shared_lock<shared_mutex>(); }
+    unique_lock<shared_mutex> write_latch() { return latch ? unique_lock<shared_mutex>(*latch) : unique_lock<shared_mutex>(); }
+
+    // Root a lookup starts from (latch held).
+    uint64_t top() const {
+        if (!shared) return root;
+        IndexMeta m{};
+        return BUFFER_POOL.read(pool, 0, &m, sizeof m) ? m.root : root;
+    }
+
+    bool write_meta() {
+        pmr::vector<uint8_t> page(PAGE_SIZE, 0, stmt_arena());
+        IndexMeta m{};
+        memcpy(m.magic, IDX_MAGIC, 4);
+        m.version = IDX_VERSION; m.keyWidth = keyWidth;
+        m.numeric = numeric; m.unique = unique; m.root = root;
+        memcpy(page.data(), &m, sizeof m);
+        return write(0, page.data());
+    }
+
+    int cmp(const uint8_t* ka, uint64_t ra, const uint8_t* kb, uint64_t rb) const {
+        int c = key_cmp(numeric, ka, kb);
+        if (c || unique) return c;
+        return ra < rb ? -1 : ra > rb;
+    }
+
+    static NodeHeader header(const uint8_t* page) { NodeHeader h; memcpy(&h, page, sizeof h); return h; }
+    static void set_header(uint8_t* page, const NodeHeader& h) { memcpy(page, &h, sizeof h); }
+    uint8_t* entry(uint8_t* page, uint32_t i, bool leaf) const {
+        return page + sizeof(NodeHeader) + (size_t)i * (leaf ? leaf_entry() : inner_entry());
+    }
+    const uint8_t* entry(const uint8_t* page, uint32_t i, bool leaf) const {
+        return page + sizeof(NodeHeader) + (size_t)i * (leaf ? leaf_entry() : inner_entry());
+    }
+    static uint64_t u64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+    // First entry position in node whose (key, rid) >= (key, rid).
+    uint32_t lower(const uint8_t* page, const uint8_t* key, uint64_t rid) const {
+        NodeHeader h = header(page);
+        uint32_t lo = 0, hi = h.count;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            const uint8_t* e = entry(page, mid, h.leaf);
+            if (cmp(e, u64(e + keyWidth), key, rid) < 0) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    // Child of an internal node that covers (key, rid).
+    uint64_t child_for(const uint8_t* page, const uint8_t* key, uint64_t rid) const {
+        NodeHeader h = header(page);
+        uint32_t lo = 0, hi = h.count;   // count of separators <= (key, rid)
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            const uint8_t* e = entry(page, mid, false);
+            if (cmp(e, u64(e + keyWidth), key, rid) <= 0) lo = mid + 1; else hi = mid;
+        }
+        return lo == 0 ? h.link : u64(entry(page, lo - 1, false) + keyWidth + 8);
+    }
+
+    // Opens or creates the index file; created is set when it starts out empty.
+    bool open(const string& path, uint32_t kw, bool isNumeric, bool isUnique, bool& created) {
+        close();
+        keyWidth = kw; numeric = isNumeric; unique = isUnique; created = false;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+        pool = BUFFER_POOL.attach(fd);
+        if (!pool) return false;
+        struct stat st;
+        fstat(fd, &st);
+        pages = (uint64_t)st.st_size / PAGE_SIZE;
+        IndexMeta m{};
+        bool ok = pages >= 2 && BUFFER_POOL.read(pool, 0, &m, sizeof m) &&
+            memcmp(m.magic, IDX_MAGIC, 4) == 0 && m.version == IDX_VERSION &&
+            m.keyWidth == kw && (bool)m.numeric == isNumeric && (bool)m.unique == isUnique;
+        if (ok) { root = m.root; return true; }
+        created = true;
+        auto lk = write_latch();
+        return reset();
+    }
+
+    // Truncates to an empty tree (a single empty leaf).
+    bool reset() {
+        if (!BUFFER_POOL.truncate(pool, 0)) return false;
+        pages = 0; root = 1;
+        vector<uint8_t> page(PAGE_SIZE, 0);
+        set_header(page.data(), NodeHeader{ 1, 0, 0, 0 });
+        return write_meta() && write(1, page.data());
+    }
+
+    // Leaf page that would hold (key, rid).
+    bool find_leaf(const uint8_t* key, uint64_t rid, uint64_t& pno, uint8_t* page) const {
+        pno = top();
+        while (true) {
+            if (!read(pno, page)) return false;
+            if (header(page).leaf) return true;
+            pno = child_for(page, key, rid);
+        }
+    }
+
+    // rid stored under key (unique trees).
+    bool find(const uint8_t* key, uint64_t& rid) const {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        auto lk = read_latch();
+        uint64_t pno;
+        if (!find_leaf(key, 0, pno, page.data())) return false;
+        NodeHeader h = header(page.data());
+        uint32_t i = lower(page.data(), key, 0);
+        if (i >= h.count) return false;
+        const uint8_t* e = entry(page.data(), i, true);
+        if (cmp(e, 0, key, 0) != 0) return false;
+        rid = u64(e + keyWidth);
+        return true;
+    }
+
+    struct Split { bool happened = false; pmr::vector<uint8_t> key{ stmt_arena() }; uint64_t rid = 0; uint64_t right = 0; };
+
+    // 1 inserted, 0 duplicate, -1 I/O error
+    int insert_into(uint64_t pno, const uint8_t* key, uint64_t rid, Split& up) {
+        pmr::vector<uint8_t> page(PAGE_SIZE + inner_entry(), stmt_arena());   // room for one entry past capacity before a split
+        if (!read(pno, page.data())) return -1;
+        NodeHeader h = header(page.data());
+        if (h.leaf) {
+            uint32_t i = lower(page.data(), key, rid);
+            if (i < h.count) {
+                const uint8_t* e = entry(page.data(), i, true);
+                if (cmp(e, u64(e + keyWidth), key, rid) == 0) return 0;
+            }
+            uint32_t es = leaf_entry();
+            uint8_t* at = entry(page.data(), i, true);
+            memmove(at + es, at, (size_t)(h.count - i) * es);
+            memcpy(at, key, keyWidth); memcpy(at + keyWidth, &rid, 8);
+            h.count++;
+            if (h.count <= leaf_cap()) { set_header(page.data(), h); return write(pno, page.data()) ? 1 : -1; }
+
+            // split: upper half moves to a new right sibling
+            pmr::vector<uint8_t> right(PAGE_SIZE, 0, stmt_arena());
+            uint32_t keep = h.count / 2, move = h.count - keep;
+            memcpy(entry(right.data(), 0, true), entry(page.data(), keep, true), (size_t)move * es);
+            uint64_t rpno = pages;
+            set_header(right.data(), NodeHeader{ 1, (uint16_t)move, 0, h.link });
+            h.count = (uint16_t)keep; h.link = rpno;
+            set_header(page.data(), h);
+            const uint8_t* first = entry(right.data(), 0, true);
+            up.happened = true;
+            up.key.assign(first, first + keyWidth);
+            up.rid = u64(first + keyWidth);
+            up.right = rpno;
+            return write(rpno, right.data()) && write(pno, page.data()) ? 1 : -1;
+        }
+
+        uint64_t child = child_for(page.data(), key, rid);
+        Split below;
+        int r = insert_into(child, key, rid, below);
+        if (r != 1 || !below.happened) return r;
+
+        uint32_t i = lower(page.data(), below.key.data(), below.rid);
+        uint32_t es = inner_entry();
+        uint8_t* at = entry(page.data(), i, false);
+        memmove(at + es, at, (size_t)(h.count - i) * es);
+        memcpy(at, below.key.data(), keyWidth);
+        memcpy(at + keyWidth, &below.rid, 8);
+        memcpy(at + keyWidth + 8, &below.right, 8);
+        h.count++;
+        if (h.count <= inner_cap()) { set_header(page.data(), h); return write(pno, page.data()) ? 1 : -1; }
+
+        // split: the middle separator moves up, its child becomes the right node's link
+        pmr::vector<uint8_t> right(PAGE_SIZE, 0, stmt_arena());
+        uint32_t mid = h.count / 2, move = h.count - mid - 1;
+        const uint8_t* m = entry(page.data(), mid, false);
+        up.happened = true;
+        up.key.assign(m, m + keyWidth);
+        up.rid = u64(m + keyWidth);
+        memcpy(entry(right.data(), 0, false), entry(page.data(), mid + 1, false), (size_t)move * es);
+        uint64_t rpno = pages;
+        set_header(right.data(), NodeHeader{ 0, (uint16_t)move, 0, u64(m + keyWidth + 8) });
+        up.right = rpno;
+        h.count = (uint16_t)mid;
+        set_header(page.data(), h);
+        return write(rpno, right.data()) && write(pno, page.data()) ? 1 : -1;
+    }
+
+    // false on duplicate key (unique trees) or I/O error
+    bool insert(const uint8_t* key, uint64_t rid) {
+        auto lk = write_latch();
+        Split up;
+        int r = insert_into(root, key, rid, up);
+        if (r != 1) return false;
+        if (!up.happened) return true;
+        pmr::vector<uint8_t> page(PAGE_SIZE, 0, stmt_arena());
+        uint8_t* e = entry(page.data(), 0, false);
+        memcpy(e, up.key.data(), keyWidth);
+        memcpy(e + keyWidth, &up.rid, 8);
+        memcpy(e + keyWidth + 8, &up.right, 8);
+        set_header(page.data(), NodeHeader{ 0, 1, 0, root });
+        uint64_t newRoot = pages;
+        if (!write(newRoot, page.data())) return false;
+        root = newRoot;
+        return write_meta();
+    }
+
+    bool erase(const uint8_t* key, uint64_t rid) {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        auto lk = write_latch();
+        uint64_t pno;
+        if (!find_leaf(key, rid, pno, page.data())) return false;
+        NodeHeader h = header(page.data());
+        uint32_t i = lower(page.data(), key, rid);
+        if (i >= h.count) return false;
+        uint8_t* at = entry(page.data(), i, true);
+        if (cmp(at, u64(at + keyWidth), key, rid) != 0) return false;
+        uint32_t es = leaf_entry();
+        memmove(at, at + es, (size_t)(h.count - i - 1) * es);
+        h.count--;
+        set_header(page.data(), h);
+        return write(pno, page.data());
+    }
+
+    // Builds the tree bottom-up from entries sorted by (key, rid), replacing its contents.
+    bool bulk_load(const vector<uint8_t>& keys, const vector<uint64_t>& rids) {
+        auto lk = write_latch();
+        if (!reset()) return false;
+        size_t n = rids.size();
+        if (n == 0) return true;
+        struct Child { vector<uint8_t> key; uint64_t rid; uint64_t pno; };
+        vector<Child> level;
+        uint32_t fill = max(1u, leaf_cap() * 9 / 10);
+        vector<uint8_t> page(PAGE_SIZE);
+        for (size_t i = 0; i < n; ) {
+            fill_n(page.begin(), PAGE_SIZE, 0);
+            uint32_t cnt = (uint32_t)min<size_t>(fill, n - i);
+            uint64_t pno = level.empty() ? 1 : pages;
+            for (uint32_t k = 0; k < cnt; ++k) {
+                uint8_t* e = entry(page.data(), k, true);
+                memcpy(e, &keys[(i + k) * keyWidth], keyWidth);
+                memcpy(e + keyWidth, &rids[i + k], 8);
+            }
+            uint64_t next = i + cnt < n ? pno + 1 : 0;
+            set_header(page.data(), NodeHeader{ 1, (uint16_t)cnt, 0, next });
+            if (!write(pno, page.data())) return false;
+            level.push_back({ vector<uint8_t>(&keys[i * keyWidth], &keys[i * keyWidth] + keyWidth), rids[i], pno });
+            i += cnt;
+        }
+        uint32_t ifill = max(2u, inner_cap() * 9 / 10);
+        while (level.size() > 1) {
+            vector<Child> up;
+            for (size_t i = 0; i < level.size(); ) {
+                size_t cnt = min<size_t>(ifill + 1, level.size() - i);   // children in this node
+                fill_n(page.begin(), PAGE_SIZE, 0);
+                for (size_t k = 1; k < cnt; ++k) {
+                    uint8_t* e = entry(page.data(), (uint32_t)(k - 1), false);
+                    memcpy(e, level[i + k].key.data(), keyWidth);
+                    memcpy(e + keyWidth, &level[i + k].rid, 8);
+                    memcpy(e + keyWidth + 8, &level[i + k].pno, 8);
+                }
+                set_header(page.data(), NodeHeader{ 0, (uint16_t)(cnt - 1), 0, level[i].pno });
+                uint64_t pno = pages;
+                if (!write(pno, page.data())) return false;
+                up.push_back({ level[i].key, level[i].rid, pno });
+                i += cnt;
+            }
+            level.swap(up);
+        }
+        root = level[0].pno;
+        return write_meta();
+    }
+
+    // Calls fn(key, rid) for entries from the first (key, rid) >= (lo, 0) onwards
+    // (from the start when lo is null) until fn returns false. fn runs with
+    // the latch released; the leaf it walks is a copy.
+    template <class F>
+    void scan_from(const uint8_t* lo, F&& fn) const {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        {
+            auto lk = read_latch();
+            uint64_t pno = top();
+            while (true) {
+                if (!read(pno, page.data())) return;
+                NodeHeader h = header(page.data());
+                if (h.leaf) break;
+                pno = lo ? child_for(page.data(), lo, 0) : h.link;
+            }
+        }
+        uint32_t i = lo ? lower(page.data(), lo, 0) : 0;
+        while (true) {
+            NodeHeader h = header(page.data());
+            for (; i < h.count; ++i) {
+                const uint8_t* e = entry(page.data(), i, true);
+                if (!fn(e, u64(e + keyWidth))) return;
+            }
+            auto lk = read_latch();
+            if (!h.link || !read(h.link, page.data())) return;
+            i = 0;
+        }
+    }
+};
+
+/* ---------- hash index ----------
+  "using hash" indexes: a static hash table of bucket pages with overflow
+  chains, rehashed into twice the buckets once it averages a full page per bucket.
+    page 0           : HashMeta
+    page 1..buckets  : primary bucket pages
+    page buckets+1.. : overflow pages
+  A bucket page is a BucketHeader followed by unordered (key, rid) entries.
+*/
+static const char HASH_MAGIC[4] = { 'S','D','B','H' };
+static const uint32_t HASH_VERSION = 1;
+
+struct HashMeta {
+    char magic[4];
+    uint32_t version;
+    uint32_t keyWidth;
+    uint8_t numeric, pad[3];
+    uint64_t buckets;
+    uint64_t entries;
+};
+
+struct BucketHeader {
+    uint32_t count;
+    uint32_t pad;
+    uint64_t next;      // overflow page, 0 at the end of the chain
+};
+
+struct HashIndex {
+    int fd = -1;
+    PoolFile* pool = nullptr;
+    uint32_t keyWidth = 0;
+    bool numeric = true;
+    uint64_t buckets = 0;
+    uint64_t entries = 0;
+    uint64_t pages = 0;
+    shared_mutex* latch = nullptr;  // as BTree's
+    bool shared = false;
+
+    HashIndex() = default;
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+    HashIndex(HashIndex&& o) noexcept { *this = move(o); }
+    HashIndex& operator=(HashIndex&& o) noexcept {
+        if (this != &o) {
+            close();
+            fd = o.fd; pool = o.pool; keyWidth = o.keyWidth; numeric = o.numeric;
+            buckets = o.buckets; entries = o.entries; pages = o.pages; latch = o.latch; shared = o.shared;
+            o.fd = -1; o.pool = nullptr;
+        }
+        return *this;
+    }
+    ~HashIndex() { close(); }
+
+    void close() {
+        if (fd >= 0) { BUFFER_POOL.detach(pool); ::close(fd); }
+        fd = -1; pool = nullptr;
+    }
+
+    uint32_t entry_size() const { return keyWidth + 8; }
+    uint32_t cap() const { return (PAGE_SIZE - sizeof(BucketHeader)) / entry_size(); }
+
+    bool read(uint64_t pno, uint8_t* buf) const { return BUFFER_POOL.read(pool, pno, buf); }
+    bool write(uint64_t pno, const uint8_t* buf) {
+        if (!BUFFER_POOL.write(pool, pno, buf)) return false;
+        if (pno >= pages) pages = pno + 1;
+        return true;
+    }
+    shared_lock<shared_mutex> read_latch() const { return latch ? shared_lock<shared_mutex>(*latch) : shared_lock<shared_mutex>(); }
+    unique_lock<shared_mutex> write_latch() { return latch ? unique_lock<shared_mutex>(*latch) : unique_lock<shared_mutex>(); }
+
+    bool write_meta() {
+        uint8_t page[PAGE_SIZE] = {};
+        HashMeta m{};
+        memcpy(m.magic, HASH_MAGIC, 4);
+        m.version = HASH_VERSION; m.keyWidth = keyWidth; m.numeric = numeric;
+        m.buckets = buckets; m.entries = entries;
+        memcpy(page, &m, sizeof m);
+        return write(0, page);
+    }
+
+    // FNV-1a over the significant key bytes (varchar padding excluded),
+    // into nb buckets (the handle's when 0)
+    uint64_t bucket_of(const uint8_t* key, uint64_t nb = 0) const {
+        size_t n = 8;
+        if (!numeric) { uint16_t len; memcpy(&len, key, 2); n = 2 + (size_t)len; }
+        uint64_t h = 1469598103934665603ULL;
+        for (size_t i = 0; i < n; ++i) { h ^= key[i]; h *= 1099511628211ULL; }
+        return 1 + (h & ((nb ? nb : buckets) - 1));
+    }
+    bool same_key(const uint8_t* a, const uint8_t* b) const { return key_cmp(numeric, a, b) == 0; }
+    uint8_t* entry(uint8_t* page, uint32_t i) const { return page + sizeof(BucketHeader) + (size_t)i * entry_size(); }
+
+    bool open(const string& path, uint32_t kw, bool isNumeric, bool& created) {
+        close();
+        keyWidth = kw; numeric = isNumeric; created = false;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+        pool = BUFFER_POOL.attach(fd);
+        if (!pool) return false;
+        struct stat st;
+        fstat(fd, &st);
+        pages = (uint64_t)st.st_size / PAGE_SIZE;
+        HashMeta m{};
+        bool ok = pages >= 2 && BUFFER_POOL.read(pool, 0, &m, sizeof m) &&
+            memcmp(m.magic, HASH_MAGIC, 4) == 0 && m.version == HASH_VERSION &&
+            m.keyWidth == kw && (bool)m.numeric == isNumeric && m.buckets && pages > m.buckets;
+        if (ok) { buckets = m.buckets; entries = m.entries; return true; }
+        created = true;
+        auto lk = write_latch();
+        return reset(1);
+    }
+
+    // Empties the index into a power-of-two number of buckets, at least n.
+    bool reset(uint64_t n) {
+        if (!BUFFER_POOL.truncate(pool, 0)) return false;
+        buckets = 1;
+        while (buckets < n) buckets <<= 1;
+        entries = 0; pages = 0;
+        vector<uint8_t> page(PAGE_SIZE, 0);
+        if (!write(0, page.data())) return false;
+        for (uint64_t b = 1; b <= buckets; ++b) if (!write(b, page.data())) return false;
+        return write_meta();
+    }
+
+    bool put(const uint8_t* key, uint64_t rid) {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        uint64_t pno = bucket_of(key);
+        while (true) {
+            if (!read(pno, page.data())) return false;
+            BucketHeader h; memcpy(&h, page.data(), sizeof h);
+            if (h.count < cap()) {
+                uint8_t* e = entry(page.data(), h.count);
+                memcpy(e, key, keyWidth); memcpy(e + keyWidth, &rid, 8);
+                h.count++;
+                memcpy(page.data(), &h, sizeof h);
+                return write(pno, page.data());
+            }
+            if (!h.next) {
+                h.next = pages;
+                memcpy(page.data(), &h, sizeof h);
+                if (!write(pno, page.data())) return false;
+                fill(page.begin(), page.end(), 0);
+                pno = h.next;
+                if (!write(pno, page.data())) return false;
+                continue;
+            }
+            pno = h.next;
+        }
+    }
+
+    bool insert(const uint8_t* key, uint64_t rid) {
+        auto lk = write_latch();
+        if (entries + 1 > buckets * cap() && !grow(buckets * 2)) return false;
+        if (!put(key, rid)) return false;
+        entries++;
+        return write_meta();
+    }
+
+    bool erase(const uint8_t* key, uint64_t rid) {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        auto lk = write_latch();
+        for (uint64_t pno = bucket_of(key); pno; ) {
+            if (!read(pno, page.data())) return false;
+            BucketHeader h; memcpy(&h, page.data(), sizeof h);
+            for (uint32_t i = 0; i < h.count; ++i) {
+                uint8_t* e = entry(page.data(), i);
+                uint64_t r; memcpy(&r, e + keyWidth, 8);
+                if (r != rid || !same_key(e, key)) continue;
+                if (i + 1 < h.count) memcpy(e, entry(page.data(), h.count - 1), entry_size());
+                h.count--;
+                memcpy(page.data(), &h, sizeof h);
+                if (!write(pno, page.data())) return false;
+                entries--;
+                return write_meta();
+            }
+            pno = h.next;
+        }
+        return false;
+    }
+
+    // Calls fn(rid) for every entry stored under key, with the latch released.
+    template <class F>
+    void lookup(const uint8_t* key, F&& fn) const {
+        pmr::vector<uint8_t> page(PAGE_SIZE, stmt_arena());
+        pmr::vector<uint64_t> rids(stmt_arena());
+        {
+            auto lk = read_latch();
+            HashMeta m{};
+            uint64_t n = shared && BUFFER_POOL.read(pool, 0, &m, sizeof m) && m.buckets ? m.buckets : buckets;
+            for (uint64_t pno = bucket_of(key, n); pno; ) {
+                if (!read(pno, page.data())) break;
+                BucketHeader h; memcpy(&h, page.data(), sizeof h);
+                for (uint32_t i = 0; i < h.count; ++i) {
+                    const uint8_t* e = page.data() + sizeof(BucketHeader) + (size_t)i * entry_size();
+                    if (!same_key(e, key)) continue;
+                    uint64_t r; memcpy(&r, e + keyWidth, 8);
+                    rids.push_back(r);
+                }
+                pno = h.next;
+            }
+        }
+        for (uint64_t r : rids) fn(r);
+    }
+
+    // Replaces the contents with keys/rids, sized so chains stay about one page long.
+    bool build(const vector<uint8_t>& keys, const vector<uint64_t>& rids) {
+        auto lk = write_latch();
+        uint64_t per = max<uint64_t>(1, cap() * 3 / 4);
+        if (!reset((rids.size() + per - 1) / per)) return false;
+        for (size_t i = 0; i < rids.size(); ++i) if (!put(&keys[i * keyWidth], rids[i])) return false;
+        entries = rids.size();
+        return write_meta();
+    }
+
+    bool grow(uint64_t n) {
+        vector<uint8_t> keys;
+        vector<uint64_t> rids;
+        vector<uint8_t> page(PAGE_SIZE);
+        for (uint64_t b = 1; b <= buckets; ++b) {
+            for (uint64_t pno = b; pno; ) {
+                if (!read(pno, page.data())) return false;
+                BucketHeader h; memcpy(&h, page.data(), sizeof h);
+                for (uint32_t i = 0; i < h.count; ++i) {
+                    const uint8_t* e = entry(page.data(), i);
+                    keys.insert(keys.end(), e, e + keyWidth);
+                    uint64_t r; memcpy(&r, e + keyWidth, 8);
+                    rids.push_back(r);
+                }
+                pno = h.next;
+            }
+        }
+        if (!reset(n)) return false;
+        for (size_t i = 0; i < rids.size(); ++i) if (!put(&keys[i * keyWidth], rids[i])) return false;
+        entries = rids.size();
+        return write_meta();
+    }
+};
+
+static string pk_index_path(const string& table) { return data_path(table + ".pk"); }
+static string index_path(const string& table, const string& index) { return data_path(table + "." + index + ".idx"); }
+
+// One secondary index of an open table; bt or hash is used depending on def->kind.
+struct SecondaryIndex {
+    const IndexDef* def = nullptr;
+    BTree bt;
+    HashIndex hash;
+
+    bool is_hash() const { return def->kind == "hash"; }
+    bool insert(const uint8_t* key, uint64_t rid) { return is_hash() ? hash.insert(key, rid) : bt.insert(key, rid); }
+    bool erase(const uint8_t* key, uint64_t rid) { return is_hash() ? hash.erase(key, rid) : bt.erase(key, rid); }
+};
+
+/* ---------- zone maps ----------
+  <Table>.zone describes the table a segment at a time, a segment being the
+  rows of one scan morsel: MORSEL_PAGES pages of a row table, MORSEL_ROWS
+  rids of a columnar one. For each segment it keeps the smallest and largest
+  value of every int, date and decimal column and, for the columns named in
+  the table's bloom(...) clause, a Bloom filter of their values. A full scan
+  skips the segments they prove can't hold a matching row.
+  Entries only widen: an insert or update adds its values, a delete leaves
+  them be, so they stay true (if loose) until rebuilt from the rows. That
+  happens when the file is missing or doesn't cover every row, and after
+  WAL recovery replays the table.
+    header  : ZoneHeader
+    segment : has-rows word, ncols minimums, ncols maximums,
+              bloomWords words per bloom column
+*/
+static const uint64_t MORSEL_PAGES = 64;
+static const uint64_t MORSEL_ROWS = COLUMN_BLOCK * 4;
+static const char ZONE_MAGIC[4] = { 'S','D','B','Z' };
+static const uint32_t ZONE_VERSION = 1;
+static const uint32_t BLOOM_PROBES = 3;
+
+struct ZoneHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t segRows;
+    uint64_t rows;          // end_rid() of the table the zones were written for
+    uint32_t ncols, nbloom;
+    uint64_t bloomWords;
+};
+
+static string zone_path(const string& table) { return data_path(table + ".zone"); }
+
+// Hashes for the Bloom filters: numbers by value, varchars by their bytes.
+static uint64_t zone_mix(uint64_t h) {
+    h += 0x9E3779B97F4A7C15ULL;                 // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+static uint64_t zone_hash_str(const void* p, size_t n) {
+    const uint8_t* b = (const uint8_t*)p;
+    uint64_t h = 14695981039346656037ULL;       // FNV-1a
+    for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 1099511628211ULL; }
+    return zone_mix(h);
+}
+
+static uint64_t zone_hash(const ColumnDef& cd, const uint8_t* f) {
+    if (cd.kind != COL_VARCHAR) return zone_mix((uint64_t)decode_num(cd, f));
+    uint16_t n; memcpy(&n, f, 2);
+    return zone_hash_str(f + 2, n);
+}
+
+struct ZoneMap {
+    const TableDef* def = nullptr;
+    const TableFile* tf = nullptr;
+    uint64_t segRows = 0, bloomWords = 0;
+    uint32_t ncols = 0;
+    vector<int> bloomCols;
+    vector<uint64_t> segs;          // recWords words per segment, as on disk
+    set<uint64_t> dirty;            // segments to write back
+    bool whole = false;             // write everything (new or rebuilt)
+
+    ZoneMap() = default;
+    ZoneMap(const ZoneMap&) = delete;
+    ZoneMap& operator=(const ZoneMap&) = delete;
+    ~ZoneMap() { close(); }
+
+    size_t recWords() const { return 1 + 2 * (size_t)ncols + bloomCols.size() * bloomWords; }
+    uint64_t count() const { return recWords() ? segs.size() / recWords() : 0; }
+    uint64_t* rec(uint64_t s) { return &segs[s * recWords()]; }
+    const uint64_t* rec(uint64_t s) const { return &segs[s * recWords()]; }
+
+    // Loads the zones of tf's table, rebuilding them from the rows when the
+    // file is missing or stale.
+    void open(const TableFile& file) {
+        tf = &file;
+        def = file.def;
+        ncols = (uint32_t)def->cols.size();
+        bloomCols = def->bloomCols;
+        segRows = def->columnar ? MORSEL_ROWS : MORSEL_PAGES * def->rowsPerPage;
+        uint64_t bits = 64;
+        while (bits < segRows * 10) bits *= 2;  // ~10 bits a row: about 1% false positives
+        bloomWords = bits / 64;
+        segs.clear(); dirty.clear(); whole = false;
+        if (!segRows) return;
+        int fd = ::open(zone_path(def->name).c_str(), O_RDONLY);
+        ZoneHeader h;
+        bool ok = fd >= 0 && pread(fd, &h, sizeof h, 0) == (ssize_t)sizeof h &&
+            memcmp(h.magic, ZONE_MAGIC, 4) == 0 && h.version == ZONE_VERSION && h.segRows == segRows &&
+            h.rows == file.end_rid() && h.ncols == ncols && h.nbloom == bloomCols.size() && h.bloomWords == bloomWords;
+        if (ok) {
+            segs.resize((h.rows + segRows - 1) / segRows * recWords());
+            ok = pread_full(fd, segs.data(), segs.size() * 8, sizeof h);
+        }
+        if (fd >= 0) ::close(fd);
+        if (!ok) rebuild();
+    }
+
+    void rebuild(uint64_t from = 0) {
+        if (!from) segs.clear();
+        scan_rows(*tf, [&](const uint8_t* r, uint64_t rid) { add(r, rid); }, from);
+        whole = true;
+    }
+
+    // Adds empty segments (no rows, min > max) up to n.
+    void grow(uint64_t n) {
+        size_t w = recWords();
+        if (n <= count()) return;
+        size_t old = segs.size();
+        segs.resize(n * w, 0);
+        for (size_t at = old; at < segs.size(); at += w) {
+            for (uint32_t c = 0; c < ncols; ++c) { segs[at + 1 + c] = (uint64_t)INT64_MAX; segs[at + 1 + ncols + c] = (uint64_t)INT64_MIN; }
+        }
+    }
+
+    // Widens rid's segment to cover row r.
+    void add(const uint8_t* r, uint64_t rid) {
+        if (!tf || !segRows) return;
+        uint64_t s = rid / segRows;
+        grow(s + 1);
+        uint64_t* z = rec(s);
+        z[0] = 1;
+        for (uint32_t c = 0; c < ncols; ++c) {
+            const ColumnDef& cd = def->cols[c];
+            if (cd.kind == COL_VARCHAR) continue;
+            int64_t v = field_num(*def, r, (int)c);
+            if (v < (int64_t)z[1 + c]) z[1 + c] = (uint64_t)v;
+            if (v > (int64_t)z[1 + ncols + c]) z[1 + ncols + c] = (uint64_t)v;
+        }
+        for (size_t b = 0; b < bloomCols.size(); ++b) {
+            int c = bloomCols[b];
+            uint64_t* bits = z + 1 + 2 * ncols + b * bloomWords;
+            uint64_t h = zone_hash(def->cols[c], r + def->offsets[c]);
+            for (uint32_t k = 0; k < BLOOM_PROBES; ++k) {
+                uint64_t bit = (h + k * ((h >> 32) | 1)) & (bloomWords * 64 - 1);
+                bits[bit / 64] |= 1ULL << (bit % 64);
+            }
+        }
+        if (!whole) dirty.insert(s);
+    }
+
+    // Whether bloom column b of segment s may hold a value hashing to h.
+    bool bloom_may_hold(uint64_t s, size_t b, uint64_t h) const {
+        const uint64_t* bits = rec(s) + 1 + 2 * ncols + b * bloomWords;
+        for (uint32_t k = 0; k < BLOOM_PROBES; ++k) {
+            uint64_t bit = (h + k * ((h >> 32) | 1)) & (bloomWords * 64 - 1);
+            if (!(bits[bit / 64] >> (bit % 64) & 1)) return false;
+        }
+        return true;
+    }
+
+    bool save() {
+        if (!tf || !segRows || (!whole && dirty.empty())) return true;
+        uint64_t rows = tf->end_rid();
+        if ((rows + segRows - 1) / segRows > count()) { grow((rows + segRows - 1) / segRows); whole = true; }
+        int fd = ::open(zone_path(def->name).c_str(), O_RDWR | O_CREAT | (whole ? O_TRUNC : 0), 0644);
+        if (fd < 0) return false;
+        ZoneHeader h;
+        memcpy(h.magic, ZONE_MAGIC, 4);
+        h.version = ZONE_VERSION;
+        h.segRows = segRows;
+        h.rows = rows;
+        h.ncols = ncols;
+        h.nbloom = (uint32_t)bloomCols.size();
+        h.bloomWords = bloomWords;
+        size_t w = recWords() * 8;
+        bool ok = true;
+        if (whole) ok = pwrite_full(fd, segs.data(), segs.size() * 8, sizeof h);
+        else for (uint64_t s : dirty) ok = ok && pwrite_full(fd, rec(s), w, (off_t)(sizeof h + s * w));
+        ok = ok && pwrite_full(fd, &h, sizeof h, 0);
+        ::close(fd);
+        dirty.clear();
+        whole = false;
+        return ok;
+    }
+
+    void close() {
+        save();
+        tf = nullptr;
+        segs.clear();
+    }
+};
+
+/* ---------- table locks ----------
+  Sessions (see saaddb.h) run statements at the same time; a statement
+  that changes a table holds its row lock for its whole run (see
+  "statement locks"). Readers don't take it: they read a snapshot (see
+  "row versions") while one writer at a time changes the table, and only
+  keep load out. So readers' index lookups run alongside a writer's index
+  changes, each under the table's index latch, held briefly.
+  Opening or closing a handle can write a table's index and zone files
+  even for a reader (rebuilding a missing index, saving zones), so handles
+  of one table open and close one at a time under its files mutex.
+*/
+// A statement that gives up on a lock at once (its session's lock wait is
+// 0) keeps its turn in the lock's queue: a server parks it instead of
+// keeping a thread waiting (see server.cpp) and runs it again when
+// lock_released() says a lock with parked statements in its queue was
+// released, which bumps LOCK_RELEASES and calls ON_LOCK_RELEASE (see
+// saaddb::on_lock_release). LOCK_QUEUED points at the place the running
+// session keeps, or is null if it waits instead.
+static atomic<uint64_t> LOCK_RELEASES{ 0 };
+static mutex ON_LOCK_RELEASE_MUTEX;     // the vacuum thread may release locks while it's set
+static function<void()> ON_LOCK_RELEASE;
+static thread_local RwLock** LOCK_QUEUED = nullptr;
+
+static void lock_released() {
+    LOCK_RELEASES.fetch_add(1);
+    lock_guard<mutex> lk(ON_LOCK_RELEASE_MUTEX);
+    if (ON_LOCK_RELEASE) ON_LOCK_RELEASE();
+}
+
+// A reader/writer lock that hands itself out in the order it was asked
+// for: a request that can't have it yet queues, and no one gets past a
+// queued writer, so a stream of selects can't starve an update (the
+// pthread rwlock under shared_mutex prefers readers). Waiters sleep on its
+// condition variable until a release wakes them; parked ones (LOCK_QUEUED)
+// stay queued when they give up, and the session has one place at a time.
+// Works with shared_lock / unique_lock.
+class RwLock {
+    struct Waiter {
+        const void* owner;
+        bool exclusive;
+        bool parked;        // not waiting here; told by lock_released()
+    };
+    mutex m;
+    condition_variable cv;
+    deque<Waiter> queue;    // first come, first served
+    unsigned readers = 0;
+    bool writer = false;
+
+    // Whether owner may have the lock now: nothing held is in the way, and
+    // no one queued before it wants what it can't share (m held).
+    bool may(const void* owner, bool exclusive) const {
+        if (writer || (exclusive && readers)) return false;
+        for (const Waiter& w : queue) {
+            if (w.owner == owner) return true;
+            if (w.exclusive || exclusive) return false;
+        }
+        return true;
+    }
+    deque<Waiter>::iterator find(const void* owner) {
+        return find_if(queue.begin(), queue.end(), [&](const Waiter& w) { return w.owner == owner; });
+    }
+    bool any_parked() const {
+        return any_of(queue.begin(), queue.end(), [](const Waiter& w) { return w.parked; });
+    }
+    // After a release or a waiter leaving: wakes the waiters, and tells
+    // the parked ones (lk is released first).
+    void released(unique_lock<mutex>& lk) {
+        bool told = any_parked();
+        lk.unlock();
+        cv.notify_all();
+        if (told) lock_released();
+    }
+
+    bool acquire(bool exclusive, chrono::steady_clock::time_point t) {
+        RwLock** place = LOCK_QUEUED;
+        if (place && *place && *place != this) leave(place);
+        const void* owner = place ? (const void*)place : (const void*)&place;
+        unique_lock<mutex> lk(m);
+        auto it = find(owner);
+        if (!may(owner, exclusive)) {
+            if (it == queue.end()) {
+                if (!place && t <= chrono::steady_clock::now()) return false;   // only trying
+                queue.push_back(Waiter{ owner, exclusive, place != nullptr });
+            }
+            else it->exclusive = exclusive;
+            if (!cv.wait_until(lk, t, [&] { return may(owner, exclusive); })) {
+                if (place) { *place = this; return false; }      // keeps its turn
+                queue.erase(find(owner));
+                released(lk);
+                return false;
+            }
+            it = find(owner);
+        }
+        if (it != queue.end()) queue.erase(it);
+        if (place && *place == this) *place = nullptr;
+        if (exclusive) writer = true;
+        else ++readers;
+        return true;
+    }
+
+public:
+    void lock() { acquire(true, chrono::steady_clock::time_point::max()); }
+    void unlock() {
+        unique_lock<mutex> lk(m);
+        writer = false;
+        released(lk);
+    }
+    void lock_shared() { acquire(false, chrono::steady_clock::time_point::max()); }
+    void unlock_shared() {
+        unique_lock<mutex> lk(m);
+        if (--readers == 0) released(lk);
+    }
+
+    // Transactions wait with a deadline instead (see "transactions").
+    bool try_lock() {
+        lock_guard<mutex> lk(m);
+        if (!may(nullptr, true)) return false;
+        writer = true;
+        return true;
+    }
+    bool try_lock_until(chrono::steady_clock::time_point t) { return acquire(true, t); }
+    bool try_lock_shared_until(chrono::steady_clock::time_point t) { return acquire(false, t); }
+
+    // Gives up the turn the session whose place this is kept here.
+    void leave(RwLock** place) {
+        unique_lock<mutex> lk(m);
+        if (*place == this) *place = nullptr;
+        auto it = find(place);
+        if (it == queue.end()) return;
+        queue.erase(it);
+        released(lk);
+    }
+};
+
+struct TableLock {
+    RwLock rows;            // exclusive to change the table's rows
+    RwLock bulk;            // shared to read the table, exclusive to load it
+    shared_mutex indexes;   // the index files' latch (see BTree::read_latch)
+    mutex files;
+};
+static RwLock ENGINE_LOCK;         // see "statement locks"
+static mutex TABLE_LOCKS_MUTEX;
+static unordered_map<string, unique_ptr<TableLock>> TABLE_LOCKS;
+
+static TableLock& table_lock(const string& table) {
+    lock_guard<mutex> lk(TABLE_LOCKS_MUTEX);
+    unique_ptr<TableLock>& l = TABLE_LOCKS[table];
+    if (!l) l.reset(new TableLock());
+    return *l;
+}
+
+/* ---------- open tables ----------
+  A TableHandle is a table file plus its indexes, opened for one statement.
+  Row changes go through insert_row / the index helpers below so the
+  indexes never fall behind the data file.
+*/
+struct TableHandle {
+    const TableDef* def = nullptr;
+    TableFile file;
+    BTree pk;
+    vector<SecondaryIndex> indexes;
+    ZoneMap zones;          // declared after file: saved while file is still open
+    TableLock* lock = nullptr;  // set while open
+
+    ~TableHandle() { close(); }
+
+    // Closes everything so the handle can be opened again.
+    void close() {
+        if (!lock) return;
+        lock_guard<mutex> lk(lock->files);
+        lock = nullptr;
+        zones.close();
+        indexes.clear();
+        pk.close();
+        file.close();
+    }
+};
+
+// (key, rid) of column col for every live row, sorted as bt orders them when bt is given.
+static void collect_keys(TableHandle& th, int col, const BTree* bt, vector<uint8_t>& keys, vector<uint64_t>& rids) {
+    const TableDef& def = *th.def;
+    uint32_t kw = key_width(def.cols[col]);
+    vector<uint8_t> raw;
+    vector<uint64_t> rawRids;
+    vector<uint8_t> key(kw);
+    scan_rows(th.file, [&](const uint8_t* rec, uint64_t rid) {
+        row_key(def, col, rec, key.data());
+        raw.insert(raw.end(), key.begin(), key.end());
+        rawRids.push_back(rid);
+    });
+    if (!bt) { keys.swap(raw); rids.swap(rawRids); return; }
+    vector<size_t> order(rawRids.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return bt->cmp(&raw[a * kw], rawRids[a], &raw[b * kw], rawRids[b]) < 0;
+    });
+    keys.resize(raw.size());
+    rids.resize(rawRids.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        memcpy(&keys[i * kw], &raw[order[i] * kw], kw);
+        rids[i] = rawRids[order[i]];
+    }
+}
+
+// Rebuilds the PK index from the table rows; false if the table holds duplicate keys.
+static bool rebuild_pk_index(TableHandle& th) {
+    vector<uint8_t> keys;
+    vector<uint64_t> rids;
+    collect_keys(th, th.def->pkIndex, &th.pk, keys, rids);
+    uint32_t kw = th.pk.keyWidth;
+    for (size_t i = 1; i < rids.size(); ++i)
+        if (th.pk.cmp(&keys[(i - 1) * kw], 0, &keys[i * kw], 0) == 0) return false;
+    return th.pk.bulk_load(keys, rids);
+}
+
+static bool rebuild_index(TableHandle& th, SecondaryIndex& ix) {
+    vector<uint8_t> keys;
+    vector<uint64_t> rids;
+    collect_keys(th, ix.def->col, ix.is_hash() ? nullptr : &ix.bt, keys, rids);
+    return ix.is_hash() ? ix.hash.build(keys, rids) : ix.bt.bulk_load(keys, rids);
+}
+
+static bool open_index(TableHandle& th, const IndexDef& d, SecondaryIndex& ix) {
+    const ColumnDef& c = th.def->cols[d.col];
+    ix.def = &d;
+    ix.bt.latch = ix.hash.latch = &th.lock->indexes;
+    ix.bt.shared = ix.hash.shared = th.pk.shared;
+    bool created;
+    string path = index_path(th.def->name, d.name);
+    bool ok = ix.is_hash() ? ix.hash.open(path, key_width(c), c.kind != COL_VARCHAR, created)
+        : ix.bt.open(path, key_width(c), c.kind != COL_VARCHAR, false, created);
+    if (!ok) return false;
+    return !created || th.file.empty() || rebuild_index(th, ix);
+}
+
+// Adds row rid to the secondary indexes (the PK index is handled by the caller).
+static bool index_row(TableHandle& th, const uint8_t* rec, uint64_t rid) {
+    pmr::vector<uint8_t> key(stmt_arena());
+    for (auto& ix : th.indexes) {
+        key.resize(key_width(th.def->cols[ix.def->col]));
+        row_key(*th.def, ix.def->col, rec, key.data());
+        if (!ix.insert(key.data(), rid)) return false;
+    }
+    return true;
+}
+
+// Removes row rid from the secondary indexes on column col (every column when col < 0).
+static void unindex_row(TableHandle& th, const uint8_t* rec, uint64_t rid, int col = -1) {
+    pmr::vector<uint8_t> key(stmt_arena());
+    for (auto& ix : th.indexes) {
+        if (col >= 0 && ix.def->col != col) continue;
+        key.resize(key_width(th.def->cols[ix.def->col]));
+        row_key(*th.def, ix.def->col, rec, key.data());
+        ix.erase(key.data(), rid);
+    }
+}
+
+// Appends rec and indexes it; false with err set on a duplicate PK or write failure.
+static bool insert_row(TableHandle& th, const uint8_t* rec, string& err) {
+    const TableDef& def = *th.def;
+    pmr::vector<uint8_t> key(th.pk.keyWidth, stmt_arena());
+    row_key(def, def.pkIndex, rec, key.data());
+    uint64_t existing;
+    if (th.pk.find(key.data(), existing)) { err = "PK already exists."; return false; }
+    uint64_t rid;
+    if (!th.file.append(rec, &rid)) { err = "Write failed."; return false; }
+    if (!th.pk.insert(key.data(), rid) || !index_row(th, rec, rid)) { err = "Index write failed."; return false; }
+    th.zones.add(rec, rid);
+    ROWS_WRITTEN.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+// Ends a statement's changes to th. A statement that is a transaction of
+// its own commits here, so the one log sync before th's pages go out
+// covers its commit record too.
+static bool flush_changes(TableHandle& th) {
+    Transaction* tx = TXN;
+    if (tx && !tx->open && tx->wrote && !tx->endPos) tx->endPos = wal_end_txn(WAL_COMMIT, *tx);
+    return th.file.flush();
+}
+
+static long import_text_rows(TableHandle& th, const string& path, long& rejected);
+
+// Opens the table file and its indexes, migrating a legacy text table and
+// rebuilding missing or outdated indexes on the way. A reading statement's
+// handle sees its snapshot (see "row versions").
+static bool open_table(const TableDef& def, TableHandle& th) {
+    th.def = &def;
+    th.lock = &table_lock(def.name);
+    lock_guard<mutex> lk(th.lock->files);
+    if (!wal_touch(def.name)) { fail(Error::IoError) << "[SaadDB] Cannot write " << WAL_FILE << "\n"; return false; }
+    string legacy;
+    if (!open_table_file(def, th.file, legacy)) return false;
+    th.pk.latch = &th.lock->indexes;
+    th.pk.shared = READER != nullptr;
+    const ColumnDef& pkc = def.cols[def.pkIndex];
+    bool created;
+    if (!th.pk.open(pk_index_path(def.name), key_width(pkc), pkc.kind != COL_VARCHAR, true, created)) return false;
+    if (created && !th.file.empty() && !rebuild_pk_index(th)) {
+        fail(Error::IoError) << "[SaadDB] <" << def.name << "> has duplicate primary keys; index not built\n";
+        return false;
+    }
+    th.indexes.clear();
+    th.indexes.reserve(def.indexes.size());
+    for (const auto& d : def.indexes) {
+        if (d.col < 0) continue;
+        th.indexes.emplace_back();
+        if (!open_index(th, d, th.indexes.back())) {
+            fail(Error::IoError) << "[SaadDB] Cannot open index " << d.name << "\n";
+            return false;
+        }
+    }
+    th.zones.open(th.file);
+    // a writer may widen zones before this handle closes: rebuilt ones go out now
+    if (READER && th.zones.whole) th.zones.save();
+    if (!legacy.empty()) {
+        long rejected = 0;
+        long n = import_text_rows(th, legacy, rejected);
+        OUT << "[SaadDB] migrated <" << def.name << "> to binary format: " << n << " rows";
+        if (rejected) OUT << ", " << rejected << " rejected";
+        OUT << " (text copy kept in " << legacy << ")\n";
+    }
+    if (READER) {
+        TableVersions& tv = table_versions(def.name);
+        lock_guard<mutex> vl(tv.m);
+        th.file.view = SnapshotView{ &tv, READER, tv.generation };
+    }
+    return true;
+}
+
+// Every file of a table: data, then indexes and zones.
+static vector<string> table_files(const TableDef& def) {
+    vector<string> out{ table_path(def.name) };
+    if (def.columnar) {
+        for (const auto& c : def.cols) {
+            out.push_back(column_path(def.name, c.name));
+            if (c.kind == COL_VARCHAR) out.push_back(blob_path(def.name, c.name));
+        }
+    }
+    out.push_back(pk_index_path(def.name));
+    for (const auto& ix : def.indexes) out.push_back(index_path(def.name, ix.name));
+    out.push_back(zone_path(def.name));
+    return out;
+}
+
+// Makes the file at path durable, with the pages the pool holds dirty for it.
+static void fsync_path(const string& path) {
+    BUFFER_POOL.write_back(path);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+// Moves the files compaction built (as table built) over def's own; the
+// ones already moved are skipped. Syncs the directory.
+static bool compact_swap(const TableDef& built, const TableDef& def) {
+    vector<string> from = table_files(built), to = table_files(def);
+    bool ok = true;
+    for (size_t i = 0; i < from.size(); ++i) {
+        if (!file_exists(from[i])) continue;
+        BUFFER_POOL.forget(to[i]);
+        if (rename(from[i].c_str(), to[i].c_str()) != 0) ok = false;
+    }
+    fsync_path(DATA_DIR.empty() ? "." : DATA_DIR);
+    return ok;
+}
+
+// Folds the log into the data files: everything it describes is already in
+// them or in the buffer pool's dirty pages (table files flush when a
+// statement ends), so write those back, make it all durable and start a
+// new, empty log. Callers make sure no transaction is open.
+static bool wal_checkpoint() {
+    if (!wal_flush(true)) return false;
+    lock_guard<mutex> lk(WAL_MUTEX);
+    if (WAL.fd < 0) return true;
+    if (!wal_write_locked() || !BUFFER_POOL.write_back()) return false;
+    for (const auto& name : WAL.touched) {
+        const TableDef* def = lookup_table(name);
+        if (def) for (const auto& path : table_files(*def)) fsync_path(path);
+    }
+    if (ftruncate(WAL.fd, 0) != 0) return false;
+    fsync(WAL.fd);
+    WAL.size = 0;
+    WAL.synced = WAL.written = WAL.appended;
+    WAL.touched.clear();
+    return true;
+}
+
+// Sets slot rid of a table file to image (made live), or frees it when image is null.
+static void wal_apply(TableFile& tf, uint64_t rid, const uint8_t* image) {
+    const TableDef& def = *tf.def;
+    if (tf.cols) {
+        uint8_t dead = ROW_FREE;
+        if (!image) tf.cols->put(rid, &dead, 1);
+        else { tf.cols->put(rid, image, def.rowSize); tf.cols->pending[rid][0] = ROW_LIVE; }
+        return;
+    }
+    uint64_t pno = 1 + rid / def.rowsPerPage;
+    uint32_t slot = (uint32_t)(rid % def.rowsPerPage);
+    uint8_t* page = tf.page_for_write(pno);
+    PageHeader ph; memcpy(&ph, page, sizeof ph);
+    uint8_t* rec = slot_ptr(def, page, slot);
+    if (!image) rec[0] = ROW_FREE;
+    else { memcpy(rec, image, def.rowSize); rec[0] = ROW_LIVE; }
+    if (slot >= ph.used) ph.used = slot + 1;
+    ph.live = 0;
+    for (uint32_t s = 0; s < ph.used; ++s) ph.live += slot_ptr(def, page, s)[0] == ROW_LIVE;
+    memcpy(page, &ph, sizeof ph);
+}
+
+// Opens the log, replaying it into the data files first if the last run
+// didn't end with a checkpoint: every change is redone in log order, then
+// the changes of transactions that never ended are undone newest first.
+// Indexes and zone maps of replayed tables are dropped and rebuilt from the
+// data the next time the table is opened.
+static bool wal_recover() {
+    WAL.fd = ::open(WAL_FILE.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (WAL.fd < 0) { OUT << "[SaadDB] Cannot open " << WAL_FILE << "\n"; return false; }
+    // one process per database: a second REPL or server would replay and truncate a live log
+    if (flock(WAL.fd, LOCK_EX | LOCK_NB) != 0) { OUT << "[SaadDB] " << WAL_FILE << " is in use by another process\n"; return false; }
+    struct stat st;
+    if (fstat(WAL.fd, &st) != 0) return false;
+    if (st.st_size == 0) return true;
+
+    vector<uint8_t> log((size_t)st.st_size);
+    if (pread(WAL.fd, log.data(), log.size(), 0) != (ssize_t)log.size()) return false;
+    map<string, unique_ptr<TableFile>> files;
+    map<string, uint64_t> loads;    // unfinished bulk loads: table -> first rid
+    set<string> replayed;
+    set<uint64_t> ended;            // transactions with a commit or abort record
+    struct Change { WalRecord r; const TableDef* def; const uint8_t* image; };
+    vector<Change> changes;
+    auto file_of = [&](const string& name, const TableDef* def) -> TableFile* {
+        unique_ptr<TableFile>& tf = files[name];
+        if (!tf) {
+            tf.reset(new TableFile());
+            string legacy;
+            if (!is_binary_table_file(table_path(name)) || !open_table_file(*def, *tf, legacy)) tf.reset();
+        }
+        return tf.get();
+    };
+    size_t at = 0;
+    // A torn or corrupt record ends the log: nothing after it was acknowledged.
+    while (at + sizeof(WalRecord) <= log.size()) {
+        WalRecord r; memcpy(&r, &log[at], sizeof r);
+        if (r.size < sizeof r || r.size > log.size() - at ||
+            r.size != sizeof r + r.nameLen + r.imageLen ||
+            fnv1a32(&log[at + 8], r.size - 8) != r.sum) break;
+        string name((const char*)&log[at + sizeof r], r.nameLen);
+        const uint8_t* image = &log[at + sizeof r + r.nameLen];
+        at += r.size;
+        if (r.type == WAL_COMMIT || r.type == WAL_ABORT) { ended.insert(r.txn); continue; }
+        const TableDef* def = lookup_table(name);
+        if (!def) continue;
+        replayed.insert(name);
+        if (r.type == WAL_TOUCH) continue;
+        if (r.type == WAL_LOAD) { loads[name] = r.rid; continue; }
+        if (r.type == WAL_LOAD_DONE) { loads.erase(name); continue; }
+        if (r.type == WAL_COMPACT) {
+            TableDef built = *def;
+            built.name.assign((const char*)image, r.imageLen);
+            compact_swap(built, *def);
+            changes.erase(remove_if(changes.begin(), changes.end(), [&](const Change& c) { return c.def == def; }), changes.end());
+            loads.erase(name);
+            continue;
+        }
+        uint32_t want = r.type == WAL_UPDATE ? 2 * def->rowSize : def->rowSize;
+        if (r.imageLen != want || (!def->columnar && def->rowsPerPage == 0)) continue;
+        changes.push_back(Change{ r, def, image });
+    }
+    long applied = 0, undone = 0;
+    set<uint64_t> losers;
+    for (const Change& c : changes) {
+        TableFile* tf = file_of(c.def->name, c.def);
+        if (!tf) continue;
+        const uint8_t* after = c.r.type == WAL_DELETE ? nullptr : c.r.type == WAL_UPDATE ? c.image + c.def->rowSize : c.image;
+        wal_apply(*tf, c.r.rid, after);
+        ++applied;
+    }
+    for (auto it = changes.rbegin(); it != changes.rend(); ++it) {
+        if (!it->r.txn || ended.count(it->r.txn)) continue;
+        TableFile* tf = file_of(it->def->name, it->def);
+        if (!tf) continue;
+        wal_apply(*tf, it->r.rid, it->r.type == WAL_INSERT ? nullptr : it->image);
+        losers.insert(it->r.txn);
+        ++undone;
+    }
+    for (const auto& kv : loads) {
+        TableFile* tf = file_of(kv.first, lookup_table(kv.first));
+        if (tf && tf->truncate_rows(kv.second))
+            OUT << "[SaadDB] rolled back an unfinished load into <" << kv.first << ">\n";
+    }
+    for (auto& kv : files) if (kv.second) kv.second->close();
+    for (const auto& name : replayed) {
+        remove(pk_index_path(name).c_str());
+        remove(zone_path(name).c_str());
+        for (const auto& ix : lookup_table(name)->indexes) remove(index_path(name, ix.name).c_str());
+        WAL.touched.insert(name);
+    }
+    if (!wal_checkpoint()) return false;
+    OUT << "[SaadDB] recovered " << applied << " logged row changes from " << WAL_FILE << "\n";
+    if (!losers.empty())
+        OUT << "[SaadDB] undid " << undone << " changes of " << losers.size() << " unfinished transaction(s)\n";
+    return true;
+}
+
+/* ---------- worker pool ----------
+  A fixed set of threads shared by every parallel statement (set threads N;
+  0 means one per hardware thread). A job is a MorselRun: n independent
+  pieces of work. Its morsels are dealt round-robin onto the workers'
+  deques; a worker takes from the front of its own deque and, when that is
+  empty, steals from the back of another's. The submitting thread doesn't
+  run morsels; it collects finished ones (in order or as they come).
+*/
+static thread_local unsigned WORKER_SLOT = 0;  // 0 on the statement's thread, 1..N on pool workers
+
+struct MorselRun {
+    size_t n = 0;
+    function<void(size_t)> work;
+    atomic<bool> cancel{false};     // set once the consumer has had enough
+    mutex m;
+    condition_variable cv;
+    vector<char> done;
+    deque<size_t> finished;     // completion order
+};
+
+struct WorkerPool {
+    struct Queue {
+        mutex m;
+        deque<pair<MorselRun*, size_t>> q;
+    };
+    vector<thread> threads;
+    vector<unique_ptr<Queue>> queues;
+    mutex m;
+    condition_variable cv;
+    size_t queued = 0;
+    atomic<size_t> next{0};     // round-robin cursor
+    bool stopping = false;
+
+    ~WorkerPool() { stop(); }
+
+    size_t size() const { return threads.size(); }
+
+    void start(unsigned n) {
+        stop();
+        stopping = false;
+        for (unsigned i = 0; i < n; ++i) queues.emplace_back(new Queue());
+        SignalsBlocked blocked;
+        for (unsigned i = 0; i < n; ++i) threads.emplace_back([this, i] { loop(i); });
+    }
+
+    void stop() {
+        { lock_guard<mutex> lk(m); stopping = true; }
+        cv.notify_all();
+        for (auto& t : threads) t.join();
+        threads.clear(); queues.clear();
+        queued = 0;
+    }
+
+    void submit(MorselRun& run) {
+        run.done.assign(run.n, 0);
+        for (size_t i = 0; i < run.n; ++i) {
+            Queue& q = *queues[next++ % queues.size()];
+            lock_guard<mutex> lk(q.m);
+            q.q.emplace_back(&run, i);
+        }
+        { lock_guard<mutex> lk(m); queued += run.n; }
+        cv.notify_all();
+    }
+
+    bool take(size_t self, pair<MorselRun*, size_t>& item) {
+        {
+            Queue& q = *queues[self];
+            lock_guard<mutex> lk(q.m);
+            if (!q.q.empty()) { item = q.q.front(); q.q.pop_front(); return true; }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& q = *queues[(self + k) % queues.size()];
+            lock_guard<mutex> lk(q.m);
+            if (!q.q.empty()) { item = q.q.back(); q.q.pop_back(); return true; }
+        }
+        return false;
+    }
+
+    void loop(size_t self) {
+        WORKER_SLOT = (unsigned)self + 1;
+        while (true) {
+            {
+                unique_lock<mutex> lk(m);
+                cv.wait(lk, [&] { return stopping || queued > 0; });
+                if (stopping) return;
+            }
+            pair<MorselRun*, size_t> item;
+            if (!take(self, item)) { this_thread::yield(); continue; }
+            { lock_guard<mutex> lk(m); --queued; }
+            MorselRun& run = *item.first;
+            if (!run.cancel.load(memory_order_relaxed)) run.work(item.second);
+            lock_guard<mutex> lk(run.m);
+            run.done[item.second] = 1;
+            run.finished.push_back(item.second);
+            run.cv.notify_all();
+        }
+    }
+};
+
+static unsigned THREADS = 0;    // set threads N; 0 = hardware threads
+static WorkerPool POOL;
+
+static unsigned thread_count() {
+    return THREADS ? THREADS : max(1u, thread::hardware_concurrency());
+}
+
+// Runs work(i) for i in [0, n) on the pool and calls consume(i) on this
+// thread as morsels finish: in index order when ordered, else in completion
+// order. Once consume returns false the morsels not yet started are skipped.
+// With one thread (or one morsel) everything runs here, in order.
+static void run_morsels(size_t n, bool ordered, const function<void(size_t)>& work, const function<bool(size_t)>& consume) {
+    if (n == 0) return;
+    unsigned want = thread_count();
+    if (want <= 1 || n == 1) {
+        for (size_t i = 0; i < n; ++i) { work(i); if (!consume(i)) return; }
+        return;
+    }
+    {
+        // statements of several sessions may get here at once
+        static mutex starting;
+        lock_guard<mutex> lk(starting);
+        if (POOL.size() != want) POOL.start(want);
+    }
+    MorselRun run;
+    run.n = n;
+    run.work = work;
+    POOL.submit(run);
+    for (size_t k = 0; k < n; ++k) {
+        size_t i;
+        {
+            unique_lock<mutex> lk(run.m);
+            if (ordered) { run.cv.wait(lk, [&] { return run.done[k] != 0; }); i = k; }
+            else {
+                run.cv.wait(lk, [&] { return !run.finished.empty(); });
+                i = run.finished.front();
+                run.finished.pop_front();
+            }
+        }
+        if (!run.cancel.load() && !consume(i)) run.cancel = true;
+    }
+}
+
+/* ---------- compiled WHERE ----------
+  A WHERE clause is compiled once per statement into a Predicate: column
+  names become field offsets, literals are parsed into the column's own
+  representation, and each term gets a comparison kernel for its type and
+  operator. AND binds tighter than OR, so the clause is kept as an OR of
+  AND-groups and evaluation stops at the first false term / true group.
+*/
+enum CmpOp : uint8_t { OP_EQ, OP_NE, OP_LT, OP_GT, OP_LE, OP_GE };   // LE/GE only reach varchar terms
+
+struct Term;
+typedef bool (*TermKernel)(const Term&, const uint8_t*);
+
+struct Term {
+    TermKernel fn = nullptr;
+    int col = -1;           // -1 for a constant term
+    ColKind kind = COL_INT;
+    CmpOp op = OP_EQ;
+    uint32_t off = 0;       // field offset in the row
+    int64_t num = 0;        // int / date (days) / decimal (scaled) literal
+    string str;             // varchar literal
+};
+
+template <class V, CmpOp OP>
+static bool num_kernel(const Term& t, const uint8_t* rec) {
+    V x; memcpy(&x, rec + t.off, sizeof x);
+    int64_t a = x;
+    if constexpr (OP == OP_EQ) return a == t.num;
+    if constexpr (OP == OP_NE) return a != t.num;
+    if constexpr (OP == OP_LT) return a < t.num;
+    if constexpr (OP == OP_GT) return a > t.num;
+}
+
+template <CmpOp OP>
+static bool str_kernel(const Term& t, const uint8_t* rec) {
+    uint16_t n; memcpy(&n, rec + t.off, 2);
+    string_view a((const char*)rec + t.off + 2, n);
+    if constexpr (OP == OP_EQ) return a == t.str;
+    if constexpr (OP == OP_NE) return a != t.str;
+    if constexpr (OP == OP_LT) return a < t.str;
+    if constexpr (OP == OP_GT) return a > t.str;
+    if constexpr (OP == OP_LE) return a <= t.str;
+    if constexpr (OP == OP_GE) return a >= t.str;
+}
+
+static bool true_kernel(const Term&, const uint8_t*) { return true; }
+static bool false_kernel(const Term&, const uint8_t*) { return false; }
+
+template <class V>
+static TermKernel num_kernel_for(CmpOp op) {
+    switch (op) {
+    case OP_EQ: return num_kernel<V, OP_EQ>;
+    case OP_NE: return num_kernel<V, OP_NE>;
+    case OP_LT: return num_kernel<V, OP_LT>;
+    default:    return num_kernel<V, OP_GT>;
+    }
+}
+
+static TermKernel str_kernel_for(CmpOp op) {
+    switch (op) {
+    case OP_EQ: return str_kernel<OP_EQ>;
+    case OP_NE: return str_kernel<OP_NE>;
+    case OP_LT: return str_kernel<OP_LT>;
+    case OP_LE: return str_kernel<OP_LE>;
+    case OP_GE: return str_kernel<OP_GE>;
+    default:    return str_kernel<OP_GT>;
+    }
+}
+
+struct Predicate {
+    vector<vector<Term>> groups;    // OR of AND-groups; empty = no WHERE
+
+    bool conjunctive() const { return groups.size() == 1; }
+    bool eval(const uint8_t* rec) const {
+        if (groups.empty()) return true;
+        for (const auto& g : groups) {
+            bool ok = true;
+            for (const auto& t : g) if (!t.fn(t, rec)) { ok = false; break; }
+            if (ok) return true;
+        }
+        return false;
+    }
+};
+
+// Whether term t may hold for some row of zone segment s.
+static bool zone_term_may_match(const ZoneMap& zm, uint64_t s, const Term& t) {
+    if (t.col < 0) return t.fn(t, nullptr);
+    if (t.kind == COL_VARCHAR) {
+        if (t.op != OP_EQ) return true;
+        auto it = find(zm.bloomCols.begin(), zm.bloomCols.end(), t.col);
+        if (it == zm.bloomCols.end()) return true;
+        return zm.bloom_may_hold(s, (size_t)(it - zm.bloomCols.begin()), zone_hash_str(t.str.data(), t.str.size()));
+    }
+    const uint64_t* z = zm.rec(s);
+    int64_t lo = (int64_t)z[1 + t.col], hi = (int64_t)z[1 + zm.ncols + t.col];
+    switch (t.op) {
+    case OP_EQ: {
+        if (t.num < lo || t.num > hi) return false;
+        auto it = find(zm.bloomCols.begin(), zm.bloomCols.end(), t.col);
+        if (it == zm.bloomCols.end()) return true;
+        return zm.bloom_may_hold(s, (size_t)(it - zm.bloomCols.begin()), zone_mix((uint64_t)t.num));
+    }
+    case OP_NE: return lo != hi || lo != t.num;
+    case OP_LT: return lo < t.num;
+    case OP_GT: return hi > t.num;
+    default:    return true;
+    }
+}
+
+// Whether any row of zone segment s may match pred.
+static bool zone_may_match(const ZoneMap& zm, uint64_t s, const Predicate& pred) {
+    if (s >= zm.count()) return true;       // rows the zones don't know about yet
+    if (!zm.rec(s)[0]) return false;        // never held a row
+    if (pred.groups.empty()) return true;
+    for (const auto& g : pred.groups) {
+        bool may = true;
+        for (const auto& t : g) if (!zone_term_may_match(zm, s, t)) { may = false; break; }
+        if (may) return true;
+    }
+    return false;
+}
+
+// Numeric literal in column c's integer representation (days, or value * 10^S).
+// exact is false when it falls between two representable values; v is then the lower one.
+// beyond is -1 / +1 when the literal lies below / above every int64 (v is then unset).
+static bool numeric_literal(const ColumnDef& c, const string& text, int64_t& v, bool& exact, int& beyond) {
+    exact = true; beyond = 0;
+    if (c.kind == COL_DATE) {
+        int32_t d;
+        if (!parse_date(text, d)) return false;
+        v = d;
+        return true;
+    }
+    if (!is_number(text)) return false;
+    int scale = c.kind == COL_DECIMAL ? c.scale : 0;
+    size_t i = 0; bool neg = false;
+    if (text[0] == '+' || text[0] == '-') { neg = text[0] == '-'; i = 1; }
+    const uint64_t LIMIT = (uint64_t)INT64_MAX + 1;   // |INT64_MIN|
+    uint64_t mag = 0; bool over = false;
+    for (; i < text.size() && text[i] != '.'; ++i) {
+        if (!over && mag > (LIMIT - (text[i] - '0')) / 10) over = true;
+        if (!over) mag = mag * 10 + (text[i] - '0');
+    }
+    int fracDigits = 0;
+    if (i < text.size()) {
+        for (++i; i < text.size(); ++i) {
+            if (fracDigits < scale) {
+                if (!over && mag > (LIMIT - (text[i] - '0')) / 10) over = true;
+                if (!over) mag = mag * 10 + (text[i] - '0');
+                ++fracDigits;
+            }
+            else if (text[i] != '0') exact = false;
+        }
+    }
+    for (; !over && fracDigits < scale; ++fracDigits) {
+        if (mag > LIMIT / 10) over = true;
+        else mag *= 10;
+    }
+    // past INT64_MAX, or at/below INT64_MIN with a fraction still to go
+    if (over || (!neg && mag == LIMIT) || (neg && mag == LIMIT && !exact)) { beyond = neg ? -1 : 1; return true; }
+    v = neg ? (int64_t)(0 - mag) - (exact ? 0 : 1) : (int64_t)mag;
+    return true;
+}
+
+static Term constant_term(bool value) {
+    Term t;
+    t.fn = value ? true_kernel : false_kernel;
+    return t;
+}
+
+static bool parse_operator(const string& text, CmpOp& op) {
+    if (text == "=") op = OP_EQ;
+    else if (text == "!=") op = OP_NE;
+    else if (text == "<") op = OP_LT;
+    else if (text == ">") op = OP_GT;
+    else if (text == "<=") op = OP_LE;
+    else if (text == ">=") op = OP_GE;
+    else return false;
+    return true;
+}
+
+// Compiles "column idx (named col) op literal" against def.
+static bool compile_term(const TableDef& def, int idx, const string& col, CmpOp op, const string& lit,
+    Term& t, string& err) {
+    const ColumnDef& c = def.cols[idx];
+    t.col = idx; t.kind = c.kind; t.op = op; t.off = def.offsets[idx];
+    if (c.kind == COL_VARCHAR) {
+        t.str = lit;
+        t.fn = str_kernel_for(op);
+        // a literal longer than the column can never be equal to it
+        if ((int)lit.size() > c.length && (op == OP_EQ || op == OP_NE)) t = constant_term(op == OP_NE);
+        return true;
+    }
+    int64_t v; bool exact; int beyond;
+    if (!numeric_literal(c, lit, v, exact, beyond)) { err = "Value " + lit + " doesn't match type of " + col; return false; }
+    // a literal past every int64 compares the same way with every row
+    if (beyond) {
+        bool below = op == OP_LT || op == OP_LE;
+        t = constant_term(op == OP_NE || (op != OP_EQ && below == (beyond > 0)));
+        return true;
+    }
+    if (!exact) {
+        if (op == OP_EQ || op == OP_NE) { t = constant_term(op == OP_NE); return true; }
+        if (op == OP_LT) {          // col < 4.5  <=>  col < 5
+            if (v == INT64_MAX) { t = constant_term(true); return true; }
+            ++v;
+        }
+    }
+    // <= and >= become < and > on the neighbouring integer, so numbers keep
+    // to the four compares the vector kernels and index ranges know; at the
+    // ends of int64 there is no neighbour and the term is constant
+    if (op == OP_LE) {              // col <= 4.5  <=>  col < 5
+        if (v == INT64_MAX) { t = constant_term(true); return true; }
+        op = OP_LT; ++v;
+    }
+    else if (op == OP_GE) {         // col >= 4  <=>  col > 3;  col >= 4.5  <=>  col > 4
+        if (exact && v == INT64_MIN) { t = constant_term(true); return true; }
+        op = OP_GT; if (exact) --v;
+    }
+    if ((op == OP_LT && v == INT64_MIN) || (op == OP_GT && v == INT64_MAX)) { t = constant_term(false); return true; }
+    t.op = op;
+    t.num = v;
+    t.fn = c.kind == COL_DATE ? num_kernel_for<int32_t>(op) : num_kernel_for<int64_t>(op);
+    return true;
+}
+
+// Compiles "col op literal" against def.
+static bool compile_term(const TableDef& def, const string& col, const string& opText, const string& lit,
+    Term& t, string& err) {
+    int idx = column_index(def, col);
+    if (idx < 0) { err = "Unknown column " + col; return false; }
+    CmpOp op;
+    if (!parse_operator(opText, op)) { err = "Unknown operator " + opText; return false; }
+    return compile_term(def, idx, col, op, lit, t, err);
+}
+
+// A WHERE value that is a statement parameter (see "statement cache"):
+// args[arg] is compiled into groups[group][term] when the values are bound.
+struct WhereSlot {
+    size_t arg = 0, group = 0, term = 0;
+    int col = -1;
+    CmpOp op = OP_EQ;
+    string name;            // the column as the statement wrote it
+};
+
+// cheapest terms first: constants, then fixed-width numbers, then strings
+static void order_terms(Predicate& pred) {
+    auto rank = [](const Term& t) { return t.col < 0 ? 0 : t.kind == COL_VARCHAR ? 2 : 1; };
+    for (auto& g : pred.groups)
+        stable_sort(g.begin(), g.end(), [&](const Term& a, const Term& b) { return rank(a) < rank(b); });
+}
+
+// Compiles the WHERE clause starting at T[wherePos]; no clause (wherePos past the
+// end or not at "where") compiles to an always-true predicate. Given slots,
+// the values at the token positions in params are left to bind_where (the
+// k-th position takes args[k]) and the terms keep the clause's order until then.
+static bool compile_where(const TableDef& def, const Tokens& T, int wherePos, Predicate& pred, string& err,
+    const vector<int>* params = nullptr, vector<WhereSlot>* slots = nullptr) {
+    pred.groups.clear();
+    if (slots) slots->clear();
+    if (wherePos >= (int)T.size() || !is_kw(T[wherePos], "where")) return true;
+    pred.groups.emplace_back();
+    int j = wherePos + 1;
+    while (true) {
+        if (j + 2 >= (int)T.size()) { err = "Incomplete WHERE clause"; return false; }
+        Term t;
+        auto param = slots ? find(params->begin(), params->end(), j + 2) : vector<int>::const_iterator();
+        if (slots && param != params->end()) {
+            WhereSlot ws;
+            ws.arg = (size_t)(param - params->begin());
+            ws.group = pred.groups.size() - 1;
+            ws.term = pred.groups.back().size();
+            ws.name = T[j];
+            if ((ws.col = column_index(def, T[j])) < 0) { err = "Unknown column " + T[j]; return false; }
+            if (!parse_operator(T[j + 1], ws.op)) { err = "Unknown operator " + T[j + 1]; return false; }
+            slots->push_back(move(ws));
+        }
+        else if (!compile_term(def, T[j], T[j + 1], T[j + 2], t, err)) return false;
+        pred.groups.back().push_back(move(t));
+        j += 3;
+        if (j >= (int)T.size()) break;
+        if (is_kw(T[j], "or")) pred.groups.emplace_back();
+        else if (!is_kw(T[j], "and")) { err = "Expected AND/OR, got " + T[j]; return false; }
+        ++j;
+    }
+    if (!slots || slots->empty()) order_terms(pred);
+    return true;
+}
+
+// pred = the WHERE compiled into tmpl with args in its slots.
+static bool bind_where(const TableDef& def, const Predicate& tmpl, const vector<WhereSlot>& slots,
+    const vector<string>& args, Predicate& pred, string& err) {
+    pred.groups = tmpl.groups;
+    for (const WhereSlot& ws : slots)
+        if (!compile_term(def, ws.col, ws.name, ws.op, args[ws.arg], pred.groups[ws.group][ws.term], err)) return false;
+    order_terms(pred);
+    return true;
+}
+
+// pred as it runs, for explain: terms in evaluation order, literals after
+// rewriting (so d <= x shows as d < the day after x).
+static string predicate_text(const TableDef& def, const Predicate& pred) {
+    static const char* OPS[] = { "=", "!=", "<", ">", "<=", ">=" };
+    string out;
+    vector<uint8_t> scratch(def.rowSize, 0);
+    char buf[FIELD_BUF];
+    for (size_t g = 0; g < pred.groups.size(); ++g) {
+        if (g) out += " or ";
+        bool paren = pred.groups.size() > 1 && pred.groups[g].size() > 1;
+        if (paren) out += "(";
+        for (size_t k = 0; k < pred.groups[g].size(); ++k) {
+            const Term& t = pred.groups[g][k];
+            if (k) out += " and ";
+            if (t.col < 0) { out += t.fn(t, nullptr) ? "true" : "false"; continue; }
+            out += def.cols[t.col].name + " " + OPS[t.op] + " ";
+            if (t.kind == COL_VARCHAR) { out += "\"" + t.str + "\""; continue; }
+            if (t.kind == COL_DATE) { int32_t d = (int32_t)t.num; memcpy(&scratch[t.off], &d, 4); }
+            else memcpy(&scratch[t.off], &t.num, 8);
+            out += string(field_view(def, scratch.data(), t.col, buf));
+        }
+        if (paren) out += ")";
+    }
+    return out;
+}
+
+/* ---------- vectorized filters ----------
+  Column-at-a-time comparison kernels for columnar scans: compare a block of
+  packed int64 (int, decimal) or int32 (date) values against a literal and
+  set bit i of the selection bitmap when value i passes. AVX2 and SSE4.2
+  versions are picked once at startup from the CPU; the scalar version is
+  the fallback and handles the tail of a block that isn't a multiple of 64.
+*/
+typedef void (*VecKernel)(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits);
+
+template <class V, CmpOp OP>
+static void vec_scalar(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits) {
+    const V* a = (const V*)col;
+    V x = (V)lit;
+    for (size_t w = 0; w * 64 < n; ++w) {
+        uint64_t m = 0;
+        size_t end = min(n, w * 64 + 64);
+        for (size_t i = w * 64; i < end; ++i) {
+            bool hit;
+            if constexpr (OP == OP_EQ) hit = a[i] == x;
+            else if constexpr (OP == OP_NE) hit = a[i] != x;
+            else if constexpr (OP == OP_LT) hit = a[i] < x;
+            else hit = a[i] > x;
+            m |= (uint64_t)hit << (i - w * 64);
+        }
+        bits[w] = m;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <CmpOp OP>
+__attribute__((target("avx2")))
+static void vec_i64_avx2(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits) {
+    const int64_t* a = (const int64_t*)col;
+    __m256i L = _mm256_set1_epi64x(lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        uint64_t m = 0;
+        for (int k = 0; k < 16; ++k) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(a + w * 64 + k * 4));
+            __m256i r;
+            if constexpr (OP == OP_EQ || OP == OP_NE) r = _mm256_cmpeq_epi64(v, L);
+            else if constexpr (OP == OP_LT) r = _mm256_cmpgt_epi64(L, v);
+            else r = _mm256_cmpgt_epi64(v, L);
+            m |= (uint64_t)(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(r)) << (k * 4);
+        }
+        bits[w] = OP == OP_NE ? ~m : m;
+    }
+    if (n % 64) vec_scalar<int64_t, OP>(col + full * 64 * 8, n % 64, lit, bits + full);
+}
+
+template <CmpOp OP>
+__attribute__((target("avx2")))
+static void vec_i32_avx2(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits) {
+    const int32_t* a = (const int32_t*)col;
+    __m256i L = _mm256_set1_epi32((int32_t)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        uint64_t m = 0;
+        for (int k = 0; k < 8; ++k) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(a + w * 64 + k * 8));
+            __m256i r;
+            if constexpr (OP == OP_EQ || OP == OP_NE) r = _mm256_cmpeq_epi32(v, L);
+            else if constexpr (OP == OP_LT) r = _mm256_cmpgt_epi32(L, v);
+            else r = _mm256_cmpgt_epi32(v, L);
+            m |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(r)) << (k * 8);
+        }
+        bits[w] = OP == OP_NE ? ~m : m;
+    }
+    if (n % 64) vec_scalar<int32_t, OP>(col + full * 64 * 4, n % 64, lit, bits + full);
+}
+
+template <CmpOp OP>
+__attribute__((target("sse4.2")))
+static void vec_i64_sse42(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits) {
+    const int64_t* a = (const int64_t*)col;
+    __m128i L = _mm_set1_epi64x(lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        uint64_t m = 0;
+        for (int k = 0; k < 32; ++k) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(a + w * 64 + k * 2));
+            __m128i r;
+            if constexpr (OP == OP_EQ || OP == OP_NE) r = _mm_cmpeq_epi64(v, L);
+            else if constexpr (OP == OP_LT) r = _mm_cmpgt_epi64(L, v);
+            else r = _mm_cmpgt_epi64(v, L);
+            m |= (uint64_t)(unsigned)_mm_movemask_pd(_mm_castsi128_pd(r)) << (k * 2);
+        }
+        bits[w] = OP == OP_NE ? ~m : m;
+    }
+    if (n % 64) vec_scalar<int64_t, OP>(col + full * 64 * 8, n % 64, lit, bits + full);
+}
+
+template <CmpOp OP>
+__attribute__((target("sse4.2")))
+static void vec_i32_sse42(const uint8_t* col, size_t n, int64_t lit, uint64_t* bits) {
+    const int32_t* a = (const int32_t*)col;
+    __m128i L = _mm_set1_epi32((int32_t)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        uint64_t m = 0;
+        for (int k = 0; k < 16; ++k) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(a + w * 64 + k * 4));
+            __m128i r;
+            if constexpr (OP == OP_EQ || OP == OP_NE) r = _mm_cmpeq_epi32(v, L);
+            else if constexpr (OP == OP_LT) r = _mm_cmpgt_epi32(L, v);
+            else r = _mm_cmpgt_epi32(v, L);
+            m |= (uint64_t)(unsigned)_mm_movemask_ps(_mm_castsi128_ps(r)) << (k * 4);
+        }
+        bits[w] = OP == OP_NE ? ~m : m;
+    }
+    if (n % 64) vec_scalar<int32_t, OP>(col + full * 64 * 4, n % 64, lit, bits + full);
+}
+#endif
+
+enum VecIsa { ISA_SCALAR, ISA_SSE42, ISA_AVX2 };
+
+static VecIsa detect_isa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return ISA_SSE42;
+#endif
+    return ISA_SCALAR;
+}
+
+static const VecIsa VEC_ISA = detect_isa();
+
+template <CmpOp OP>
+static VecKernel vec_kernel_op(bool wide) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (VEC_ISA == ISA_AVX2) return wide ? vec_i64_avx2<OP> : vec_i32_avx2<OP>;
+    if (VEC_ISA == ISA_SSE42) return wide ? vec_i64_sse42<OP> : vec_i32_sse42<OP>;
+#endif
+    return wide ? vec_scalar<int64_t, OP> : vec_scalar<int32_t, OP>;
+}
+
+// Kernel for a numeric term on a packed column of kind k.
+static VecKernel vec_kernel(ColKind k, CmpOp op) {
+    bool wide = k != COL_DATE;
+    switch (op) {
+    case OP_EQ: return vec_kernel_op<OP_EQ>(wide);
+    case OP_NE: return vec_kernel_op<OP_NE>(wide);
+    case OP_LT: return vec_kernel_op<OP_LT>(wide);
+    default:    return vec_kernel_op<OP_GT>(wide);
+    }
+}
+
+// Key bounds a conjunctive predicate puts on column col, from its =, < and >
+// terms on col. > and < are exclusive; the caller still evaluates the whole
+// predicate on every row it fetches.
+struct KeyRange {
+    bool usable = false;
+    bool point = false;
+    vector<uint8_t> eq, lo, hi;   // empty when unbounded
+};
+
+static void term_key(const ColumnDef& c, const Term& t, uint8_t* key) {
+    if (c.kind != COL_VARCHAR) { memcpy(key, &t.num, 8); return; }
+    uint16_t n = (uint16_t)t.str.size();
+    memset(key, 0, key_width(c));
+    memcpy(key, &n, 2);
+    memcpy(key + 2, t.str.data(), n);
+}
+
+static KeyRange where_key_range(const TableDef& def, int col, const Predicate& pred) {
+    KeyRange r;
+    if (!pred.conjunctive()) return r;
+    const ColumnDef& c = def.cols[col];
+    bool numeric = c.kind != COL_VARCHAR;
+    vector<uint8_t> key(key_width(c));
+    for (const Term& t : pred.groups[0]) {
+        if (t.col != col || t.op == OP_NE || t.op == OP_LE || t.op == OP_GE) continue;
+        if (!numeric && (int)t.str.size() > c.length) continue;
+        term_key(c, t, key.data());
+        if (t.op == OP_EQ) { if (!r.point) { r.point = true; r.eq = key; } }
+        else if (t.op == OP_GT) { if (r.lo.empty() || key_cmp(numeric, key.data(), r.lo.data()) > 0) r.lo = key; }
+        else { if (r.hi.empty() || key_cmp(numeric, key.data(), r.hi.data()) < 0) r.hi = key; }
+        r.usable = true;
+    }
+    return r;
+}
+
+
+static void parse_tokens(const string& q) {
+    TOKENS.clear();
+    string temp;
+    int group = -1, groups = 0, depth = 0;
+    // quoted tokens are values (see is_kw for keywords)
+    auto push = [&](string text, bool quoted) { TOKENS.emplace_back(move(text), quoted, group); };
+    auto flush = [&] { if (!temp.empty()) { push(temp, false); temp.clear(); } };
+    for (size_t i = 0; i < q.size(); ++i) {
+        char c = q[i];
+        if (c == '"' || c == '\'') {
+            string s;
+            ++i;
+            while (i < q.size() && q[i] != c) { s.push_back(q[i]); ++i; }
+            push(move(s), true);
+        }
+        else if (c == ' ' || c == '(' || c == ')' || c == ',' || c == ';') {
+            flush();
+            if (c == '(' && depth++ == 0) group = groups++;
+            if (c == ')' && depth > 0 && --depth == 0) group = -1;
+        }
+        else if (c == '!' && i + 1 < q.size() && q[i + 1] == '=') {
+            flush();
+            push("!=", false); ++i;
+        }
+        else if ((c == '<' || c == '>') && i + 1 < q.size() && q[i + 1] == '=') {
+            flush();
+            push(string(1, c) + "=", false); ++i;
+        }
+        else if (c == '<' || c == '>' || c == '=') {
+            flush();
+            push(string(1, c), false);
+        }
+        else {
+            temp.push_back(c);
+        }
+    }
+    flush();
+}
+
+
+
+static bool ensure_table_exists(const string& name) {
+    if (!table_exists(name)) {
+        fail() << "[SaadDB] table <" << name << "> doesn't exist\n";
+        return false;
+    }
+    return true;
+}
+static bool ensure_table_absent(const string& name) {
+    if (table_exists(name)) {
+        fail() << "[SaadDB] table <" << name << "> already exists\n";
+        return false;
+    }
+    for (const auto& def : REFUSED_TABLES) {
+        if (def.name == name) { fail() << "[SaadDB] table <" << name << "> exists but was refused at load\n"; return false; }
+    }
+    return true;
+}
+
+
+static void cmd_help(const Tokens& T) {
+    if (T.size() == 1) {
+        OUT << "Saad DB Help:\n"
+            "  help tables;\n"
+            "  help create; help drop; help insert; help select; help update; help delete;\n"
+            "  help import; help export; help load;\n"
+            "  checkpoint;   (fold the write-ahead log into the table files)\n"
+            "  vacuum;  vacuum T;   (rewrite tables without their dead space, rows in primary key order)\n"
+            "  show space;  show space T;   (live and dead rows, file sizes and space amplification per table)\n"
+            "  show stats;   (buffer pool hits, misses, evictions and write-backs)\n"
+            "  benchmark select ...;   (run a query without output; time, rows and allocations per row)\n"
+            "  benchmark insert|update|delete ...;   (run it; time and allocations per row written)\n"
+            "  explain select|update|delete ...;   (show the plan)\n"
+            "  explain analyze select|update|delete ...;   (run it and show time and counters per operator)\n"
+            "  begin; ... commit;  or  begin; ... rollback;   (several statements as one transaction)\n"
+            "  set synchronous full|normal|off;   (a commit waits for the disk / the log file / nothing)\n"
+            "  set commit_window N;   (microseconds a commit waits for others to share its log sync)\n"
+            "  set timing on|off;   (parse / plan / execute time after each statement)\n"
+            "  prepare q as select * from T where a>? limit ?;   execute q(10, 5);   deallocate q;\n"
+            "  set threads N;   (threads for scans and loads; 0 = one per hardware thread)\n"
+            "  set memory N;    (MB a query may hold before spilling to disk)\n"
+            "  set buffer_pool N;   (MB of table and index pages kept in memory)\n";
+        return;
+    }
+    if (T.size() >= 2) {
+        string k = lowered(T[1]);
+        if (k == "tables") {
+            if (!file_exists(SCHEMA_FILE)) { OUT << "[SaadDB] No schema yet.\n"; return; }
+            OUT << "Tables:\n";
+            for (const auto& name : CATALOG_ORDER) OUT << "  " << name << "\n";
+            if (CATALOG_ORDER.empty()) OUT << "  (none)\n";
+            return;
+        }
+        if (k == "create") {
+            OUT << "create table T(a int, b varchar(30), d date, x decimal(7,2), primary key(a));\n"
+                "create table F(a int, d date, x decimal(9,2), primary key(a)) storage columnar;\n"
+                "create table G(a int, b varchar(8), primary key(a)) bloom(b);   (Bloom filters on b let scans skip segments)\n"
+                "create index T_b on T(b) using hash;   create index T_d on T(d);  (btree is the default)\n"
+                "  (a row table's row must fit one 4 KB page: at most 4088 bytes, 1 status byte + 8 per int/decimal,\n"
+                "   4 per date, 2+N per varchar(N); columnar tables have no such limit)\n";
+            return;
+        }
+        if (k == "drop") { OUT << "drop table T;  drop index T_b;\n"; return; }
+        if (k == "insert") {
+            OUT << "insert into T values(1,\"Name\",24-02-2001,500.25);\n"
+                "insert into T values (1,\"A\",24-02-2001,1.00), (2,\"B\",25-02-2001,2.00);   (all rows or none)\n";
+            return;
+        }
+        if (k == "select") {
+            OUT << "select * from T where a>10;  select a,b from T where b!=\"x\";\n"
+                "select * from T where d>=01-01-2024 and d<=31-12-2024 and x<=99.5;   (=, !=, <, >, <=, >=)\n"
+                "select b, count(*), sum(x), avg(x), min(d), max(d) from T where a>10 group by b;\n"
+                "select * from T order by d desc, a limit 10;   select b, count(*) from T group by b order by count(*) desc;\n"
+                "select T.b, U.c from T join U on T.a = U.a where U.c>5;   (columns may be written table.col)\n";
+            return;
+        }
+        if (k == "update") { OUT << "update T set b=\"Z\", x=123.45 where a=1;\n"; return; }
+        if (k == "delete") { OUT << "delete from T where a!=5;\n"; return; }
+        if (k == "import") { OUT << "import T from \"T.txt\";   (text rows like <1,Name,24-02-2001,500.25>)\n"; return; }
+        if (k == "load") {
+            OUT << "load T from 'T.csv';   load T from 'T.csv' with header, delimiter ';';\n"
+                "  (one row per line; rows with bad values or repeated PKs are skipped and counted)\n";
+            return;
+        }
+        if (k == "export") { OUT << "export T to \"T.txt\";\n"; return; }
+        fail() << "[SaadDB] Unknown help topic.\n";
+    }
+}
+
+// Table owning the index called name, or nullptr.
+static TableDef* find_index_owner(const string& name) {
+    for (auto& kv : CATALOG)
+        for (const auto& ix : kv.second.indexes)
+            if (ix.name == name) return &kv.second;
+    return nullptr;
+}
+
+static void cmd_create_index(const Tokens& T) {
+
+    // create index <name> on <table> <col> [using hash|btree]
+    if (T.size() < 6 || !is_kw(T[3], "on")) { fail() << "[SaadDB] INVALID CREATE INDEX\n"; return; }
+    string name = T[2], table = T[4], col = T[5];
+    string kind = "btree";
+    if (T.size() >= 8 && is_kw(T[6], "using")) {
+        kind = lowered(T[7]);
+    }
+    if (kind != "hash" && kind != "btree") { fail() << "[SaadDB] Index type must be hash or btree\n"; return; }
+    if (!ensure_table_exists(table)) { fail() << "[SaadDB] Index not created\n"; return; }
+    if (find_index_owner(name)) { fail() << "[SaadDB] index <" << name << "> already exists\n"; return; }
+    TableDef& def = CATALOG[table];
+    int c = column_index(def, col);
+    if (c < 0) { fail() << "[SaadDB] Unknown column " << col << "\n"; return; }
+
+    remove(index_path(table, name).c_str());
+    def.indexes.push_back(IndexDef{ name, col, kind, c });
+    TableHandle th;
+    if (!open_table(def, th)) {
+        def.indexes.pop_back();
+        remove(index_path(table, name).c_str());
+        fail(Error::IoError) << "[SaadDB] Index not created\n"; return;
+    }
+    if (!save_catalog()) { fail(Error::IoError) << "[SaadDB] Failed writing schema.\n"; return; }
+    OUT << "[SaadDB] Index <" << name << "> created on " << table << "(" << col << ") using " << kind << ".\n";
+}
+
+static void cmd_drop_index(const Tokens& T) {
+
+    if (T.size() < 3) { fail() << "[SaadDB] INVALID DROP INDEX\n"; return; }
+    string name = T[2];
+    TableDef* def = find_index_owner(name);
+    if (!def) { fail() << "[SaadDB] index <" << name << "> doesn't exist\n"; return; }
+    auto& ixs = def->indexes;
+    ixs.erase(remove_if(ixs.begin(), ixs.end(), [&](const IndexDef& ix) { return ix.name == name; }), ixs.end());
+    BUFFER_POOL.forget(index_path(def->name, name));
+    remove(index_path(def->name, name).c_str());
+    if (!save_catalog()) { fail(Error::IoError) << "[SaadDB] Failed to update schema\n"; return; }
+    OUT << "[SaadDB] Index <" << name << "> dropped.\n";
+}
+
+static void cmd_create(const Tokens& T) {
+
+    if (T.size() >= 2 && is_kw(T[1], "index")) return cmd_create_index(T);
+    if (T.size() < 4 || !is_kw(T[0], "create") || !is_kw(T[1], "table")) { fail() << "[SaadDB] INVALID CREATE\n"; return; }
+    string table = T[2];
+    if (!ensure_table_absent(table)) { fail() << "[SaadDB] Table not created\n"; return; }
+
+
+    int n = (int)T.size();
+    int pPrimary = -1;
+    for (int i = 3; i < n; i++) if (is_kw(T[i], "primary")) { pPrimary = i; break; }
+    if (pPrimary == -1 || pPrimary + 2 >= n || !is_kw(T[pPrimary + 1], "key")) {
+        fail() << "[SaadDB] Defining primary key is mandatory. Table not created.\n"; return;
+    }
+    TableDef def;
+    def.name = table;
+    def.pk = T[pPrimary + 2];
+    for (int i = pPrimary + 3; i < n; ) {
+        if (is_kw(T[i], "storage")) {
+            string kind = i + 1 < n ? lowered(T[i + 1]) : "";
+            if (kind != "columnar" && kind != "row") { fail() << "[SaadDB] storage must be row or columnar\n"; return; }
+            def.columnar = kind == "columnar";
+            i += 2;
+        }
+        else if (is_kw(T[i], "bloom")) {
+            for (++i; i < n && !is_kw(T[i], "storage") && !is_kw(T[i], "bloom"); ++i) def.bloom.push_back(T[i]);
+            if (def.bloom.empty()) { fail() << "[SaadDB] bloom needs at least one column\n"; return; }
+        }
+        else { fail() << "[SaadDB] Unexpected " << T[i] << " after primary key\n"; return; }
+    }
+    for (int i = 3; i < pPrimary; ) {
+
+        if (i >= pPrimary) break;
+        string name = T[i++];
+        if (i >= pPrimary) { fail() << "[SaadDB] Column type missing for " << name << "\n"; return; }
+        string type = lowered(T[i++]); // int|varchar|date|decimal
+        ostringstream ln; ln << name << " " << type;
+
+        if (type == "varchar") {
+            if (i >= pPrimary) { fail() << "[SaadDB] varchar requires length\n"; return; }
+            ln << " " << T[i++]; // length
+        }
+        else if (type == "decimal") {
+            if (i + 1 >= pPrimary) { fail() << "[SaadDB] decimal requires P S\n"; return; }
+            ln << " " << T[i] << " " << T[i + 1]; // P S
+            i += 2;
+        }
+        else if (type == "int" || type == "date") {
+
+        }
+        else {
+            fail() << "[SaadDB] Unknown type " << type << "\n"; return;
+        }
+
+
+        if (i < pPrimary && is_kw(T[i], "check")) {
+            ln << " check";
+            while (i < pPrimary && !is_kw(T[i], "primary")) { ln << " " << T[i++]; }
+        }
+        ColumnDef c;
+        parse_column_line(ln.str(), c);
+        if (c.kind == COL_VARCHAR && c.length <= 0) { fail() << "[SaadDB] Bad varchar length for " << name << "\n"; return; }
+        if (c.kind == COL_DECIMAL && (c.precision < 1 || c.precision > 18 || c.scale < 0 || c.scale > c.precision)) {
+            fail() << "[SaadDB] decimal P S must satisfy 1 <= P <= 18, 0 <= S <= P\n"; return;
+        }
+        def.cols.push_back(c);
+    }
+
+    finish_table_def(def);
+    string why = table_def_error(def);
+    if (!why.empty()) { fail() << "[SaadDB] Bad table <" << table << ">: " << why << ". Table not created.\n"; return; }
+    if (def.bloomCols.size() != def.bloom.size()) { fail() << "[SaadDB] bloom names an unknown column\n"; return; }
+    if (def.rowsPerPage == 0 && !def.columnar) {
+        fail() << "[SaadDB] Row is " << def.rowSize << " bytes; a row table's rows must fit a " << PAGE_SIZE
+               << "-byte page (at most " << MAX_ROW_SIZE << " bytes: 1 status byte, 8 per int or decimal, 4 per date, 2+N per varchar(N))."
+               << " Use shorter varchars or storage columnar. Table not created.\n";
+        return;
+    }
+
+    // Log records name tables, so no record may outlive a table it could be replayed into.
+    wal_checkpoint();
+    if (!append_table_schema(def)) { fail(Error::IoError) << "[SaadDB] Failed writing schema.\n"; return; }
+    catalog_put(def);
+
+    TableFile tf;
+    if (!create_table_file(*lookup_table(table), table_path(table), tf)) { fail(Error::IoError) << "[SaadDB] Failed creating table file.\n"; return; }
+
+    OUT << "[SaadDB] Table <" << table << "> created successfully.\n";
+}
+
+static void cmd_drop(const Tokens& T) {
+
+    if (T.size() >= 2 && is_kw(T[1], "index")) return cmd_drop_index(T);
+    if (T.size() < 3) { fail() << "[SaadDB] INVALID DROP\n"; return; }
+    string table = T[2];
+    if (!ensure_table_exists(table)) { fail() << "[SaadDB] Table not dropped\n"; return; }
+
+    wal_checkpoint();
+    for (const auto& path : table_files(*lookup_table(table))) BUFFER_POOL.forget(path);
+    remove(table_path(table).c_str());
+    remove(pk_index_path(table).c_str());
+    remove(zone_path(table).c_str());
+    if (lookup_table(table)->columnar) {
+        for (const auto& c : lookup_table(table)->cols) {
+            remove(column_path(table, c.name).c_str());
+            remove(blob_path(table, c.name).c_str());
+        }
+    }
+    for (const auto& ix : lookup_table(table)->indexes) remove(index_path(table, ix.name).c_str());
+
+    catalog_erase(table);
+    if (!save_catalog()) { fail(Error::IoError) << "[SaadDB] Failed to update schema\n"; return; }
+    OUT << "[SaadDB] <" << table << "> dropped successfully.\n";
+}
+
+static void cmd_describe(const Tokens& T) {
+
+    if (T.size() < 2) { fail() << "[SaadDB] INVALID DESCRIBE\n"; return; }
+    string table = T[1];
+    if (!ensure_table_exists(table)) return;
+
+    for (const auto& ln : table_block_lines(*lookup_table(table))) OUT << ln << "\n";
+}
+
+// Validates vals against the column types and encodes them into rec (def.rowSize bytes).
+static bool check_values_match_schema(const vector<string>& vals, const TableDef& def, uint8_t* rec) {
+    if (vals.size() != def.cols.size()) return false;
+    memset(rec, 0, def.rowSize);
+    rec[0] = ROW_LIVE;
+    for (size_t i = 0; i < def.cols.size(); ++i) {
+        if (!encode_field(def.cols[i], vals[i], rec + def.offsets[i])) return false;
+    }
+    return true;
+}
+
+// Appends the rows of a legacy text table (<v1,...,vn> per line); rows that don't
+// match the schema or repeat a PK are counted in rejected.
+static long import_text_rows(TableHandle& th, const string& path, long& rejected) {
+    const TableDef& def = *th.def;
+    ifstream in(path);
+    string line, err; long n = 0;
+    vector<string> vals;
+    vector<uint8_t> rec(def.rowSize);
+    rejected = 0;
+    while (safe_getline(in, line)) {
+        trim_in_place(line);
+        if (line.empty()) continue;
+        split_csv_inside_tuple(line, vals);
+        if (!check_values_match_schema(vals, def, rec.data()) || !insert_row(th, rec.data(), err)) { ++rejected; continue; }
+        ++n;
+    }
+    return n;
+}
+
+/* ---------- insert / update / delete plans ----------
+  A change is parsed and resolved against the catalog once per plan, as a
+  select is (see SelectPlan): its values are encoded into the rows it
+  inserts or the fields it sets, and its WHERE is compiled. What runs per
+  call is binding the ? parameters (each encoded into its field, or
+  compiled into its WHERE term), opening the table and writing.
+  cmd_dml plans and runs in one go; cached and prepared statements keep
+  the plan until the schema changes (see "statement cache").
+*/
+struct DmlPlan {
+    enum Kind { INSERT, UPDATE, DELETE } kind = INSERT;
+    Tokens T;                   // the statement's tokens; parameters are ? until bound
+    vector<int> params;         // positions of the ? placeholders in T
+    uint64_t version = 0;       // CATALOG_VERSION the plan was made against
+    const TableDef* def = nullptr;
+    struct Field { size_t arg; int col; size_t at; };  // args[arg] goes into column col (at byte at of rows)
+    vector<Field> fields;
+    vector<uint8_t> rows;       // insert: its tuples, encoded back to back
+    size_t tuples = 0;
+    map<int, vector<uint8_t>> updates;     // update: column -> encoded field
+    Predicate pred;             // update / delete: WHERE; its parameters wait in slots
+    vector<WhereSlot> slots;
+    Predicate bound;            // pred with this call's values in its slots
+};
+
+// " (tuple n)" for the t-th of several tuples.
+static string tuple_where(const DmlPlan& p, size_t t) {
+    return p.tuples > 1 ? " (tuple " + to_string(t + 1) + ")" : string();
+}
+
+static bool plan_insert(DmlPlan& p) {
+    const Tokens& T = p.T;
+    if (T.size() < 4 || !is_kw(T[0], "insert") || !is_kw(T[1], "into")) { fail() << "[SaadDB] INVALID INSERT\n"; return false; }
+    const string& table = T[2];
+    if (!ensure_table_exists(table)) { fail() << "[SaadDB] Tuple not inserted\n"; return false; }
+
+    int i = keyword_pos(T, "values", 3);
+    if (i >= (int)T.size() - 1) { fail() << "[SaadDB] VALUES missing.\n"; return false; }
+    ++i;
+
+    // One tuple per (...) group, as [first, end) token positions; a bare value list counts as one tuple.
+    vector<pair<int, int>> tuples;
+    int group = INT_MIN;
+    for (; i < (int)T.size(); ++i) {
+        int g = T[i].group;
+        if (tuples.empty() || g != group) tuples.emplace_back(i, i);
+        group = g;
+        tuples.back().second = i + 1;
+    }
+
+    const TableDef& def = *lookup_table(table);
+    p.def = &def;
+
+    // literal values are encoded now, parameters per call
+    p.tuples = tuples.size();
+    p.rows.assign(p.tuples * def.rowSize, 0);
+    size_t a = 0;
+    for (size_t t = 0; t < p.tuples; ++t) {
+        size_t count = (size_t)(tuples[t].second - tuples[t].first);
+        if (count != def.attrs.size()) {
+            fail() << "[SaadDB] Values count mismatch" << tuple_where(p, t) << ". Expected " << def.attrs.size() << ", got " << count << "\n";
+            return false;
+        }
+        uint8_t* rec = &p.rows[t * def.rowSize];
+        rec[0] = ROW_LIVE;
+        for (size_t c = 0; c < count; ++c) {
+            int k = tuples[t].first + (int)c;
+            size_t at = t * def.rowSize + def.offsets[c];
+            while (a < p.params.size() && p.params[a] < k) ++a;
+            if (a < p.params.size() && p.params[a] == k) { p.fields.push_back({ a, (int)c, at }); continue; }
+            if (!encode_field(def.cols[c], T[k], &p.rows[at])) {
+                fail(Error::Constraint) << "[SaadDB] Values don't match column types" << tuple_where(p, t) << ".\n"; return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void run_insert(DmlPlan& p, const vector<string>& args) {
+    const TableDef& def = *p.def;
+    for (const DmlPlan::Field& f : p.fields) {
+        if (!encode_field(def.cols[f.col], args[f.arg], &p.rows[f.at])) {
+            fail(Error::Constraint) << "[SaadDB] Values don't match column types" << tuple_where(p, f.at / def.rowSize) << ".\n";
+            return;
+        }
+    }
+
+    TableHandle th;
+    if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] Tuple not inserted\n"; return; }
+    mark_planned();
+
+    // The whole batch is checked before anything is written: all rows go in or none.
+    pmr::unordered_set<pmr::string> keys(stmt_arena());
+    keys.reserve(p.tuples);
+    pmr::string key(th.pk.keyWidth, '\0', stmt_arena());
+    for (size_t t = 0; t < p.tuples; ++t) {
+        row_key(def, def.pkIndex, &p.rows[t * def.rowSize], (uint8_t*)&key[0]);
+        uint64_t existing;
+        if (!keys.insert(key).second || th.pk.find((const uint8_t*)key.data(), existing)) {
+            fail(Error::Constraint) << "[SaadDB] PK already exists" << tuple_where(p, t) << ".\n"; return;
+        }
+    }
+
+    string err;
+    for (size_t t = 0; t < p.tuples; ++t) {
+        if (!insert_row(th, &p.rows[t * def.rowSize], err)) { fail(Error::IoError) << "[SaadDB] " << err << "\n"; return; }
+    }
+    if (!flush_changes(th)) { fail(Error::IoError) << "[SaadDB] Failed writing <" << def.name << ">\n"; return; }
+    STMT_AFFECTED = p.tuples;
+    if (p.tuples > 1) { OUT << "[SaadDB] " << p.tuples << " tuples inserted successfully.\n"; return; }
+    OUT << "[SaadDB] Tuple inserted successfully.\n";
+}
+
+// How a WHERE clause reaches its rows: a full scan, or a lookup / range scan
+// on the PK index or one secondary index.
+struct AccessPath {
+    enum Kind { FULL_SCAN, PK_LOOKUP, PK_RANGE, INDEX_LOOKUP, INDEX_RANGE } kind = FULL_SCAN;
+    SecondaryIndex* index = nullptr;
+    KeyRange range;
+};
+
+// Prefers an equality lookup (PK, then any secondary index) over a range scan
+// (PK, then an ordered secondary index) over a full scan.
+static AccessPath choose_access_path(TableHandle& th, const Predicate& pred) {
+    const TableDef& def = *th.def;
+    AccessPath best;
+    if (!pred.conjunctive()) return best;
+    KeyRange pk = where_key_range(def, def.pkIndex, pred);
+    if (pk.point) { best.kind = AccessPath::PK_LOOKUP; best.range = pk; return best; }
+    AccessPath range;
+    if (pk.usable) { range.kind = AccessPath::PK_RANGE; range.range = pk; }
+    for (auto& ix : th.indexes) {
+        KeyRange kr = where_key_range(def, ix.def->col, pred);
+        if (!kr.usable) continue;
+        if (kr.point) { best.kind = AccessPath::INDEX_LOOKUP; best.index = &ix; best.range = kr; return best; }
+        if (range.kind == AccessPath::FULL_SCAN && !ix.is_hash()) {
+            range.kind = AccessPath::INDEX_RANGE; range.index = &ix; range.range = kr;
+        }
+    }
+    return range;
+}
+
+// Calls fn(key, rid) over a B+tree for keys strictly inside kr's lo/hi bounds.
+template <class F>
+static void btree_range(const BTree& bt, const KeyRange& kr, F&& fn) {
+    bt.scan_from(kr.lo.empty() ? nullptr : kr.lo.data(), [&](const uint8_t* key, uint64_t rid) {
+        if (!kr.lo.empty() && key_cmp(bt.numeric, key, kr.lo.data()) <= 0) return true;
+        if (!kr.hi.empty() && key_cmp(bt.numeric, key, kr.hi.data()) >= 0) return false;
+        return fn(rid);
+    });
+}
+
+// Scan of rids [from, to) of a columnar table (nothing pending). Numeric
+// terms run as vector kernels over a block of each column into selection
+// bitmaps; varchar terms are evaluated only for rows still selected;
+// matching rows get just the columns in project filled in before fn(rec, rid)
+// sees them. from must be a multiple of COLUMN_BLOCK. False if fn stopped it.
+// Under a snapshot a block reads every column it needs up front; rows with
+// versions then drop out of the bitmaps and their snapshot images are
+// filtered one by one instead.
+template <class F>
+static bool columnar_scan(const ColumnStore& cs, const Predicate& pred, const vector<int>& project,
+    uint64_t from, uint64_t to, const SnapshotView& view, F&& fn) {
+    const TableDef& def = *cs.def;
+    const size_t W = COLUMN_BLOCK / 64;
+    vector<uint64_t> live(W), sel(W), grp(W), bits(W);
+    vector<uint8_t> status, rec(def.rowSize, 0);
+    size_t ncols = def.cols.size();
+    vector<vector<uint8_t>> col(ncols);
+    vector<string> blob(ncols);
+    vector<uint64_t> blobBase(ncols);
+    vector<char> haveCol(ncols), haveBlob(ncols);
+    auto column = [&](int c, uint64_t base, size_t n) {
+        if (!haveCol[c]) { cs.read_column(c, base, n, col[c]); haveCol[c] = 1; }
+        if (def.cols[c].kind == COL_VARCHAR && !haveBlob[c]) {
+            cs.read_blob(c, (const uint64_t*)col[c].data(), n, blob[c], blobBase[c]);
+            haveBlob[c] = 1;
+        }
+    };
+    set<int> needed;
+    if (view.active()) {
+        needed.insert(project.begin(), project.end());
+        for (const auto& g : pred.groups) for (const Term& t : g) if (t.col >= 0) needed.insert(t.col);
+    }
+    map<uint64_t, vector<uint8_t>> changed;
+    to = min(to, cs.stored);
+    for (uint64_t base = from; base < to; base += COLUMN_BLOCK) {
+        size_t n = (size_t)min<uint64_t>(COLUMN_BLOCK, to - base);
+        size_t words = (n + 63) / 64;
+        status.resize(n);
+        if (!pread_full(cs.statusFd, status.data(), n, (off_t)(PAGE_SIZE + base))) break;
+        fill(haveCol.begin(), haveCol.end(), 0);
+        fill(haveBlob.begin(), haveBlob.end(), 0);
+        changed.clear();
+        if (view.active()) {
+            for (int c : needed) column(c, base, n);
+            view.rows(base, base + n, changed);
+        }
+        bool anyLive = false;
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t m = 0;
+            for (size_t i = w * 64; i < min(n, w * 64 + 64); ++i) m |= (uint64_t)(status[i] == ROW_LIVE) << (i - w * 64);
+            live[w] = m;
+        }
+        for (const auto& kv : changed) live[(kv.first - base) / 64] &= ~(1ULL << ((kv.first - base) % 64));
+        for (size_t w = 0; w < words; ++w) anyLive |= live[w] != 0;
+        if (!anyLive && changed.empty()) continue;
+        for (size_t w = 0; w < words; ++w) ROWS_VISITED.fetch_add((uint64_t)__builtin_popcountll(live[w]), memory_order_relaxed);
+
+        if (pred.groups.empty()) copy(live.begin(), live.begin() + words, sel.begin());
+        else fill(sel.begin(), sel.begin() + words, 0);
+        for (const auto& g : pred.groups) {
+            copy(live.begin(), live.begin() + words, grp.begin());
+            for (const Term& t : g) {
+                bool any = false;
+                for (size_t w = 0; w < words; ++w) any |= grp[w] != 0;
+                if (!any) break;
+                if (t.col < 0) {
+                    if (!t.fn(t, nullptr)) fill(grp.begin(), grp.begin() + words, 0);
+                    continue;
+                }
+                column(t.col, base, n);
+                if (t.kind != COL_VARCHAR) {
+                    vec_kernel(t.kind, t.op)(col[t.col].data(), n, t.num, bits.data());
+                    for (size_t w = 0; w < words; ++w) grp[w] &= bits[w];
+                    continue;
+                }
+                for (size_t w = 0; w < words; ++w) {
+                    for (uint64_t m = grp[w]; m; m &= m - 1) {
+                        size_t i = w * 64 + __builtin_ctzll(m);
+                        cs.unpack_field(t.col, col[t.col].data(), i, blob[t.col], blobBase[t.col], rec.data());
+                        if (!t.fn(t, rec.data())) grp[w] &= ~(1ULL << (i - w * 64));
+                    }
+                }
+            }
+            for (size_t w = 0; w < words; ++w) sel[w] |= grp[w];
+        }
+
+        // snapshot images of the rows before upto, in rid order among the others
+        auto fix = changed.begin();
+        auto changed_upto = [&](uint64_t upto) {
+            for (; fix != changed.end() && fix->first < upto; ++fix) {
+                const uint8_t* image = fix->second.data();
+                if (fix->second.empty()) continue;
+                ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+                if (pred.eval(image) && !row_visit(fn, image, fix->first)) return false;
+            }
+            return true;
+        };
+        for (size_t w = 0; w < words; ++w) {
+            for (uint64_t m = sel[w]; m; m &= m - 1) {
+                size_t i = w * 64 + __builtin_ctzll(m);
+                if (!changed_upto(base + i)) return false;
+                for (int c : project) {
+                    column(c, base, n);
+                    cs.unpack_field(c, col[c].data(), i, blob[c], blobBase[c], rec.data());
+                }
+                rec[0] = ROW_LIVE;
+                if (!row_visit(fn, rec.data(), base + i)) return false;
+            }
+        }
+        if (!changed_upto(UINT64_MAX)) return false;
+    }
+    return true;
+}
+
+/* ---------- parallel full scans ----------
+  A full scan is cut into morsels: MORSEL_PAGES pages of a row table, or
+  MORSEL_ROWS rids of a columnar one (one zone map segment each). Pool
+  workers filter their morsel into a private buffer of matching row images;
+  the statement's own thread then hands the buffered rows to fn in rid
+  order, or morsel by morsel as they finish when the caller doesn't need the
+  order. Morsels the zone map rules out are never read.
+*/
+
+// A full scan of tf split into morsels; morsel(i, fn) calls fn(rec, rid) for
+// the matches in morsel i and may run on any thread.
+struct MorselScan {
+    const TableFile& tf;
+    const Predicate& pred;
+    const vector<int>& project;
+    const ZoneMap* zones;
+    const ColumnStore* cs;
+    PageMap pm;
+    uint64_t first, end, step;
+    size_t n;
+    uint64_t unitBytes;     // bytes read per page / per columnar row
+
+    MorselScan(const TableFile& tf, const Predicate& pred, const vector<int>& project, const ZoneMap* zones = nullptr)
+        : tf(tf), pred(pred), project(project), zones(zones), cs(tf.cols.get()), pm(tf) {
+        first = cs ? 0 : 1;
+        end = cs ? cs->stored : tf.pages;
+        step = cs ? MORSEL_ROWS : MORSEL_PAGES;
+        n = end > first ? (size_t)((end - first + step - 1) / step) : 0;
+        if (zones && zones->segRows != (cs ? MORSEL_ROWS : MORSEL_PAGES * tf.def->rowsPerPage)) this->zones = nullptr;
+        unitBytes = PAGE_SIZE;
+        if (cs) {
+            set<int> read(project.begin(), project.end());
+            for (const auto& g : pred.groups) for (const auto& t : g) if (t.col >= 0) read.insert(t.col);
+            unitBytes = 1;  // status byte
+            for (int c : read) unitBytes += column_width(tf.def->cols[c]);
+        }
+    }
+
+    // Rids of morsel i.
+    uint64_t rid_lo(size_t i) const { return cs ? first + i * step : (first + i * step - 1) * tf.def->rowsPerPage; }
+    uint64_t rid_hi(size_t i) const { return cs ? first + (i + 1) * step : (first + (i + 1) * step - 1) * tf.def->rowsPerPage; }
+
+    // Zones hold the rows on the pages: a snapshot can't skip a morsel with row versions.
+    template <class F>
+    bool morsel(size_t i, F&& fn) const {
+        if (zones && !zone_may_match(*zones, i, pred) && !tf.view.any(rid_lo(i), rid_hi(i))) {
+            SEGMENTS_SKIPPED.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+        SEGMENTS_SCANNED.fetch_add(1, memory_order_relaxed);
+        uint64_t lo = first + i * step, hi = min(end, first + (i + 1) * step);
+        BYTES_READ.fetch_add((hi - lo) * unitBytes, memory_order_relaxed);
+        return range(lo, hi, fn);
+    }
+
+    template <class F>
+    bool all(F&& fn) const {
+        for (size_t i = 0; i < n; ++i) if (!morsel(i, fn)) return false;
+        return true;
+    }
+
+    template <class F>
+    bool range(uint64_t lo, uint64_t hi, F&& fn) const {
+        if (cs) return columnar_scan(*cs, pred, project, lo, hi, tf.view, fn);
+        return scan_page_range(tf, pm, lo, hi, 0, [&](const uint8_t* rec, uint64_t rid) {
+            return !pred.eval(rec) || row_visit(fn, rec, rid);
+        });
+    }
+};
+
+struct MorselOut {
+    vector<uint8_t> recs;       // rowSize bytes per match (empty when rows aren't wanted)
+    vector<uint64_t> rids;
+};
+
+template <class F>
+static void full_scan(TableHandle& th, const Predicate& pred, const vector<int>* project, bool ordered, F&& fn) {
+    th.file.flush();
+    const TableDef& def = *th.def;
+    vector<int> all;
+    if (!project) { for (int c = 0; c < (int)def.cols.size(); ++c) all.push_back(c); project = &all; }
+    bool wantRows = !project->empty();
+    MorselScan ms(th.file, pred, *project, &th.zones);
+
+    if (thread_count() <= 1 || ms.n <= 1) { ms.all(fn); return; }
+    vector<MorselOut> outs(ms.n);
+    run_morsels(ms.n, ordered, [&](size_t i) {
+        MorselOut& out = outs[i];
+        ms.morsel(i, [&](const uint8_t* rec, uint64_t rid) {
+            if (wantRows) out.recs.insert(out.recs.end(), rec, rec + def.rowSize);
+            out.rids.push_back(rid);
+        });
+    }, [&](size_t i) {
+        MorselOut& out = outs[i];
+        for (size_t k = 0; k < out.rids.size(); ++k)
+            if (!row_visit(fn, wantRows ? &out.recs[k * def.rowSize] : nullptr, out.rids[k])) return false;
+        MorselOut().recs.swap(out.recs);
+        vector<uint64_t>().swap(out.rids);
+        return true;
+    });
+}
+
+// What scan_where does for pred on th, for explain.
+static string scan_text(TableHandle& th, const AccessPath& ap, const Predicate& pred) {
+    string s;
+    switch (ap.kind) {
+    case AccessPath::PK_LOOKUP:    s = "PK lookup"; break;
+    case AccessPath::PK_RANGE:     s = "PK range scan"; break;
+    case AccessPath::INDEX_LOOKUP: s = string("lookup on ") + (ap.index->is_hash() ? "hash" : "btree") + " index " + ap.index->def->name; break;
+    case AccessPath::INDEX_RANGE:  s = "range scan on btree index " + ap.index->def->name; break;
+    default: {
+        static const vector<int> none;
+        th.file.flush();
+        MorselScan ms(th.file, pred, none, &th.zones);
+        size_t ruled = 0;
+        if (ms.zones) for (size_t i = 0; i < ms.n; ++i) ruled += !zone_may_match(*ms.zones, i, pred);
+        s = string(th.def->columnar ? "columnar" : "row") + " full scan, " + to_string(thread_count()) + " thread(s), " +
+            to_string(ms.n) + " segments, " + to_string(ruled) + " ruled out by zone maps";
+    }
+    }
+    if (!pred.groups.empty()) s += "; filter " + predicate_text(*th.def, pred);
+    return s;
+}
+
+// Calls fn(rec, rid) for every live row matching pred, reading through an
+// index when choose_access_path finds one. A full scan runs in parallel (see
+// above): rows come in rid order only when ordered is set, and only the
+// columns in project (every column when null) are sure to be filled in;
+// rec is null when project is empty. A fn returning bool stops the scan by
+// returning false. Under a snapshot an index lookup finishes before any
+// row is read: the rows changed since are then checked by their images
+// (see SnapshotChanges).
+template <class F>
+static void scan_where(TableHandle& th, const Predicate& pred, F&& fn, const vector<int>* project = nullptr,
+    bool ordered = true) {
+    AccessPath ap = choose_access_path(th, pred);
+    ProfileSpan span;
+    if (PROFILE) span.begin("scan " + th.def->name, scan_text(th, ap, pred));
+    if (dry_run()) return;
+    auto counted = [&](const uint8_t* rec, uint64_t rid) { ++span.out; return row_visit(fn, rec, rid); };
+    if (ap.kind == AccessPath::FULL_SCAN) {
+        full_scan(th, pred, project, ordered, counted);
+        return;
+    }
+    RowFetcher rows(th.file);
+    bool stopped = false;
+    auto visit = [&](uint64_t rid) {
+        const uint8_t* rec = stopped ? nullptr : rows.get(rid);
+        if (!rec) return !stopped;
+        ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+        if (pred.eval(rec) && !counted(rec, rid)) stopped = true;
+        return !stopped;
+    };
+    const KeyRange& kr = ap.range;
+    auto lookup = [&](auto&& visit) {
+        switch (ap.kind) {
+        case AccessPath::PK_LOOKUP: {
+            uint64_t rid;
+            if (th.pk.find(kr.eq.data(), rid)) visit(rid);
+            break;
+        }
+        case AccessPath::PK_RANGE:
+            btree_range(th.pk, kr, visit);
+            break;
+        case AccessPath::INDEX_LOOKUP:
+            if (ap.index->is_hash()) { ap.index->hash.lookup(kr.eq.data(), visit); break; }
+            {
+                ap.index->bt.scan_from(kr.eq.data(), [&](const uint8_t* key, uint64_t rid) {
+                    if (key_cmp(ap.index->bt.numeric, key, kr.eq.data()) != 0) return false;
+                    return visit(rid);
+                });
+            }
+            break;
+        case AccessPath::INDEX_RANGE:
+            btree_range(ap.index->bt, kr, visit);
+            break;
+        default:
+            break;
+        }
+    };
+    if (!th.file.view.active()) { lookup(visit); return; }
+    vector<uint64_t> hits;
+    lookup([&](uint64_t rid) { hits.push_back(rid); return true; });
+    SnapshotChanges sc(th.file.view, [&](const uint8_t* rec) { return pred.eval(rec); });
+    sc.refresh();
+    for (uint64_t rid : hits) if (!sc.changed.count(rid) && !visit(rid)) return;
+    for (const auto& kv : sc.rows) {
+        ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+        if (!counted(kv.second.data(), kv.first)) return;
+    }
+}
+
+// Sorted rids of the rows matching pred.
+static vector<uint64_t> matching_rids(TableHandle& th, const Predicate& pred) {
+    vector<uint64_t> rids;
+    static const vector<int> none;
+    scan_where(th, pred, [&](const uint8_t*, uint64_t rid) { rids.push_back(rid); }, &none, false);
+    sort(rids.begin(), rids.end());
+    return rids;
+}
+
+/* ---------- temp files ----------
+  Spilled aggregation partitions and sort runs live in TEMP_DIR next to the
+  tables, one file each, and are removed as soon as they have been read back.
+*/
+static string TEMP_DIR = "SaadDB.tmp";
+static atomic<uint64_t> TEMP_SEQ{0};
+
+// A fresh path under TEMP_DIR (created on first use).
+static string temp_path(const char* kind) {
+    ::mkdir(TEMP_DIR.c_str(), 0755);
+    char name[64];
+    snprintf(name, sizeof name, "/%s.%d.%llu", kind, (int)getpid(),
+        (unsigned long long)TEMP_SEQ.fetch_add(1));
+    return TEMP_DIR + name;
+}
+
+// Appends n bytes to the end of path.
+static bool temp_append(const string& path, const void* p, size_t n) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) return false;
+    bool ok = pwrite_full(fd, p, n, lseek(fd, 0, SEEK_END));
+    ::close(fd);
+    return ok;
+}
+
+// Calls fn(rec) for each width-byte record of path, reading a chunk at a time.
+template <class F>
+static void temp_read(const string& path, size_t width, F&& fn) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    vector<uint8_t> chunk(width * max<size_t>(1, (64u << 10) / width));
+    uint64_t at = 0;
+    ssize_t got;
+    while ((got = pread(fd, chunk.data(), chunk.size(), (off_t)at)) > 0) {
+        size_t whole = (size_t)got / width * width;
+        if (!whole) break;
+        for (size_t k = 0; k < whole; k += width) fn((const uint8_t*)&chunk[k]);
+        at += whole;
+    }
+    ::close(fd);
+}
+
+/* ---------- aggregation ----------
+  select b, count(*), sum(x) from T [where ...] group by b;
+  Hash aggregation over the scan. Every thread that scans folds its rows
+  into its own AggTable and the partial tables are merged into one at the
+  end. A group is a fixed-size record: the group-by fields as stored in the
+  row, then one accumulator per aggregate. A table that grows past its
+  share of the query memory budget (set memory N;) spills its groups to
+  SPILL_PARTS files by key hash and carries on empty; at the end each
+  partition is read back and merged on its own, one level deeper, with a
+  differently seeded hash.
+  Sums are 128-bit integers at the column's scale, so a decimal sum is exact
+  and printed with the column's S digits; an average is rounded half away
+  from zero to S digits (2 for an int column).
+*/
+enum AggFn { AGG_COUNT, AGG_SUM, AGG_AVG, AGG_MIN, AGG_MAX };
+
+struct AggItem {
+    AggFn fn = AGG_COUNT;
+    int col = -1;               // -1 for count(*)
+    uint32_t off = 0;           // accumulator offset in the group record
+};
+
+struct AggSpec {
+    const TableDef* def = nullptr;
+    vector<int> keys;           // group by columns
+    uint32_t keyWidth = 0;
+    vector<AggItem> aggs;
+    uint32_t width = 0;         // group record: key bytes + accumulators
+};
+
+static const int SPILL_PARTS = 32;
+static const int SPILL_DEPTH = 3;
+static size_t QUERY_MEMORY = 64u << 20;     // set memory N; (MB)
+
+static bool parse_agg_fn(const string& name, AggFn& fn) {
+    string low = name;
+    transform(low.begin(), low.end(), low.begin(), ::tolower);
+    if (low == "count") fn = AGG_COUNT;
+    else if (low == "sum") fn = AGG_SUM;
+    else if (low == "avg") fn = AGG_AVG;
+    else if (low == "min") fn = AGG_MIN;
+    else if (low == "max") fn = AGG_MAX;
+    else return false;
+    return true;
+}
+
+static string agg_text(const TableDef& def, const AggItem& a) {
+    static const char* NAMES[] = { "count", "sum", "avg", "min", "max" };
+    return string(NAMES[a.fn]) + "(" + (a.col < 0 ? "*" : def.cols[a.col].name) + ")";
+}
+
+// Lays out the group record; false (with err) for an aggregate the column's type can't take.
+static bool plan_aggregates(AggSpec& spec, string& err) {
+    const TableDef& def = *spec.def;
+    spec.keyWidth = 0;
+    for (int c : spec.keys) spec.keyWidth += column_width(def.cols[c]);
+    uint32_t off = spec.keyWidth;
+    for (AggItem& a : spec.aggs) {
+        a.off = off;
+        if (a.fn == AGG_COUNT) { off += 8; continue; }
+        const ColumnDef& cd = def.cols[a.col];
+        if (a.fn == AGG_SUM || a.fn == AGG_AVG) {
+            if (cd.kind != COL_INT && cd.kind != COL_DECIMAL) {
+                err = string(a.fn == AGG_SUM ? "SUM" : "AVG") + " needs an int or decimal column, not " + cd.name;
+                return false;
+            }
+            off += 16 + 8;      // __int128 sum, row count
+            continue;
+        }
+        off += 1 + column_width(cd);    // seen flag, smallest/largest field
+    }
+    spec.width = off;
+    return true;
+}
+
+static bool field_less(const ColumnDef& cd, const uint8_t* a, const uint8_t* b) {
+    if (cd.kind != COL_VARCHAR) return decode_num(cd, a) < decode_num(cd, b);
+    uint16_t na, nb; memcpy(&na, a, 2); memcpy(&nb, b, 2);
+    return string_view((const char*)a + 2, na) < string_view((const char*)b + 2, nb);
+}
+
+// Folds row rec into the accumulators of group record g.
+static void agg_fold(const AggSpec& spec, uint8_t* g, const uint8_t* rec) {
+    const TableDef& def = *spec.def;
+    for (const AggItem& a : spec.aggs) {
+        uint8_t* acc = g + a.off;
+        if (a.fn == AGG_COUNT) { uint64_t n; memcpy(&n, acc, 8); ++n; memcpy(acc, &n, 8); continue; }
+        const ColumnDef& cd = def.cols[a.col];
+        const uint8_t* f = rec + def.offsets[a.col];
+        if (a.fn == AGG_SUM || a.fn == AGG_AVG) {
+            __int128 sum; uint64_t n;
+            memcpy(&sum, acc, 16); memcpy(&n, acc + 16, 8);
+            sum += decode_num(cd, f); ++n;
+            memcpy(acc, &sum, 16); memcpy(acc + 16, &n, 8);
+            continue;
+        }
+        uint32_t w = column_width(cd);
+        if (!acc[0] || (a.fn == AGG_MIN ? field_less(cd, f, acc + 1) : field_less(cd, acc + 1, f))) {
+            acc[0] = 1;
+            memcpy(acc + 1, f, w);
+        }
+    }
+}
+
+// Merges the accumulators of group record src into dst (same key).
+static void agg_merge(const AggSpec& spec, uint8_t* dst, const uint8_t* src) {
+    const TableDef& def = *spec.def;
+    for (const AggItem& a : spec.aggs) {
+        uint8_t* d = dst + a.off;
+        const uint8_t* s = src + a.off;
+        if (a.fn == AGG_COUNT) {
+            uint64_t x, y; memcpy(&x, d, 8); memcpy(&y, s, 8); x += y; memcpy(d, &x, 8);
+            continue;
+        }
+        if (a.fn == AGG_SUM || a.fn == AGG_AVG) {
+            __int128 x, y; uint64_t n, m;
+            memcpy(&x, d, 16); memcpy(&y, s, 16); memcpy(&n, d + 16, 8); memcpy(&m, s + 16, 8);
+            x += y; n += m;
+            memcpy(d, &x, 16); memcpy(d + 16, &n, 8);
+            continue;
+        }
+        const ColumnDef& cd = def.cols[a.col];
+        if (!s[0]) continue;
+        if (!d[0] || (a.fn == AGG_MIN ? field_less(cd, s + 1, d + 1) : field_less(cd, d + 1, s + 1)))
+            memcpy(d, s, 1 + column_width(cd));
+    }
+}
+
+static uint64_t agg_hash(const uint8_t* key, size_t n, int level) {
+    uint64_t h = 1469598103934665603ULL ^ ((uint64_t)level * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = 0; i < n; ++i) { h ^= key[i]; h *= 1099511628211ULL; }
+    return h ^ (h >> 29);
+}
+
+// Open-addressing hash table of group records, spilling to partition files
+// once it holds more than budget bytes.
+struct AggTable {
+    const AggSpec* spec;
+    size_t budget;
+    int level;
+    vector<uint8_t> recs;           // group records, spec->width bytes each
+    size_t count = 0;
+    vector<uint32_t> slots;         // group number + 1, 0 = empty; size is a power of two
+    vector<string> parts;           // spill files, empty until the first spill
+
+    AggTable(const AggSpec& spec, size_t budget, int level = 0) : spec(&spec), budget(budget), level(level) {}
+    AggTable(AggTable&&) = default;
+
+    ~AggTable() { for (const auto& p : parts) ::unlink(p.c_str()); }
+
+    size_t bytes() const { return recs.capacity() + slots.capacity() * sizeof(uint32_t); }
+
+    // The group record for key (spec->keyWidth bytes); fresh tells whether it was just added (zeroed).
+    uint8_t* group(const uint8_t* key, bool& fresh) {
+        size_t kw = spec->keyWidth, w = spec->width;
+        if (slots.empty()) slots.assign(64, 0);
+        size_t mask = slots.size() - 1;
+        size_t i = (size_t)agg_hash(key, kw, level) & mask;
+        for (; slots[i]; i = (i + 1) & mask) {
+            uint8_t* g = &recs[(size_t)(slots[i] - 1) * w];
+            if (memcmp(g, key, kw) == 0) { fresh = false; return g; }
+        }
+        if ((count + 1) * w > budget && level < SPILL_DEPTH && count > 0) {
+            spill();
+            return group(key, fresh);
+        }
+        if ((count + 1) * 2 > slots.size()) { grow(); return group(key, fresh); }
+        fresh = true;
+        recs.resize((count + 1) * w, 0);
+        slots[i] = (uint32_t)++count;
+        uint8_t* g = &recs[(count - 1) * w];
+        memcpy(g, key, kw);
+        return g;
+    }
+
+    void grow() {
+        vector<uint32_t> old(slots.size() * 2, 0);
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (size_t k = 0; k < count; ++k) {
+            size_t i = (size_t)agg_hash(&recs[k * spec->width], spec->keyWidth, level) & mask;
+            while (slots[i]) i = (i + 1) & mask;
+            slots[i] = (uint32_t)(k + 1);
+        }
+    }
+
+    void fold(const uint8_t* key, const uint8_t* rec) {
+        bool fresh;
+        agg_fold(*spec, group(key, fresh), rec);
+    }
+
+    void merge(const uint8_t* g) {
+        bool fresh;
+        uint8_t* d = group(g, fresh);
+        if (fresh) memcpy(d + spec->keyWidth, g + spec->keyWidth, spec->width - spec->keyWidth);
+        else agg_merge(*spec, d, g);
+    }
+
+    // Appends every group to the partition file of its key hash and empties the table.
+    void spill() {
+        size_t w = spec->width;
+        if (parts.empty())
+            for (int p = 0; p < SPILL_PARTS; ++p) parts.push_back(temp_path("spill"));
+        vector<vector<uint8_t>> buf(SPILL_PARTS);
+        auto drain = [&](int p) {
+            temp_append(parts[p], buf[p].data(), buf[p].size());
+            buf[p].clear();
+        };
+        for (size_t k = 0; k < count; ++k) {
+            const uint8_t* g = &recs[k * w];
+            // the partition comes from the next level's hash, so it splits the keys afresh
+            int p = (int)(agg_hash(g, spec->keyWidth, level + 1) % SPILL_PARTS);
+            buf[p].insert(buf[p].end(), g, g + w);
+            if (buf[p].size() >= (1u << 16)) drain(p);
+        }
+        for (int p = 0; p < SPILL_PARTS; ++p) if (!buf[p].empty()) drain(p);
+        vector<uint8_t>().swap(recs);
+        vector<uint32_t>().swap(slots);
+        count = 0;
+    }
+
+    // Calls emit(g) once per group, reading back spilled partitions one at a time.
+    template <class F>
+    void finish(F&& emit) {
+        size_t w = spec->width;
+        if (parts.empty()) {
+            for (size_t k = 0; k < count; ++k) emit((const uint8_t*)&recs[k * w]);
+            return;
+        }
+        spill();
+        for (const auto& path : parts) {
+            AggTable sub(*spec, budget, level + 1);
+            temp_read(path, w, [&](const uint8_t* g) { sub.merge(g); });
+            ::unlink(path.c_str());
+            sub.finish(emit);
+        }
+        parts.clear();
+    }
+};
+
+// Result column of aggregate a: count is an int, avg of an int has 2 decimals.
+static saaddb::Column agg_column(const AggSpec& spec, const AggItem& a) {
+    saaddb::Column out;
+    out.name = agg_text(*spec.def, a);
+    if (a.fn == AGG_COUNT) { out.type = saaddb::Type::Int; return out; }
+    const ColumnDef& cd = spec.def->cols[a.col];
+    out.type = column_type(cd);
+    out.scale = cd.kind == COL_DECIMAL ? cd.scale : 0;
+    if (a.fn == AGG_AVG && cd.kind != COL_DECIMAL) { out.type = saaddb::Type::Decimal; out.scale = 2; }
+    return out;
+}
+
+// Value of the accumulator of a (NULL over no rows).
+static void agg_result(const AggSpec& spec, const AggItem& a, const uint8_t* g, uint8_t* scratch, saaddb::Value& v) {
+    const TableDef& def = *spec.def;
+    const uint8_t* acc = g + a.off;
+    v.str.clear();
+    v.num = 0;
+    if (a.fn == AGG_COUNT) { uint64_t n; memcpy(&n, acc, 8); v.type = saaddb::Type::Int; v.scale = 0; v.num = (int64_t)n; return; }
+    const ColumnDef& cd = def.cols[a.col];
+    int scale = cd.kind == COL_DECIMAL ? cd.scale : 0;
+    if (a.fn == AGG_SUM || a.fn == AGG_AVG) {
+        __int128 sum; uint64_t n;
+        memcpy(&sum, acc, 16); memcpy(&n, acc + 16, 8);
+        if (!n) { v.type = saaddb::Type::Null; return; }
+        int outScale = a.fn == AGG_AVG && cd.kind != COL_DECIMAL ? 2 : scale;
+        if (a.fn == AGG_AVG) {
+            for (int k = scale; k < outScale; ++k) sum *= 10;
+            unsigned __int128 mag = sum < 0 ? 0 - (unsigned __int128)sum : (unsigned __int128)sum;
+            unsigned __int128 q = (mag + n / 2) / n;
+            sum = sum < 0 ? -(__int128)q : (__int128)q;
+        }
+        v.type = cd.kind == COL_DECIMAL || a.fn == AGG_AVG ? saaddb::Type::Decimal : saaddb::Type::Int;
+        v.scale = outScale;
+        if (sum >= INT64_MIN && sum <= INT64_MAX) { v.num = (int64_t)sum; return; }
+        char buf[FIELD_BUF];
+        v.type = saaddb::Type::Varchar;
+        v.str.assign(format_scaled(sum, outScale, buf));
+        return;
+    }
+    if (!acc[0]) { v.type = saaddb::Type::Null; return; }
+    memcpy(scratch + def.offsets[a.col], acc + 1, column_width(cd));
+    field_value(def, scratch, a.col, v);
+}
+
+/* ---------- sorting ----------
+  ORDER BY sorts fixed-size records (row images, or the group records of a
+  grouped select) by a RowOrder. With LIMIT k the records go through a TopK
+  heap that holds k of them, O(n log k). Otherwise a Sorter buffers records
+  up to the query memory budget, writes each full buffer as a sorted run
+  under TEMP_DIR and, at the end, k-way merges the runs through a heap of
+  run cursors. Keys compare by type: numbers and dates (days) numerically,
+  varchars bytewise; an aggregate over no rows (NULL) sorts first.
+*/
+struct OrderKey {
+    int col = -1;               // table column (or group-by column), or -1
+    int agg = -1;               // index into AggSpec::aggs, or -1
+    bool desc = false;
+};
+
+static int field_cmp(const ColumnDef& cd, const uint8_t* a, const uint8_t* b) {
+    if (cd.kind != COL_VARCHAR) {
+        int64_t x = decode_num(cd, a), y = decode_num(cd, b);
+        return x < y ? -1 : x > y;
+    }
+    uint16_t na, nb; memcpy(&na, a, 2); memcpy(&nb, b, 2);
+    int r = string_view((const char*)a + 2, na).compare(string_view((const char*)b + 2, nb));
+    return r < 0 ? -1 : r > 0;
+}
+
+static int agg_cmp(const AggSpec& spec, const AggItem& a, const uint8_t* ga, const uint8_t* gb) {
+    const uint8_t* x = ga + a.off;
+    const uint8_t* y = gb + a.off;
+    if (a.fn == AGG_COUNT) {
+        uint64_t p, q; memcpy(&p, x, 8); memcpy(&q, y, 8);
+        return p < q ? -1 : p > q;
+    }
+    if (a.fn == AGG_SUM || a.fn == AGG_AVG) {
+        __int128 s, t; uint64_t n, m;
+        memcpy(&s, x, 16); memcpy(&t, y, 16); memcpy(&n, x + 16, 8); memcpy(&m, y + 16, 8);
+        if (!n || !m) return (n != 0) - (m != 0);
+        if (a.fn == AGG_AVG) { s *= (__int128)m; t *= (__int128)n; }   // s/n vs t/m
+        return s < t ? -1 : s > t;
+    }
+    if (!x[0] || !y[0]) return (x[0] != 0) - (y[0] != 0);
+    return field_cmp(spec.def->cols[a.col], x + 1, y + 1);
+}
+
+struct RowOrder {
+    const TableDef* def = nullptr;
+    const AggSpec* spec = nullptr;      // set when the records are group records
+    vector<OrderKey> keys;
+
+    // Offset of column c in a record.
+    uint32_t offset(int c) const {
+        if (!spec) return def->offsets[c];
+        uint32_t at = 0;
+        for (int k : spec->keys) {
+            if (k == c) break;
+            at += column_width(def->cols[k]);
+        }
+        return at;
+    }
+
+    int compare(const uint8_t* a, const uint8_t* b) const {
+        for (const OrderKey& k : keys) {
+            int r;
+            if (k.agg >= 0) r = agg_cmp(*spec, spec->aggs[k.agg], a, b);
+            else {
+                uint32_t off = offset(k.col);
+                r = field_cmp(def->cols[k.col], a + off, b + off);
+            }
+            if (r) return k.desc ? -r : r;
+        }
+        return 0;
+    }
+
+    bool operator()(const uint8_t* a, const uint8_t* b) const { return compare(a, b) < 0; }
+};
+
+// The k first records in order.
+struct TopK {
+    const RowOrder& order;
+    size_t k, width;
+    vector<uint8_t> recs;
+    vector<uint32_t> heap;      // record numbers, the last in order on top
+
+    TopK(const RowOrder& order, size_t k, size_t width) : order(order), k(k), width(width) {}
+
+    const uint8_t* at(uint32_t i) const { return &recs[(size_t)i * width]; }
+
+    void push(const uint8_t* rec) {
+        auto later = [&](uint32_t x, uint32_t y) { return order(at(x), at(y)); };
+        if (heap.size() < k) {
+            recs.insert(recs.end(), rec, rec + width);
+            heap.push_back((uint32_t)heap.size());
+            push_heap(heap.begin(), heap.end(), later);
+            return;
+        }
+        if (!k || !order(rec, at(heap.front()))) return;
+        pop_heap(heap.begin(), heap.end(), later);
+        memcpy(&recs[(size_t)heap.back() * width], rec, width);
+        push_heap(heap.begin(), heap.end(), later);
+    }
+
+    template <class F>
+    void finish(F&& emit) {
+        sort_heap(heap.begin(), heap.end(), [&](uint32_t x, uint32_t y) { return order(at(x), at(y)); });
+        for (uint32_t i : heap) if (!emit(at(i))) return;
+    }
+};
+
+// All records in order, sorted in memory or externally.
+struct Sorter {
+    const RowOrder& order;
+    size_t width, budget;
+    vector<uint8_t> buf;
+    vector<string> runs;
+
+    Sorter(const RowOrder& order, size_t width, size_t budget) : order(order), width(width), budget(budget) {}
+    ~Sorter() { for (const auto& r : runs) ::unlink(r.c_str()); }
+
+    void push(const uint8_t* rec) {
+        buf.insert(buf.end(), rec, rec + width);
+        if (buf.size() >= budget) write_run();
+    }
+
+    vector<uint32_t> sorted() const {
+        vector<uint32_t> idx(buf.size() / width);
+        for (uint32_t i = 0; i < idx.size(); ++i) idx[i] = i;
+        sort(idx.begin(), idx.end(), [&](uint32_t x, uint32_t y) { return order(&buf[(size_t)x * width], &buf[(size_t)y * width]); });
+        return idx;
+    }
+
+    void write_run() {
+        vector<uint32_t> idx = sorted();
+        string path = temp_path("run");
+        vector<uint8_t> out;
+        for (uint32_t i : idx) {
+            out.insert(out.end(), &buf[(size_t)i * width], &buf[(size_t)i * width] + width);
+            if (out.size() >= (1u << 16)) { temp_append(path, out.data(), out.size()); out.clear(); }
+        }
+        if (!out.empty()) temp_append(path, out.data(), out.size());
+        runs.push_back(path);
+        vector<uint8_t>().swap(buf);
+    }
+
+    // Calls emit(rec) in order until it returns false.
+    template <class F>
+    void finish(F&& emit) {
+        if (runs.empty()) {
+            for (uint32_t i : sorted()) if (!emit((const uint8_t*)&buf[(size_t)i * width])) return;
+            return;
+        }
+        if (!buf.empty()) write_run();
+        struct Cursor {
+            int fd = -1;
+            vector<uint8_t> chunk;
+            size_t pos = 0, len = 0;
+            uint64_t at = 0;
+        };
+        size_t chunkBytes = width * max<size_t>(1, min<size_t>(budget / runs.size(), 1u << 16) / width);
+        vector<Cursor> cur(runs.size());
+        auto fill = [&](Cursor& c) {
+            c.pos = 0;
+            ssize_t got = pread(c.fd, c.chunk.data(), c.chunk.size(), (off_t)c.at);
+            c.len = got > 0 ? (size_t)got / width * width : 0;
+            c.at += c.len;
+            return c.len > 0;
+        };
+        auto head = [&](size_t r) { return (const uint8_t*)&cur[r].chunk[cur[r].pos]; };
+        auto later = [&](size_t x, size_t y) { return order(head(y), head(x)); };
+        vector<size_t> heap;
+        for (size_t r = 0; r < runs.size(); ++r) {
+            cur[r].fd = ::open(runs[r].c_str(), O_RDONLY);
+            cur[r].chunk.resize(chunkBytes);
+            if (cur[r].fd >= 0 && fill(cur[r])) heap.push_back(r);
+        }
+        make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), later);
+            size_t r = heap.back();
+            if (!emit(head(r))) break;
+            Cursor& c = cur[r];
+            c.pos += width;
+            if (c.pos < c.len || fill(c)) push_heap(heap.begin(), heap.end(), later);
+            else heap.pop_back();
+        }
+        for (auto& c : cur) if (c.fd >= 0) ::close(c.fd);
+    }
+};
+
+// Feeds the records that feed(push) produces through a TopK (with a limit
+// that fits in memory) or a Sorter, and calls emit(rec) on the first limit
+// of them in order (all of them when limit < 0).
+template <class Feed, class Emit>
+static void sort_records(const RowOrder& order, size_t width, long long limit, Feed&& feed, Emit&& emit) {
+    bool topk = limit >= 0 && (size_t)limit * width <= QUERY_MEMORY;
+    ProfileSpan span;
+    if (PROFILE) {
+        string by;
+        for (const OrderKey& k : order.keys) {
+            if (!by.empty()) by += ", ";
+            if (k.agg >= 0) by += agg_text(*order.def, order.spec->aggs[k.agg]);
+            else by += order.def->cols[k.col].name;
+            if (k.desc) by += " desc";
+        }
+        span.begin("sort", (topk ? "top " + to_string(limit) + " in a heap" : string("external merge sort")) + " by " + by);
+    }
+    if (topk) {
+        TopK top(order, (size_t)limit, width);
+        feed([&](const uint8_t* rec) { top.push(rec); });
+        top.finish([&](const uint8_t* rec) { ++span.out; emit(rec); return true; });
+        return;
+    }
+    Sorter s(order, width, QUERY_MEMORY);
+    feed([&](const uint8_t* rec) { s.push(rec); });
+    long long left = limit;
+    s.finish([&](const uint8_t* rec) {
+        if (left == 0) return false;
+        ++span.out;
+        emit(rec);
+        if (left > 0) --left;
+        return true;
+    });
+    if (!s.runs.empty()) span.note("; " + to_string(s.runs.size()) + " runs spilled to disk");
+}
+
+// Calls fn(rec, rid) for the rows matching pred like scan_where, but a full
+// scan calls it on the pool's threads as they go (WORKER_SLOT tells which).
+template <class F>
+static void scan_where_parallel(TableHandle& th, const Predicate& pred, const vector<int>& project, F&& fn) {
+    if (choose_access_path(th, pred).kind != AccessPath::FULL_SCAN) {
+        scan_where(th, pred, fn, &project);
+        return;
+    }
+    ProfileSpan span;
+    if (PROFILE) span.begin("scan " + th.def->name, scan_text(th, AccessPath(), pred) + "; rows consumed on the workers");
+    if (dry_run()) return;
+    th.file.flush();
+    MorselScan ms(th.file, pred, project, &th.zones);
+    atomic<uint64_t> out{ 0 };
+    run_morsels(ms.n, false, [&](size_t i) {
+        uint64_t k = 0;
+        ms.morsel(i, [&](const uint8_t* rec, uint64_t rid) { ++k; return row_visit(fn, rec, rid); });
+        out.fetch_add(k, memory_order_relaxed);
+    }, [](size_t) { return true; });
+    span.out = out.load();
+}
+
+/* ---------- joins ----------
+  select ... from A join B on A.x = B.y [where ...]
+  A joined row is the row image of A followed by that of B, described by a
+  TableDef made up for the statement (join_def) whose columns are named
+  A.col and B.col, so projection, GROUP BY and ORDER BY work on it as on a
+  table. WHERE terms are pushed down to the scan of the side they name.
+  The join runs as an index nested-loop join when one side has its PK or
+  an index on the join column and the other side is much smaller, or
+  pinned to a few rows by its WHERE. Otherwise it is a hash join that builds
+  on the smaller side (by row count) and probes with the larger; when the
+  build rows outgrow the query memory budget both sides are partitioned by
+  key hash into temp files and joined one partition pair at a time.
+*/
+static const int JOIN_PARTS = 32;
+
+struct JoinSide {
+    const TableDef* def = nullptr;
+    TableHandle th;
+    Predicate pred;
+    int col = -1;               // join column
+    vector<int> project;        // columns the statement reads
+    uint32_t base = 0;          // offset of this side in the joined row
+};
+
+struct JoinPlan {
+    TableDef def;               // the joined row
+    JoinSide side[2];
+};
+
+static void join_def(JoinPlan& jp, const TableDef& a, const TableDef& b) {
+    TableDef& j = jp.def;
+    j.name = a.name + " join " + b.name;
+    const TableDef* parts[2] = { &a, &b };
+    for (int s = 0; s < 2; ++s) {
+        const TableDef& t = *parts[s];
+        jp.side[s].def = &t;
+        jp.side[s].base = j.rowSize;
+        for (size_t c = 0; c < t.cols.size(); ++c) {
+            ColumnDef cd = t.cols[c];
+            cd.name = t.name + "." + cd.name;
+            j.cols.push_back(cd);
+            j.attrs.push_back(cd.name);
+            j.types.push_back(cd.type);
+            j.offsets.push_back(j.rowSize + t.offsets[c]);
+        }
+        j.rowSize += t.rowSize;
+    }
+}
+
+// Splits the WHERE clause at T[wherePos] between the two sides of jp. Terms
+// joined by AND go to the side they name; a clause with OR must name one side only.
+static bool split_join_where(JoinPlan& jp, const Tokens& T, int wherePos, string& err) {
+    Tokens w[2] = { { "where" }, { "where" } };
+    int n = (int)T.size();
+    if (wherePos < n && is_kw(T[wherePos], "where")) {
+        bool anyOr = keyword_pos(T, "or", wherePos) < n;
+        int nA = (int)jp.side[0].def->cols.size();
+        int only = -1;
+        for (int j = wherePos + 1; ; j += 4) {
+            if (j + 2 >= n) { err = "Incomplete WHERE clause"; return false; }
+            int c = column_index(jp.def, T[j]);
+            if (c < 0) { err = column_error(jp.def, T[j]); return false; }
+            int s = c < nA ? 0 : 1;
+            if (anyOr && only >= 0 && s != only) { err = "OR can't mix columns of both joined tables"; return false; }
+            only = s;
+            if (w[s].size() > 1) w[s].push_back(anyOr ? T[j - 1] : "and");
+            w[s].push_back(jp.side[s].def->attrs[c - (s ? nA : 0)]);
+            w[s].push_back(T[j + 1]);
+            w[s].push_back(T[j + 2]);
+            if (j + 3 >= n) break;
+            if (!is_kw(T[j + 3], "and") && !is_kw(T[j + 3], "or")) { err = "Expected AND/OR, got " + T[j + 3]; return false; }
+        }
+    }
+    for (int s = 0; s < 2; ++s)
+        if (!compile_where(*jp.side[s].def, w[s], w[s].size() > 1 ? 0 : 1, jp.side[s].pred, err)) return false;
+    return true;
+}
+
+static uint64_t join_hash(const JoinSide& js, const uint8_t* rec) {
+    const ColumnDef& cd = js.def->cols[js.col];
+    if (cd.kind != COL_VARCHAR) {
+        int64_t v = field_num(*js.def, rec, js.col);
+        return agg_hash((const uint8_t*)&v, 8, 0);
+    }
+    string_view s = field_str(*js.def, rec, js.col);
+    return agg_hash((const uint8_t*)s.data(), s.size(), 0);
+}
+
+static bool join_match(const JoinSide& x, const uint8_t* rx, const JoinSide& y, const uint8_t* ry) {
+    if (x.def->cols[x.col].kind != COL_VARCHAR) return field_num(*x.def, rx, x.col) == field_num(*y.def, ry, y.col);
+    return field_str(*x.def, rx, x.col) == field_str(*y.def, ry, y.col);
+}
+
+// Rows of one side, rowSize bytes each, chained by join key hash.
+struct JoinBuild {
+    const JoinSide* js;
+    vector<uint8_t> rows;
+    vector<uint32_t> head, next;        // row number + 1, 0 ends a chain
+
+    size_t count() const { return rows.size() / js->def->rowSize; }
+    const uint8_t* row(uint32_t i) const { return &rows[(size_t)i * js->def->rowSize]; }
+
+    void index() {
+        size_t n = count(), buckets = 16;
+        while (buckets < n * 2) buckets *= 2;
+        head.assign(buckets, 0);
+        next.assign(n, 0);
+        for (uint32_t i = 0; i < n; ++i) {
+            size_t b = (size_t)join_hash(*js, row(i)) & (buckets - 1);
+            next[i] = head[b];
+            head[b] = i + 1;
+        }
+    }
+
+    // Calls fn(buildRow) for each build row whose key equals that of probe row rec of side p.
+    template <class F>
+    bool probe(const JoinSide& p, const uint8_t* rec, F&& fn) const {
+        for (uint32_t i = head[(size_t)join_hash(p, rec) & (head.size() - 1)]; i; i = next[i - 1])
+            if (join_match(*js, row(i - 1), p, rec) && !fn(row(i - 1))) return false;
+        return true;
+    }
+};
+
+static const uint64_t ESTIMATE_SAMPLES = 16;     // pages (status blocks) live_rows reads
+static const uint64_t ESTIMATE_DIVE = 4096;       // index entries an estimate counts before guessing
+
+// Live rows of tf, from the page headers (status bytes of a columnar table)
+// of up to ESTIMATE_SAMPLES spots spread over the file: end_rid() counts
+// every slot ever handed out, deleted ones included.
+static uint64_t live_rows(TableFile& tf) {
+    tf.flush();
+    uint64_t live = 0;
+    if (const ColumnStore* cs = tf.cols.get()) {
+        uint64_t blocks = (cs->stored + COLUMN_BLOCK - 1) / COLUMN_BLOCK, k = min(blocks, ESTIMATE_SAMPLES), seen = 0;
+        vector<uint8_t> status;
+        for (uint64_t i = 0; i < k; ++i) {
+            uint64_t base = i * blocks / k * COLUMN_BLOCK;
+            status.resize((size_t)min<uint64_t>(COLUMN_BLOCK, cs->stored - base));
+            if (!pread_full(cs->statusFd, status.data(), status.size(), (off_t)(PAGE_SIZE + base))) break;
+            live += (uint64_t)count(status.begin(), status.end(), (uint8_t)ROW_LIVE);
+            seen += status.size();
+        }
+        return (seen ? (uint64_t)((double)live * cs->stored / seen) : 0) + (cs->rows - cs->stored);
+    }
+    uint64_t pages = tf.pages > 1 ? tf.pages - 1 : 0, k = min(pages, ESTIMATE_SAMPLES), seen = 0;
+    PageHeader ph;
+    for (uint64_t i = 0; i < k; ++i, ++seen) {
+        if (!BUFFER_POOL.read(tf.pool, 1 + i * pages / k, &ph, sizeof ph, true)) break;
+        live += ph.live;
+    }
+    return seen ? (uint64_t)((double)live * pages / seen) : 0;
+}
+
+// Share of live rows in zone segments pred doesn't rule out.
+static double zone_share(const TableHandle& th, const Predicate& pred) {
+    uint64_t n = th.zones.count(), may = 0;
+    if (!n || pred.groups.empty()) return 1.0;
+    for (uint64_t s = 0; s < n; ++s) may += zone_may_match(th.zones, s, pred);
+    return (double)may / n;
+}
+
+// Rows of th the statement is expected to read through pred: index entries
+// counted up to ESTIMATE_DIVE, past that (and for a full scan) the live rows
+// in the zone segments that may match.
+static uint64_t row_estimate(TableHandle& th, const Predicate& pred) {
+    AccessPath ap = choose_access_path(th, pred);
+    const KeyRange& kr = ap.range;
+    uint64_t n = 0;
+    auto counted = [&](uint64_t) { return ++n < ESTIMATE_DIVE; };
+    switch (ap.kind) {
+    case AccessPath::PK_LOOKUP: return 1;
+    case AccessPath::PK_RANGE: btree_range(th.pk, kr, counted); break;
+    case AccessPath::INDEX_RANGE: btree_range(ap.index->bt, kr, counted); break;
+    case AccessPath::INDEX_LOOKUP:
+        if (ap.index->is_hash()) ap.index->hash.lookup(kr.eq.data(), [&](uint64_t) { ++n; });
+        else ap.index->bt.scan_from(kr.eq.data(), [&](const uint8_t* key, uint64_t rid) {
+            return key_cmp(ap.index->bt.numeric, key, kr.eq.data()) == 0 && counted(rid);
+        });
+        break;
+    default: return (uint64_t)(live_rows(th.file) * zone_share(th, pred));
+    }
+    if (n < ESTIMATE_DIVE) return n;
+    return max(n, (uint64_t)(live_rows(th.file) * zone_share(th, pred)));
+}
+
+// Rows per side the statement is expected to read.
+static uint64_t join_estimate(JoinSide& js) {
+    return row_estimate(js.th, js.pred);
+}
+
+static SecondaryIndex* join_index(JoinSide& js) {
+    for (auto& ix : js.th.indexes) if (ix.def->col == js.col) return &ix;
+    return nullptr;
+}
+
+// Calls emit(joinedRow) for each pair of rows matching on the join columns,
+// until emit returns false.
+template <class F>
+static void run_join(JoinPlan& jp, F&& emit) {
+    ProfileSpan span;
+    vector<uint8_t> out(jp.def.rowSize, 0);
+    auto pair_up = [&](const JoinSide& x, const uint8_t* rx, const JoinSide& y, const uint8_t* ry) {
+        ++span.out;
+        memcpy(&out[x.base], rx, x.def->rowSize);
+        memcpy(&out[y.base], ry, y.def->rowSize);
+        return emit((const uint8_t*)out.data());
+    };
+    uint64_t est[2] = { join_estimate(jp.side[0]), join_estimate(jp.side[1]) };
+    auto side_text = [&](const JoinSide& js) { return js.def->name + " (~" + to_string(est[&js - jp.side]) + " rows)"; };
+
+    // index nested loop: scan the outer side, look each key up in the inner one
+    int inner = -1;
+    for (int s = 0; s < 2; ++s) {
+        JoinSide& in = jp.side[s];
+        bool indexed = in.col == in.def->pkIndex || join_index(in);
+        if (indexed && est[1 - s] * 8 <= est[s] && (inner < 0 || est[1 - s] < est[1 - inner])) inner = s;
+    }
+    if (inner >= 0) {
+        JoinSide& in = jp.side[inner];
+        JoinSide& outer = jp.side[1 - inner];
+        const ColumnDef& ic = in.def->cols[in.col];
+        SecondaryIndex* ix = in.col == in.def->pkIndex ? nullptr : join_index(in);
+        if (PROFILE) {
+            string d = "index nested loop: outer " + side_text(outer) + ", inner " + side_text(in) + " looked up by " +
+                (ix ? "index " + ix->def->name : string("PK")) + " on " + ic.name;
+            if (!in.pred.groups.empty()) d += "; inner filter " + predicate_text(*in.def, in.pred);
+            span.begin("join", d);
+        }
+        in.th.file.flush();
+        RowFetcher rows(in.th.file);
+        vector<uint8_t> key(key_width(ic)), ikey(key_width(ic));
+        bool go = true;
+        // under a snapshot, inner rows changed since are matched by image (see scan_where)
+        bool snapshot = in.th.file.view.active();
+        SnapshotChanges sc(in.th.file.view, [&](const uint8_t* rec) { return in.pred.eval(rec); });
+        auto visit = [&](const uint8_t* orec, uint64_t rid) {
+            if (snapshot && sc.changed.count(rid)) return go;
+            const uint8_t* irec = rows.get(rid);
+            if (!irec) return true;
+            ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+            if (in.pred.eval(irec) && !pair_up(outer, orec, in, irec)) go = false;
+            return go;
+        };
+        vector<uint64_t> hits;
+        auto hit = [&](const uint8_t*, uint64_t rid) { hits.push_back(rid); return true; };
+        scan_where(outer.th, outer.pred, [&](const uint8_t* orec, uint64_t) {
+            if (ic.kind == COL_VARCHAR) {
+                string_view s = field_str(*outer.def, orec, outer.col);
+                if ((int)s.size() > ic.length) return true;
+                uint16_t len = (uint16_t)s.size();
+                memset(key.data(), 0, key.size());
+                memcpy(key.data(), &len, 2);
+                memcpy(key.data() + 2, s.data(), s.size());
+            }
+            else {
+                int64_t v = field_num(*outer.def, orec, outer.col);
+                memcpy(key.data(), &v, 8);
+            }
+            auto probe = [&](auto&& visit) {
+                uint64_t rid;
+                if (!ix) { if (in.th.pk.find(key.data(), rid)) visit(orec, rid); }
+                else if (ix->is_hash()) ix->hash.lookup(key.data(), [&](uint64_t r) { if (go) visit(orec, r); });
+                else ix->bt.scan_from(key.data(), [&](const uint8_t* k, uint64_t r) {
+                    return key_cmp(ix->bt.numeric, k, key.data()) == 0 && visit(orec, r);
+                });
+            };
+            if (!snapshot) { probe(visit); return go; }
+            hits.clear();
+            probe(hit);
+            sc.refresh();
+            for (uint64_t r : hits) if (!visit(orec, r)) return false;
+            for (const auto& kv : sc.rows) {
+                row_key(*in.def, in.col, kv.second.data(), ikey.data());
+                if (key_cmp(ic.kind != COL_VARCHAR, ikey.data(), key.data()) != 0) continue;
+                ROWS_VISITED.fetch_add(1, memory_order_relaxed);
+                if (!pair_up(outer, orec, in, kv.second.data())) return go = false;
+            }
+            return go;
+        }, &outer.project, false);
+        return;
+    }
+
+    // hash join, building on the smaller side
+    int b = est[0] <= est[1] ? 0 : 1;
+    JoinSide& bs = jp.side[b];
+    JoinSide& ps = jp.side[1 - b];
+    if (PROFILE) span.begin("join", "hash join: build " + side_text(bs) + ", probe " + side_text(ps) + " on " +
+        bs.def->name + "." + bs.def->cols[bs.col].name + " = " + ps.def->name + "." + ps.def->cols[ps.col].name);
+    JoinBuild build;
+    build.js = &bs;
+    vector<string> parts[2];            // grace partitions once the build side is too big
+    vector<vector<uint8_t>> pbuf(JOIN_PARTS);
+    auto partition = [&](int s, const uint8_t* rec) {
+        const JoinSide& js = jp.side[s];
+        int p = (int)(join_hash(js, rec) % JOIN_PARTS);
+        pbuf[p].insert(pbuf[p].end(), rec, rec + js.def->rowSize);
+        if (pbuf[p].size() >= (1u << 16)) { temp_append(parts[s][p], pbuf[p].data(), pbuf[p].size()); pbuf[p].clear(); }
+    };
+    auto drain = [&](int s) {
+        for (int p = 0; p < JOIN_PARTS; ++p) {
+            if (!pbuf[p].empty()) temp_append(parts[s][p], pbuf[p].data(), pbuf[p].size());
+            pbuf[p].clear();
+        }
+    };
+    auto cleanup = [&] { for (auto& v : parts) for (auto& path : v) ::unlink(path.c_str()); };
+
+    scan_where(bs.th, bs.pred, [&](const uint8_t* rec, uint64_t) {
+        if (!parts[b].empty()) { partition(b, rec); return; }
+        build.rows.insert(build.rows.end(), rec, rec + bs.def->rowSize);
+        if (build.rows.size() <= QUERY_MEMORY) return;
+        for (int s = 0; s < 2; ++s) for (int p = 0; p < JOIN_PARTS; ++p) parts[s].push_back(temp_path("join"));
+        for (size_t i = 0; i < build.count(); ++i) partition(b, build.row((uint32_t)i));
+        vector<uint8_t>().swap(build.rows);
+    }, &bs.project, false);
+
+    if (parts[b].empty()) {
+        build.index();
+        scan_where(ps.th, ps.pred, [&](const uint8_t* rec, uint64_t) {
+            return build.probe(ps, rec, [&](const uint8_t* brow) { return pair_up(bs, brow, ps, rec); });
+        }, &ps.project, false);
+        return;
+    }
+    drain(b);
+    span.note("; build outgrew memory, joined as " + to_string(JOIN_PARTS) + " partition pairs on disk");
+    scan_where(ps.th, ps.pred, [&](const uint8_t* rec, uint64_t) { partition(1 - b, rec); }, &ps.project, false);
+    drain(1 - b);
+    bool go = true;
+    for (int p = 0; p < JOIN_PARTS && go; ++p) {
+        build.rows.clear();
+        temp_read(parts[b][p], bs.def->rowSize, [&](const uint8_t* rec) {
+            build.rows.insert(build.rows.end(), rec, rec + bs.def->rowSize);
+        });
+        build.index();
+        temp_read(parts[1 - b][p], ps.def->rowSize, [&](const uint8_t* rec) {
+            if (go) go = build.probe(ps, rec, [&](const uint8_t* brow) { return pair_up(bs, brow, ps, rec); });
+        });
+    }
+    cleanup();
+}
+
+// One output column of a grouped select: a group-by field or an aggregate.
+struct SelectItem {
+    int col = -1;               // group-by column, or -1
+    int agg = -1;               // index into AggSpec::aggs, or -1
+};
+
+// Prints the groups of the rows scan(fold) feeds to fold(rec, rid), which
+// may be called on any pool thread.
+template <class Scan>
+static size_t select_grouped(const AggSpec& spec, const vector<SelectItem>& items, Scan&& scan,
+    const vector<OrderKey>& orderBy, long long limit) {
+    const TableDef& def = *spec.def;
+    ProfileSpan span;
+    if (PROFILE) {
+        string d = spec.keys.empty() ? "one group" : "hash on";
+        for (size_t k = 0; k < spec.keys.size(); ++k) d += (k ? ", " : " ") + def.cols[spec.keys[k]].name;
+        for (size_t k = 0; k < spec.aggs.size(); ++k) d += (k ? ", " : "; ") + agg_text(def, spec.aggs[k]);
+        span.begin("aggregate", d);
+    }
+    size_t slotsN = thread_count() + 1;
+    vector<AggTable> partial;
+    for (size_t k = 0; k < slotsN; ++k) partial.emplace_back(spec, max<size_t>(QUERY_MEMORY / slotsN, 1));
+    scan([&](const uint8_t* rec, uint64_t) {
+        AggTable& t = partial[WORKER_SLOT];
+        uint8_t key[512];
+        vector<uint8_t> big;
+        uint8_t* k = key;
+        if (spec.keyWidth > sizeof key) { big.resize(spec.keyWidth); k = big.data(); }
+        uint32_t at = 0;
+        for (int c : spec.keys) {
+            uint32_t w = column_width(def.cols[c]);
+            memcpy(k + at, rec + def.offsets[c], w);
+            at += w;
+        }
+        t.fold(k, rec);
+    });
+
+    for (auto& t : partial) if (!t.parts.empty()) { span.note("; spilled to disk"); break; }
+    AggTable total(spec, QUERY_MEMORY);
+    for (auto& t : partial) t.finish([&](const uint8_t* g) { total.merge(g); });
+    RowOrder order;
+    order.def = &def;
+    order.spec = &spec;
+    order.keys = orderBy;
+    vector<uint8_t> scratch(def.rowSize, 0);
+    size_t groups = 0;
+    saaddb::Row row(ROW_SINK ? items.size() : 0);
+    bool stopped = false;
+    if (ROW_SINK) {
+        vector<saaddb::Column> cols;
+        for (const SelectItem& it : items)
+            cols.push_back(it.agg >= 0 ? agg_column(spec, spec.aggs[it.agg]) : column_info(def.cols[it.col]));
+        ROW_SINK->columns(cols);
+    }
+    auto print = [&](const uint8_t* g) {
+        ++groups;
+        if (!ROW_SINK || stopped) return;
+        for (size_t j = 0; j < items.size(); ++j) {
+            const SelectItem& it = items[j];
+            if (it.agg >= 0) agg_result(spec, spec.aggs[it.agg], g, scratch.data(), row[j]);
+            else {
+                memcpy(scratch.data() + def.offsets[it.col], g + order.offset(it.col), column_width(def.cols[it.col]));
+                field_value(def, scratch.data(), it.col, row[j]);
+            }
+        }
+        stopped = !ROW_SINK->row(row);
+    };
+    if (!orderBy.empty()) sort_records(order, spec.width, limit, [&](auto push) { total.finish(push); }, print);
+    else total.finish([&](const uint8_t* g) { if (limit < 0 || (long long)groups < limit) print(g); });
+    if (!groups && spec.keys.empty() && limit != 0) {
+        vector<uint8_t> empty(spec.width, 0);   // aggregates over no rows: count 0, the rest NULL
+        print(empty.data());
+    }
+    if (!groups && !spec.keys.empty()) OUT << "[SaadDB] (no rows)\n";
+    span.out = groups;
+    return groups;
+}
+
+// A select parsed and resolved against the catalog: what runs per call is
+// binding the WHERE / LIMIT parameters, opening the tables and the scan.
+struct SelectPlan {
+    Tokens T;                   // the statement's tokens; parameters are ? until bound
+    vector<int> params;         // positions of the ? placeholders in T
+    uint64_t version = 0;       // CATALOG_VERSION the plan was made against
+    unique_ptr<JoinPlan> join;
+    const TableDef* def = nullptr;
+    int wherePos = 0, pGroup = 0, pLimit = 0;
+    Predicate pred;             // compiled once; WHERE parameters wait in slots
+    vector<WhereSlot> slots;
+    Predicate bound;            // pred with this call's values in its slots
+    long long limit = -1;
+    vector<int> idxs;
+    AggSpec spec;
+    vector<SelectItem> items;
+    vector<OrderKey> orderBy;
+    bool grouped = false;
+    vector<int> project;        // the columns the statement reads
+};
+
+// Parses and resolves a select; false (with the reason printed) if it's invalid.
+static bool plan_select(SelectPlan& p) {
+    const Tokens& T = p.T;
+    if (T.size() < 4 || !is_kw(T[0], "select")) { fail() << "[SaadDB] INVALID SELECT\n"; return false; }
+    p.version = CATALOG_VERSION;
+
+    int i = 1;
+    vector<string> want;
+    for (; i < (int)T.size() && (!is_kw(T[i], "from") || T[i].quoted); ++i) {
+        if (T[i] == ",") continue;
+        want.push_back(T[i]);
+    }
+    if (i >= (int)T.size() - 1 || !is_kw(T[i], "from")) { fail() << "[SaadDB] FROM missing\n"; return false; }
+    string table = T[++i];
+    if (!ensure_table_exists(table)) return false;
+
+    // from A join B on A.x = B.y
+    if (i + 1 < (int)T.size() && is_kw(T[i + 1], "join")) {
+        if (i + 6 >= (int)T.size() || !is_kw(T[i + 3], "on") || T[i + 5] != "=") {
+            fail() << "[SaadDB] Expected JOIN table ON column = column\n"; return false;
+        }
+        const string& other = T[i + 2];
+        if (!ensure_table_exists(other)) return false;
+        if (other == table) { fail() << "[SaadDB] A table can't be joined with itself\n"; return false; }
+        p.join.reset(new JoinPlan());
+        JoinPlan& jp = *p.join;
+        join_def(jp, *lookup_table(table), *lookup_table(other));
+        int nA = (int)jp.side[0].def->cols.size();
+        int l = column_index(jp.def, T[i + 4]), r = column_index(jp.def, T[i + 6]);
+        if (l < 0 || r < 0) { fail() << "[SaadDB] " << column_error(jp.def, T[l < 0 ? i + 4 : i + 6]) << "\n"; return false; }
+        if ((l < nA) == (r < nA)) { fail() << "[SaadDB] ON must compare a column of each table\n"; return false; }
+        if (l > r) swap(l, r);
+        const ColumnDef& lc = jp.def.cols[l];
+        const ColumnDef& rc = jp.def.cols[r];
+        if (lc.kind != rc.kind || (lc.kind == COL_DECIMAL && lc.scale != rc.scale)) {
+            fail() << "[SaadDB] " << lc.name << " and " << rc.name << " have different types\n"; return false;
+        }
+        jp.side[0].col = l;
+        jp.side[1].col = r - nA;
+        i += 6;
+    }
+
+    p.def = p.join ? &p.join->def : lookup_table(table);
+    const TableDef& def = *p.def;
+    bool select_all = (want.size() == 1 && want[0] == "*");
+    vector<int>& idxs = p.idxs;
+    AggSpec& spec = p.spec;
+    spec.def = &def;
+    vector<SelectItem>& items = p.items;
+    if (!select_all) {
+        for (size_t k = 0; k < want.size(); ++k) {
+            // name(arg) arrives as two tokens; a column that happens to be called count stays a column
+            AggFn fn;
+            if (k + 1 < want.size() && column_index(def, want[k]) < 0 && parse_agg_fn(want[k], fn)) {
+                AggItem a;
+                a.fn = fn;
+                const string& arg = want[++k];
+                if (arg != "*") {
+                    a.col = column_index(def, arg);
+                    if (a.col < 0) { fail() << "[SaadDB] " << column_error(def, arg) << "\n"; return false; }
+                }
+                else if (fn != AGG_COUNT) { fail() << "[SaadDB] Only COUNT takes *\n"; return false; }
+                SelectItem it;
+                it.agg = (int)spec.aggs.size();
+                spec.aggs.push_back(a);
+                items.push_back(it);
+                continue;
+            }
+            int idx = column_index(def, want[k]);
+            if (idx < 0) { fail() << "[SaadDB] " << column_error(def, want[k]) << "\n"; return false; }
+            idxs.push_back(idx);
+            SelectItem it;
+            it.col = idx;
+            items.push_back(it);
+        }
+    }
+    else {
+        for (int k = 0; k < (int)def.cols.size(); ++k) idxs.push_back(k);
+    }
+
+    // WHERE runs up to GROUP BY, ORDER BY or LIMIT, in that order. Its
+    // column op value terms are stepped over, and GROUP and ORDER count only
+    // before BY, so columns called Group, Order or Limit stay columns.
+    int n = (int)T.size();
+    int from = i + 1;
+    if (from < n && is_kw(T[from], "where")) {
+        int j = from + 1;
+        while (j + 3 < n && (is_kw(T[j + 3], "and") || is_kw(T[j + 3], "or"))) j += 4;
+        from = min(j + 3, n);
+    }
+    auto clause = [&](const char* word, bool by) {
+        for (int k = from; k < n; ++k)
+            if (is_kw(T[k], word) && !T[k].quoted && (!by || (k + 1 < n && is_kw(T[k + 1], "by")))) return k;
+        return n;
+    };
+    int pLimit = keyword_pos(T, "limit", max(from, n - 2));
+    for (int k = from; pLimit == n && k < n; ++k)
+        if (is_kw(T[k], "limit") && !T[k].quoted && column_index(def, T[k]) < 0) pLimit = k;
+    int pOrder = clause("order", true);
+    if (pOrder > pLimit) pOrder = pLimit;
+    int pGroup = clause("group", true);
+    if (pGroup > pOrder) pGroup = pOrder;
+    p.wherePos = i + 1;
+    p.pGroup = pGroup;
+    p.pLimit = pLimit;
+    if (pLimit < n) {
+        bool param = find(p.params.begin(), p.params.end(), pLimit + 1) != p.params.end();
+        if (pLimit + 2 != n || (!param && (!is_integer(T[pLimit + 1]) || T[pLimit + 1][0] == '-' || T[pLimit + 1].size() > 18))) {
+            fail() << "[SaadDB] LIMIT needs a row count at the end\n"; return false;
+        }
+        if (!param) p.limit = stoll(T[pLimit + 1]);
+    }
+    if (pGroup < pOrder) {
+        if (pGroup + 2 >= pOrder || !is_kw(T[pGroup + 1], "by")) { fail() << "[SaadDB] Expected GROUP BY column\n"; return false; }
+        for (int k = pGroup + 2; k < pOrder; ++k) {
+            if (T[k] == ",") continue;
+            int c = column_index(def, T[k]);
+            if (c < 0) { fail() << "[SaadDB] " << column_error(def, T[k]) << "\n"; return false; }
+            if (find(spec.keys.begin(), spec.keys.end(), c) == spec.keys.end()) spec.keys.push_back(c);
+        }
+    }
+    bool grouped = p.grouped = !spec.aggs.empty() || !spec.keys.empty();
+    vector<OrderKey>& orderBy = p.orderBy;
+    if (pOrder < pLimit) {
+        if (pOrder + 2 >= pLimit || !is_kw(T[pOrder + 1], "by")) { fail() << "[SaadDB] Expected ORDER BY column\n"; return false; }
+        for (int k = pOrder + 2; k < pLimit; ++k) {
+            if (T[k] == ",") continue;
+            OrderKey ok;
+            AggFn fn;
+            if (grouped && k + 1 < pLimit && column_index(def, T[k]) < 0 && parse_agg_fn(T[k], fn)) {
+                // an aggregate call; one that isn't selected is computed anyway
+                AggItem a;
+                a.fn = fn;
+                const string& arg = T[++k];
+                if (arg != "*" && (a.col = column_index(def, arg)) < 0) { fail() << "[SaadDB] " << column_error(def, arg) << "\n"; return false; }
+                for (size_t x = 0; x < spec.aggs.size() && ok.agg < 0; ++x)
+                    if (spec.aggs[x].fn == a.fn && spec.aggs[x].col == a.col) ok.agg = (int)x;
+                if (ok.agg < 0) { ok.agg = (int)spec.aggs.size(); spec.aggs.push_back(a); }
+            }
+            else {
+                ok.col = column_index(def, T[k]);
+                if (ok.col < 0) { fail() << "[SaadDB] " << column_error(def, T[k]) << "\n"; return false; }
+                if (grouped && find(spec.keys.begin(), spec.keys.end(), ok.col) == spec.keys.end()) {
+                    fail() << "[SaadDB] ORDER BY " << T[k] << " must be a GROUP BY column or an aggregate\n"; return false;
+                }
+            }
+            if (k + 1 < pLimit && (is_kw(T[k + 1], "asc") || is_kw(T[k + 1], "desc"))) ok.desc = is_kw(T[++k], "desc");
+            orderBy.push_back(ok);
+        }
+    }
+    if (grouped && select_all) { fail() << "[SaadDB] SELECT * can't be grouped\n"; return false; }
+    for (const SelectItem& it : items) {
+        if (grouped && it.agg < 0 && find(spec.keys.begin(), spec.keys.end(), it.col) == spec.keys.end()) {
+            fail() << "[SaadDB] Column " << def.cols[it.col].name << " must be in GROUP BY or inside an aggregate\n";
+            return false;
+        }
+    }
+
+    // the WHERE is compiled now, its parameters left in slots; a join's is split per call
+    bool whereParams = false;
+    for (int k : p.params) whereParams |= k < pGroup;
+    if (!whereParams || !p.join) {
+        string err;
+        Tokens head(T.begin(), T.begin() + pGroup);
+        bool whereOk = p.join ? split_join_where(*p.join, head, p.wherePos, err)
+                              : compile_where(def, head, p.wherePos, p.pred, err, &p.params, &p.slots);
+        if (!whereOk) { fail() << "[SaadDB] " << err << "\n"; return false; }
+    }
+    string err;
+    if (grouped && !plan_aggregates(spec, err)) { fail() << "[SaadDB] " << err << "\n"; return false; }
+
+    vector<int>& project = p.project;
+    project = idxs;
+    for (int c : spec.keys) project.push_back(c);
+    for (const AggItem& a : spec.aggs) if (a.col >= 0) project.push_back(a.col);
+    for (const OrderKey& k : orderBy) if (k.col >= 0) project.push_back(k.col);
+    sort(project.begin(), project.end());
+    project.erase(unique(project.begin(), project.end()), project.end());
+    if (p.join) {
+        int nA = (int)p.join->side[0].def->cols.size();
+        for (int s = 0; s < 2; ++s) {
+            JoinSide& js = p.join->side[s];
+            js.project.push_back(js.col);
+            for (int c : project) if ((c < nA) == (s == 0)) js.project.push_back(s ? c - nA : c);
+            sort(js.project.begin(), js.project.end());
+            js.project.erase(unique(js.project.begin(), js.project.end()), js.project.end());
+        }
+    }
+    return true;
+}
+
+// Runs a planned select; args fill its ? placeholders, in order.
+static void run_select(SelectPlan& p, const vector<string>& args) {
+    const TableDef& def = *p.def;
+    unique_ptr<JoinPlan>& join = p.join;
+    long long limit = p.limit;
+    if (!p.params.empty()) {
+        Tokens head;
+        if (join) head.assign(p.T.begin(), p.T.begin() + p.pGroup);
+        bool whereParams = false;
+        for (size_t a = 0; a < p.params.size(); ++a) {
+            int k = p.params[a];
+            if (k < p.pGroup) { if (join) { head[k].assign(args[a]); head[k].quoted = true; } whereParams = true; }
+            else if (k == p.pLimit + 1) {
+                const string& v = args[a];
+                if (!is_integer(v) || v[0] == '-' || v.size() > 18) { fail() << "[SaadDB] LIMIT needs a row count\n"; return; }
+                limit = stoll(v);
+            }
+        }
+        string err;
+        bool whereOk = !whereParams || (join ? split_join_where(*join, head, p.wherePos, err)
+                                             : bind_where(def, p.pred, p.slots, args, p.bound, err));
+        if (!whereOk) { fail() << "[SaadDB] " << err << "\n"; return; }
+    }
+    const Predicate& pred = p.slots.empty() ? p.pred : p.bound;
+    const AggSpec& spec = p.spec;
+    const vector<int>& project = p.project;
+    const vector<int>& idxs = p.idxs;
+    const vector<OrderKey>& orderBy = p.orderBy;
+
+    TableHandle th;
+    if (join) {
+        for (int s = 0; s < 2; ++s) {
+            if (!open_table(*join->side[s].def, join->side[s].th)) { fail(Error::IoError) << "[SaadDB] No data.\n"; return; }
+        }
+    }
+    else if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] No data.\n"; return; }
+    // a join's handles live in the plan; close them (saving their state) when the call ends
+    struct CloseSides {
+        JoinPlan* jp;
+        ~CloseSides() { if (jp) for (auto& s : jp->side) s.th.close(); }
+    } closeSides{ join.get() };
+    mark_planned();
+    ProfileSpan span;
+    if (PROFILE) span.begin("select", limit >= 0 ? "limit " + to_string(limit) : string());
+    // calls fn(rec) for each row of the FROM clause matching WHERE until fn returns false
+    auto each_row = [&](auto&& fn) {
+        if (join) run_join(*join, fn);
+        else scan_where(th, pred, [&](const uint8_t* rec, uint64_t) { return fn(rec); }, &project, false);
+    };
+
+    if (p.grouped) {
+        if (join) span.out = select_grouped(spec, p.items, [&](auto&& fold) {
+            each_row([&](const uint8_t* rec) { fold(rec, 0); return true; });
+        }, orderBy, limit);
+        else span.out = select_grouped(spec, p.items, [&](auto&& fold) { scan_where_parallel(th, pred, project, fold); }, orderBy, limit);
+        return;
+    }
+    long long shown = 0;
+    saaddb::Row row(ROW_SINK ? idxs.size() : 0);
+    bool stopped = false;
+    if (ROW_SINK) {
+        vector<saaddb::Column> cols;
+        for (int k : idxs) cols.push_back(column_info(def.cols[k]));
+        ROW_SINK->columns(cols);
+    }
+    auto print = [&](const uint8_t* rec) {
+        ++shown;
+        if (!ROW_SINK || stopped) return;
+        for (size_t j = 0; j < idxs.size(); ++j) field_value(def, rec, idxs[j], row[j]);
+        stopped = !ROW_SINK->row(row);
+    };
+    if (orderBy.empty()) {
+        // without ORDER BY any rows will do, so LIMIT ends the scan
+        if (limit != 0) each_row([&](const uint8_t* rec) {
+            print(rec);
+            return (limit < 0 || shown < limit) && !stopped;
+        });
+    }
+    else if (limit != 0) {
+        RowOrder order;
+        order.def = &def;
+        order.keys = orderBy;
+        sort_records(order, def.rowSize, limit, [&](auto push) {
+            each_row([&](const uint8_t* rec) { push(rec); return true; });
+        }, print);
+    }
+    span.out = shown;
+    if (!shown) OUT << "[SaadDB] (no rows)\n";
+}
+
+static void cmd_select(const Tokens& T) {
+    SelectPlan p;
+    p.T = T;
+    if (plan_select(p)) run_select(p, {});
+}
+
+static bool plan_update(DmlPlan& p) {
+    const Tokens& T = p.T;
+    if (T.size() < 4 || !is_kw(T[0], "update")) { fail() << "[SaadDB] INVALID UPDATE\n"; return false; }
+    const string& table = T[1];
+    if (!ensure_table_exists(table)) return false;
+
+    int pSet = keyword_pos(T, "set", 2);
+    if (pSet == (int)T.size()) { fail() << "[SaadDB] SET missing\n"; return false; }
+
+    const TableDef& def = *lookup_table(table);
+    p.def = &def;
+
+    // literal values are encoded now, parameters per call
+    int pWhere = pSet + 1;
+    for (; pWhere < (int)T.size(); pWhere += 3) {
+        int i = pWhere;
+        if (is_kw(T[i], "where") && (i + 1 >= (int)T.size() || T[i + 1] != "=")) break;   // not a column called Where
+        if (i + 2 >= (int)T.size() || T[i + 1] != "=") { fail() << "[SaadDB] Bad assignment\n"; return false; }
+        const string& col = T[i];
+        const string& val = T[i + 2];
+        int idx = column_index(def, col);
+        if (idx < 0) { fail() << "[SaadDB] Unknown column " << col << "\n"; return false; }
+        vector<uint8_t>& field = p.updates[idx];
+        field.assign(column_width(def.cols[idx]), 0);
+        // the last assignment of a column wins
+        p.fields.erase(remove_if(p.fields.begin(), p.fields.end(), [&](const DmlPlan::Field& f) { return f.col == idx; }), p.fields.end());
+        auto param = find(p.params.begin(), p.params.end(), i + 2);
+        if (param != p.params.end()) { p.fields.push_back({ (size_t)(param - p.params.begin()), idx, 0 }); continue; }
+        if (!encode_field(def.cols[idx], val, field.data())) {
+            fail(Error::Constraint) << "[SaadDB] Value " << val << " doesn't match type of " << col << "\n"; return false;
+        }
+    }
+
+    if (p.updates.count(def.pkIndex) && pWhere == (int)T.size()) {
+        fail() << "[SaadDB] Refuse updating PK without WHERE.\n"; return false;
+    }
+
+    string err;
+    if (!compile_where(def, T, pWhere, p.pred, err, &p.params, &p.slots)) { fail() << "[SaadDB] " << err << "\n"; return false; }
+    return true;
+}
+
+// p's WHERE with args in its slots; null (with the reason printed) when a value doesn't fit its column.
+static const Predicate* bind_dml_where(DmlPlan& p, const vector<string>& args) {
+    if (p.slots.empty()) return &p.pred;
+    string err;
+    if (!bind_where(*p.def, p.pred, p.slots, args, p.bound, err)) { fail() << "[SaadDB] " << err << "\n"; return nullptr; }
+    return &p.bound;
+}
+
+static void run_update(DmlPlan& p, const vector<string>& args) {
+    const TableDef& def = *p.def;
+    const string& table = def.name;
+    map<int, vector<uint8_t>>& updates = p.updates;
+    for (const DmlPlan::Field& f : p.fields) {
+        if (!encode_field(def.cols[f.col], args[f.arg], updates[f.col].data())) {
+            fail(Error::Constraint) << "[SaadDB] Value " << args[f.arg] << " doesn't match type of " << def.cols[f.col].name << "\n"; return;
+        }
+    }
+    const Predicate* where = bind_dml_where(p, args);
+    if (!where) return;
+    const Predicate& pred = *where;
+    int pkIndex = def.pkIndex;
+
+    TableHandle th;
+    if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] No data.\n"; return; }
+    mark_planned();
+    ProfileSpan span;
+    if (PROFILE) {
+        string cols;
+        for (auto& kv : updates) cols += (cols.empty() ? "" : ", ") + def.cols[kv.first].name;
+        span.begin("update " + table, "set " + cols);
+    }
+
+    // A new PK value is a single literal, so it can land on at most one row
+    // and must not collide with another row's key.
+    bool pkChanges = updates.count(pkIndex) != 0;
+    vector<uint8_t> newKey(th.pk.keyWidth), oldKey(th.pk.keyWidth);
+    vector<uint64_t> hits = matching_rids(th, pred);
+    if (hits.empty()) { OUT << "[SaadDB] 0 rows affected.\n"; return; }
+    if (changed_since_snapshot(table, hits)) return;
+    if (pkChanges) {
+        uint8_t* field = updates[pkIndex].data();
+        const ColumnDef& pkc = def.cols[pkIndex];
+        if (pkc.kind == COL_VARCHAR) memcpy(newKey.data(), field, newKey.size());
+        else { int64_t v = decode_num(pkc, field); memcpy(newKey.data(), &v, 8); }
+        uint64_t owner;
+        bool taken = th.pk.find(newKey.data(), owner);
+        if (hits.size() > 1 || (hits.size() == 1 && taken && owner != hits[0])) {
+            fail(Error::Constraint) << "[SaadDB] PK already exists.\n"; return;
+        }
+    }
+
+    int affected = 0;
+    bool ok = true;
+    vector<uint8_t> rec(def.rowSize), old(def.rowSize);
+    RowFetcher rows(th.file);
+    for (uint64_t rid : hits) {
+        const uint8_t* cur = rows.get(rid);
+        if (!cur) continue;
+        memcpy(old.data(), cur, def.rowSize);
+        memcpy(rec.data(), cur, def.rowSize);
+        if (pkChanges) row_key(def, pkIndex, rec.data(), oldKey.data());
+        for (auto& kv : updates) memcpy(rec.data() + def.offsets[kv.first], kv.second.data(), kv.second.size());
+        // the row first (leaving its old version for snapshots), then the indexes
+        if (!th.file.update(rid, rec.data())) { ok = false; break; }
+        th.zones.add(rec.data(), rid);
+        for (auto& kv : updates) unindex_row(th, old.data(), rid, kv.first);
+        if (pkChanges) { th.pk.erase(oldKey.data(), rid); th.pk.insert(newKey.data(), rid); }
+        for (auto& ix : th.indexes) {
+            if (!updates.count(ix.def->col)) continue;
+            pmr::vector<uint8_t> key(key_width(def.cols[ix.def->col]), stmt_arena());
+            row_key(def, ix.def->col, rec.data(), key.data());
+            ix.insert(key.data(), rid);
+        }
+        ++affected;
+    }
+    ROWS_WRITTEN.fetch_add(affected, memory_order_relaxed);
+    span.out = affected;
+    if (!flush_changes(th) || !ok) { fail(Error::IoError) << "[SaadDB] Failed writing <" << table << ">\n"; return; }
+    STMT_AFFECTED = affected;
+    OUT << "[SaadDB] " << affected << " rows affected.\n";
+}
+
+static bool plan_delete(DmlPlan& p) {
+    const Tokens& T = p.T;
+    if (T.size() < 3 || !is_kw(T[0], "delete") || !is_kw(T[1], "from")) { fail() << "[SaadDB] INVALID DELETE\n"; return false; }
+    if (!ensure_table_exists(T[2])) return false;
+
+    const TableDef& def = *lookup_table(T[2]);
+    p.def = &def;
+    string err;
+    if (!compile_where(def, T, 3, p.pred, err, &p.params, &p.slots)) { fail() << "[SaadDB] " << err << "\n"; return false; }
+    return true;
+}
+
+static void run_delete(DmlPlan& p, const vector<string>& args) {
+    const TableDef& def = *p.def;
+    const string& table = def.name;
+    const Predicate* where = bind_dml_where(p, args);
+    if (!where) return;
+    const Predicate& pred = *where;
+
+    TableHandle th;
+    if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] No data.\n"; return; }
+    mark_planned();
+    ProfileSpan span;
+    if (PROFILE) span.begin("delete from " + table, "");
+    vector<uint64_t> hits = matching_rids(th, pred);
+    if (hits.empty()) { OUT << "[SaadDB] 0 rows affected.\n"; return; }
+    if (changed_since_snapshot(table, hits)) return;
+    int affected = 0;
+    bool ok = true;
+    vector<uint8_t> key(th.pk.keyWidth), rec(def.rowSize);
+    RowFetcher rows(th.file);
+    for (uint64_t rid : hits) {
+        const uint8_t* cur = rows.get(rid);
+        if (!cur) continue;
+        memcpy(rec.data(), cur, def.rowSize);
+        if (!th.file.erase(rid)) { ok = false; break; }
+        row_key(def, def.pkIndex, rec.data(), key.data());
+        th.pk.erase(key.data(), rid);
+        unindex_row(th, rec.data(), rid);
+        ++affected;
+    }
+    ROWS_WRITTEN.fetch_add(affected, memory_order_relaxed);
+    span.out = affected;
+    if (!flush_changes(th) || !ok) { fail(Error::IoError) << "[SaadDB] Failed writing <" << table << ">\n"; return; }
+    STMT_AFFECTED = affected;
+    OUT << "[SaadDB] " << affected << " rows affected.\n";
+}
+
+// Parses and resolves an insert, update or delete; false (with the reason printed) if it's invalid.
+static bool plan_dml(DmlPlan& p) {
+    p.version = CATALOG_VERSION;
+    if (is_kw(p.T[0], "insert")) { p.kind = DmlPlan::INSERT; return plan_insert(p); }
+    if (is_kw(p.T[0], "update")) { p.kind = DmlPlan::UPDATE; return plan_update(p); }
+    p.kind = DmlPlan::DELETE;
+    return plan_delete(p);
+}
+
+// Runs a planned change; args fill its ? placeholders, in order.
+static void run_dml(DmlPlan& p, const vector<string>& args) {
+    switch (p.kind) {
+    case DmlPlan::INSERT: return run_insert(p, args);
+    case DmlPlan::UPDATE: return run_update(p, args);
+    case DmlPlan::DELETE: return run_delete(p, args);
+    }
+}
+
+// insert ...;  update ...;  delete ...;
+static void cmd_dml(const Tokens& T) {
+    DmlPlan p;
+    p.T = T;
+    if (plan_dml(p)) run_dml(p, {});
+}
+
+static void cmd_export(const Tokens& T) {
+
+    if (T.size() < 4 || !is_kw(T[2], "to")) { fail() << "[SaadDB] INVALID EXPORT\n"; return; }
+    string table = T[1];
+    if (!ensure_table_exists(table)) return;
+
+    const TableDef& def = *lookup_table(table);
+    TableHandle th;
+    if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] No data.\n"; return; }
+    ofstream out(T[3], ios::trunc);
+    if (!out) { fail(Error::IoError) << "[SaadDB] Cannot write " << T[3] << "\n"; return; }
+    long n = 0;
+    vector<string> vals(def.cols.size());
+    string line;
+    char buf[FIELD_BUF];
+    scan_rows(th.file, [&](const uint8_t* rec, uint64_t) {
+        for (size_t k = 0; k < vals.size(); ++k) vals[k].assign(field_view(def, rec, (int)k, buf));
+        join_csv_tuple(vals, line);
+        out << line << "\n";
+        ++n;
+    });
+    OUT << "[SaadDB] " << n << " rows exported to " << T[3] << "\n";
+}
+
+/* ---------- bulk load ----------
+  load T from 'file.csv' [with header, delimiter ','];
+  The file is read in blocks of whole lines. Each block is split into one
+  slice per hardware thread; the threads parse and encode their lines with
+  check_values_match_schema's rules into private row buffers. The rows are
+  then checked for PK uniqueness in one hashed pass (against the rest of the
+  load and the table's PK index) and written as whole pages (whole column
+  runs for a columnar table). Indexes are
+  built bottom-up afterwards when the table was empty, else row by row.
+  Fields may be wrapped in "double quotes" ("" inside is one quote); a field
+  can't span lines.
+*/
+static const size_t LOAD_BLOCK = 32u << 20;
+static const size_t LOAD_WRITE_PAGES = 1024;
+
+struct LoadSlice {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    vector<uint8_t> rows;
+    size_t lines = 0, rejected = 0;
+    size_t firstBad = 0;    // line within the slice (1-based), 0 if none
+    string firstReason;
+};
+
+// Splits one CSV line into fields; false on an unterminated quote.
+static bool split_csv_line(const char* p, const char* e, char delim, vector<string>& out) {
+    out.clear();
+    while (true) {
+        string f;
+        while (p < e && (*p == ' ' || *p == '\t') && *p != delim) ++p;
+        if (p < e && *p == '"') {
+            ++p;
+            while (true) {
+                if (p >= e) return false;
+                if (*p == '"') {
+                    if (p + 1 < e && p[1] == '"') { f.push_back('"'); p += 2; continue; }
+                    ++p; break;
+                }
+                f.push_back(*p++);
+            }
+            while (p < e && *p != delim) ++p;
+        }
+        else {
+            const char* s = p;
+            while (p < e && *p != delim) ++p;
+            const char* t = p;
+            while (t > s && isspace((unsigned char)t[-1])) --t;
+            f.assign(s, t);
+        }
+        out.push_back(std::move(f));
+        if (p >= e) return true;
+        ++p;    // delimiter
+    }
+}
+
+static void parse_load_slice(const TableDef& def, char delim, LoadSlice& sl) {
+    vector<string> vals;
+    vector<uint8_t> rec(def.rowSize);
+    for (const char* p = sl.begin; p < sl.end; ) {
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(sl.end - p));
+        const char* e = nl ? nl : sl.end;
+        const char* le = (e > p && e[-1] == '\r') ? e - 1 : e;
+        ++sl.lines;
+        bool blank = true;
+        for (const char* c = p; c < le; ++c) if (!isspace((unsigned char)*c)) { blank = false; break; }
+        if (!blank) {
+            const char* why = nullptr;
+            if (!split_csv_line(p, le, delim, vals)) why = "unterminated quote";
+            else if (vals.size() != def.cols.size()) why = "wrong number of fields";
+            else if (!check_values_match_schema(vals, def, rec.data())) why = "value doesn't match column type";
+            if (why) {
+                if (!sl.rejected++) { sl.firstBad = sl.lines; sl.firstReason = why; }
+            }
+            else sl.rows.insert(sl.rows.end(), rec.begin(), rec.end());
+        }
+        p = nl ? nl + 1 : sl.end;
+    }
+}
+
+static void cmd_load(const Tokens& T) {
+
+    if (T.size() < 4 || !is_kw(T[2], "from")) { fail() << "[SaadDB] INVALID LOAD\n"; return; }
+    string table = T[1], path = T[3];
+    if (!ensure_table_exists(table)) return;
+    bool header = false;
+    char delim = ',';
+    for (size_t i = 4; i < T.size(); ++i) {
+        if (is_kw(T[i], "with")) continue;
+        if (is_kw(T[i], "header")) { header = true; continue; }
+        if (is_kw(T[i], "delimiter") && i + 1 < T.size()) {
+            const string& d = T[++i];
+            if (d == "\\t" || is_kw(d, "tab")) delim = '\t';
+            else if (d.size() == 1 && d != "\n" && d != "\"") delim = d[0];
+            else { fail() << "[SaadDB] Delimiter must be one character\n"; return; }
+            continue;
+        }
+        fail() << "[SaadDB] Unknown load option " << T[i] << "\n"; return;
+    }
+
+    int in = ::open(path.c_str(), O_RDONLY);
+    if (in < 0) { fail(Error::IoError) << "[SaadDB] Cannot read " << path << "\n"; return; }
+    const TableDef& def = *lookup_table(table);
+    TableHandle th;
+    if (!open_table(def, th)) { ::close(in); fail(Error::IoError) << "[SaadDB] Rows not loaded\n"; return; }
+    if (!th.file.flush()) { ::close(in); fail(Error::IoError) << "[SaadDB] Failed writing <" << table << ">\n"; return; }
+    auto t0 = chrono::steady_clock::now();
+
+    uint64_t firstRid = th.file.end_rid();
+    bool wasEmpty = firstRid == 0;
+    wal_log(WAL_LOAD, def.name, firstRid, nullptr, nullptr, 0);
+    if (!wal_flush(true)) { ::close(in); fail(Error::IoError) << "[SaadDB] Cannot write " << WAL_FILE << "\n"; return; }
+
+    unsigned nthreads = thread_count();
+    uint32_t kw = th.pk.keyWidth;
+    unordered_set<string> seen;
+    string key(kw, '\0');
+    vector<uint8_t> out;            // accepted rows not yet written
+    size_t pageRows = def.rowsPerPage;
+    size_t loaded = 0, rejected = 0, dups = 0, lineBase = 0;
+    size_t firstBad = 0; string firstReason;
+    bool ok = true, skipHeader = header;
+    vector<char> buf;
+    size_t carry = 0;
+
+    auto write_out = [&](bool all) {
+        size_t n = out.size() / def.rowSize;
+        size_t take = all ? n : n / pageRows * pageRows;
+        if (!take) return true;
+        if (!th.file.append_rows(out.data(), take)) return false;
+        out.erase(out.begin(), out.begin() + take * def.rowSize);
+        return true;
+    };
+
+    while (ok) {
+        buf.resize(carry + LOAD_BLOCK);
+        ssize_t got = read(in, buf.data() + carry, LOAD_BLOCK);
+        if (got < 0) { ok = false; break; }
+        size_t len = carry + (size_t)got;
+        bool eof = got == 0;
+        if (len == 0) break;
+        // Parse up to the last newline; the tail waits for the next block.
+        size_t upto = len;
+        if (!eof) {
+            const char* b = buf.data();
+            size_t k = len;
+            while (k > 0 && b[k - 1] != '\n') --k;
+            if (k == 0) { carry = len; continue; }
+            upto = k;
+        }
+        const char* begin = buf.data();
+        const char* end = begin + upto;
+        if (skipHeader) {
+            const char* nl = (const char*)memchr(begin, '\n', upto);
+            begin = nl ? nl + 1 : end;
+            lineBase = 1;
+            skipHeader = false;
+        }
+
+        vector<LoadSlice> slices(nthreads);
+        size_t step = (size_t)(end - begin) / nthreads + 1;
+        const char* p = begin;
+        for (auto& sl : slices) {
+            sl.begin = p;
+            const char* q = p + min(step, (size_t)(end - p));
+            if (q < end) {
+                const char* nl = (const char*)memchr(q, '\n', (size_t)(end - q));
+                q = nl ? nl + 1 : end;
+            }
+            sl.end = p = q;
+        }
+        vector<thread> workers;
+        for (size_t i = 1; i < slices.size(); ++i)
+            workers.emplace_back(parse_load_slice, cref(def), delim, ref(slices[i]));
+        parse_load_slice(def, delim, slices[0]);
+        for (auto& w : workers) w.join();
+
+        for (auto& sl : slices) {
+            if (sl.rejected && !firstBad) { firstBad = lineBase + sl.firstBad; firstReason = sl.firstReason; }
+            rejected += sl.rejected;
+            lineBase += sl.lines;
+            size_t n = sl.rows.size() / def.rowSize;
+            for (size_t r = 0; r < n; ++r) {
+                const uint8_t* rec = &sl.rows[r * def.rowSize];
+                row_key(def, def.pkIndex, rec, (uint8_t*)&key[0]);
+                uint64_t existing;
+                if (!seen.insert(key).second || (!wasEmpty && th.pk.find((const uint8_t*)key.data(), existing))) {
+                    ++dups; continue;
+                }
+                out.insert(out.end(), rec, rec + def.rowSize);
+                ++loaded;
+            }
+            vector<uint8_t>().swap(sl.rows);
+        }
+        if (out.size() / def.rowSize >= pageRows * LOAD_WRITE_PAGES && !write_out(false)) { ok = false; break; }
+
+        memmove(buf.data(), buf.data() + upto, len - upto);
+        carry = len - upto;
+        if (eof) break;
+    }
+    ::close(in);
+    ok = ok && write_out(true) && th.file.sync();
+    if (!ok) { fail(Error::IoError) << "[SaadDB] Failed loading <" << table << ">\n"; return; }
+    wal_log(WAL_LOAD_DONE, def.name, firstRid, nullptr, nullptr, 0);
+    wal_flush(true);
+
+    // Index the new rows: bottom-up rebuilds for a table that was empty,
+    // else one insert per row.
+    bool indexed = true;
+    if (wasEmpty) {
+        indexed = rebuild_pk_index(th);
+        for (auto& ix : th.indexes) indexed = indexed && rebuild_index(th, ix);
+        th.zones.rebuild();
+    }
+    else {
+        scan_rows(th.file, [&](const uint8_t* rec, uint64_t rid) {
+            if (!indexed) return;
+            row_key(def, def.pkIndex, rec, (uint8_t*)&key[0]);
+            indexed = th.pk.insert((const uint8_t*)key.data(), rid) && index_row(th, rec, rid);
+            th.zones.add(rec, rid);
+        }, firstRid);
+    }
+    if (!indexed) { fail(Error::IoError) << "[SaadDB] Index update failed for <" << table << ">\n"; return; }
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    char took[32];
+    snprintf(took, sizeof took, "%.2f", secs);
+    STMT_AFFECTED = loaded;
+    OUT << "[SaadDB] " << loaded << " rows loaded into <" << table << "> in " << took
+        << " s (" << (long)(secs > 0 ? loaded / secs : loaded) << " rows/s)";
+    if (rejected) OUT << ", " << rejected << " rejected (first at line " << firstBad << ": " << firstReason << ")";
+    if (dups) OUT << ", " << dups << " duplicate PKs skipped";
+    OUT << ".\n";
+}
+
+static void cmd_import(const Tokens& T) {
+
+    if (T.size() < 4 || !is_kw(T[2], "from")) { fail() << "[SaadDB] INVALID IMPORT\n"; return; }
+    string table = T[1];
+    if (!ensure_table_exists(table)) return;
+    if (!file_exists(T[3])) { fail(Error::IoError) << "[SaadDB] Cannot read " << T[3] << "\n"; return; }
+
+    const TableDef& def = *lookup_table(table);
+    TableHandle th;
+    if (!open_table(def, th)) { fail(Error::IoError) << "[SaadDB] Rows not imported\n"; return; }
+    long rejected = 0;
+    long n = import_text_rows(th, T[3], rejected);
+    if (!flush_changes(th)) { fail(Error::IoError) << "[SaadDB] Failed writing <" << table << ">\n"; return; }
+    STMT_AFFECTED = n;
+    OUT << "[SaadDB] " << n << " rows imported";
+    if (rejected) OUT << ", " << rejected << " rejected";
+    OUT << ".\n";
+}
+
+// Discards everything written to it.
+struct NullBuf : streambuf {
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+// benchmark select|insert|update|delete ...;  runs the statement and
+// reports time, rows visited, heap allocations per row and the full-scan
+// segments read and skipped. A select's rows are thrown away; the others
+// really change the table, print their own messages and count
+// allocations per row written.
+static void cmd_benchmark(const Tokens& T) {
+    string kind = T.size() > 1 ? lowered(T[1]) : string();
+    if (kind != "select" && kind != "insert" && kind != "update" && kind != "delete") {
+        fail() << "[SaadDB] benchmark works on select, insert, update and delete\n"; return;
+    }
+    Tokens q(T.begin() + 1, T.end());
+    NullBuf null;
+    uint64_t allocs0 = ALLOCATIONS.load(), rows0 = ROWS_VISITED.load(), written0 = ROWS_WRITTEN.load();
+    uint64_t scanned0 = SEGMENTS_SCANNED.load(), skipped0 = SEGMENTS_SKIPPED.load();
+    auto t0 = chrono::steady_clock::now();
+    if (kind == "select") {
+        streambuf* saved = OUT.rdbuf(&null);
+        RowSink* sink = ROW_SINK;
+        ROW_SINK = nullptr;
+        cmd_select(q);
+        ROW_SINK = sink;
+        OUT.rdbuf(saved);
+    }
+    else cmd_dml(q);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    uint64_t allocs = ALLOCATIONS.load() - allocs0, rows = ROWS_VISITED.load() - rows0;
+    uint64_t written = ROWS_WRITTEN.load() - written0;
+    uint64_t scanned = SEGMENTS_SCANNED.load() - scanned0, skipped = SEGMENTS_SKIPPED.load() - skipped0;
+    uint64_t per = kind == "select" ? rows : written;
+    char line[256];
+    int n = snprintf(line, sizeof line, "[SaadDB] %.3f s, %llu rows visited (%.0f rows/s), ",
+        secs, (unsigned long long)rows, secs > 0 ? rows / secs : 0.0);
+    if (kind != "select") n += snprintf(line + n, sizeof line - n, "%llu written, ", (unsigned long long)written);
+    snprintf(line + n, sizeof line - n, "%llu allocations (%.4f per row), %llu segments scanned, %llu skipped\n",
+        (unsigned long long)allocs, per ? (double)allocs / per : 0.0, (unsigned long long)scanned, (unsigned long long)skipped);
+    OUT << line;
+}
+
+// Keeps the first limit bytes written to it: the messages of a statement
+// whose rows are thrown away, or of any statement run through the library.
+struct CaptureBuf : streambuf {
+    string text;
+    size_t limit = 4096;
+    int overflow(int c) override { if (c != EOF && text.size() < limit) text.push_back((char)c); return c; }
+    streamsize xsputn(const char* p, streamsize n) override {
+        if (text.size() < limit) text.append(p, min<size_t>((size_t)n, limit - text.size()));
+        return n;
+    }
+};
+
+// explain [analyze] select|update|delete ...;  prints the operators the
+// statement runs as. With analyze the statement really runs, its rows are
+// thrown away and each operator reports its time and counters.
+static void cmd_explain(const Tokens& T) {
+    bool analyze = T.size() > 1 && is_kw(T[1], "analyze");
+    Tokens q(T.begin() + (analyze ? 2 : 1), T.end());
+    if (q.empty() || (!is_kw(q[0], "select") && !is_kw(q[0], "update") && !is_kw(q[0], "delete"))) {
+        fail() << "[SaadDB] explain works on select, update and delete\n"; return;
+    }
+    QueryProfile qp;
+    qp.dryRun = !analyze;
+    CaptureBuf capture;
+    streambuf* saved = OUT.rdbuf(&capture);
+    RowSink* sink = ROW_SINK;
+    ROW_SINK = nullptr;
+    PROFILE = &qp;
+    uint64_t rows0 = ROWS_VISITED.load(), lookups0 = SCHEMA_LOOKUPS.load(), allocs0 = ALLOCATIONS.load();
+    auto t0 = chrono::steady_clock::now();
+    if (is_kw(q[0], "select")) cmd_select(q);
+    else cmd_dml(q);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    uint64_t rows = ROWS_VISITED.load() - rows0, lookups = SCHEMA_LOOKUPS.load() - lookups0;
+    uint64_t allocs = ALLOCATIONS.load() - allocs0;
+    PROFILE = nullptr;
+    ROW_SINK = sink;
+    OUT.rdbuf(saved);
+    // no operator ran: the statement failed before planning, so show why
+    if (qp.ops.empty()) { OUT << capture.text; return; }
+    OUT << "[SaadDB] Plan:\n";
+    print_profile(qp, analyze);
+    if (!analyze) return;
+    istringstream msgs(capture.text);
+    string ln;
+    while (getline(msgs, ln)) if (ln.rfind("[SaadDB]", 0) == 0) OUT << ln << "\n";
+    char line[160];
+    snprintf(line, sizeof line, "[SaadDB] %.3f ms in total, %llu rows read, %llu allocations, %llu schema lookups\n",
+        secs * 1e3, (unsigned long long)rows, (unsigned long long)allocs, (unsigned long long)lookups);
+    OUT << line;
+}
+
+// set threads N;   (0 = one per hardware thread)
+// set memory N;    (MB a query may hold before it spills to disk)
+// set buffer_pool N;   (MB of table and index pages kept in memory)
+// set timing on|off;
+static void cmd_set(const Tokens& T) {
+    if (T.size() == 3 && is_kw(T[1], "threads") && is_integer(T[2]) && T[2].size() < 6) {
+        long long n = stoll(T[2]);
+        if (n < 0 || n > 1024) { fail() << "[SaadDB] threads must be between 0 and 1024\n"; return; }
+        THREADS = (unsigned)n;
+        if (POOL.size() && POOL.size() != thread_count()) POOL.stop();
+        OUT << "[SaadDB] Using " << thread_count() << " thread(s) for scans and loads.\n";
+        return;
+    }
+    if (T.size() == 3 && is_kw(T[1], "memory") && is_integer(T[2]) && T[2].size() < 7) {
+        long long mb = stoll(T[2]);
+        if (mb < 1) { fail() << "[SaadDB] memory must be at least 1 MB\n"; return; }
+        QUERY_MEMORY = (size_t)mb << 20;
+        OUT << "[SaadDB] Queries may use " << mb << " MB before spilling to disk.\n";
+        return;
+    }
+    if (T.size() == 3 && is_kw(T[1], "buffer_pool") && is_integer(T[2]) && T[2].size() < 7) {
+        long long mb = stoll(T[2]);
+        if (mb < 1) { fail() << "[SaadDB] buffer_pool must be at least 1 MB\n"; return; }
+        BUFFER_POOL_BYTES = (size_t)mb << 20;
+        if (!BUFFER_POOL.set_budget(BUFFER_POOL_BYTES)) fail(Error::IoError) << "[SaadDB] Some changed pages couldn't be written back\n";
+        OUT << "[SaadDB] Keeping up to " << mb << " MB of table and index pages in memory.\n";
+        return;
+    }
+    if (T.size() == 3 && is_kw(T[1], "timing") && (is_kw(T[2], "on") || is_kw(T[2], "off"))) {
+        TIMING = is_kw(T[2], "on");
+        OUT << "[SaadDB] Timing " << lowered(T[2]) << ".\n";
+        return;
+    }
+    if (T.size() == 3 && is_kw(T[1], "synchronous") && (is_kw(T[2], "full") || is_kw(T[2], "normal") || is_kw(T[2], "off"))) {
+        SYNCHRONOUS = is_kw(T[2], "full") ? SYNC_FULL : is_kw(T[2], "normal") ? SYNC_NORMAL : SYNC_OFF;
+        OUT << "[SaadDB] Synchronous " << lowered(T[2]) << ".\n";
+        return;
+    }
+    if (T.size() == 3 && is_kw(T[1], "commit_window") && is_integer(T[2]) && T[2].size() < 8) {
+        long long us = stoll(T[2]);
+        if (us < 0 || us > 100000) { fail() << "[SaadDB] commit_window must be between 0 and 100000 microseconds\n"; return; }
+        COMMIT_WINDOW_US = (unsigned)us;
+        OUT << "[SaadDB] Commits wait up to " << us << " us to share a log sync.\n";
+        return;
+    }
+    fail() << "[SaadDB] Usage: set threads N;  set memory N;  set buffer_pool N;  set timing on|off;  set synchronous full|normal|off;  set commit_window N;\n";
+}
+
+/* ---------- statement cache ----------
+  The last STMT_CACHE_SIZE distinct statements keep their tokens, and a
+  select, insert, update or delete also keeps its plan (see SelectPlan,
+  DmlPlan), so running it again skips straight to binding its values and
+  opening the tables. Those four are keyed by their shape, read off the
+  line before it is tokenized (see shape_key): the values of a WHERE, a
+  LIMIT count, the tuples of an insert and the assignments of an update
+  become parameters of one plan that every statement differing only in
+  them runs, and a hit is neither tokenized nor parsed. One with a value
+  anywhere else, and every other statement, is keyed by its text with
+  runs of spaces outside quotes squeezed, keeps its tokens and is parsed
+  again on each run (a select, insert, update or delete keeps its plan).
+  prepare name as <stmt>; plans a select, insert, update or delete whose
+  values may be ? placeholders and keeps it until deallocate name;, and
+  execute name(v1, v2, ...); binds the placeholders left to right and runs
+  it. A statement that doesn't plan isn't prepared; a plan is made again
+  when the schema changed since (CATALOG_VERSION).
+*/
+static const size_t STMT_CACHE_SIZE = 64;
+
+struct CachedStmt {
+    Tokens tokens;
+    vector<int> params;             // positions of ? placeholders
+    bool shaped = false;            // keyed by its shape: runs from its tokens and plan
+    unique_ptr<SelectPlan> select;  // set once a select has been planned
+    unique_ptr<DmlPlan> dml;        // ... or an insert, update or delete
+};
+
+// Each thread keeps its own cache: a cached plan holds the handles its join opens.
+static thread_local list<pair<string, CachedStmt>> STMT_LRU;    // most recently used first
+static thread_local unordered_map<string, list<pair<string, CachedStmt>>::iterator> STMT_INDEX;
+
+static const chrono::milliseconds LOCK_WAIT(5000);     // a session's default (see "transactions")
+
+// What a session keeps between its statements: prepared statements, its
+// settings and its open transaction. SESSION is the session whose statement runs on this thread.
+struct SessionState {
+    unordered_map<string, CachedStmt> prepared;
+    bool timing = false;
+    int synchronous = SYNC_FULL;
+    unique_ptr<Transaction> txn;    // begin ... commit in progress
+    chrono::milliseconds lockWait = LOCK_WAIT;
+    bool lockTimedOut = false;      // the last statement didn't get its locks
+    RwLock* queuedOn = nullptr;     // keeps its turn there (lock wait 0, see LOCK_QUEUED)
+};
+static thread_local SessionState* SESSION = nullptr;
+
+static string normalize_query(const string& q) {
+    string out;
+    char quote = 0;
+    for (char c : q) {
+        if (quote) { out.push_back(c); if (c == quote) quote = 0; continue; }
+        if (c == '"' || c == '\'') quote = c;
+        if (c == ' ' && (out.empty() || out.back() == ' ')) continue;
+        out.push_back(c);
+    }
+    while (!out.empty() && out.back() == ' ') out.pop_back();
+    return out;
+}
+
+static bool is_value(const string& t, bool quoted) { return quoted || is_number(t) || is_date_token(t); }
+
+// Whether q is a select, insert, update or delete (the statements keyed by shape).
+static bool shape_cached(const string& q) {
+    size_t i = q.find_first_not_of(' ');
+    if (i == string::npos) return false;
+    size_t j = q.find_first_of(" ();", i);
+    string w = q.substr(i, j == string::npos ? string::npos : j - i);
+    return is_kw(w, "select") || is_kw(w, "insert") || is_kw(w, "update") || is_kw(w, "delete");
+}
+
+// Key of q's shape: its words and separators as parse_tokens splits them,
+// with every value (a quoted string, a number or a date) a placeholder
+// whose text goes to args.
+static string shape_key(const string& q, vector<string>& args) {
+    string key = "\x01";    // never a line's text
+    string word;
+    auto end_word = [&] {
+        if (word.empty()) return;
+        if (is_value(word, false)) { key += '\x02'; args.push_back(word); }
+        else key += word;
+        key += '\x1f';
+        word.clear();
+    };
+    for (size_t i = 0; i < q.size(); ++i) {
+        char c = q[i];
+        if (c == '"' || c == '\'') {
+            size_t close = q.find(c, i + 1);
+            if (close == string::npos) close = q.size();
+            args.emplace_back(q, i + 1, close - i - 1);
+            key += "\x03\x1f";
+            i = close;
+        }
+        else if (c == ' ' || c == '(' || c == ')' || c == ',' || c == ';' || c == '<' || c == '>' || c == '=' ||
+                 (c == '!' && i + 1 < q.size() && q[i + 1] == '=')) {
+            end_word();
+            if (c != ' ') key += c;
+        }
+        else word.push_back(c);
+    }
+    end_word();
+    return key;
+}
+
+// Positions of the values in T (TOKENS) that a plan of it takes as
+// parameters: the values of its WHERE terms, a select's LIMIT count, the
+// tuples of an insert and the assignments of an update.
+static vector<int> statement_params(const Tokens& T) {
+    vector<int> params;
+    int n = (int)T.size();
+    auto where = [&](int w) {
+        if (w >= n || !is_kw(T[w], "where")) return;
+        for (int j = w + 1; j + 2 < n; j += 4) {
+            if (is_value(T[j + 2], T[j + 2].quoted)) params.push_back(j + 2);
+            if (j + 3 >= n || T[j + 3].quoted || (!is_kw(T[j + 3], "and") && !is_kw(T[j + 3], "or"))) break;
+        }
+    };
+    if (n == 0) return params;
+    if (is_kw(T[0], "select")) {
+        int from = keyword_pos(T, "from");
+        where(from + 2 < n && is_kw(T[from + 2], "join") ? from + 8 : from + 2);
+        if (n >= 2 && is_kw(T[n - 2], "limit") && !T[n - 2].quoted && !T[n - 1].quoted && is_integer(T[n - 1])) params.push_back(n - 1);
+    }
+    else if (is_kw(T[0], "insert")) {
+        for (int k = keyword_pos(T, "values", 3) + 1; k < n; ++k)
+            if (is_value(T[k], T[k].quoted)) params.push_back(k);
+    }
+    else if (is_kw(T[0], "update")) {
+        int i = keyword_pos(T, "set", 2) + 1;
+        for (; i + 2 < n && T[i + 1] == "="; i += 3)
+            if (is_value(T[i + 2], T[i + 2].quoted)) params.push_back(i + 2);
+        where(i);
+    }
+    else if (is_kw(T[0], "delete")) where(3);
+    sort(params.begin(), params.end());
+    params.erase(unique(params.begin(), params.end()), params.end());
+    return params;
+}
+
+static CachedStmt& cache_entry(const string& key) {
+    STMT_LRU.emplace_front(key, CachedStmt());
+    STMT_INDEX[key] = STMT_LRU.begin();
+    if (STMT_LRU.size() > STMT_CACHE_SIZE) {
+        STMT_INDEX.erase(STMT_LRU.back().first);
+        STMT_LRU.pop_back();
+    }
+    return STMT_LRU.front().second;
+}
+
+// The cache entry of q, made on a miss. One keyed by shape comes back with
+// the values to bind in args and its tokens left in the entry; otherwise
+// TOKENS is set from it. The entry stays
+// valid until the next call.
+static CachedStmt& tokenize_cached(const string& q, vector<string>& args) {
+    string shape;
+    if (shape_cached(q)) {
+        shape = shape_key(q, args);
+        auto it = STMT_INDEX.find(shape);
+        if (it != STMT_INDEX.end()) {
+            STMT_LRU.splice(STMT_LRU.begin(), STMT_LRU, it->second);
+            return it->second->second;
+        }
+    }
+    string key = normalize_query(q);
+    auto it = STMT_INDEX.find(key);
+    if (it != STMT_INDEX.end()) {
+        STMT_LRU.splice(STMT_LRU.begin(), STMT_LRU, it->second);
+        CachedStmt& cs = it->second->second;
+        TOKENS = cs.tokens;
+        args.clear();
+        return cs;
+    }
+    parse_tokens(q);
+    // the shape holds when every value of the line is a parameter of the plan
+    vector<int> params;
+    if (!shape.empty()) params = statement_params(TOKENS);
+    bool shaped = !shape.empty() && params.size() == args.size();
+    CachedStmt& cs = cache_entry(shaped ? shape : key);
+    cs.tokens = TOKENS;
+    if (shaped) {
+        for (int k : params) { cs.tokens[k].assign("?"); cs.tokens[k].quoted = true; }
+        cs.params = move(params);
+        cs.shaped = true;
+    }
+    else args.clear();
+    return cs;
+}
+
+// Runs a cached select, planning it first if it has no plan for the current schema.
+static void select_cached(CachedStmt& cs, const vector<string>& args) {
+    if (!cs.select || cs.select->version != CATALOG_VERSION) {
+        cs.select.reset(new SelectPlan());
+        cs.select->T = cs.tokens;
+        cs.select->params = cs.params;
+        if (!plan_select(*cs.select)) { cs.select.reset(); return; }
+    }
+    run_select(*cs.select, args);
+}
+
+// Runs a cached insert, update or delete, planning it first as select_cached does.
+static void dml_cached(CachedStmt& cs, const vector<string>& args) {
+    if (!cs.dml || cs.dml->version != CATALOG_VERSION) {
+        cs.dml.reset(new DmlPlan());
+        cs.dml->T = cs.tokens;
+        cs.dml->params = cs.params;
+        if (!plan_dml(*cs.dml)) { cs.dml.reset(); return; }
+    }
+    run_dml(*cs.dml, args);
+}
+
+static bool is_dml(const string& t) { return is_kw(t, "insert") || is_kw(t, "update") || is_kw(t, "delete"); }
+
+static void execute(CachedStmt* cs = nullptr, const vector<string>& args = {});
+
+// Makes ps from the select, insert, update or delete in T[from..] (T is
+// TOKENS) and plans it; false, with the reason, if it isn't one or doesn't plan.
+static bool prepare_tokens(const Tokens& T, size_t from, CachedStmt& ps) {
+    if (from >= T.size()) { fail() << "[SaadDB] Nothing to prepare\n"; return false; }
+    const string s0 = lowered(T[from]);
+    if (s0 != "select" && !is_dml(s0)) {
+        fail() << "[SaadDB] Only select, insert, update and delete can be prepared, not " << T[from] << "\n";
+        return false;
+    }
+    ps.tokens.assign(T.begin() + from, T.end());
+    for (size_t k = 0; k < ps.tokens.size(); ++k)
+        if (ps.tokens[k] == "?" && !ps.tokens[k].quoted) ps.params.push_back((int)k);
+    if (s0 == "select") {
+        ps.select.reset(new SelectPlan());
+        ps.select->T = ps.tokens;
+        ps.select->params = ps.params;
+        if (!plan_select(*ps.select)) { fail() << "[SaadDB] Statement not prepared\n"; return false; }
+    }
+    else {
+        ps.dml.reset(new DmlPlan());
+        ps.dml->T = ps.tokens;
+        ps.dml->params = ps.params;
+        if (!plan_dml(*ps.dml)) { fail() << "[SaadDB] Statement not prepared\n"; return false; }
+    }
+    return true;
+}
+
+// Runs prepared statement ps with args bound to its placeholders. Bound
+// values count as quoted: a value is never read as a keyword.
+static void execute_prepared(CachedStmt& ps, const vector<string>& args) {
+    bool select = is_kw(ps.tokens[0], "select");
+    bool planned = select ? ps.select && ps.select->version == CATALOG_VERSION
+                 : ps.dml && ps.dml->version == CATALOG_VERSION;
+    if (!planned) TOKENS = ps.tokens;
+    if (select) select_cached(ps, args);
+    else dml_cached(ps, args);
+}
+
+// prepare name as <statement with ? placeholders>;
+static void cmd_prepare(const Tokens& T) {
+    if (T.size() < 4 || !is_kw(T[2], "as")) { fail() << "[SaadDB] Usage: prepare name as statement;\n"; return; }
+    CachedStmt ps;
+    if (!prepare_tokens(T, 3, ps)) return;
+    size_t n = ps.params.size();
+    SESSION->prepared[T[1]] = move(ps);
+    OUT << "[SaadDB] Statement <" << T[1] << "> prepared with " << n << " parameter(s).\n";
+}
+
+// execute name(v1, v2, ...);
+static void cmd_execute(const Tokens& T) {
+    if (T.size() < 2) { fail() << "[SaadDB] Usage: execute name(values);\n"; return; }
+    auto it = SESSION->prepared.find(T[1]);
+    if (it == SESSION->prepared.end()) { fail() << "[SaadDB] No prepared statement <" << T[1] << ">\n"; return; }
+    CachedStmt& ps = it->second;
+    vector<string> args(T.begin() + 2, T.end());    // T is TOKENS, rebound below
+    if (args.size() != ps.params.size()) {
+        fail() << "[SaadDB] <" << T[1] << "> takes " << ps.params.size() << " value(s), got " << args.size() << "\n"; return;
+    }
+    execute_prepared(ps, args);
+}
+
+static void cmd_deallocate(const Tokens& T) {
+    if (T.size() != 2) { fail() << "[SaadDB] Usage: deallocate name;\n"; return; }
+    if (!SESSION->prepared.erase(T[1])) { fail() << "[SaadDB] No prepared statement <" << T[1] << ">\n"; return; }
+    OUT << "[SaadDB] Statement <" << T[1] << "> deallocated.\n";
+}
+
+// After each statement under `set timing on;`: parse, plan (until the
+// statement calls mark_planned) and execute times.
+static void print_timing(chrono::steady_clock::time_point t0, chrono::steady_clock::time_point t1) {
+    auto t2 = chrono::steady_clock::now();
+    auto ms = [](chrono::steady_clock::duration d) { return chrono::duration<double, milli>(d).count(); };
+    char line[128];
+    snprintf(line, sizeof line, "[SaadDB] parse %.3f ms, plan %.3f ms, execute %.3f ms\n",
+        ms(t1 - t0), ms(STMT_PLANNED - t1), ms(t2 - STMT_PLANNED));
+    OUT << line;
+}
+
+/* ---------- transactions ----------
+  Every statement runs in a transaction. On its own it is one: it commits
+  as it flushes its changes (flush_changes), before its statement locks
+  are released. begin; opens one that spans the session's statements until
+  commit; or rollback;. It holds ENGINE_LOCK shared, and the row lock of
+  every table its statements change, until it ends; its selects read the
+  snapshot it took at begin (snapshot isolation, see "row versions"). An
+  update or delete of rows another transaction changed and committed
+  after that snapshot is refused, so no change is lost. A lock it can't
+  get within the session's lock wait fails the statement (as any
+  statement's does), which breaks a cycle of transactions waiting on each
+  other; the transaction stays open in both cases. Every transaction keeps
+  the old image of every row it changes, so rollback can put them back
+  through the usual write path (and the log), as a commit whose record
+  can't be made durable does: a commit becomes visible and lets its locks
+  go only after its sync (see txn_end). Schema changes, checkpoint,
+  load and vacuum can't run inside one. A session that goes away with one
+  open (a closed connection, Database::close) rolls it back.
+  Each statement still writes its pages when it ends, so under synchronous
+  full a transaction syncs the log once per changing statement and once
+  at commit; syncs of concurrent sessions are shared (see wal_sync_to).
+*/
+static atomic<int> OPEN_TXNS{ 0 };      // begin ... commit transactions in progress
+
+// When a statement starting now stops waiting for locks.
+static chrono::steady_clock::time_point lock_deadline() {
+    return chrono::steady_clock::now() + (SESSION ? SESSION->lockWait : LOCK_WAIT);
+}
+
+// Takes m exclusive for tx until it ends; false if not by deadline.
+static bool txn_lock(Transaction& tx, RwLock& m, chrono::steady_clock::time_point deadline) {
+    if (tx.locks.count(&m)) return true;
+    if (!m.try_lock_until(deadline)) return false;
+    tx.locks.insert(&m);
+    return true;
+}
+
+// Ends tx: logs its commit or, with logged set, its abort, and waits for
+// the commit record as synchronous says (other transactions' commits share
+// the sync, see wal_sync_to); only then makes its changes visible to new
+// snapshots (or never) and releases its locks and snapshot, so no one acts
+// on a commit a crash could still take back. False, with tx still open and
+// its locks held, if the commit record couldn't be written: txn_commit
+// then rolls it back.
+static bool txn_end(Transaction& tx, bool commit, bool logged = true) {
+    if (tx.wrote && !tx.endPos && (commit || logged)) tx.endPos = wal_end_txn(commit ? WAL_COMMIT : WAL_ABORT, tx);
+    if (tx.wrote && commit && SYNCHRONOUS != SYNC_OFF && !wal_sync_to(tx.endPos, SYNCHRONOUS == SYNC_FULL)) return false;
+    versions_end(tx, commit);
+    for (RwLock* m : tx.locks) m->unlock();
+    tx.locks.clear();
+    if (tx.wrote) {
+        WRITING_TXNS.fetch_sub(1);
+        tx.wrote = false;
+    }
+    snapshot_end(tx);
+    if (tx.engine) { tx.engine->unlock_shared(); tx.engine = nullptr; OPEN_TXNS.fetch_sub(1); }
+    tx.undo.clear();
+    return true;
+}
+
+// Puts row u.rid of th back the way it was before the change u recorded:
+// the row first, then its index entries (as run_update does).
+static bool undo_change(TableHandle& th, const UndoRecord& u) {
+    const TableDef& def = *th.def;
+    vector<uint8_t> key(th.pk.keyWidth), cur;
+    RowFetcher rows(th.file);
+    if (const uint8_t* r = rows.get(u.rid)) cur.assign(r, r + def.rowSize);
+    bool ok = u.type == WAL_INSERT ? th.file.erase(u.rid)
+        : u.type == WAL_UPDATE ? th.file.update(u.rid, u.before.data())
+        : th.file.restore(u.rid, u.before.data());
+    if (ok && !cur.empty()) {
+        row_key(def, def.pkIndex, cur.data(), key.data());
+        th.pk.erase(key.data(), u.rid);
+        unindex_row(th, cur.data(), u.rid);
+    }
+    if (!ok || u.type == WAL_INSERT) return ok;
+    row_key(def, def.pkIndex, u.before.data(), key.data());
+    th.pk.insert(key.data(), u.rid);
+    index_row(th, u.before.data(), u.rid);
+    th.zones.add(u.before.data(), u.rid);
+    return true;
+}
+
+// Undoes tx's changes newest first and ends it. If that fails part way the
+// log keeps tx unfinished, so the next start undoes the rest.
+static void txn_rollback(Transaction& tx) {
+    Transaction* prev = TXN;
+    TXN = &tx;
+    tx.undoing = true;
+    bool ok = true;
+    for (auto& kv : tx.undo) {
+        const TableDef* def = lookup_table(kv.first);
+        TableHandle th;
+        if (!def || !open_table(*def, th)) { ok = false; continue; }
+        for (auto it = kv.second.rbegin(); it != kv.second.rend(); ++it) ok = undo_change(th, *it) && ok;
+        ok = th.file.flush() && ok;
+    }
+    if (!ok) fail(Error::IoError) << "[SaadDB] Rollback incomplete; it finishes when the database is next opened\n";
+    txn_end(tx, false, ok);
+    TXN = prev;
+}
+
+// Commits tx, or rolls it back if its commit record can't be made durable
+// as synchronous says: a commit that failed never becomes visible. The
+// abort record then follows the undone changes, so the next open keeps
+// them undone even if the commit record reached the log (if the log takes
+// neither, what it does hold decides).
+static bool txn_commit(Transaction& tx) {
+    if (txn_end(tx, true)) return true;
+    fail(Error::IoError) << "[SaadDB] Commit failed: cannot write " << WAL_FILE << "; the changes are rolled back\n";
+    tx.endPos = 0;
+    txn_rollback(tx);
+    return false;
+}
+
+// Rolls back the session's open transaction, if any.
+static void rollback_session(SessionState& ss) {
+    if (!ss.txn) return;
+    unique_ptr<Transaction> tx = move(ss.txn);
+    txn_rollback(*tx);
+    OUT << "[SaadDB] Transaction rolled back.\n";
+}
+
+static void cmd_begin(const Tokens& T) {
+    if (T.size() != 1 || !SESSION) { fail() << "[SaadDB] Usage: begin;\n"; return; }
+    if (SESSION->txn) { fail() << "[SaadDB] A transaction is already open\n"; return; }
+    if (!ENGINE_LOCK.try_lock_shared_until(lock_deadline())) {
+        SESSION->lockTimedOut = true;
+        fail(Error::LockTimeout) << "[SaadDB] Timed out waiting for other sessions; no transaction started\n"; return;
+    }
+    unique_ptr<Transaction> tx(new Transaction());
+    tx->id = NEXT_TXN++;
+    tx->open = true;
+    tx->engine = &ENGINE_LOCK;
+    snapshot_begin(*tx);
+    OPEN_TXNS.fetch_add(1);
+    SESSION->txn = move(tx);
+    OUT << "[SaadDB] Transaction started.\n";
+}
+
+static void cmd_commit(const Tokens& T) {
+    if (T.size() != 1) { fail() << "[SaadDB] Usage: commit;\n"; return; }
+    if (!SESSION || !SESSION->txn) { fail() << "[SaadDB] No transaction is open\n"; return; }
+    unique_ptr<Transaction> tx = move(SESSION->txn);
+    if (txn_commit(*tx)) OUT << "[SaadDB] Transaction committed.\n";
+}
+
+static void cmd_rollback(const Tokens& T) {
+    if (T.size() != 1) { fail() << "[SaadDB] Usage: rollback;\n"; return; }
+    if (!SESSION || !SESSION->txn) { fail() << "[SaadDB] No transaction is open\n"; return; }
+    rollback_session(*SESSION);
+}
+
+/* ---------- compaction ----------
+  Slots of deleted rows stay in the file for good (and an updated varchar
+  of a columnar table leaves its old bytes in the blob), so scans read ever
+  more dead space. Compaction rewrites a table: its live rows in primary
+  key order into new files under a name of their own, with indexes and
+  tight zone maps built from them, then logs WAL_COMPACT and moves the new
+  files over the old. It holds the table's row lock, so writers wait, but
+  readers don't: a statement that opened the old files keeps reading
+  them (nothing writes them any more), later ones open the new ones. Rows
+  get new rids, so it only starts once no snapshot needs a row version of
+  the table (see "row versions"). With the lock held no versions come, and
+  the snapshots that read the ones left began before the table's last
+  commit, so it waits for those up to COMPACT_SNAPSHOT_WAIT with the lock
+  (new snapshots don't hold it back) before it lets writers in and tries
+  again.
+  A rewrite takes about as long as reading and writing the table's bytes
+  at the rate the last one went (COMPACT_RATE); writers wait for it at
+  most their lock wait. So the vacuum thread and vacuum; skip a table
+  whose rewrite would hold it longer than COMPACT_MAX_HOLD, and vacuum;
+  says so.
+  Every COMPACT_INTERVAL the vacuum thread measures the tables that changed
+  and compacts those whose dead space is at least COMPACT_MIN_BYTES and
+  COMPACT_DEAD_RATIO of their files, skipping any a writer holds.
+  vacuum; compacts every table with dead space now, vacuum T; rewrites T
+  regardless; show space [T]; lists the measurements.
+*/
+static const uint64_t COMPACT_MIN_BYTES = 1u << 20;
+static const double COMPACT_DEAD_RATIO = 0.3;
+static const chrono::milliseconds COMPACT_SNAPSHOT_WAIT(200);
+static const chrono::milliseconds COMPACT_MAX_HOLD(LOCK_WAIT / 2);     // room for an estimate that runs short
+static atomic<uint64_t> COMPACT_RATE{ 64u << 20 };     // bytes read and written per second
+static atomic<uint64_t> COMPACT_SEQ{ 0 };
+
+enum CompactResult { COMPACT_DONE, COMPACT_CLEAN, COMPACT_SKIPPED, COMPACT_FAILED };
+
+struct SpaceStats {
+    uint64_t slots = 0, live = 0;           // rids handed out, live rows
+    uint64_t fileBytes = 0, liveBytes = 0;  // data files, and what the live rows need
+    uint64_t dead_bytes() const { return fileBytes > liveBytes ? fileBytes - liveBytes : 0; }
+};
+
+struct TableSpace {
+    SpaceStats stats;
+    uint64_t changes = UINT64_MAX;          // TableVersions::changes when measured
+    uint64_t compactions = 0;
+};
+static mutex SPACE_MUTEX;
+static map<string, TableSpace> SPACE;
+
+static uint64_t fd_size(int fd) {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Measures tf's data files as they are on disk.
+static SpaceStats measure_space(const TableFile& tf) {
+    const TableDef& def = *tf.def;
+    SpaceStats s;
+    if (const ColumnStore* cs = tf.cols.get()) {
+        uint64_t width = 1, blobBytes = 0;
+        s.fileBytes = fd_size(cs->statusFd);
+        for (size_t c = 0; c < def.cols.size(); ++c) {
+            s.fileBytes += fd_size(cs->colFd[c]) + fd_size(cs->blobFd[c]);
+            width += packed_width(def.cols[c]);
+        }
+        vector<uint8_t> status, col;
+        for (uint64_t base = 0; base < cs->stored; base += COLUMN_BLOCK) {
+            size_t n = (size_t)min<uint64_t>(COLUMN_BLOCK, cs->stored - base);
+            status.resize(n);
+            if (!pread_full(cs->statusFd, status.data(), n, (off_t)(PAGE_SIZE + base))) break;
+            size_t live = (size_t)count(status.begin(), status.end(), (uint8_t)ROW_LIVE);
+            s.live += live;
+            for (size_t c = 0; live && c < def.cols.size(); ++c) {
+                if (def.cols[c].kind != COL_VARCHAR) continue;
+                cs->read_column((int)c, base, n, col);
+                for (size_t i = 0; i < n; ++i) {
+                    uint64_t e; memcpy(&e, &col[i * 8], 8);
+                    if (status[i] == ROW_LIVE) blobBytes += e & 0xFFFF;
+                }
+            }
+        }
+        s.slots = cs->stored;
+        s.liveBytes = PAGE_SIZE + s.live * width + blobBytes;
+        return s;
+    }
+    PageHeader ph;
+    for (uint64_t p = 1; p < tf.pages; ++p) {
+        if (!BUFFER_POOL.read(tf.pool, p, &ph, sizeof ph, true)) break;
+        s.slots += ph.used;
+        s.live += ph.live;
+    }
+    s.fileBytes = tf.pages * PAGE_SIZE;
+    s.liveBytes = (1 + (s.live + def.rowsPerPage - 1) / def.rowsPerPage) * PAGE_SIZE;
+    return s;
+}
+
+// Builds the new files of th's table as table built: live rows in PK order
+// (runs of whole pages, as load writes them), indexes, zone maps.
+static bool compact_build(TableHandle& th, const TableDef& built, TableLock& scratch, SpaceStats& after) {
+    const TableDef& def = *th.def;
+    TableHandle out;
+    out.def = &built;
+    out.lock = &scratch;
+    if (!create_table_file(built, table_path(built.name), out.file)) return false;
+    bool ok = true;
+    size_t batch = def.columnar ? COLUMN_BLOCK : (size_t)def.rowsPerPage * MORSEL_PAGES;
+    vector<uint8_t> rows;
+    RowOrder order;
+    order.def = &def;
+    order.keys.push_back(OrderKey{ def.pkIndex, -1, false });
+    sort_records(order, def.rowSize, -1, [&](auto push) {
+        scan_rows(th.file, [&](const uint8_t* rec, uint64_t) { push(rec); });
+    }, [&](const uint8_t* rec) {
+        rows.insert(rows.end(), rec, rec + def.rowSize);
+        rows[rows.size() - def.rowSize] = ROW_LIVE;
+        if (rows.size() / def.rowSize < batch) return;
+        ok = ok && out.file.append_rows(rows.data(), batch);
+        rows.clear();
+    });
+    ok = ok && (rows.empty() || out.file.append_rows(rows.data(), rows.size() / def.rowSize)) && out.file.sync();
+    if (!ok) return false;
+    const ColumnDef& pkc = def.cols[def.pkIndex];
+    bool created;
+    out.pk.latch = &scratch.indexes;
+    if (!out.pk.open(pk_index_path(built.name), key_width(pkc), pkc.kind != COL_VARCHAR, true, created)) return false;
+    if (!out.file.empty() && !rebuild_pk_index(out)) return false;
+    out.indexes.reserve(built.indexes.size());
+    for (const auto& d : built.indexes) {
+        if (d.col < 0) continue;
+        out.indexes.emplace_back();
+        if (!open_index(out, d, out.indexes.back())) return false;
+    }
+    out.zones.open(out.file);
+    after = measure_space(out.file);
+    return true;
+}
+
+// Waits (holding rows) up to COMPACT_SNAPSHOT_WAIT, and no later than
+// deadline, for tv to have no row versions left.
+static bool compact_unversioned(TableVersions& tv, chrono::steady_clock::time_point deadline) {
+    auto until = min(deadline, chrono::steady_clock::now() + COMPACT_SNAPSHOT_WAIT);
+    for (;;) {
+        vacuum_versions();
+        { lock_guard<mutex> lk(tv.m); if (tv.rows.empty()) return true; }
+        if (chrono::steady_clock::now() >= until) return false;
+        this_thread::sleep_for(chrono::milliseconds(2));
+    }
+}
+
+// Rewrites def's table (see above) if its dead space is at least minDead
+// bytes and minRatio of its files, and, if bounded, its rewrite would hold
+// writers at most COMPACT_MAX_HOLD; before / after are its measurements.
+// COMPACT_SKIPPED and COMPACT_FAILED say why in err: for a failure, by
+// deadline a writer still held it or snapshots still read its row
+// versions, or the files couldn't be written.
+static CompactResult compact_table(const TableDef& def, chrono::steady_clock::time_point deadline, uint64_t minDead,
+                                   double minRatio, bool bounded, SpaceStats& before, SpaceStats& after, string& err) {
+    TableLock& tl = table_lock(def.name);
+    TableVersions& tv = table_versions(def.name);
+    unique_lock<RwLock> rows(tl.rows, defer_lock);
+    for (;;) {
+        bool locked = rows.try_lock_until(deadline);
+        if (locked && compact_unversioned(tv, deadline)) break;
+        // a writer queued on the lock may hold a snapshot that reads them: let it in
+        if (locked) rows.unlock();
+        if (!locked || chrono::steady_clock::now() >= deadline) {
+            err = locked ? "has row versions that running snapshots still read" : "is being changed";
+            if (SESSION) SESSION->lockTimedOut = true;
+            return COMPACT_FAILED;
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    TableHandle th;
+    if (!open_table(def, th)) { err = "can't be opened"; return COMPACT_FAILED; }
+    before = measure_space(th.file);
+    {
+        lock_guard<mutex> lk(SPACE_MUTEX);
+        TableSpace& sp = SPACE[def.name];
+        sp.stats = before;
+        sp.changes = tv.changes.load();
+    }
+    if (before.dead_bytes() < minDead || before.dead_bytes() < minRatio * before.fileBytes) return COMPACT_CLEAN;
+    uint64_t bytes = before.fileBytes + before.liveBytes;
+    uint64_t estimate = bytes * 1000 / max<uint64_t>(COMPACT_RATE.load(), 1);    // ms
+    if (bounded && estimate > (uint64_t)COMPACT_MAX_HOLD.count()) {
+        char buf[96];
+        snprintf(buf, sizeof buf, "rewriting it would hold its writers about %.1f s", estimate / 1000.0);
+        err = buf;
+        return COMPACT_SKIPPED;
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    TableDef built = def;
+    built.name = def.name + ".compact" + to_string(COMPACT_SEQ.fetch_add(1));
+    vector<string> files = table_files(built);
+    for (const auto& path : files) ::unlink(path.c_str());
+    TableLock scratch;
+    bool ok = compact_build(th, built, scratch, after);
+    th.close();
+    if (ok) for (const auto& path : files) fsync_path(path);
+    if (!ok || !wal_compact(def.name, built.name)) {
+        for (const auto& path : files) ::unlink(path.c_str());
+        err = ok ? "can't be logged" : "couldn't be rewritten";
+        return COMPACT_FAILED;
+    }
+    {
+        // no handle opens between the moves; handles open on the old files keep them
+        lock_guard<mutex> lk(tl.files);
+        { lock_guard<mutex> vl(tv.m); tv.generation++; }
+        ok = compact_swap(built, def);
+    }
+    if (!ok) { err = "was only partly swapped; the next start finishes it"; return COMPACT_FAILED; }
+    auto took = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0).count();
+    if (bytes >= COMPACT_MIN_BYTES && took > 0) COMPACT_RATE = bytes * 1000 / (uint64_t)took;
+    lock_guard<mutex> lk(SPACE_MUTEX);
+    TableSpace& sp = SPACE[def.name];
+    sp.stats = after;
+    sp.compactions++;
+    return COMPACT_DONE;
+}
+
+// Vacuum thread: measures the tables that changed since it last looked and
+// compacts those past the thresholds, quietly; a busy table waits for the
+// next round, one too big to rewrite within COMPACT_MAX_HOLD for a change.
+static void compact_due() {
+    shared_lock<RwLock> engine(ENGINE_LOCK, chrono::steady_clock::now());
+    if (!engine) return;
+    NullBuf null;
+    streambuf* saved = OUT.rdbuf(&null);
+    for (const string& name : CATALOG_ORDER) {
+        uint64_t changes = table_versions(name).changes.load();
+        {
+            lock_guard<mutex> lk(SPACE_MUTEX);
+            auto it = SPACE.find(name);
+            if (it != SPACE.end() && it->second.changes == changes) continue;
+        }
+        SpaceStats before, after;
+        string err;
+        auto deadline = chrono::steady_clock::now() + VACUUM_INTERVAL;
+        if (compact_table(*lookup_table(name), deadline, COMPACT_MIN_BYTES, COMPACT_DEAD_RATIO, true,
+                          before, after, err) != COMPACT_FAILED) continue;
+        lock_guard<mutex> lk(SPACE_MUTEX);
+        SPACE[name].changes = UINT64_MAX;   // try again next round
+    }
+    OUT.rdbuf(saved);
+}
+
+static string byte_size(uint64_t n) {
+    char buf[32];
+    if (n < 10240) snprintf(buf, sizeof buf, "%llu B", (unsigned long long)n);
+    else if (n < (10ull << 20)) snprintf(buf, sizeof buf, "%.1f KB", n / 1024.0);
+    else snprintf(buf, sizeof buf, "%.1f MB", n / 1048576.0);
+    return buf;
+}
+
+static void cmd_vacuum(const Tokens& T) {
+    if (T.size() > 2) { fail() << "[SaadDB] Usage: vacuum;  vacuum T;\n"; return; }
+    if (T.size() == 2 && !ensure_table_exists(T[1])) return;
+    vector<string> names = T.size() == 2 ? vector<string>{ T[1] } : CATALOG_ORDER;
+    size_t done = 0, failed = 0, skipped = 0;
+    for (const string& name : names) {
+        SpaceStats before, after;
+        string err;
+        bool all = T.size() == 2;
+        switch (compact_table(*lookup_table(name), lock_deadline(), all ? 0 : 1, 0, !all, before, after, err)) {
+        case COMPACT_CLEAN:
+            break;
+        case COMPACT_SKIPPED:
+            ++skipped;
+            OUT << "[SaadDB] <" << name << "> skipped: " << err << "; vacuum " << name << "; rewrites it anyway.\n";
+            break;
+        case COMPACT_FAILED:
+            ++failed;
+            fail(SESSION && SESSION->lockTimedOut ? Error::LockTimeout : Error::IoError) << "[SaadDB] <" << name << "> not compacted: it " << err << "\n";
+            break;
+        case COMPACT_DONE:
+            ++done;
+            OUT << "[SaadDB] Compacted <" << name << ">: " << after.live << " rows, "
+                << byte_size(before.fileBytes) << " -> " << byte_size(after.fileBytes) << ".\n";
+            break;
+        }
+    }
+    if (!done && !failed && !skipped && T.size() == 1) OUT << "[SaadDB] No table has dead space.\n";
+}
+
+// show stats;  rows of (stat, value): the buffer pool's budget, pages held
+// and dirty, then its counters since the process started.
+static void show_stats() {
+    uint64_t pages, dirty;
+    BUFFER_POOL.usage(pages, dirty);
+    pair<const char*, uint64_t> stats[] = {
+        { "pool_budget_bytes", BUFFER_POOL_BYTES }, { "pool_pages", pages }, { "pool_dirty_pages", dirty },
+        { "pool_hits", BUFFER_POOL.hits.load() }, { "pool_misses", BUFFER_POOL.misses.load() },
+        { "pool_evictions", BUFFER_POOL.evictions.load() }, { "pool_writebacks", BUFFER_POOL.writebacks.load() },
+        { "pool_ring_reads", BUFFER_POOL.ringReads.load() },
+    };
+    if (!ROW_SINK) return;
+    vector<saaddb::Column> cols(2);
+    cols[0].name = "stat"; cols[0].type = saaddb::Type::Varchar;
+    cols[1].name = "value"; cols[1].type = saaddb::Type::Int;
+    ROW_SINK->columns(cols);
+    saaddb::Row row(2);
+    row[0].type = saaddb::Type::Varchar;
+    row[1].type = saaddb::Type::Int;
+    for (const auto& st : stats) {
+        row[0].str = st.first;
+        row[1].num = (int64_t)st.second;
+        if (!ROW_SINK->row(row)) break;
+    }
+}
+
+// show space [T];  rows of: table, live rows, dead rows, bytes in the data
+// files, bytes the live rows need, dead share of the files in %, space
+// amplification (files / needed), compactions since the database opened.
+static void cmd_show(const Tokens& T) {
+    if (T.size() == 2 && is_kw(T[1], "stats")) return show_stats();
+    if (T.size() < 2 || !is_kw(T[1], "space") || T.size() > 3) { fail() << "[SaadDB] Usage: show space;  show space T;  show stats;\n"; return; }
+    if (T.size() == 3 && !ensure_table_exists(T[2])) return;
+    vector<string> names = T.size() == 3 ? vector<string>{ T[2] } : CATALOG_ORDER;
+    if (ROW_SINK) {
+        vector<saaddb::Column> cols(8);
+        const char* heads[] = { "table", "rows", "dead_rows", "file_bytes", "live_bytes", "dead_pct", "amplification", "compactions" };
+        for (size_t i = 0; i < cols.size(); ++i) {
+            cols[i].name = heads[i];
+            cols[i].type = i == 0 ? saaddb::Type::Varchar : i == 5 || i == 6 ? saaddb::Type::Decimal : saaddb::Type::Int;
+            cols[i].scale = i == 5 ? 1 : i == 6 ? 2 : 0;
+        }
+        ROW_SINK->columns(cols);
+    }
+    saaddb::Row row(8);
+    for (const string& name : names) {
+        TableHandle th;
+        if (!open_table(*lookup_table(name), th)) continue;
+        SpaceStats s = measure_space(th.file);
+        th.close();
+        uint64_t compactions;
+        {
+            lock_guard<mutex> lk(SPACE_MUTEX);
+            TableSpace& sp = SPACE[name];
+            sp.stats = s;
+            compactions = sp.compactions;
+        }
+        if (!ROW_SINK) continue;
+        int64_t nums[] = { 0, (int64_t)s.live, (int64_t)(s.slots - s.live), (int64_t)s.fileBytes, (int64_t)s.liveBytes,
+            s.fileBytes ? (int64_t)(s.dead_bytes() * 1000 / s.fileBytes) : 0,
+            s.liveBytes ? (int64_t)(s.fileBytes * 100 / s.liveBytes) : 100, (int64_t)compactions };
+        for (size_t i = 0; i < row.size(); ++i) {
+            row[i].type = i == 0 ? saaddb::Type::Varchar : i == 5 || i == 6 ? saaddb::Type::Decimal : saaddb::Type::Int;
+            row[i].scale = i == 5 ? 1 : i == 6 ? 2 : 0;
+            row[i].num = nums[i];
+            row[i].str = i == 0 ? name : string();
+        }
+        if (!ROW_SINK->row(row)) break;
+    }
+}
+
+// ---------- executor ----------
+// Runs the statement in TOKENS; cs is its statement cache entry, if any.
+static void execute(CachedStmt* cs, const vector<string>& args) {
+    if (TOKENS.empty()) return;
+    const string t0 = lowered(TOKENS[0]);
+    if (t0 == "help")          return cmd_help(TOKENS);
+    if (t0 == "create")        return cmd_create(TOKENS);
+    if (t0 == "drop")          return cmd_drop(TOKENS);
+    if (t0 == "describe")      return cmd_describe(TOKENS);
+    if (t0 == "insert")        return cs ? dml_cached(*cs, args) : cmd_dml(TOKENS);
+    if (t0 == "select")        return cs ? select_cached(*cs, args) : cmd_select(TOKENS);
+    if (t0 == "update")        return cs ? dml_cached(*cs, args) : cmd_dml(TOKENS);
+    if (t0 == "delete")        return cs ? dml_cached(*cs, args) : cmd_dml(TOKENS);
+    if (t0 == "export")        return cmd_export(TOKENS);
+    if (t0 == "import")        return cmd_import(TOKENS);
+    if (t0 == "load")          return cmd_load(TOKENS);
+    if (t0 == "benchmark")     return cmd_benchmark(TOKENS);
+    if (t0 == "explain")       return cmd_explain(TOKENS);
+    if (t0 == "prepare")       return cmd_prepare(TOKENS);
+    if (t0 == "execute")       return cmd_execute(TOKENS);
+    if (t0 == "deallocate")    return cmd_deallocate(TOKENS);
+    if (t0 == "set")           return cmd_set(TOKENS);
+    if (t0 == "begin")         return cmd_begin(TOKENS);
+    if (t0 == "commit")        return cmd_commit(TOKENS);
+    if (t0 == "rollback")      return cmd_rollback(TOKENS);
+    if (t0 == "vacuum")        return cmd_vacuum(TOKENS);
+    if (t0 == "show")          return cmd_show(TOKENS);
+    if (t0 == "checkpoint") {
+        if (wal_checkpoint()) OUT << "[SaadDB] Checkpoint done.\n";
+        else fail(Error::IoError) << "[SaadDB] Checkpoint failed.\n";
+        return;
+    }
+    if (t0 == "quit") { wal_checkpoint(); OUT << "[SaadDB] Bye.\n"; return; }
+    fail() << "[SaadDB] INVALID QUERY\n";
+}
+
+/* ---------- statement locks ----------
+  What a statement locks is read off its tokens before it runs. Statements
+  that change the schema or engine state (create, drop, set threads|memory|
+  buffer_pool, checkpoint, quit) hold ENGINE_LOCK exclusive and run alone. Every other
+  statement holds it shared. insert / update / delete / load / import (and
+  explain analyze of one) also hold the row lock of each table they name,
+  exclusive; load holds its table's bulk lock exclusive too. Any other
+  statement reads: it holds the bulk lock of each table it names shared
+  and reads a snapshot (see "row versions"), so it waits for no writer but
+  load. vacuum takes its tables' row locks itself (see "compaction").
+  The tables a statement names are those in its table positions (see
+  statement_tables), not every token that spells a table's name.
+  `execute name` locks for the statement it runs. Locks are taken
+  in name order, so statements never wait in a cycle. Inside begin ...
+  commit the transaction takes and keeps the row locks instead (see
+  "transactions"). No statement waits longer than its session's lock
+  wait: behind an open transaction, waiting statements could otherwise
+  take every server worker and leave none to run its commit.
+*/
+// The tables statement T[k..] names where a table goes: after FROM and JOIN,
+// INTO, UPDATE, and the table position of load, import, export, describe
+// and show space. Columns and values never lock a table of the same name.
+static set<string> statement_tables(const Tokens& T, size_t k) {
+    set<string> tables;
+    auto add = [&](size_t i) { if (i < T.size() && !T[i].quoted && CATALOG.count(T[i])) tables.insert(T[i]); };
+    if (k >= T.size()) return tables;
+    const string s0 = lowered(T[k]);
+    if (s0 == "select") {
+        size_t from = (size_t)keyword_pos(T, "from", (int)k + 1);
+        add(from + 1);
+        if (from + 2 < T.size() && is_kw(T[from + 2], "join") && !T[from + 2].quoted) add(from + 3);
+    }
+    else if (s0 == "insert" || s0 == "delete") add(k + 2);
+    else if (s0 == "update" || s0 == "load" || s0 == "import" || s0 == "export" || s0 == "describe") add(k + 1);
+    else if (s0 == "show") add(k + 2);
+    return tables;
+}
+
+struct StatementLocks {
+    shared_lock<RwLock> shared;
+    unique_lock<RwLock> exclusive;
+    vector<shared_lock<RwLock>> readers;
+    vector<unique_lock<RwLock>> writers;
+    string error;           // set when the statement must not run
+    bool timedOut = false;
+    bool reads = false;     // reads a snapshot of the tables it names
+
+    // tx is the session's open transaction (open set) or the statement's own;
+    // either way tx holds the row locks, and txn_end releases them.
+    StatementLocks(const Tokens& T, Transaction& tx, bool open) {
+        const Tokens* t = &T;
+        if (T.size() >= 2 && is_kw(T[0], "execute") && SESSION) {
+            auto it = SESSION->prepared.find(T[1]);
+            if (it != SESSION->prepared.end()) t = &it->second.tokens;
+        }
+        size_t k = 0;
+        bool dry = false;
+        if (k < t->size() && is_kw((*t)[k], "benchmark")) ++k;
+        else if (k < t->size() && is_kw((*t)[k], "explain")) {
+            ++k;
+            if (k < t->size() && is_kw((*t)[k], "analyze")) ++k;
+            else dry = true;
+        }
+        const string s0 = k < t->size() ? lowered((*t)[k]) : string();
+        if (s0 == "begin" || s0 == "commit" || s0 == "rollback") return;
+        bool sessionSetting = s0 == "set" && k + 1 < t->size() &&
+            (is_kw((*t)[k + 1], "timing") || is_kw((*t)[k + 1], "synchronous") || is_kw((*t)[k + 1], "commit_window"));
+        bool engine = s0 == "create" || s0 == "drop" || s0 == "checkpoint" || s0 == "quit" || (s0 == "set" && !sessionSetting);
+        if (open && (engine || s0 == "load" || s0 == "vacuum")) {
+            error = "[SaadDB] " + s0 + " can't run inside a transaction; commit or rollback first\n";
+            return;
+        }
+        auto deadline = lock_deadline();
+        if (engine) exclusive = unique_lock<RwLock>(ENGINE_LOCK, deadline);
+        else if (!open) shared = shared_lock<RwLock>(ENGINE_LOCK, deadline);
+        if (engine ? !exclusive : !open && !shared) {
+            timedOut = true;
+            error = "[SaadDB] Timed out waiting for other sessions; statement not run\n";
+            return;
+        }
+        if (engine) return;
+        if (s0 == "prepare" || s0 == "deallocate" || s0 == "set" || s0 == "vacuum") return;
+        bool write = !dry && (s0 == "insert" || s0 == "update" || s0 == "delete" || s0 == "load" || s0 == "import");
+        reads = !write;
+        for (const string& name : statement_tables(*t, k)) {
+            TableLock& tl = table_lock(name);
+            bool ok;
+            if (!write) { readers.emplace_back(tl.bulk, deadline); ok = readers.back().owns_lock(); }
+            else ok = txn_lock(tx, tl.rows, deadline);
+            if (ok && write && s0 == "load") { writers.emplace_back(tl.bulk, deadline); ok = writers.back().owns_lock(); }
+            if (ok) continue;
+            timedOut = true;
+            error = "[SaadDB] Timed out waiting for a lock on <" + name + ">; statement not run\n";
+            return;
+        }
+    }
+};
+
+// Runs fn as the statement in T under its locks: in the session's open
+// transaction, or as a transaction of its own whose commit releases its
+// row locks before waiting for the log (see txn_end); a reading statement
+// reads that transaction's snapshot. quit rolls an open transaction back first.
+template <class F>
+static void run_locked(const Tokens& T, F&& fn) {
+    Transaction* open = SESSION ? SESSION->txn.get() : nullptr;
+    if (open && !T.empty() && is_kw(T[0], "quit")) { rollback_session(*SESSION); open = nullptr; }
+    Transaction own;
+    if (!open) own.id = NEXT_TXN++;
+    if (SESSION) SESSION->lockTimedOut = false;
+    StatementLocks locks(T, open ? *open : own, open != nullptr);
+    StatementArena arena;
+    if (!locks.error.empty()) {
+        if (!open) txn_end(own, false);     // the row locks it did get
+        if (SESSION) SESSION->lockTimedOut = locks.timedOut;
+        fail(locks.timedOut ? Error::LockTimeout : Error::Invalid) << locks.error;
+        return;
+    }
+    TXN = open ? open : &own;
+    if (locks.reads) {
+        if (!open) snapshot_begin(own);
+        READER = TXN;
+    }
+    fn();
+    TXN = nullptr;
+    READER = nullptr;
+    if (!open) txn_commit(own);
+}
+
+// Checkpoints once the log has grown past WAL_CHECKPOINT_BYTES, when no
+// statement is running and no transaction is open (their records must
+// stay). The statement that finds it due waits up to CHECKPOINT_WAIT for
+// ENGINE_LOCK exclusive, whatever its session's lock wait: queued ahead of
+// the statements asked for after it, it only waits for the running ones
+// and the open transactions to end. One statement waits at a time; if the
+// wait runs out (a transaction left open) the next one waits no sooner
+// than CHECKPOINT_RETRY later. A session in a transaction holds
+// ENGINE_LOCK itself, so it leaves the checkpoint to the others.
+static const chrono::milliseconds CHECKPOINT_WAIT(250), CHECKPOINT_RETRY(1000);
+static atomic<bool> CHECKPOINTING{ false };
+static atomic<chrono::steady_clock::rep> CHECKPOINT_NEXT{ 0 };    // no wait before (steady_clock ticks)
+
+static void checkpoint_if_due() {
+    if (!wal_due() || (SESSION && SESSION->txn)) return;
+    auto now = chrono::steady_clock::now();
+    if (now.time_since_epoch().count() < CHECKPOINT_NEXT.load() || CHECKPOINTING.exchange(true)) return;
+    RwLock** queued = LOCK_QUEUED;
+    LOCK_QUEUED = nullptr;      // waits here instead of parking
+    {
+        unique_lock<RwLock> lk(ENGINE_LOCK, now + CHECKPOINT_WAIT);
+        if (!lk) CHECKPOINT_NEXT = (now + CHECKPOINT_RETRY).time_since_epoch().count();
+        else if (wal_due()) wal_checkpoint();
+    }
+    LOCK_QUEUED = queued;
+    CHECKPOINTING = false;
+}
+
+// One statement the way the REPL runs it: cached tokens, locks, `set timing`.
+static void run_statement(const string& q) {
+    bool timed = TIMING;
+    chrono::steady_clock::time_point t0, t1;
+    if (timed) t0 = chrono::steady_clock::now();
+    vector<string> args;
+    CachedStmt& cs = tokenize_cached(q, args);
+    if (timed) STMT_PLANNED = t1 = chrono::steady_clock::now();
+    if (cs.shaped) run_locked(cs.tokens, [&] { execute_prepared(cs, args); });
+    else run_locked(TOKENS, [&] { execute(&cs, args); });
+    if (timed) print_timing(t0, t1);
+    checkpoint_if_due();
+}
+
+/* ---------- library API ----------
+  saaddb.h on top of the executor. A call runs with this thread's OUT
+  pointed at a CaptureBuf, so the messages the REPL prints come back as
+  text, with SESSION set to the caller's session, and with ROW_SINK handing
+  a select's rows to the caller: straight to a RowCallback, or into a
+  ResultSet.
+*/
+static bool DB_OPEN = false;
+
+struct CallbackSink : RowSink {
+    const saaddb::RowCallback* fn = nullptr;
+    vector<saaddb::Column> cols;
+    void columns(const vector<saaddb::Column>& c) override { cols = c; }
+    bool row(const saaddb::Row& r) override { return (*fn)(cols, r); }
+};
+
+struct CollectSink : RowSink {
+    vector<saaddb::Column> cols;
+    vector<saaddb::Row> rows;
+    void columns(const vector<saaddb::Column>& c) override { cols = c; }
+    bool row(const saaddb::Row& r) override { rows.push_back(r); return true; }
+};
+
+// Runs fn() in session ss (may be null) with rows going to sink; returns what
+// it printed. STMT_ERROR and STMT_AFFECTED then hold how it went.
+template <class F>
+static string run_captured(SessionState* ss, RowSink* sink, F&& fn) {
+    CaptureBuf capture;
+    capture.limit = SIZE_MAX;
+    struct Restore {
+        streambuf* buf; RowSink* sink; SessionState* session; bool timing; int synchronous; RwLock** queued;
+        ~Restore() {
+            if (SESSION) { SESSION->timing = TIMING; SESSION->synchronous = SYNCHRONOUS; }
+            OUT.rdbuf(buf); ROW_SINK = sink; SESSION = session; TIMING = timing; SYNCHRONOUS = synchronous;
+            LOCK_QUEUED = queued;
+        }
+    } restore{ OUT.rdbuf(&capture), ROW_SINK, SESSION, TIMING, SYNCHRONOUS, LOCK_QUEUED };
+    ROW_SINK = sink;
+    SESSION = ss;
+    TIMING = ss && ss->timing;
+    SYNCHRONOUS = ss ? ss->synchronous : SYNC_FULL;
+    LOCK_QUEUED = ss && ss->lockWait.count() == 0 ? &ss->queuedOn : nullptr;
+    STMT_ERROR = Error::None;
+    STMT_AFFECTED = 0;
+    fn();
+    // a statement that didn't give up on a lock has no turn left to keep
+    if (ss && ss->queuedOn && STMT_ERROR != Error::LockTimeout) ss->queuedOn->leave(&ss->queuedOn);
+    return move(capture.text);
+}
+
+// run_captured, with the outcome as a QueryStatus.
+template <class F>
+static saaddb::QueryStatus run_status(SessionState* ss, RowSink* sink, F&& fn) {
+    saaddb::QueryStatus st;
+    st.message = run_captured(ss, sink, forward<F>(fn));
+    st.error = STMT_ERROR;
+    st.affected = STMT_AFFECTED;
+    return st;
+}
+
+static const string NOT_OPEN = "[SaadDB] Database not open\n";
+
+static saaddb::QueryStatus not_open() {
+    saaddb::QueryStatus st;
+    st.error = Error::NotOpen;
+    st.message = NOT_OPEN;
+    return st;
+}
+
+namespace saaddb {
+
+void Value::append_text(std::string& out) const {
+    char buf[FIELD_BUF];
+    switch (type) {
+    case Type::Null: out += "NULL"; return;
+    case Type::Varchar: out += str; return;
+    case Type::Date: {
+        int y, m, d; civil_from_days((int32_t)num, y, m, d);
+        int n = snprintf(buf, FIELD_BUF, "%02d-%02d-%04d", d, m, y);
+        out.append(buf, (size_t)n);
+        return;
+    }
+    default: out += format_scaled(num, scale, buf); return;
+    }
+}
+
+std::string Value::text() const {
+    std::string s;
+    append_text(s);
+    return s;
+}
+
+// Shared with the session's prepared Statements, which run in it.
+struct Session::Impl {
+    shared_ptr<SessionState> state = make_shared<SessionState>();
+    ~Impl() {
+        if (state->queuedOn) state->queuedOn->leave(&state->queuedOn);
+        if (state->txn && DB_OPEN) run_captured(state.get(), nullptr, [&] { rollback_session(*state); });
+    }
+};
+
+Session::Session() : impl(new Impl()) {}
+Session::~Session() = default;
+Session::Session(Session&&) noexcept = default;
+Session& Session::operator=(Session&&) noexcept = default;
+
+QueryStatus Session::query(const std::string& sql, const RowCallback& fn) {
+    if (!DB_OPEN || !impl) return not_open();
+    CallbackSink sink;
+    sink.fn = &fn;
+    return run_status(impl->state.get(), &sink, [&] { run_statement(sql); });
+}
+
+void Session::set_lock_wait(unsigned ms) {
+    if (impl) impl->state->lockWait = chrono::milliseconds(ms);
+}
+
+bool Session::lock_timed_out() const {
+    return impl && impl->state->lockTimedOut;
+}
+
+void Session::stop_waiting() {
+    if (impl && impl->state->queuedOn) impl->state->queuedOn->leave(&impl->state->queuedOn);
+}
+
+bool Session::in_transaction() const {
+    return impl && impl->state->txn != nullptr;
+}
+
+uint64_t lock_releases() { return LOCK_RELEASES.load(); }
+
+void on_lock_release(std::function<void()> fn) {
+    lock_guard<mutex> lk(ON_LOCK_RELEASE_MUTEX);
+    ON_LOCK_RELEASE = move(fn);
+}
+
+ResultSet Session::query(const std::string& sql) {
+    ResultSet rs;
+    if (!DB_OPEN || !impl) { rs.msg = NOT_OPEN; rs.err = Error::NotOpen; return rs; }
+    CollectSink sink;
+    rs.msg = run_captured(impl->state.get(), &sink, [&] { run_statement(sql); });
+    rs.err = STMT_ERROR;
+    rs.changed = STMT_AFFECTED;
+    rs.cols = move(sink.cols);
+    rs.data = move(sink.rows);
+    return rs;
+}
+
+bool Database::open(const std::string& dir, std::string& message) {
+    if (opened || DB_OPEN) { message = "[SaadDB] A database is already open in this process\n"; return false; }
+    DATA_DIR = dir.empty() || dir == "." ? "" : dir.back() == '/' ? dir : dir + "/";
+    if (!DATA_DIR.empty()) ::mkdir(dir.c_str(), 0755);
+    SCHEMA_FILE = data_path("SaadSchema.txt");
+    WAL_FILE = data_path("SaadDB.wal");
+    TEMP_DIR = data_path("SaadDB.tmp");
+    STMT_LRU.clear(); STMT_INDEX.clear();
+    own = Session();
+    bool ok = false;
+    message = run_captured(nullptr, nullptr, [&] { load_catalog(); ok = wal_recover(); });
+    if (!ok) {
+        if (WAL.fd >= 0) ::close(WAL.fd);
+        WAL = WalState();
+        return false;
+    }
+    vacuum_start();
+    opened = DB_OPEN = true;
+    return true;
+}
+
+void Database::close() {
+    if (!opened) return;
+    own = Session();    // rolls back a transaction it left open
+    vacuum_stop();
+    wal_checkpoint();
+    ::close(WAL.fd);
+    WAL = WalState();
+    STMT_LRU.clear(); STMT_INDEX.clear();
+    BUFFER_POOL.clear();
+    opened = DB_OPEN = false;
+}
+
+Database::~Database() { close(); }
+
+QueryStatus Database::query(const std::string& sql, const RowCallback& fn) {
+    return opened ? own.query(sql, fn) : not_open();
+}
+
+ResultSet Database::query(const std::string& sql) {
+    if (opened) return own.query(sql);
+    ResultSet rs;
+    rs.msg = NOT_OPEN;
+    rs.err = Error::NotOpen;
+    return rs;
+}
+
+struct Statement::Impl {
+    shared_ptr<SessionState> state;     // of the session that prepared it
+    CachedStmt stmt;
+    vector<string> args;
+    vector<bool> bound;
+    bool ok = false;
+    Error err = Error::None;    // why it wasn't prepared
+    string msg;
+    string badBind;             // a bind since the last execute that had no such parameter
+};
+
+Statement::Statement() = default;
+Statement::~Statement() = default;
+Statement::Statement(Statement&&) noexcept = default;
+Statement& Statement::operator=(Statement&&) noexcept = default;
+
+Statement::operator bool() const { return impl && impl->ok; }
+
+const std::string& Statement::message() const {
+    static const string none;
+    return impl ? impl->msg : none;
+}
+
+size_t Statement::parameters() const { return impl ? impl->args.size() : 0; }
+
+Statement& Statement::bind(size_t i, const std::string& value) {
+    if (!impl) return *this;
+    if (i >= 1 && i <= impl->args.size()) { impl->args[i - 1] = value; impl->bound[i - 1] = true; }
+    else if (impl->badBind.empty())
+        impl->badBind = "[SaadDB] No parameter " + to_string(i) + " to bind; the statement takes " + to_string(impl->args.size()) + " (1 to " + to_string(impl->args.size()) + ")\n";
+    return *this;
+}
+
+Statement& Statement::bind(size_t i, int64_t value) { return bind(i, to_string(value)); }
+
+Statement Session::prepare(const std::string& sql) {
+    Statement st;
+    st.impl.reset(new Statement::Impl());
+    Statement::Impl& im = *st.impl;
+    if (!DB_OPEN || !impl) { im.msg = NOT_OPEN; im.err = Error::NotOpen; return st; }
+    im.state = impl->state;
+    im.msg = run_captured(im.state.get(), nullptr, [&] {
+        parse_tokens(sql);
+        // as prepare; does (see "statement locks"): an open transaction already holds ENGINE_LOCK
+        SESSION->lockTimedOut = false;
+        shared_lock<RwLock> lk;
+        if (!SESSION->txn) {
+            lk = shared_lock<RwLock>(ENGINE_LOCK, lock_deadline());
+            if (!lk) {
+                SESSION->lockTimedOut = true;
+                fail(Error::LockTimeout) << "[SaadDB] Timed out waiting for other sessions; statement not prepared\n";
+                return;
+            }
+        }
+        im.ok = prepare_tokens(TOKENS, 0, im.stmt);
+    });
+    im.err = im.ok ? Error::None : STMT_ERROR == Error::None ? Error::Invalid : STMT_ERROR;
+    im.args.assign(im.stmt.params.size(), "?");
+    im.bound.assign(im.args.size(), false);
+    return st;
+}
+
+Statement Database::prepare(const std::string& sql) {
+    if (opened) return own.prepare(sql);
+    Statement st;
+    st.impl.reset(new Statement::Impl());
+    st.impl->msg = NOT_OPEN;
+    st.impl->err = Error::NotOpen;
+    return st;
+}
+
+// Why the statement can't run now; ok() if it can. A bad bind is
+// reported once, by the execute after it.
+static saaddb::QueryStatus not_runnable(const Statement& st, Error prepared, const vector<bool>& bound, string& badBind) {
+    saaddb::QueryStatus why;
+    if (!st) { why.error = prepared; why.message = st.message(); }
+    else if (!DB_OPEN) return not_open();
+    else if (!badBind.empty()) { why.error = Error::Invalid; why.message.swap(badBind); }
+    for (size_t k = 0; why.ok() && k < bound.size(); ++k)
+        if (!bound[k]) { why.error = Error::Invalid; why.message = "[SaadDB] Parameter " + to_string(k + 1) + " is not bound\n"; }
+    return why;
+}
+
+// Runs a bound prepared statement under its locks.
+static void run_prepared(CachedStmt& ps, const vector<string>& args) {
+    run_locked(ps.tokens, [&] { execute_prepared(ps, args); });
+    checkpoint_if_due();
+}
+
+QueryStatus Statement::execute(const RowCallback& fn) {
+    QueryStatus why = impl ? not_runnable(*this, impl->err, impl->bound, impl->badBind) : not_open();
+    if (!why.ok()) return why;
+    CallbackSink sink;
+    sink.fn = &fn;
+    return run_status(impl->state.get(), &sink, [&] { run_prepared(impl->stmt, impl->args); });
+}
+
+ResultSet Statement::execute() {
+    ResultSet rs;
+    QueryStatus why = impl ? not_runnable(*this, impl->err, impl->bound, impl->badBind) : not_open();
+    if (!why.ok()) { rs.msg = move(why.message); rs.err = why.error; return rs; }
+    CollectSink sink;
+    rs.msg = run_captured(impl->state.get(), &sink, [&] { run_prepared(impl->stmt, impl->args); });
+    rs.err = STMT_ERROR;
+    rs.changed = STMT_AFFECTED;
+    rs.cols = move(sink.cols);
+    rs.data = move(sink.rows);
+    return rs;
+}
+
+}
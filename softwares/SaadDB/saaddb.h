@@ -0,0 +1,212 @@
+#ifndef SAADDB_H
+#define SAADDB_H
+
+/* ========== libsaaddb ==========
+  The Saad DB engine as a library. The REPL (main.cpp) is one client; a
+  program can embed the engine the same way:
+
+    saaddb::Database db;
+    std::string msg;
+    if (!db.open("data", msg)) { ... }
+    db.query("select id, name from People where age > 30;",
+        [](const std::vector<saaddb::Column>& cols, const saaddb::Row& row) {
+            ... row[0].num, row[1].str ...
+            return true;            // false stops the select
+        });
+
+  Statements are the same SQL the REPL takes (the trailing ; is optional).
+  A select hands back typed rows; every statement also reports whether it
+  ran (ok(), error()), the rows it inserted, updated or deleted (affected())
+  and the engine's messages ("[SaadDB] ..." lines, one per line) as text.
+  The engine keeps its catalog and worker pool in process-wide state: open
+  one Database at a time. Threads that run statements at the same time each
+  use their own Session (Database::query and Database::prepare use the
+  database's own);
+  selects of a table run side by side, changes to a table wait for them.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace saaddb {
+
+enum class Type { Null, Int, Date, Decimal, Varchar };
+
+// One field of a result row. num holds an int, a date as days since
+// 01-01-1970, or a decimal scaled by 10^scale; str holds a varchar.
+// A SUM too large for 64 bits comes back as a Varchar of its digits.
+struct Value {
+    Type type = Type::Null;
+    int64_t num = 0;
+    int scale = 0;
+    std::string str;
+
+    bool is_null() const { return type == Type::Null; }
+    void append_text(std::string& out) const;   // as the REPL prints it
+    std::string text() const;
+};
+
+struct Column {
+    std::string name;           // "col", "T.col" in a join, "sum(col)" for an aggregate
+    Type type = Type::Null;
+    int scale = 0;              // decimal S
+};
+
+using Row = std::vector<Value>;
+
+// Why a statement failed; its message says more.
+enum class Error : uint8_t {
+    None = 0,
+    Invalid,        // malformed, or names a table, column or statement that doesn't exist
+    Constraint,     // a value that doesn't fit its column, a duplicate primary key
+    Conflict,       // a row it would change was changed since the transaction began
+    LockTimeout,    // other sessions held what it needs too long; it didn't run
+    IoError,        // a file couldn't be read or written
+    NotOpen,        // no database is open
+};
+
+// What a statement run with a RowCallback reports.
+struct QueryStatus {
+    Error error = Error::None;
+    uint64_t affected = 0;      // rows inserted, updated, deleted, loaded or imported
+    std::string message;
+
+    bool ok() const { return error == Error::None; }
+};
+
+// Heap allocations so far, for benchmark and explain analyze. The engine
+// doesn't replace operator new; a program that wants the count replaces it
+// with one that bumps this (as the REPL does, see main.cpp). 0 otherwise.
+extern std::atomic<uint64_t> allocations;
+
+// For a server that doesn't keep a thread on a statement waiting for
+// locks: its sessions give up at once (set_lock_wait(0)) and it parks the
+// statement instead. The statement keeps its turn in the queue of the lock
+// it gave up on (one queued writer holds new readers back) until it runs
+// again, and locks go to queued statements first come, first served.
+// lock_releases() counts the releases of locks with parked statements
+// queued; fn, if set, is called after each of them on the thread that
+// released the lock. A statement that gave up while the count stayed the
+// same can wait for fn; otherwise it may try again right away. Set fn
+// before any session runs.
+uint64_t lock_releases();
+void on_lock_release(std::function<void()> fn);
+
+// Called once per row of a select; returning false ends the select.
+using RowCallback = std::function<bool(const std::vector<Column>& columns, const Row& row)>;
+
+class ResultSet {
+public:
+    const std::vector<Column>& columns() const { return cols; }
+    const std::vector<Row>& rows() const { return data; }
+    std::vector<Row>::const_iterator begin() const { return data.begin(); }
+    std::vector<Row>::const_iterator end() const { return data.end(); }
+    size_t size() const { return data.size(); }
+    bool ok() const { return err == Error::None; }
+    Error error() const { return err; }
+    uint64_t affected() const { return changed; }
+    const std::string& message() const { return msg; }
+
+private:
+    friend class Session;
+    friend class Database;
+    friend class Statement;
+    std::vector<Column> cols;
+    std::vector<Row> data;
+    std::string msg;
+    Error err = Error::None;
+    uint64_t changed = 0;
+};
+
+class Statement;
+
+// One client of the database: its open transaction (begin; ... commit;),
+// its prepare-d statements (prepare name as ...;) and `set timing`. Use a
+// session, and the Statements it prepared, from one thread at a time.
+class Session {
+public:
+    Session();
+    ~Session();
+    Session(Session&&) noexcept;
+    Session& operator=(Session&&) noexcept;
+
+    ResultSet query(const std::string& sql);
+    QueryStatus query(const std::string& sql, const RowCallback& fn);
+    Statement prepare(const std::string& sql);
+
+    // How long a statement waits for tables other sessions hold (5000 ms
+    // unless set). One that gives up doesn't run: it says so, and
+    // lock_timed_out() is true until the next statement.
+    void set_lock_wait(unsigned ms);
+    bool lock_timed_out() const;
+    // With lock wait 0: gives up the turn the last statement kept, for one
+    // that won't run again. A statement that doesn't give up on a lock,
+    // and the session going away, give it up too.
+    void stop_waiting();
+
+    // Whether a transaction is open (begin; without its commit; or rollback;).
+    bool in_transaction() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// A select, insert, update or delete with ? placeholders, bound left to
+// right from 1 and run any number of times (see prepare / execute in the
+// REPL's help). It runs in the session that prepared it, inside that
+// session's open transaction. A statement that isn't one of those four or
+// doesn't plan isn't prepared. Binding a number outside 1..parameters()
+// fails the next execute (Error::Invalid); it doesn't run.
+class Statement {
+public:
+    Statement();
+    ~Statement();
+    Statement(Statement&&) noexcept;
+    Statement& operator=(Statement&&) noexcept;
+
+    explicit operator bool() const;             // prepared; message() says why not
+    const std::string& message() const;
+    size_t parameters() const;
+    Statement& bind(size_t i, const std::string& value);   // 42, 01-02-2024, 9.50, or a string (no quotes)
+    Statement& bind(size_t i, int64_t value);
+
+    ResultSet execute();
+    QueryStatus execute(const RowCallback& fn);
+
+private:
+    friend class Session;
+    friend class Database;
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+class Database {
+public:
+    Database() = default;
+    ~Database();
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    // Opens the database kept in dir (created if missing), replaying its
+    // write-ahead log if the last run crashed. message gets what recovery said.
+    bool open(const std::string& dir, std::string& message);
+    void close();               // checkpoints the log; no session may be running
+    bool is_open() const { return opened; }
+
+    ResultSet query(const std::string& sql);
+    QueryStatus query(const std::string& sql, const RowCallback& fn);
+    Statement prepare(const std::string& sql);
+
+private:
+    bool opened = false;
+    Session own;
+};
+
+}
+
+#endif
@@ -0,0 +1,373 @@
+#include "server.h"
+#include "protocol.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+using namespace std;
+
+/* ========== Saad DB server ==========
+  saaddb --serve PATH [--workers N]: the database in the current directory,
+  served over a Unix domain socket (see protocol.h for the frames).
+  One thread runs an epoll loop. It accepts connections, reads requests
+  and writes responses, all non-blocking. A fixed pool of workers runs the
+  statements: one at a time per connection, each connection in its own
+  saaddb::Session, so selects from many clients run side by side, and
+  next to writers (see "statement locks" in saaddb.cpp). A worker encodes rows as they come and
+  hands them to the loop every CHUNK bytes; while a slow client has more
+  than OUT_LIMIT bytes unsent its worker waits. A statement whose tables
+  another session holds doesn't keep a worker waiting: its session gives
+  up at once (lock wait 0) and the statement is parked, off the queue,
+  keeping its turn for the lock, until a lock with parked statements
+  queued is released (saaddb::on_lock_release) or LOCK_WAIT has passed;
+  then it runs again, or is refused and gives its turn up. A
+  transaction's commit can then always get a worker, even with every
+  other statement waiting on its tables, and statements of sessions with
+  an open transaction run ahead of the others: they end the transactions
+  the others wait for. SIGINT / SIGTERM stop the server: running
+  statements finish, then the log is checkpointed.
+*/
+namespace {
+
+const size_t CHUNK = 64u << 10;
+const size_t OUT_LIMIT = 8u << 20;
+const chrono::milliseconds LOCK_WAIT(5000);
+
+struct Conn {
+    int fd = -1;
+    saaddb::Session session;
+    string in;                  // received, not yet handed to a worker (loop thread only)
+    bool armed = false;         // EPOLLOUT requested (loop thread only)
+    atomic<bool> closed{false};
+    mutex m;                    // guards out, sent and busy
+    condition_variable drained;
+    string out;                 // waiting to be written
+    size_t sent = 0;            // bytes of out already written
+    bool busy = false;          // a worker runs one of its statements
+};
+typedef shared_ptr<Conn> ConnPtr;
+
+struct Job {
+    ConnPtr conn;
+    string sql;
+    chrono::steady_clock::time_point queued;
+    bool urgent = false;        // its session has a transaction open
+};
+
+// epoll data for the fds that aren't connections
+char LISTEN_TAG, WAKE_TAG, SIGNAL_TAG;
+
+struct Server {
+    int ep = -1, listenFd = -1, wakeFd = -1, sigFd = -1;
+    unordered_map<Conn*, ConnPtr> conns;
+
+    mutex jobsM;                // guards urgent, jobs, parked and stopping
+    condition_variable jobsCv;
+    deque<Job> urgent;          // run first: statements of open transactions
+    deque<Job> jobs;
+    vector<Job> parked;         // gave up on a lock; wait for a release or LOCK_WAIT
+    bool stopping = false;
+
+    mutex readyM;
+    vector<ConnPtr> ready;      // connections a worker gave output to
+
+    vector<thread> workers;
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t n = write(wakeFd, &one, sizeof one);
+        (void)n;
+    }
+
+    // Queues job to run (jobsM held).
+    void queue(Job job) {
+        (job.urgent ? urgent : jobs).push_back(move(job));
+        jobsCv.notify_one();
+    }
+
+    // A lock some parked statement gave up on is free: they all try again.
+    void unpark() {
+        lock_guard<mutex> lk(jobsM);
+        for (Job& job : parked) queue(move(job));
+        parked.clear();
+    }
+
+    // Loop side: parked statements past LOCK_WAIT run once more, and are
+    // refused if they still can't get their locks. Returns the epoll_wait
+    // timeout until the next one is due (-1: none parked).
+    int expire_parked() {
+        lock_guard<mutex> lk(jobsM);
+        auto now = chrono::steady_clock::now();
+        int timeout = -1;
+        for (size_t i = 0; i < parked.size(); ) {
+            auto due = parked[i].queued + LOCK_WAIT;
+            if (due <= now) {
+                queue(move(parked[i]));
+                parked[i] = move(parked.back());
+                parked.pop_back();
+                continue;
+            }
+            int ms = (int)chrono::duration_cast<chrono::milliseconds>(due - now).count() + 1;
+            if (timeout < 0 || ms < timeout) timeout = ms;
+            ++i;
+        }
+        return timeout;
+    }
+
+    // Worker side: queues bytes for conn; done ends its running statement.
+    void deliver(Conn& c, const ConnPtr& cp, string& bytes, bool done) {
+        {
+            unique_lock<mutex> lk(c.m);
+            c.drained.wait(lk, [&] { return c.closed || c.out.size() - c.sent <= OUT_LIMIT; });
+            if (!c.closed) c.out += bytes;
+            if (done) c.busy = false;
+        }
+        bytes.clear();
+        { lock_guard<mutex> lk(readyM); ready.push_back(cp); }
+        wake();
+    }
+
+    void work() {
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> lk(jobsM);
+                jobsCv.wait(lk, [&] { return stopping || !urgent.empty() || !jobs.empty(); });
+                if (stopping) return;
+                deque<Job>& from = urgent.empty() ? jobs : urgent;
+                job = move(from.front());
+                from.pop_front();
+            }
+            Conn& c = *job.conn;
+            uint64_t releases = saaddb::lock_releases();
+            string buf;
+            bool first = true;
+            saaddb::QueryStatus st = c.session.query(job.sql, [&](const vector<saaddb::Column>& cols, const saaddb::Row& row) {
+                if (first) { saaddb::wire::put_columns(buf, cols); first = false; }
+                saaddb::wire::put_row(buf, row);
+                if (buf.size() >= CHUNK) deliver(c, job.conn, buf, false);
+                return !c.closed;
+            });
+            if (st.error == saaddb::Error::LockTimeout && !c.closed && chrono::steady_clock::now() - job.queued < LOCK_WAIT) {
+                job.urgent = c.session.in_transaction();
+                {
+                    lock_guard<mutex> lk(jobsM);
+                    // released since it started: it may get them now
+                    if (saaddb::lock_releases() != releases) { queue(move(job)); continue; }
+                    parked.push_back(move(job));
+                }
+                wake();     // the loop times it out
+                continue;
+            }
+            if (st.error == saaddb::Error::LockTimeout) c.session.stop_waiting();     // refused for good
+            saaddb::wire::put_done(buf, st);
+            deliver(c, job.conn, buf, true);
+        }
+    }
+
+    void arm(Conn& c, bool out) {
+        if (c.armed == out) return;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | (out ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = &c;
+        epoll_ctl(ep, EPOLL_CTL_MOD, c.fd, &ev);
+        c.armed = out;
+    }
+
+    void drop(Conn& c) {
+        {
+            lock_guard<mutex> lk(c.m);
+            c.closed = true;
+        }
+        c.drained.notify_all();
+        epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, nullptr);
+        ::close(c.fd);
+        conns.erase(&c);
+    }
+
+    // Writes what conn has queued; false if the connection is gone.
+    bool flush(Conn& c) {
+        bool pending;
+        {
+            lock_guard<mutex> lk(c.m);
+            while (c.sent < c.out.size()) {
+                ssize_t n = ::send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+                if (n > 0) { c.sent += (size_t)n; continue; }
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                return false;
+            }
+            if (c.sent == c.out.size()) { c.out.clear(); c.sent = 0; }
+            else if (c.sent > (1u << 20)) { c.out.erase(0, c.sent); c.sent = 0; }
+            pending = !c.out.empty();
+        }
+        c.drained.notify_all();
+        arm(c, pending);
+        return true;
+    }
+
+    // Hands conn's next whole request to the workers unless one is running.
+    bool dispatch(Conn& c, const ConnPtr& cp) {
+        if (c.in.size() < saaddb::wire::FRAME_HEADER) return true;
+        uint32_t n = saaddb::wire::get_u32(c.in.data());
+        if (n < 1 || n > saaddb::wire::MAX_FRAME || (uint8_t)c.in[4] != saaddb::wire::QUERY) return false;
+        if (c.in.size() < 4 + (size_t)n) return true;
+        {
+            lock_guard<mutex> lk(c.m);
+            if (c.busy) return true;
+            c.busy = true;
+        }
+        Job job;
+        job.conn = cp;
+        job.sql.assign(c.in, saaddb::wire::FRAME_HEADER, n - 1);
+        job.queued = chrono::steady_clock::now();
+        job.urgent = c.session.in_transaction();    // no worker runs c's session now
+        c.in.erase(0, 4 + (size_t)n);
+        lock_guard<mutex> lk(jobsM);
+        queue(move(job));
+        return true;
+    }
+
+    void accept_all() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            ConnPtr c = make_shared<Conn>();
+            c->fd = fd;
+            c->session.set_lock_wait(0);
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.ptr = c.get();
+            if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0) { ::close(fd); continue; }
+            conns[c.get()] = c;
+        }
+    }
+
+    // Reads everything conn has sent; false once the client is gone.
+    bool receive(Conn& c) {
+        char buf[64 << 10];
+        while (true) {
+            ssize_t n = ::read(c.fd, buf, sizeof buf);
+            if (n > 0) { c.in.append(buf, (size_t)n); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            return false;
+        }
+    }
+
+    void on_ready() {
+        uint64_t n;
+        ssize_t r = read(wakeFd, &n, sizeof n);
+        (void)r;
+        vector<ConnPtr> list;
+        { lock_guard<mutex> lk(readyM); list.swap(ready); }
+        for (const ConnPtr& cp : list) {
+            Conn& c = *cp;
+            if (c.closed || !conns.count(&c)) continue;
+            if (!flush(c) || !dispatch(c, cp)) drop(c);
+        }
+    }
+
+    void loop() {
+        epoll_event evs[64];
+        bool running = true;
+        int timeout = -1;
+        while (running) {
+            int n = epoll_wait(ep, evs, 64, timeout);
+            timeout = expire_parked();
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+            for (int i = 0; i < n; ++i) {
+                void* tag = evs[i].data.ptr;
+                if (tag == &LISTEN_TAG) { accept_all(); continue; }
+                if (tag == &WAKE_TAG) { on_ready(); continue; }
+                if (tag == &SIGNAL_TAG) { running = false; continue; }
+                Conn& c = *(Conn*)tag;
+                if (!conns.count(&c)) continue;
+                ConnPtr cp = conns[&c];
+                bool ok = true;
+                if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ok = receive(c) && dispatch(c, cp);
+                if (ok && (evs[i].events & EPOLLOUT)) ok = flush(c);
+                if (!ok) drop(c);
+            }
+        }
+    }
+
+    bool listen_on(const string& path) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof addr.sun_path) { cout << "[SaadDB] Socket path too long\n"; return false; }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());     // left by a server that died
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof addr) != 0 || listen(listenFd, 128) != 0) {
+            cout << "[SaadDB] Cannot listen on " << path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+}
+
+int serve(saaddb::Database& db, const string& path, unsigned workers) {
+    if (!workers) workers = max(1u, thread::hardware_concurrency());
+    Server s;
+    if (!s.listen_on(path)) return 1;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);     // before the workers start, so they inherit it
+    s.sigFd = signalfd(-1, &mask, SFD_CLOEXEC);
+    s.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    s.ep = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &LISTEN_TAG; epoll_ctl(s.ep, EPOLL_CTL_ADD, s.listenFd, &ev);
+    ev.data.ptr = &WAKE_TAG; epoll_ctl(s.ep, EPOLL_CTL_ADD, s.wakeFd, &ev);
+    ev.data.ptr = &SIGNAL_TAG; epoll_ctl(s.ep, EPOLL_CTL_ADD, s.sigFd, &ev);
+    saaddb::on_lock_release([&s] { s.unpark(); });
+    for (unsigned i = 0; i < workers; ++i) s.workers.emplace_back([&s] { s.work(); });
+    cout << "[SaadDB] Serving on " << path << " with " << workers << " worker(s).\n" << flush;
+
+    s.loop();
+
+    ::close(s.listenFd);
+    unlink(path.c_str());
+    for (auto& kv : s.conns) {
+        lock_guard<mutex> lk(kv.second->m);
+        kv.second->closed = true;
+        kv.second->drained.notify_all();
+    }
+    { lock_guard<mutex> lk(s.jobsM); s.stopping = true; s.urgent.clear(); s.jobs.clear(); s.parked.clear(); }
+    s.jobsCv.notify_all();
+    for (auto& t : s.workers) t.join();
+    saaddb::on_lock_release(nullptr);
+    for (auto& kv : s.conns) ::close(kv.second->fd);
+    s.conns.clear();
+    db.close();
+    cout << "[SaadDB] Server stopped.\n";
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef SAADDB_SERVER_H
+#define SAADDB_SERVER_H
+
+#include "saaddb.h"
+
+#include <string>
+
+// Serves db on a Unix domain socket at path until SIGINT / SIGTERM (see
+// server.cpp); workers statements run at once, 0 = one per hardware thread.
+int serve(saaddb::Database& db, const std::string& path, unsigned workers);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SAADDB_STATEMENT_LINE_H
+#define SAADDB_STATEMENT_LINE_H
+
+/* ========== statement lines ==========
+  How the programs that take statements as text lines (the REPL in
+  main.cpp, saaddb-client, saaddb-load) tell a finished statement and
+  quit from the rest, before the line goes to the engine or the server.
+*/
+
+#include <string>
+#include <cctype>
+
+namespace saaddb {
+
+// Whether the line ends in ';' (trailing blanks aside).
+inline bool has_semicolon(const std::string& q) {
+    for (int i = (int)q.size() - 1; i >= 0; --i) {
+        if (!isspace((unsigned char)q[i])) return q[i] == ';';
+    }
+    return false;
+}
+
+// Whether the line's first word is quit, in any case.
+inline bool is_quit(const std::string& q) {
+    size_t i = 0;
+    while (i < q.size() && isspace((unsigned char)q[i])) ++i;
+    std::string w;
+    while (i < q.size() && isalpha((unsigned char)q[i])) w.push_back((char)tolower((unsigned char)q[i++]));
+    return w == "quit";
+}
+
+}
+
+#endif